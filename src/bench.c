@@ -0,0 +1,584 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "HandmadeMath.h"
+
+#include "bench_field.h"
+#include "bench_kernel.h"
+#include "bench_ot.h"
+#include "bench_raycast.h"
+#include "blob.h"
+#include "blob_models.h"
+#include "core.h"
+#include "creature.h"
+#include "ecs.h"
+#include "level.h"
+
+#include "enemies/floater.h"
+
+// Headless benchmark of the blob simulation. Every scenario loads the level
+// into a new BlobSim and runs scripted phases with a fixed delta and seed, so
+// runs are repeatable. Timings of each phase are printed to stdout as JSON.
+// With -b both, every scenario runs once with each liquid broadphase, and with
+// -t sweep once with each of BENCH_SWEEP_THREADS threads. -o saves
+// a snapshot of the sim after each scenario, and -r replays one instead of
+// running the scenarios. The other modes of -m run a benchmark of one part of
+// the simulation instead
+
+#define BENCH_DELTA (1.0 / 60.0)
+#define BENCH_SEED 1
+#define BENCH_MAX_PHASES 4
+// Ticks that a snapshot passed with -r is simulated for
+#define BENCH_REPLAY_TICKS 300
+
+// Thread counts that -t sweep runs every scenario with
+static const int BENCH_SWEEP_THREADS[] = {1, 2, 4, 8};
+
+// Where the liquid scenarios pour and aim, which is above the floor of
+// test.blvl
+#define BENCH_CENTER_X -2.0f
+#define BENCH_CENTER_Z 2.0f
+
+typedef enum BenchMode {
+  BENCH_MODE_SIM,
+  // Octree micro benchmarks in bench_ot.c
+  BENCH_MODE_OCTREE,
+  // Accuracy of the solid distance field in bench_field.c
+  BENCH_MODE_FIELD,
+  // Single and batched raycasts in bench_raycast.c
+  BENCH_MODE_RAYCAST,
+  // Agreement of the SIMD kernel levels with the scalar one in bench_kernel.c
+  BENCH_MODE_KERNEL,
+  BENCH_MODE_COUNT,
+} BenchMode;
+
+// Indexed by BenchMode
+static const char *BENCH_MODES[] = {"sim", "octree", "field", "raycast",
+                                    "kernel"};
+
+typedef struct BenchPhase {
+  const char *name;
+  int ticks;
+  // Called before each tick of the phase. Can be NULL
+  void (*script)(BlobSim *bs, int tick);
+} BenchPhase;
+
+typedef struct BenchScenario {
+  const char *name;
+  // Called once after the level is loaded. Can be NULL
+  void (*setup)(BlobSim *bs);
+  BenchPhase phases[BENCH_MAX_PHASES];
+} BenchScenario;
+
+static void bench_pour(BlobSim *bs, int count) {
+  for (int i = 0; i < count; i++) {
+    int b = liquid_blob_create(bs);
+    if (b == -1) {
+      return;
+    }
+
+    liquid_blob_get_info(bs, b)->mat_idx = 2;
+    HMM_Vec3 pos = HMM_V3(BENCH_CENTER_X + (rand_float() - 0.5f) * 4.0f,
+                          6.0f + rand_float() * 4.0f,
+                          BENCH_CENTER_Z + (rand_float() - 0.5f) * 4.0f);
+    liquid_blob_set_radius_pos(bs, b, 0.3f, &pos);
+    HMM_Vec3 vel = HMM_V3((rand_float() - 0.5f) * 2.0f, 0.0f,
+                          (rand_float() - 0.5f) * 2.0f);
+    liquid_blob_set_vel(bs, b, &vel);
+  }
+}
+
+// 4096 liquids poured over 64 ticks
+static void liquid_pour_script(BlobSim *bs, int tick) {
+  (void)tick;
+  bench_pour(bs, 64);
+}
+
+// Projectiles fired from a ring around the center. Without callbacks, they
+// pass through collider models and turn into liquids when they hit solids
+static void projectile_storm_script(BlobSim *bs, int tick) {
+  (void)tick;
+  for (int i = 0; i < 32; i++) {
+    Projectile *p = projectile_create(bs);
+    if (!p) {
+      return;
+    }
+
+    float angle = rand_float() * HMM_PI32 * 2.0f;
+    HMM_Vec3 dir = HMM_V3(cosf(angle), 0.0f, sinf(angle));
+    p->pos = HMM_V3(BENCH_CENTER_X + dir.X * 8.0f, 6.0f + rand_float() * 2.0f,
+                    BENCH_CENTER_Z + dir.Z * 8.0f);
+    p->vel = HMM_MulV3F(dir, -10.0f - rand_float() * 10.0f);
+    p->vel.Y = rand_float() * 4.0f;
+    p->radius = 0.2f;
+    p->mat_idx = 0;
+    p->lifetime = 1.0f + rand_float();
+  }
+}
+
+// Floaters in a grid above the center, as many as there can be collider
+// models next to the ones of the level
+#define BENCH_FLOATER_GRID 10
+#define BENCH_FLOATER_ROWS 12
+
+static void mass_liquify_setup(BlobSim *bs) {
+  // Floaters add their collider models to global.blob_sim
+  (void)bs;
+  for (int x = 0; x < BENCH_FLOATER_GRID; x++) {
+    for (int z = 0; z < BENCH_FLOATER_ROWS; z++) {
+      Entity ent = floater_create();
+      HMM_Mat4 *trans = entity_get_component(ent, COMPONENT_TRANSFORM);
+      trans->Columns[3].XYZ =
+          HMM_V3(BENCH_CENTER_X + (x - BENCH_FLOATER_GRID * 0.5f) * 1.2f, 7.0f,
+                 BENCH_CENTER_Z + (z - BENCH_FLOATER_ROWS * 0.5f) * 1.2f);
+    }
+  }
+}
+
+// Turns every floater into liquids at once, like player.c does when a
+// creature dies
+static void mass_liquify_script(BlobSim *bs, int tick) {
+  (void)tick;
+  for (int i = component_get_count(COMPONENT_ENEMY_FLOATER) - 1; i >= 0; i--) {
+    Entity ent = component_get_from_idx(COMPONENT_ENEMY_FLOATER, i)->entity;
+    HMM_Mat4 *trans = entity_get_component(ent, COMPONENT_TRANSFORM);
+    Model *mdl = entity_get_component(ent, COMPONENT_MODEL);
+
+    for (int j = 0; j < mdl->blob_count; j++) {
+      int b = liquid_blob_create(bs);
+      if (b == -1) {
+        break;
+      }
+
+      HMM_Vec4 p = {0, 0, 0, 1};
+      p.XYZ = mdl->blobs[j].pos;
+      p = HMM_MulM4V4(*trans, p);
+      liquid_blob_get_info(bs, b)->mat_idx = mdl->blobs[j].mat_idx;
+      liquid_blob_set_radius_pos(bs, b, HMM_MAX(0.2f, mdl->blobs[j].radius),
+                                 &p.XYZ);
+      HMM_Vec3 vel = HMM_V3((rand_float() - 0.5f) * 5.0f,
+                            (rand_float() - 0.5f) * 5.0f + 8.0f,
+                            (rand_float() - 0.5f) * 5.0f);
+      liquid_blob_set_vel(bs, b, &vel);
+    }
+
+    collider_model_remove(bs, ent);
+    blob_mdl_destroy(mdl);
+    entity_destroy(ent);
+  }
+}
+
+static void editor_fill_script(BlobSim *bs, int tick) {
+  (void)tick;
+  bench_pour(bs, 32);
+}
+
+// Moves every solid of the level back and forth in one batch each tick, like
+// dragging a large selection in the editor
+static void editor_moves_script(BlobSim *bs, int tick) {
+  float dir = (tick / 20) % 2 ? -0.02f : 0.02f;
+  blob_sim_begin_solid_batch(bs);
+  for (int i = 0; i < bs->solids.count; i++) {
+    SolidBlob *b = fixed_array_get(&bs->solids, i);
+    HMM_Vec3 pos = b->pos;
+    pos.X += dir;
+    solid_blob_set_radius_pos(bs, b, b->radius, &pos);
+  }
+  blob_sim_end_solid_batch(bs);
+}
+
+// Where the liquid beds are, below the level so that its solids are not in
+// the way
+#define BENCH_BED_Y -40.0f
+#define BENCH_BED_LAYERS 4
+#define BENCH_BED_SPACING 0.5f
+
+// Packs count liquids BENCH_BED_LAYERS deep on a floor of solids that grows
+// with them, so every bed has the same density and only the area changes.
+// active_pos is at the center, so bigger beds have more mid and far liquids
+static void bench_bed_setup(BlobSim *bs, int count) {
+  int side = (int)ceilf(sqrtf((float)count / BENCH_BED_LAYERS));
+  float half = side * BENCH_BED_SPACING * 0.5f;
+
+  blob_sim_begin_solid_batch(bs);
+  for (float x = -half - 1.0f; x <= half + 1.0f; x += 1.0f) {
+    for (float z = -half - 1.0f; z <= half + 1.0f; z += 1.0f) {
+      SolidBlob *b = solid_blob_create(bs);
+      if (!b) {
+        break;
+      }
+      b->mat_idx = 0;
+      HMM_Vec3 pos = HMM_V3(x, BENCH_BED_Y, z);
+      solid_blob_set_radius_pos(bs, b, 0.75f, &pos);
+    }
+  }
+  blob_sim_end_solid_batch(bs);
+
+  for (int i = 0; i < count; i++) {
+    int b = liquid_blob_create(bs);
+    if (b == -1) {
+      break;
+    }
+    int layer = i / (side * side);
+    int cell = i % (side * side);
+    liquid_blob_get_info(bs, b)->mat_idx = 2;
+    HMM_Vec3 pos = HMM_V3(-half + (cell % side + 0.5f) * BENCH_BED_SPACING,
+                          BENCH_BED_Y + 1.0f + layer * BENCH_BED_SPACING,
+                          -half + (cell / side + 0.5f) * BENCH_BED_SPACING);
+    liquid_blob_set_radius_pos(bs, b, 0.3f, &pos);
+  }
+
+  bs->active_pos = HMM_V3(0.0f, BENCH_BED_Y, 0.0f);
+}
+
+static void liquid_bed_16k_setup(BlobSim *bs) { bench_bed_setup(bs, 16384); }
+static void liquid_bed_64k_setup(BlobSim *bs) { bench_bed_setup(bs, 65536); }
+static void liquid_bed_256k_setup(BlobSim *bs) {
+  bench_bed_setup(bs, 262144);
+}
+
+static const BenchScenario BENCH_SCENARIOS[] = {
+    {"liquid_pour",
+     NULL,
+     {{"pour", 64, liquid_pour_script}, {"settle", 300, NULL}}},
+    {"projectile_storm",
+     NULL,
+     {{"storm", 300, projectile_storm_script}, {"drain", 180, NULL}}},
+    {"mass_liquify",
+     mass_liquify_setup,
+     {{"idle", 30, NULL},
+      {"liquify", 1, mass_liquify_script},
+      {"splash", 300, NULL}}},
+    {"editor_bulk_moves",
+     NULL,
+     {{"fill", 32, editor_fill_script},
+      {"moves", 120, editor_moves_script},
+      {"settle", 120, NULL}}},
+    {"liquid_bed_16k",
+     liquid_bed_16k_setup,
+     {{"warmup", 20, NULL}, {"steady", 60, NULL}}},
+    {"liquid_bed_64k",
+     liquid_bed_64k_setup,
+     {{"warmup", 20, NULL}, {"steady", 60, NULL}}},
+    {"liquid_bed_256k",
+     liquid_bed_256k_setup,
+     {{"warmup", 20, NULL}, {"steady", 60, NULL}}},
+};
+
+// Runs from a snapshot instead of a script
+static const BenchScenario BENCH_REPLAY = {
+    "replay", NULL, {{"replay", BENCH_REPLAY_TICKS, NULL}}};
+
+// Indexed by LiquidBroadphase
+static const char *BENCH_BROADPHASES[] = {"octree", "grid"};
+
+static int compare_doubles(const void *a, const void *b) {
+  double x = *(const double *)a;
+  double y = *(const double *)b;
+  return (x > y) - (x < y);
+}
+
+// Destroys every entity, so the next scenario starts with only the ones of
+// the level
+static void bench_clear_entities() {
+  while (component_get_count(COMPONENT_TRANSFORM) > 0) {
+    int last = component_get_count(COMPONENT_TRANSFORM) - 1;
+    Entity ent = component_get_from_idx(COMPONENT_TRANSFORM, last)->entity;
+    Model *mdl = entity_get_component_or_null(ent, COMPONENT_MODEL);
+    if (mdl) {
+      blob_mdl_destroy(mdl);
+    }
+    entity_destroy(ent);
+  }
+}
+
+static void bench_run_phase(BlobSim *bs, const BenchPhase *phase,
+                            double *tick_times) {
+  double script_time = 0.0;
+  int64_t pair_count = 0;
+  int builds = bs->liquid_neighbours.builds;
+  int updates = bs->liquid_neighbours.updates;
+  for (int i = 0; i < phase->ticks; i++) {
+    if (phase->script) {
+      double start = get_time();
+      phase->script(bs, i);
+      script_time += get_time() - start;
+    }
+
+    double start = get_time();
+    blob_simulate(bs, BENCH_DELTA);
+    tick_times[i] = get_time() - start;
+    pair_count += bs->liquid_pair_count;
+  }
+
+  double total = 0.0;
+  for (int i = 0; i < phase->ticks; i++) {
+    total += tick_times[i];
+  }
+  qsort(tick_times, phase->ticks, sizeof(*tick_times), compare_doubles);
+  int p95 = (int)ceil(phase->ticks * 0.95) - 1;
+
+  printf("        {\"name\": \"%s\", \"ticks\": %d, \"script_ms\": %.3f, "
+         "\"sim_ms\": %.3f, \"tick_mean_ms\": %.3f, \"tick_p50_ms\": %.3f, "
+         "\"tick_p95_ms\": %.3f, \"tick_max_ms\": %.3f, "
+         "\"pairs_per_tick\": %.1f, \"neighbour_builds\": %d, "
+         "\"neighbour_updates\": %d, \"liquids\": %d, \"solids\": %d, "
+         "\"projectiles\": %d}",
+         phase->name, phase->ticks, script_time * 1000.0, total * 1000.0,
+         total * 1000.0 / phase->ticks, tick_times[phase->ticks / 2] * 1000.0,
+         tick_times[p95] * 1000.0, tick_times[phase->ticks - 1] * 1000.0,
+         (double)pair_count / phase->ticks,
+         bs->liquid_neighbours.builds - builds,
+         bs->liquid_neighbours.updates - updates, bs->liquids.count,
+         bs->solids.count, bs->projectiles.count);
+}
+
+// Loads the snapshot at load_path after the level if it isn't NULL, and saves
+// one to save_prefix followed by the scenario and broadphase names afterwards
+// if that isn't NULL. Returns false if either fails
+static bool bench_run_scenario(const BenchScenario *scenario,
+                               const char *level_data, int level_size,
+                               int thread_count, LiquidBroadphase broadphase,
+                               const char *load_path,
+                               const char *save_prefix) {
+  static BlobSim bs;
+  srand(BENCH_SEED);
+
+  double start = get_time();
+  blob_sim_create(&bs);
+  blob_sim_set_thread_count(&bs, thread_count);
+  blob_sim_set_liquid_broadphase(&bs, broadphase);
+  global.blob_sim = &bs;
+  level_load(&bs, level_data, level_size);
+  if (scenario->setup) {
+    scenario->setup(&bs);
+  }
+  bool ok = !load_path || blob_sim_load_snapshot(&bs, load_path);
+  double setup_time = get_time() - start;
+  if (!ok) {
+    bench_clear_entities();
+    blob_sim_destroy(&bs);
+    global.blob_sim = NULL;
+    return false;
+  }
+
+  printf("    {\"name\": \"%s\", \"broadphase\": \"%s\", \"threads\": %d, "
+         "\"setup_ms\": %.3f, \"phases\": [\n",
+         scenario->name, BENCH_BROADPHASES[broadphase],
+         bs.workers.thread_count, setup_time * 1000.0);
+
+  for (int i = 0; i < BENCH_MAX_PHASES && scenario->phases[i].name; i++) {
+    const BenchPhase *phase = &scenario->phases[i];
+    double *tick_times = alloc_mem(phase->ticks * sizeof(double));
+    if (i > 0) {
+      printf(",\n");
+    }
+    bench_run_phase(&bs, phase, tick_times);
+    free_mem(tick_times);
+  }
+  printf("\n      ]}");
+
+  if (save_prefix) {
+    char path[1024];
+    snprintf(path, sizeof(path), "%s%s_%s.snap", save_prefix, scenario->name,
+             BENCH_BROADPHASES[broadphase]);
+    ok = blob_sim_save_snapshot(&bs, path);
+  }
+
+  bench_clear_entities();
+  blob_sim_destroy(&bs);
+  global.blob_sim = NULL;
+  return ok;
+}
+
+// Runs the benchmark of one part of the simulation with the level loaded.
+// Returns false if a check of the benchmark failed
+static bool bench_run_mode(BenchMode mode, const char *level_data,
+                           int level_size, int thread_count) {
+  static BlobSim bs;
+  blob_sim_create(&bs);
+  blob_sim_set_thread_count(&bs, thread_count);
+  global.blob_sim = &bs;
+  level_load(&bs, level_data, level_size);
+
+  bool ok = true;
+  switch (mode) {
+  case BENCH_MODE_OCTREE:
+    bench_ot_run(bs.solids.data, bs.solids.count);
+    break;
+  case BENCH_MODE_FIELD:
+    bench_field_run(&bs);
+    break;
+  case BENCH_MODE_RAYCAST:
+    bench_raycast_run(&bs);
+    break;
+  case BENCH_MODE_KERNEL:
+    ok = bench_kernel_run();
+    break;
+  default:
+    break;
+  }
+
+  bench_clear_entities();
+  blob_sim_destroy(&bs);
+  global.blob_sim = NULL;
+  return ok;
+}
+
+static void bench_usage() {
+  fprintf(stderr, "Usage: goop_bench [-l level.blvl] [-t threads|sweep] "
+                  "[-s scenario] [-b octree|grid|both] [-m mode] "
+                  "[-o snapshot_prefix] [-r snapshot]\n");
+  fprintf(stderr, "Modes:");
+  for (int i = 0; i < BENCH_MODE_COUNT; i++) {
+    fprintf(stderr, " %s", BENCH_MODES[i]);
+  }
+  fprintf(stderr, "\nScenarios:");
+  for (int i = 0; i < (int)ARR_SIZE(BENCH_SCENARIOS); i++) {
+    fprintf(stderr, " %s", BENCH_SCENARIOS[i].name);
+  }
+  fprintf(stderr, "\n");
+}
+
+int main(int argc, char **argv) {
+  const char *level_path = "assets/test.blvl";
+  const char *only = NULL;
+  const char *save_prefix = NULL;
+  const char *replay_path = NULL;
+  BenchMode mode = BENCH_MODE_SIM;
+  // 0 lets the sim pick
+  int thread_count = 0;
+  // Thread counts to run every scenario with
+  const int *thread_counts = &thread_count;
+  int thread_count_count = 1;
+  // Range of broadphases to run every scenario with
+  int first_broadphase = LIQUID_BROADPHASE_OCTREE;
+  int last_broadphase = LIQUID_BROADPHASE_OCTREE;
+  for (int i = 1; i < argc; i++) {
+    if (i + 1 < argc && strcmp(argv[i], "-l") == 0) {
+      level_path = argv[++i];
+    } else if (i + 1 < argc && strcmp(argv[i], "-t") == 0) {
+      i++;
+      if (strcmp(argv[i], "sweep") == 0) {
+        thread_counts = BENCH_SWEEP_THREADS;
+        thread_count_count = ARR_SIZE(BENCH_SWEEP_THREADS);
+      } else {
+        thread_count = atoi(argv[i]);
+      }
+    } else if (i + 1 < argc && strcmp(argv[i], "-s") == 0) {
+      only = argv[++i];
+    } else if (i + 1 < argc && strcmp(argv[i], "-o") == 0) {
+      save_prefix = argv[++i];
+    } else if (i + 1 < argc && strcmp(argv[i], "-r") == 0) {
+      replay_path = argv[++i];
+    } else if (i + 1 < argc && strcmp(argv[i], "-b") == 0) {
+      i++;
+      if (strcmp(argv[i], "octree") == 0) {
+        first_broadphase = last_broadphase = LIQUID_BROADPHASE_OCTREE;
+      } else if (strcmp(argv[i], "grid") == 0) {
+        first_broadphase = last_broadphase = LIQUID_BROADPHASE_GRID;
+      } else if (strcmp(argv[i], "both") == 0) {
+        first_broadphase = LIQUID_BROADPHASE_OCTREE;
+        last_broadphase = LIQUID_BROADPHASE_GRID;
+      } else {
+        bench_usage();
+        return 1;
+      }
+    } else if (i + 1 < argc && strcmp(argv[i], "-m") == 0) {
+      i++;
+      mode = BENCH_MODE_COUNT;
+      for (int m = 0; m < BENCH_MODE_COUNT; m++) {
+        if (strcmp(argv[i], BENCH_MODES[m]) == 0) {
+          mode = m;
+        }
+      }
+      if (mode == BENCH_MODE_COUNT) {
+        bench_usage();
+        return 1;
+      }
+    } else {
+      bench_usage();
+      return 1;
+    }
+  }
+
+  bool found = !only;
+  for (int i = 0; i < (int)ARR_SIZE(BENCH_SCENARIOS) && !found; i++) {
+    found = strcmp(only, BENCH_SCENARIOS[i].name) == 0;
+  }
+  if (!found) {
+    fprintf(stderr, "No scenario named %s\n", only);
+    bench_usage();
+    return 1;
+  }
+
+  ecs_register_component(COMPONENT_TRANSFORM, sizeof(HMM_Mat4));
+  ecs_register_component(COMPONENT_MODEL, sizeof(Model));
+  ecs_register_component(COMPONENT_CREATURE, sizeof(Creature));
+  ecs_register_component(COMPONENT_ENEMY_FLOATER, sizeof(Floater));
+
+  FILE *f = fopen(level_path, "rb");
+  if (!f) {
+    fprintf(stderr, "Failed to open %s\n", level_path);
+    return 1;
+  }
+  fseek(f, 0, SEEK_END);
+  int level_size = ftell(f);
+  fseek(f, 0, SEEK_SET);
+  char *level_data = alloc_mem(level_size);
+  fread(level_data, 1, level_size, f);
+  fclose(f);
+
+  // Windows paths have backslashes, which have to be escaped
+  printf("{\n  \"level\": \"");
+  for (const char *c = level_path; *c; c++) {
+    if (*c == '\\' || *c == '"') {
+      putchar('\\');
+    }
+    putchar(*c);
+  }
+  printf("\",\n");
+
+  if (mode != BENCH_MODE_SIM) {
+    bool ok = bench_run_mode(mode, level_data, level_size, thread_count);
+    printf("}\n");
+    free_mem(level_data);
+    return ok ? 0 : 1;
+  }
+
+  printf("  \"delta\": %f, \"seed\": %d,\n"
+         "  \"scenarios\": [\n",
+         BENCH_DELTA, BENCH_SEED);
+  // A snapshot is replayed instead of the scenarios
+  const BenchScenario *scenarios = BENCH_SCENARIOS;
+  int scenario_count = ARR_SIZE(BENCH_SCENARIOS);
+  if (replay_path) {
+    scenarios = &BENCH_REPLAY;
+    scenario_count = 1;
+    only = NULL;
+  }
+  bool first = true;
+  bool ok = true;
+  for (int i = 0; i < scenario_count && ok; i++) {
+    const BenchScenario *scenario = &scenarios[i];
+    if (only && strcmp(only, scenario->name) != 0) {
+      continue;
+    }
+    for (int t = 0; t < thread_count_count && ok; t++) {
+      for (int b = first_broadphase; b <= last_broadphase && ok; b++) {
+        if (!first) {
+          printf(",\n");
+        }
+        first = false;
+        ok = bench_run_scenario(scenario, level_data, level_size,
+                                thread_counts[t], b, replay_path, save_prefix);
+      }
+    }
+  }
+  printf("\n  ]\n}\n");
+
+  free_mem(level_data);
+  return ok ? 0 : 1;
+}
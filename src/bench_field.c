@@ -0,0 +1,105 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "HandmadeMath.h"
+
+#include "bench_field.h"
+#include "blob.h"
+#include "core.h"
+
+#define BENCH_FIELD_SEED 1
+#define BENCH_FIELD_SAMPLE_COUNT 65536
+// Samples are from this far inside of a solid to this far outside of it
+#define BENCH_FIELD_MIN_OFFSET -0.25f
+#define BENCH_FIELD_MAX_OFFSET 0.9f
+// About the size of a liquid, and smaller than the band of the field so that
+// every query uses it
+#define BENCH_FIELD_QUERY_RADIUS 0.5f
+
+void bench_field_run(BlobSim *bs) {
+  if (bs->solids.count == 0) {
+    printf("  \"field\": null\n");
+    return;
+  }
+
+  // Everything has to be baked, or the field would miss solids
+  solid_field_bake_marked(&bs->solid_field, bs, bs->solid_field.pending_count);
+
+  srand(BENCH_FIELD_SEED);
+  HMM_Vec3 *points = alloc_mem(BENCH_FIELD_SAMPLE_COUNT * sizeof(*points));
+  for (int i = 0; i < BENCH_FIELD_SAMPLE_COUNT; i++) {
+    const SolidBlob *b = fixed_array_get_const(
+        &bs->solids, rand() % bs->solids.count);
+    HMM_Vec3 dir = HMM_NormV3(HMM_V3(rand_float() - 0.5f, rand_float() - 0.5f,
+                                     rand_float() - 0.5f));
+    float offset = BENCH_FIELD_MIN_OFFSET +
+                   rand_float() * (BENCH_FIELD_MAX_OFFSET -
+                                   BENCH_FIELD_MIN_OFFSET);
+    points[i] = HMM_AddV3(b->pos, HMM_MulV3F(dir, b->radius + offset));
+  }
+
+  HMM_Vec3 *field = alloc_mem(BENCH_FIELD_SAMPLE_COUNT * sizeof(*field));
+  HMM_Vec3 *exact = alloc_mem(BENCH_FIELD_SAMPLE_COUNT * sizeof(*exact));
+
+  double start = get_time();
+  for (int i = 0; i < BENCH_FIELD_SAMPLE_COUNT; i++) {
+    field[i] = blob_get_correction_from_solids(bs, &points[i],
+                                               BENCH_FIELD_QUERY_RADIUS);
+  }
+  double field_time = get_time() - start;
+
+  start = get_time();
+  for (int i = 0; i < BENCH_FIELD_SAMPLE_COUNT; i++) {
+    exact[i] = blob_get_correction_from_solids_exact(
+        bs, &points[i], BENCH_FIELD_QUERY_RADIUS);
+  }
+  double exact_time = get_time() - start;
+
+  // Depth and angle errors are only measured where both queries hit, and
+  // points that only one of them hits are counted instead
+  int both_count = 0;
+  int field_only_count = 0;
+  int exact_only_count = 0;
+  double depth_error_sum = 0.0;
+  float depth_error_max = 0.0f;
+  double angle_sum = 0.0;
+  float angle_max = 0.0f;
+  for (int i = 0; i < BENCH_FIELD_SAMPLE_COUNT; i++) {
+    float field_depth = HMM_LenV3(field[i]);
+    float exact_depth = HMM_LenV3(exact[i]);
+    if (field_depth == 0.0f || exact_depth == 0.0f) {
+      field_only_count += field_depth > 0.0f;
+      exact_only_count += exact_depth > 0.0f;
+      continue;
+    }
+
+    both_count++;
+    float depth_error = fabsf(field_depth - exact_depth);
+    depth_error_sum += depth_error;
+    depth_error_max = HMM_MAX(depth_error_max, depth_error);
+
+    float cos_angle =
+        HMM_DotV3(field[i], exact[i]) / (field_depth * exact_depth);
+    float angle = acosf(HMM_Clamp(-1.0f, cos_angle, 1.0f)) * HMM_RadToDeg;
+    angle_sum += angle;
+    angle_max = HMM_MAX(angle_max, angle);
+  }
+
+  free_mem(points);
+  free_mem(field);
+  free_mem(exact);
+
+  printf("  \"field\": {\"samples\": %d, \"query_radius\": %.2f, "
+         "\"bricks\": %d, \"both_hit\": %d, \"field_only\": %d, "
+         "\"exact_only\": %d, \"depth_error_mean\": %.5f, "
+         "\"depth_error_max\": %.5f, \"angle_mean_deg\": %.3f, "
+         "\"angle_max_deg\": %.3f, \"field_ns\": %.1f, \"exact_ns\": %.1f}\n",
+         BENCH_FIELD_SAMPLE_COUNT, BENCH_FIELD_QUERY_RADIUS,
+         bs->solid_field.brick_count - bs->solid_field.free_brick_count,
+         both_count, field_only_count, exact_only_count,
+         both_count ? depth_error_sum / both_count : 0.0, depth_error_max,
+         both_count ? angle_sum / both_count : 0.0, angle_max,
+         field_time * 1e9 / BENCH_FIELD_SAMPLE_COUNT,
+         exact_time * 1e9 / BENCH_FIELD_SAMPLE_COUNT);
+}
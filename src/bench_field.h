@@ -0,0 +1,8 @@
+#pragma once
+
+#include "blob.h"
+
+// Compares the collision corrections from the solid distance field with the
+// ones from the exact octree query, at points around the solids of bs. Prints
+// a JSON object with the errors and how long each query took
+void bench_field_run(BlobSim *bs);
@@ -0,0 +1,197 @@
+#include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "HandmadeMath.h"
+
+#include "bench_kernel.h"
+#include "blob.h"
+#include "blob_kernel.h"
+#include "core.h"
+
+#define BENCH_KERNEL_SEED 1
+#define BENCH_KERNEL_CASE_COUNT 8192
+// Neighbour counts go up to this, so every level also has leftover blobs
+#define BENCH_KERNEL_MAX_OTHERS 67
+// Allowed difference from the scalar sum, as a fraction of the summed length
+// of the attractions
+#define BENCH_KERNEL_TOLERANCE 1e-5f
+// Every case is summed this many times at each level for the timings
+#define BENCH_KERNEL_ROUNDS 8
+
+// Indexed by BlobKernelLevel
+static const char *BENCH_KERNEL_LEVELS[] = {"scalar", "sse", "avx2"};
+
+// A liquid and the blobs around it, which are others_count blobs from
+// others_start in the shared arrays
+typedef struct BenchKernelCase {
+  HMM_Vec3 pos;
+  float radius;
+  int others_start;
+  int others_count;
+} BenchKernelCase;
+
+typedef struct BenchKernelData {
+  BenchKernelCase cases[BENCH_KERNEL_CASE_COUNT];
+  float x[BENCH_KERNEL_CASE_COUNT * BENCH_KERNEL_MAX_OTHERS];
+  float y[BENCH_KERNEL_CASE_COUNT * BENCH_KERNEL_MAX_OTHERS];
+  float z[BENCH_KERNEL_CASE_COUNT * BENCH_KERNEL_MAX_OTHERS];
+  float radius[BENCH_KERNEL_CASE_COUNT * BENCH_KERNEL_MAX_OTHERS];
+  int pair_count;
+  // Results of the scalar level
+  HMM_Vec3 sums[BENCH_KERNEL_CASE_COUNT];
+  float dists[BENCH_KERNEL_CASE_COUNT][4];
+  int closest[BENCH_KERNEL_CASE_COUNT][4];
+} BenchKernelData;
+
+static BlobKernelBlobs bench_kernel_get_others(const BenchKernelData *data,
+                                               const BenchKernelCase *c) {
+  BlobKernelBlobs others;
+  others.x = data->x + c->others_start;
+  others.y = data->y + c->others_start;
+  others.z = data->z + c->others_start;
+  others.radius = data->radius + c->others_start;
+  others.count = c->others_count;
+  return others;
+}
+
+// Liquids of random sizes around each one, from on top of it to past the
+// reach of the attraction. Some cases include the liquid itself
+static void bench_kernel_make_cases(BenchKernelData *data) {
+  data->pair_count = 0;
+  for (int i = 0; i < BENCH_KERNEL_CASE_COUNT; i++) {
+    BenchKernelCase *c = &data->cases[i];
+    c->pos = HMM_V3((rand_float() - 0.5f) * 64.0f, rand_float() * 16.0f,
+                    (rand_float() - 0.5f) * 64.0f);
+    c->radius = 0.2f + rand_float() * 0.4f;
+    c->others_start = data->pair_count;
+    c->others_count = rand() % (BENCH_KERNEL_MAX_OTHERS + 1);
+    for (int j = 0; j < c->others_count; j++) {
+      int k = c->others_start + j;
+      data->radius[k] = 0.2f + rand_float() * 0.4f;
+      HMM_Vec3 p = c->pos;
+      if (rand() % 16 != 0) {
+        HMM_Vec3 dir = HMM_NormV3(HMM_V3(
+            rand_float() - 0.5f, rand_float() - 0.5f, rand_float() - 0.5f));
+        float reach = (c->radius + data->radius[k]) * 1.2f;
+        p = HMM_AddV3(p, HMM_MulV3F(dir, rand_float() * reach * 1.2f));
+      }
+      data->x[k] = p.X;
+      data->y[k] = p.Y;
+      data->z[k] = p.Z;
+    }
+    data->pair_count += c->others_count;
+  }
+}
+
+// 4 points around each case, some inside of its blobs
+static void bench_kernel_get_points(const BenchKernelCase *c, int i, float *px,
+                                    float *py, float *pz) {
+  for (int l = 0; l < 4; l++) {
+    float t = (float)(i % 7 + l) * 0.3f;
+    px[l] = c->pos.X + cosf(t) * t;
+    py[l] = c->pos.Y + sinf(t * 1.7f) * t;
+    pz[l] = c->pos.Z + sinf(t) * t;
+  }
+}
+
+// Runs every case at the current level. Returns the seconds that the
+// attraction sums took
+static double bench_kernel_run_level(const BenchKernelData *data,
+                                     HMM_Vec3 *sums, float (*dists)[4],
+                                     int (*closest)[4]) {
+  double start = get_time();
+  for (int round = 0; round < BENCH_KERNEL_ROUNDS; round++) {
+    for (int i = 0; i < BENCH_KERNEL_CASE_COUNT; i++) {
+      const BenchKernelCase *c = &data->cases[i];
+      BlobKernelBlobs others = bench_kernel_get_others(data, c);
+      sums[i] = blob_kernel_attraction_sum(&c->pos, c->radius, &others);
+    }
+  }
+  double time = get_time() - start;
+
+  for (int i = 0; i < BENCH_KERNEL_CASE_COUNT; i++) {
+    const BenchKernelCase *c = &data->cases[i];
+    BlobKernelBlobs others = bench_kernel_get_others(data, c);
+    float px[4], py[4], pz[4];
+    bench_kernel_get_points(c, i, px, py, pz);
+    blob_kernel_smin_dist_x4(px, py, pz, &others, BLOB_SMOOTH, dists[i],
+                             closest[i]);
+  }
+  return time;
+}
+
+bool bench_kernel_run() {
+  BlobKernelLevel old_level = blob_kernel_get_level();
+  BlobKernelLevel supported = blob_kernel_get_supported_level();
+
+  srand(BENCH_KERNEL_SEED);
+  BenchKernelData *data = alloc_mem(sizeof(*data));
+  bench_kernel_make_cases(data);
+
+  HMM_Vec3 *sums = alloc_mem(BENCH_KERNEL_CASE_COUNT * sizeof(*sums));
+  float(*dists)[4] = alloc_mem(BENCH_KERNEL_CASE_COUNT * sizeof(*dists));
+  int(*closest)[4] = alloc_mem(BENCH_KERNEL_CASE_COUNT * sizeof(*closest));
+
+  printf("  \"kernel\": {\"cases\": %d, \"pairs\": %d, \"tolerance\": %g, "
+         "\"levels\": [\n",
+         BENCH_KERNEL_CASE_COUNT, data->pair_count, BENCH_KERNEL_TOLERANCE);
+
+  bool ok = true;
+  for (int level = BLOB_KERNEL_SCALAR; level <= (int)supported; level++) {
+    blob_kernel_set_level(level);
+    bool is_scalar = level == BLOB_KERNEL_SCALAR;
+    double time = bench_kernel_run_level(
+        data, is_scalar ? data->sums : sums, is_scalar ? data->dists : dists,
+        is_scalar ? data->closest : closest);
+
+    // Errors are relative to the summed length of the attractions, which
+    // bounds how much reordering the sum can change it
+    float error_max = 0.0f;
+    int failures = 0;
+    int smin_mismatches = 0;
+    for (int i = 0; i < BENCH_KERNEL_CASE_COUNT && !is_scalar; i++) {
+      const BenchKernelCase *c = &data->cases[i];
+      float length_sum = 0.0f;
+      for (int j = 0; j < c->others_count; j++) {
+        int k = c->others_start + j;
+        HMM_Vec3 o_pos = HMM_V3(data->x[k], data->y[k], data->z[k]);
+        length_sum += HMM_LenV3(blob_get_attraction_to(
+            &c->pos, c->radius, &o_pos, data->radius[k]));
+      }
+      float error = HMM_LenV3(HMM_SubV3(sums[i], data->sums[i]));
+      if (error > BENCH_KERNEL_TOLERANCE * length_sum) {
+        failures++;
+      }
+      if (length_sum > 0.0f) {
+        error_max = HMM_MAX(error_max, error / length_sum);
+      }
+
+      // The smooth distances are vectorized across points, so every level
+      // has to give exactly the same result
+      for (int l = 0; l < 4; l++) {
+        smin_mismatches += dists[i][l] != data->dists[i][l] ||
+                           closest[i][l] != data->closest[i][l];
+      }
+    }
+    ok = ok && failures == 0 && smin_mismatches == 0;
+
+    if (level > BLOB_KERNEL_SCALAR) {
+      printf(",\n");
+    }
+    printf("    {\"level\": \"%s\", \"attraction_ns_per_pair\": %.3f, "
+           "\"error_max\": %.3g, \"failures\": %d, \"smin_mismatches\": %d}",
+           BENCH_KERNEL_LEVELS[level],
+           time * 1e9 / ((double)data->pair_count * BENCH_KERNEL_ROUNDS),
+           error_max, failures, smin_mismatches);
+  }
+  printf("\n  ], \"ok\": %s}\n", ok ? "true" : "false");
+
+  free_mem(sums);
+  free_mem(dists);
+  free_mem(closest);
+  free_mem(data);
+  blob_kernel_set_level(old_level);
+  return ok;
+}
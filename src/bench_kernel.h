@@ -0,0 +1,9 @@
+#pragma once
+
+#include <stdbool.h>
+
+// Runs every kernel level that the CPU supports on the same random liquids and
+// checks that their results stay within the tolerance in blob_kernel.h of the
+// scalar level. Prints a JSON object with the errors and how fast each level
+// was. Returns false if a level is outside of the tolerance
+bool bench_kernel_run();
@@ -0,0 +1,235 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "HandmadeMath.h"
+
+#include "bench_ot.h"
+#include "blob.h"
+#include "core.h"
+
+#define BENCH_OT_SEED 1
+#define BENCH_OT_BLOB_COUNT 4096
+#define BENCH_OT_QUERY_COUNT 4096
+// Every operation is repeated until at least this many were timed, so small
+// distributions are measured as precisely as large ones
+#define BENCH_OT_MIN_OPS 65536
+// Radius of sphere queries, which is about how far liquids look for
+// neighbours. Cube queries take it as their full size, so they reach half as
+// far, 0.6 from their center
+#define BENCH_OT_QUERY_SIZE 1.2f
+
+typedef struct BenchOtBlobs {
+  const char *name;
+  HMM_Vec3 *pos;
+  float *radius;
+  int count;
+} BenchOtBlobs;
+
+// Counted by the leaf callback of queries
+typedef struct BenchOtVisits {
+  int64_t leaves;
+  // Blobs in the leaves, including blobs that are in more than one
+  int64_t entries;
+} BenchOtVisits;
+
+static HMM_Vec3 bench_ot_get_pos_from_idx(BlobOt *bot, int idx) {
+  const BenchOtBlobs *blobs = bot->userdata;
+  return blobs->pos[idx];
+}
+
+static float bench_ot_get_radius_from_idx(BlobOt *bot, int idx) {
+  const BenchOtBlobs *blobs = bot->userdata;
+  return blobs->radius[idx];
+}
+
+static void bench_ot_blobs_create(BenchOtBlobs *blobs, const char *name,
+                                  int count) {
+  blobs->name = name;
+  blobs->count = count;
+  blobs->pos = alloc_mem(count * sizeof(*blobs->pos));
+  blobs->radius = alloc_mem(count * sizeof(*blobs->radius));
+}
+
+static void bench_ot_blobs_destroy(BenchOtBlobs *blobs) {
+  free_mem(blobs->pos);
+  free_mem(blobs->radius);
+}
+
+// Blobs anywhere in a 40 m cube
+static void bench_ot_make_uniform(BenchOtBlobs *blobs) {
+  bench_ot_blobs_create(blobs, "uniform", BENCH_OT_BLOB_COUNT);
+  for (int i = 0; i < blobs->count; i++) {
+    blobs->pos[i] = HMM_V3((rand_float() - 0.5f) * 40.0f, rand_float() * 40.0f,
+                           (rand_float() - 0.5f) * 40.0f);
+    blobs->radius[i] = 0.3f;
+  }
+}
+
+// Liquids that have settled into a shallow puddle, densest in the middle
+static void bench_ot_make_puddle(BenchOtBlobs *blobs) {
+  bench_ot_blobs_create(blobs, "puddle", BENCH_OT_BLOB_COUNT);
+  for (int i = 0; i < blobs->count; i++) {
+    float angle = rand_float() * HMM_PI32 * 2.0f;
+    float dist = rand_float() * rand_float() * 4.0f;
+    blobs->pos[i] = HMM_V3(cosf(angle) * dist, rand_float() * 0.6f,
+                           sinf(angle) * dist);
+    blobs->radius[i] = 0.3f;
+  }
+}
+
+// One layer of solids making a floor
+static void bench_ot_make_sheet(BenchOtBlobs *blobs) {
+  bench_ot_blobs_create(blobs, "floor_sheet", BENCH_OT_BLOB_COUNT);
+  int side = (int)sqrtf((float)blobs->count);
+  for (int i = 0; i < blobs->count; i++) {
+    blobs->pos[i] = HMM_V3((i % side - side / 2) * 0.5f, 0.0f,
+                           (i / side - side / 2) * 0.5f);
+    blobs->radius[i] = 0.4f;
+  }
+}
+
+static void bench_ot_make_level(BenchOtBlobs *blobs, const SolidBlob *solids,
+                                int count) {
+  bench_ot_blobs_create(blobs, "level_solids", count);
+  for (int i = 0; i < count; i++) {
+    blobs->pos[i] = solids[i].pos;
+    blobs->radius[i] = solids[i].radius;
+  }
+}
+
+static bool bench_ot_visit_leaf(BlobOtEnumData *enum_data) {
+  BenchOtVisits *visits = enum_data->user_data;
+  visits->leaves++;
+  visits->entries += enum_data->curr_leaf->leaf_blob_count;
+  return true;
+}
+
+// Returns the seconds that every query took
+static double bench_ot_time_queries(BlobOt *bot, const HMM_Vec3 *centers,
+                                    bool sphere, int rounds,
+                                    BenchOtVisits *visits) {
+  BlobOtEnumData enum_data;
+  enum_data.bot = bot;
+  enum_data.shape_size = BENCH_OT_QUERY_SIZE;
+  enum_data.callback = bench_ot_visit_leaf;
+  enum_data.user_data = visits;
+
+  double start = get_time();
+  for (int r = 0; r < rounds; r++) {
+    for (int i = 0; i < BENCH_OT_QUERY_COUNT; i++) {
+      enum_data.shape_pos = centers[i];
+      if (sphere) {
+        blob_ot_enum_leaves_sphere(&enum_data);
+      } else {
+        blob_ot_enum_leaves_cube(&enum_data);
+      }
+    }
+  }
+  return get_time() - start;
+}
+
+static void bench_ot_run_blobs(const BenchOtBlobs *blobs) {
+  // Set up like the octrees of BlobSim
+  BlobOt bot;
+  bot.max_subdiv = 8;
+  bot.root_pos = HMM_V3(0, 0, 0);
+  bot.root_size = BLOB_LEVEL_SIZE;
+  bot.userdata = (void *)blobs;
+  bot.get_pos_from_idx = bench_ot_get_pos_from_idx;
+  bot.get_radius_from_idx = bench_ot_get_radius_from_idx;
+  blob_ot_create(&bot);
+  bot.max_dist_to_leaf = BLOB_SDF_MAX_DIST;
+
+  int rounds = HMM_MAX(1, BENCH_OT_MIN_OPS / blobs->count);
+  double insert_time = 0.0;
+  double remove_time = 0.0;
+  for (int r = 0; r < rounds; r++) {
+    blob_ot_reset(&bot);
+
+    double start = get_time();
+    for (int i = 0; i < blobs->count; i++) {
+      blob_ot_insert(&bot, &blobs->pos[i], blobs->radius[i], i);
+    }
+    insert_time += get_time() - start;
+
+    start = get_time();
+    for (int i = 0; i < blobs->count; i++) {
+      blob_ot_remove(&bot, &blobs->pos[i], blobs->radius[i], i);
+    }
+    remove_time += get_time() - start;
+  }
+  double ops = (double)rounds * blobs->count;
+
+  blob_ot_reset(&bot);
+  for (int i = 0; i < blobs->count; i++) {
+    blob_ot_insert(&bot, &blobs->pos[i], blobs->radius[i], i);
+  }
+
+  // Queries around random blobs, like the ones the simulation makes
+  HMM_Vec3 *centers = alloc_mem(BENCH_OT_QUERY_COUNT * sizeof(*centers));
+  for (int i = 0; i < BENCH_OT_QUERY_COUNT; i++) {
+    HMM_Vec3 offset = HMM_V3(rand_float() - 0.5f, rand_float() - 0.5f,
+                             rand_float() - 0.5f);
+    centers[i] = HMM_AddV3(blobs->pos[rand() % blobs->count], offset);
+  }
+
+  int query_rounds = HMM_MAX(1, BENCH_OT_MIN_OPS / BENCH_OT_QUERY_COUNT);
+  double queries = (double)query_rounds * BENCH_OT_QUERY_COUNT;
+  BenchOtVisits sphere = {0};
+  double sphere_time =
+      bench_ot_time_queries(&bot, centers, true, query_rounds, &sphere);
+  BenchOtVisits cube = {0};
+  double cube_time =
+      bench_ot_time_queries(&bot, centers, false, query_rounds, &cube);
+  free_mem(centers);
+
+  // Blobs are added to every leaf that they are within max_dist_to_leaf of,
+  // so counting the blobs in every leaf shows how many are duplicates
+  BenchOtVisits all = {0};
+  BlobOtEnumData enum_data;
+  enum_data.bot = &bot;
+  enum_data.shape_pos = bot.root_pos;
+  enum_data.shape_size = bot.root_size;
+  enum_data.callback = bench_ot_visit_leaf;
+  enum_data.user_data = &all;
+  blob_ot_enum_leaves_cube(&enum_data);
+
+  printf("    {\"name\": \"%s\", \"blobs\": %d, \"insert_ns\": %.1f, "
+         "\"remove_ns\": %.1f, \"sphere_ns\": %.1f, \"sphere_leaves\": %.2f, "
+         "\"sphere_entries\": %.2f, \"cube_ns\": %.1f, \"cube_leaves\": %.2f, "
+         "\"cube_entries\": %.2f, \"leaves\": %lld, \"duplicate_ratio\": %.3f, "
+         "\"used_bytes\": %d}",
+         blobs->name, blobs->count, insert_time * 1e9 / ops,
+         remove_time * 1e9 / ops, sphere_time * 1e9 / queries,
+         sphere.leaves / queries, sphere.entries / queries,
+         cube_time * 1e9 / queries, cube.leaves / queries,
+         cube.entries / queries, (long long)all.leaves,
+         (double)all.entries / blobs->count, blob_ot_get_used_bytes(&bot));
+
+  blob_ot_destroy(&bot);
+}
+
+void bench_ot_run(const SolidBlob *level_solids, int level_solid_count) {
+  BenchOtBlobs blobs[4];
+  int blobs_count = 0;
+  srand(BENCH_OT_SEED);
+  bench_ot_make_uniform(&blobs[blobs_count++]);
+  bench_ot_make_puddle(&blobs[blobs_count++]);
+  bench_ot_make_sheet(&blobs[blobs_count++]);
+  if (level_solid_count > 0) {
+    bench_ot_make_level(&blobs[blobs_count++], level_solids,
+                        level_solid_count);
+  }
+
+  printf("  \"octree\": [\n");
+  for (int i = 0; i < blobs_count; i++) {
+    if (i > 0) {
+      printf(",\n");
+    }
+    srand(BENCH_OT_SEED);
+    bench_ot_run_blobs(&blobs[i]);
+    bench_ot_blobs_destroy(&blobs[i]);
+  }
+  printf("\n  ]\n");
+}
@@ -0,0 +1,7 @@
+#pragma once
+
+#include "blob.h"
+
+// Micro benchmarks of BlobOt with a few distributions of blobs, including the
+// solids of a level. Prints a JSON array with the results of each
+void bench_ot_run(const SolidBlob *level_solids, int level_solid_count);
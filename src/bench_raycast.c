@@ -0,0 +1,203 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "HandmadeMath.h"
+
+#include "bench_raycast.h"
+#include "blob.h"
+#include "core.h"
+
+#define BENCH_RAYCAST_SEED 1
+// Rays of the camera fan along each axis
+#define BENCH_RAYCAST_FAN_SIDE 128
+#define BENCH_RAYCAST_COUNT (BENCH_RAYCAST_FAN_SIDE * BENCH_RAYCAST_FAN_SIDE)
+// Every set of rays is traced this many times with each API
+#define BENCH_RAYCAST_ROUNDS 4
+// Solid counts of the generated levels that show how raycasts scale
+static const int BENCH_RAYCAST_SOLID_COUNTS[] = {64, 256, 1024, 4096, 16384};
+
+typedef struct BenchRays {
+  const char *name;
+  HMM_Vec3 ro[BENCH_RAYCAST_COUNT];
+  HMM_Vec3 rd[BENCH_RAYCAST_COUNT];
+} BenchRays;
+
+static void bench_raycast_get_bounds(const BlobSim *bs, HMM_Vec3 *min,
+                                     HMM_Vec3 *max) {
+  *min = HMM_V3(INFINITY, INFINITY, INFINITY);
+  *max = HMM_V3(-INFINITY, -INFINITY, -INFINITY);
+  for (int i = 0; i < bs->solids.count; i++) {
+    const SolidBlob *b = fixed_array_get_const(&bs->solids, i);
+    *min = HMM_V3(fminf(min->X, b->pos.X - b->radius),
+                  fminf(min->Y, b->pos.Y - b->radius),
+                  fminf(min->Z, b->pos.Z - b->radius));
+    *max = HMM_V3(fmaxf(max->X, b->pos.X + b->radius),
+                  fmaxf(max->Y, b->pos.Y + b->radius),
+                  fmaxf(max->Z, b->pos.Z + b->radius));
+  }
+}
+
+// 30 unit rays from above one side of the solids looking across and down at
+// them, like a camera. Rays next to each other in the arrays are next to each
+// other in the fan, so packets are coherent
+static void bench_raycast_make_fan(BenchRays *rays, const BlobSim *bs) {
+  HMM_Vec3 min, max;
+  bench_raycast_get_bounds(bs, &min, &max);
+  HMM_Vec3 ro = HMM_V3((min.X + max.X) * 0.5f, max.Y + 2.0f, min.Z - 2.0f);
+
+  rays->name = "camera_fan";
+  for (int y = 0; y < BENCH_RAYCAST_FAN_SIDE; y++) {
+    float pitch = -HMM_PI32 / 3.0f * y / (BENCH_RAYCAST_FAN_SIDE - 1);
+    for (int x = 0; x < BENCH_RAYCAST_FAN_SIDE; x++) {
+      float yaw =
+          HMM_PI32 * 0.5f * ((float)x / (BENCH_RAYCAST_FAN_SIDE - 1) - 0.5f);
+      int i = y * BENCH_RAYCAST_FAN_SIDE + x;
+      rays->ro[i] = ro;
+      rays->rd[i] = HMM_MulV3F(HMM_V3(sinf(yaw) * cosf(pitch), sinf(pitch),
+                                      cosf(yaw) * cosf(pitch)),
+                               30.0f);
+    }
+  }
+}
+
+// 4 unit rays from random points near the solids in random directions, like
+// line of sight checks between creatures. Packets are not coherent
+static void bench_raycast_make_random(BenchRays *rays, const BlobSim *bs) {
+  rays->name = "random";
+  for (int i = 0; i < BENCH_RAYCAST_COUNT; i++) {
+    const SolidBlob *b =
+        fixed_array_get_const(&bs->solids, rand() % bs->solids.count);
+    HMM_Vec3 offset = HMM_NormV3(HMM_V3(
+        rand_float() - 0.5f, rand_float() - 0.5f, rand_float() - 0.5f));
+    rays->ro[i] = HMM_AddV3(
+        b->pos, HMM_MulV3F(offset, b->radius + 0.5f + rand_float() * 3.0f));
+    rays->rd[i] = HMM_MulV3F(HMM_NormV3(HMM_V3(rand_float() - 0.5f,
+                                               rand_float() - 0.5f,
+                                               rand_float() - 0.5f)),
+                             4.0f);
+  }
+}
+
+static void bench_raycast_trace(BlobSim *bs, const BenchRays *rays,
+                                RaycastResult *single, RaycastResult *batch) {
+  double start = get_time();
+  for (int r = 0; r < BENCH_RAYCAST_ROUNDS; r++) {
+    for (int i = 0; i < BENCH_RAYCAST_COUNT; i++) {
+      blob_sim_raycast(&single[i], bs, rays->ro[i], rays->rd[i],
+                       RAYCAST_SOLIDS);
+    }
+  }
+  double single_time = get_time() - start;
+
+  start = get_time();
+  for (int r = 0; r < BENCH_RAYCAST_ROUNDS; r++) {
+    blob_sim_raycast_batch(batch, bs, rays->ro, rays->rd, BENCH_RAYCAST_COUNT,
+                           RAYCAST_SOLIDS);
+  }
+  double batch_time = get_time() - start;
+
+  // Both should hit the same blobs at about the same distances
+  int hits = 0;
+  int mismatches = 0;
+  for (int i = 0; i < BENCH_RAYCAST_COUNT; i++) {
+    hits += single[i].has_hit;
+    if (single[i].has_hit != batch[i].has_hit ||
+        (single[i].has_hit &&
+         (single[i].blob_idx != batch[i].blob_idx ||
+          fabsf(single[i].traveled - batch[i].traveled) > 1e-3f))) {
+      mismatches++;
+    }
+  }
+
+  double traced = (double)BENCH_RAYCAST_ROUNDS * BENCH_RAYCAST_COUNT;
+  printf("    {\"name\": \"%s\", \"rays\": %d, \"hits\": %d, "
+         "\"single_mrays_per_s\": %.3f, \"batch_mrays_per_s\": %.3f, "
+         "\"mismatches\": %d}",
+         rays->name, BENCH_RAYCAST_COUNT, hits, traced / single_time * 1e-6,
+         traced / batch_time * 1e-6, mismatches);
+}
+
+// Fills a floor with count solids, one per square unit, so that levels with
+// more solids are bigger instead of denser
+static void bench_raycast_make_floor(BlobSim *bs, int count) {
+  float side = sqrtf((float)count);
+  blob_sim_begin_solid_batch(bs);
+  for (int i = 0; i < count; i++) {
+    SolidBlob *b = solid_blob_create(bs);
+    if (!b) {
+      break;
+    }
+    b->mat_idx = 0;
+    HMM_Vec3 pos = HMM_V3((rand_float() - 0.5f) * side, rand_float() * 0.5f,
+                          (rand_float() - 0.5f) * side);
+    solid_blob_set_radius_pos(bs, b, 0.4f + rand_float() * 0.4f, &pos);
+  }
+  blob_sim_end_solid_batch(bs);
+}
+
+// Random rays on generated levels with more and more solids. Only the leaves
+// along a ray are checked, so the cost per ray should barely change
+static void bench_raycast_run_scaling(BlobSim *level_bs, BenchRays *rays,
+                                      RaycastResult *results) {
+  printf("  \"raycast_scaling\": [\n");
+  for (int i = 0; i < (int)ARR_SIZE(BENCH_RAYCAST_SOLID_COUNTS); i++) {
+    static BlobSim bs;
+    blob_sim_create(&bs);
+    blob_sim_set_thread_count(&bs, level_bs->workers.thread_count);
+    bench_raycast_make_floor(&bs, BENCH_RAYCAST_SOLID_COUNTS[i]);
+    bench_raycast_make_random(rays, &bs);
+
+    double start = get_time();
+    for (int r = 0; r < BENCH_RAYCAST_ROUNDS; r++) {
+      for (int j = 0; j < BENCH_RAYCAST_COUNT; j++) {
+        blob_sim_raycast(&results[j], &bs, rays->ro[j], rays->rd[j],
+                         RAYCAST_SOLIDS);
+      }
+    }
+    double single_time = get_time() - start;
+
+    start = get_time();
+    for (int r = 0; r < BENCH_RAYCAST_ROUNDS; r++) {
+      blob_sim_raycast_batch(results, &bs, rays->ro, rays->rd,
+                             BENCH_RAYCAST_COUNT, RAYCAST_SOLIDS);
+    }
+    double batch_time = get_time() - start;
+
+    double traced = (double)BENCH_RAYCAST_ROUNDS * BENCH_RAYCAST_COUNT;
+    if (i > 0) {
+      printf(",\n");
+    }
+    printf("    {\"solids\": %d, \"single_ns_per_ray\": %.1f, "
+           "\"batch_ns_per_ray\": %.1f}",
+           bs.solids.count, single_time * 1e9 / traced,
+           batch_time * 1e9 / traced);
+    blob_sim_destroy(&bs);
+  }
+  printf("\n  ]\n");
+}
+
+void bench_raycast_run(BlobSim *bs) {
+  if (bs->solids.count == 0) {
+    printf("  \"raycast\": null\n");
+    return;
+  }
+
+  srand(BENCH_RAYCAST_SEED);
+  BenchRays *rays = alloc_mem(sizeof(*rays));
+  RaycastResult *single = alloc_mem(BENCH_RAYCAST_COUNT * sizeof(*single));
+  RaycastResult *batch = alloc_mem(BENCH_RAYCAST_COUNT * sizeof(*batch));
+
+  printf("  \"raycast\": [\n");
+  bench_raycast_make_fan(rays, bs);
+  bench_raycast_trace(bs, rays, single, batch);
+  printf(",\n");
+  bench_raycast_make_random(rays, bs);
+  bench_raycast_trace(bs, rays, single, batch);
+  printf("\n  ],\n");
+  bench_raycast_run_scaling(bs, rays, single);
+
+  free_mem(rays);
+  free_mem(single);
+  free_mem(batch);
+}
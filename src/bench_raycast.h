@@ -0,0 +1,9 @@
+#pragma once
+
+#include "blob.h"
+
+// Traces the same rays around the solids of bs with blob_sim_raycast and with
+// blob_sim_raycast_batch, and then random rays on generated levels with more
+// and more solids. Prints JSON arrays with how fast each was, and whether the
+// two functions agree
+void bench_raycast_run(BlobSim *bs);
@@ -1,34 +1,79 @@
 #include <math.h>
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
 #include "blob.h"
+#include "blob_kernel.h"
 #include "core.h"
+#include "snapshot.h"
 
 #define LIQUID_GRAVITY 9.81f
 #define LIQUID_MIN_Y_VEL -10.0f
 #define LIQUID_DRAG 0.5f
 
-#define BLOB_RAY_MAX_STEPS 32
+// Liquids slower than the rest speed for LIQUID_SLEEP_TICKS ticks in a row go
+// to sleep. Liquids faster than the wake speed wake the ones in their leaves
+#define LIQUID_REST_SPEED 0.3f
+#define LIQUID_WAKE_SPEED 1.0f
+#define LIQUID_SLEEP_TICKS 30
+// Mid and far liquids are simulated every few ticks with a delta that is as
+// many times larger. The tiers start on different ticks so they are not all
+// simulated on the same one
+#define LIQUID_LOD_MID_INTERVAL 4
+#define LIQUID_LOD_MID_PHASE 1
+#define LIQUID_LOD_FAR_INTERVAL 8
+#define LIQUID_LOD_FAR_PHASE 3
+// Far liquids that are not in a simulated leaf are split into jobs of this
+// many liquids
+#define LIQUID_FAR_JOB_SIZE 256
+// liquid_ot is built again at the end of a tick unless fewer than 1 / this of
+// the liquids are awake, in which case they are moved in it instead
+#define LIQUID_OT_MOVE_MAX_FRACTION 8
+// Liquids only attract liquids closer than this times the sum of their radii
+#define LIQUID_ATTRACTION_REACH 0.8f
+// Neighbour lists also have liquids up to this much further away, so they can
+// be reused until a liquid has moved half of this
+#define LIQUID_NEIGHBOUR_SKIN 0.2f
+
+// Projectiles are moved in jobs of this many projectiles
+#define PROJECTILE_JOB_SIZE 256
+// Most steps a projectile takes through the solid field in a tick. One that
+// runs out stops where it got to and goes on next tick
+#define PROJECTILE_MAX_STEPS 16
+
+#define BLOB_RAY_MAX_STEPS 64
 #define BLOB_RAY_INTERSECT 0.001f
+// Rays in a batch are traced in packets, and each job traces a few packets
+#define RAYCAST_PACKET_SIZE 4
+#define RAYCAST_BATCH_JOB_RAYS 64
 
-// TODO: dynamically increase leaf blob count
-#define BLOB_OT_LEAF_MAX_BLOB_COUNT 256
 #define BLOB_OT_LEAF_SUBDIV_BLOB_COUNT 8
-#define BLOB_OT_DEFAULT_CAPACITY_INT 2400000
+#define BLOB_OT_START_CAPACITY_INT 4096
+
+#define LEAF_SCRATCH_START_CAPACITY 256
+
+// Blobs with a radius up to the band use the solid distance field
+#define SOLID_FIELD_CELL_SIZE 0.25f
+#define SOLID_FIELD_BAND 1.0f
 
 #define BLOB_DEFAULT_RADIUS 0.5f
+
+// Bricks that bulk solid changes marked are baked a few at a time each tick
+#define SOLID_FIELD_BAKES_PER_TICK 64
 #define PROJECTILE_DEFAULT_DELETE_TIME 2.0f
 
-HMM_Vec3 blob_get_attraction_to(LiquidBlob *b, LiquidBlob *other) {
-  HMM_Vec3 direction = HMM_SubV3(b->pos, other->pos);
+HMM_Vec3 blob_get_attraction_to(const HMM_Vec3 *pos, float radius,
+                                const HMM_Vec3 *other_pos, float other_radius) {
+  HMM_Vec3 direction = HMM_SubV3(*pos, *other_pos);
   float len = HMM_LenV3(direction);
   if (len == 0.0f)
     return (HMM_Vec3){0};
 
-  float desired_dist = (b->radius + other->radius) * 0.4f;
+  float desired_dist = (radius + other_radius) * 0.4f;
 
   float x = fabsf(desired_dist - len);
 
@@ -37,7 +82,7 @@ HMM_Vec3 blob_get_attraction_to(LiquidBlob *b, LiquidBlob *other) {
   }
 
   float power =
-      fmaxf(0.0f, logf((-50.0f * fmaxf(1.0f, (other->radius / 0.5f))) * x *
+      fmaxf(0.0f, logf((-50.0f * fmaxf(1.0f, (other_radius / 0.5f))) * x *
                            (x - desired_dist) +
                        1.0f));
 
@@ -51,13 +96,14 @@ HMM_Vec3 blob_get_attraction_to(LiquidBlob *b, LiquidBlob *other) {
   return direction;
 }
 
-float blob_get_support_with(LiquidBlob *b, LiquidBlob *other) {
+float blob_get_support_with(const HMM_Vec3 *pos, float radius,
+                            const HMM_Vec3 *other_pos, float other_radius) {
   return 0.0f;
 
-  HMM_Vec3 direction = HMM_SubV3(b->pos, other->pos);
+  HMM_Vec3 direction = HMM_SubV3(*pos, *other_pos);
   float len = HMM_LenV3(direction);
 
-  float desired_dist = (b->radius + other->radius) * 0.4f;
+  float desired_dist = (radius + other_radius) * 0.4f;
 
   float x = desired_dist - len;
 
@@ -76,7 +122,7 @@ float blob_get_support_with(LiquidBlob *b, LiquidBlob *other) {
   }
 
   return fmaxf(0.0f,
-               (-1.0f * fmaxf(1.0f, other->radius / 0.5f)) * x * x + 0.4f);
+               (-1.0f * fmaxf(1.0f, other_radius / 0.5f)) * x * x + 0.4f);
 }
 
 SolidBlob *solid_blob_create(BlobSim *bs) {
@@ -86,6 +132,8 @@ SolidBlob *solid_blob_create(BlobSim *bs) {
     return NULL;
   }
 
+  handle_table_add(&bs->solid_handles, bs->solids.count - 1);
+
   b->radius = BLOB_DEFAULT_RADIUS;
   b->pos = HMM_V3(INFINITY, INFINITY, INFINITY);
   b->mat_idx = 0;
@@ -93,56 +141,413 @@ SolidBlob *solid_blob_create(BlobSim *bs) {
   return b;
 }
 
-LiquidBlob *liquid_blob_create(BlobSim *bs) {
-  LiquidBlob *b = fixed_array_append(&bs->liquids, NULL);
-  if (!b) {
+// Liquids are committed in chunks of this many. Every array of the store
+// grows by a multiple of MEM_COMMIT_ALIGN bytes
+#define LIQUID_STORE_CHUNK 65536
+// Starting capacity of arrays that grow with the number of blobs
+#define BLOB_SIM_START_CAPACITY 1024
+
+// Each array of the store and the size of its elements
+static const struct {
+  size_t offset;
+  size_t size;
+} liquid_store_arrays[] = {
+    {offsetof(LiquidStore, pos_x), sizeof(float)},
+    {offsetof(LiquidStore, pos_y), sizeof(float)},
+    {offsetof(LiquidStore, pos_z), sizeof(float)},
+    {offsetof(LiquidStore, vel_x), sizeof(float)},
+    {offsetof(LiquidStore, vel_y), sizeof(float)},
+    {offsetof(LiquidStore, vel_z), sizeof(float)},
+    {offsetof(LiquidStore, radius), sizeof(float)},
+    {offsetof(LiquidStore, info), sizeof(LiquidBlobInfo)},
+    {offsetof(LiquidStore, rest_ticks), sizeof(int)},
+    {offsetof(LiquidStore, disturbing), sizeof(bool)},
+};
+
+static void **liquid_store_array(LiquidStore *ls, int i) {
+  return (void **)((char *)ls + liquid_store_arrays[i].offset);
+}
+
+static size_t liquid_store_reserved_bytes(const LiquidStore *ls,
+                                          size_t size) {
+  size_t chunks = (ls->capacity + LIQUID_STORE_CHUNK - 1) / LIQUID_STORE_CHUNK;
+  return chunks * LIQUID_STORE_CHUNK * size;
+}
+
+// Address space for capacity liquids is reserved, so the arrays never move
+// when the store grows
+static void liquid_store_create(LiquidStore *ls, int capacity) {
+  ls->count = 0;
+  ls->capacity = capacity;
+  ls->committed = 0;
+
+  for (int i = 0; i < (int)ARR_SIZE(liquid_store_arrays); i++) {
+    *liquid_store_array(ls, i) = reserve_mem(
+        liquid_store_reserved_bytes(ls, liquid_store_arrays[i].size));
+  }
+}
+
+static void liquid_store_destroy(LiquidStore *ls) {
+  for (int i = 0; i < (int)ARR_SIZE(liquid_store_arrays); i++) {
+    void **array = liquid_store_array(ls, i);
+    release_mem(*array,
+                liquid_store_reserved_bytes(ls, liquid_store_arrays[i].size));
+    *array = NULL;
+  }
+
+  ls->count = 0;
+  ls->capacity = 0;
+  ls->committed = 0;
+}
+
+// Commits another chunk of every array
+static void liquid_store_grow(LiquidStore *ls) {
+  for (int i = 0; i < (int)ARR_SIZE(liquid_store_arrays); i++) {
+    size_t size = liquid_store_arrays[i].size;
+    commit_mem((char *)*liquid_store_array(ls, i) + ls->committed * size,
+               LIQUID_STORE_CHUNK * size);
+  }
+  ls->committed += LIQUID_STORE_CHUNK;
+}
+
+// Moves the last liquid into idx
+static void liquid_store_remove_swap(LiquidStore *ls, int idx) {
+  int last_idx = ls->count - 1;
+  if (idx != last_idx) {
+    float *hot[] = {ls->pos_x, ls->pos_y, ls->pos_z, ls->vel_x,
+                    ls->vel_y, ls->vel_z, ls->radius};
+    for (int i = 0; i < (int)ARR_SIZE(hot); i++) {
+      hot[i][idx] = hot[i][last_idx];
+    }
+    ls->info[idx] = ls->info[last_idx];
+    ls->rest_ticks[idx] = ls->rest_ticks[last_idx];
+    ls->disturbing[idx] = ls->disturbing[last_idx];
+  }
+  ls->count--;
+}
+
+static void liquid_store_snapshot_write(const LiquidStore *ls,
+                                        SnapshotWriter *w) {
+  snapshot_write(w, &ls->count, sizeof(ls->count));
+  for (int i = 0; i < (int)ARR_SIZE(liquid_store_arrays); i++) {
+    const void *array = *liquid_store_array((LiquidStore *)ls, i);
+    snapshot_write(w, array, ls->count * liquid_store_arrays[i].size);
+  }
+}
+
+// Anything but 0 or 1 in a bool is undefined, so a snapshot with one is broken
+static bool bools_are_valid(const void *bools, int count) {
+  const unsigned char *bytes = bools;
+  for (int i = 0; i < count; i++) {
+    if (bytes[i] > 1) {
+      return false;
+    }
+  }
+  return true;
+}
+
+static bool liquid_store_snapshot_read(LiquidStore *ls, SnapshotReader *r) {
+  int count;
+  if (!snapshot_read_into(r, &count, sizeof(count)) || count < 0 ||
+      count > ls->capacity) {
+    return false;
+  }
+
+  while (ls->committed < count) {
+    liquid_store_grow(ls);
+  }
+  ls->count = count;
+  for (int i = 0; i < (int)ARR_SIZE(liquid_store_arrays); i++) {
+    if (!snapshot_read_into(r, *liquid_store_array(ls, i),
+                            count * liquid_store_arrays[i].size)) {
+      ls->count = 0;
+      return false;
+    }
+  }
+  if (!bools_are_valid(ls->disturbing, count)) {
+    ls->count = 0;
+    return false;
+  }
+  return true;
+}
+
+static void blob_sim_set_liquids_awake(BlobSim *bs) {
+  for (int i = 0; i < LIQUID_LOD_COUNT; i++) {
+    bs->liquids_awake[i] = true;
+  }
+}
+
+int liquid_blob_create(BlobSim *bs) {
+  LiquidStore *ls = &bs->liquids;
+  if (ls->count >= ls->capacity) {
     fprintf(stderr, "Liquid blob max count reached\n");
+    return -1;
+  }
+
+  if (ls->count >= ls->committed) {
+    liquid_store_grow(ls);
+  }
+
+  int bidx = ls->count++;
+  handle_table_add(&bs->liquid_handles, bidx);
+  bs->liquid_neighbours_dirty = true;
+
+  ls->pos_x[bidx] = INFINITY;
+  ls->pos_y[bidx] = INFINITY;
+  ls->pos_z[bidx] = INFINITY;
+  ls->vel_x[bidx] = 0.0f;
+  ls->vel_y[bidx] = 0.0f;
+  ls->vel_z[bidx] = 0.0f;
+  ls->radius[bidx] = BLOB_DEFAULT_RADIUS;
+  ls->rest_ticks[bidx] = 0;
+  ls->disturbing[bidx] = false;
+  blob_sim_set_liquids_awake(bs);
+
+  LiquidBlobInfo *info = &ls->info[bidx];
+  info->mat_idx = 0;
+
+  return bidx;
+}
+
+Projectile *projectile_create(BlobSim *bs) {
+  Projectile *p = fixed_array_append(&bs->projectiles, NULL);
+  if (!p) {
+    fprintf(stderr, "Projectile max count reached\n");
     return NULL;
   }
 
-  b->type = LIQUID_BASE;
-  b->radius = BLOB_DEFAULT_RADIUS;
-  b->pos = HMM_V3(INFINITY, INFINITY, INFINITY);
-  b->vel = HMM_V3(0, 0, 0);
-  b->mat_idx = 0;
+  handle_table_add(&bs->projectile_handles, bs->projectiles.count - 1);
 
-  return b;
+  // Clears the padding too, since projectiles are written to snapshots as they
+  // are
+  memset(p, 0, sizeof(*p));
+  p->pos = HMM_V3(INFINITY, INFINITY, INFINITY);
+  p->vel = HMM_V3(0.0f, 0.0f, 0.0f);
+  p->radius = BLOB_DEFAULT_RADIUS;
+  p->mat_idx = 0;
+  p->lifetime = INFINITY;
+  p->callback = NULL;
+  p->userdata = 0;
+
+  return p;
+}
+
+Handle solid_blob_get_handle(const BlobSim *bs, const SolidBlob *b) {
+  return handle_table_get_handle(
+      &bs->solid_handles, fixed_array_get_idx_from_ptr(&bs->solids, b));
+}
+
+Handle liquid_blob_get_handle(const BlobSim *bs, int bidx) {
+  return handle_table_get_handle(&bs->liquid_handles, bidx);
+}
+
+Handle projectile_get_handle(const BlobSim *bs, const Projectile *p) {
+  return handle_table_get_handle(
+      &bs->projectile_handles,
+      fixed_array_get_idx_from_ptr(&bs->projectiles, p));
+}
+
+SolidBlob *solid_blob_from_handle(BlobSim *bs, Handle h) {
+  int idx = handle_table_get_idx(&bs->solid_handles, h);
+  return idx != -1 ? fixed_array_get(&bs->solids, idx) : NULL;
+}
+
+Projectile *projectile_from_handle(BlobSim *bs, Handle h) {
+  int idx = handle_table_get_idx(&bs->projectile_handles, h);
+  return idx != -1 ? fixed_array_get(&bs->projectiles, idx) : NULL;
+}
+
+int liquid_blob_get_idx(const BlobSim *bs, Handle h) {
+  return handle_table_get_idx(&bs->liquid_handles, h);
+}
+
+HMM_Vec3 liquid_blob_get_pos(const BlobSim *bs, int bidx) {
+  const LiquidStore *ls = &bs->liquids;
+  return HMM_V3(ls->pos_x[bidx], ls->pos_y[bidx], ls->pos_z[bidx]);
+}
+
+float liquid_blob_get_radius(const BlobSim *bs, int bidx) {
+  return bs->liquids.radius[bidx];
+}
+
+HMM_Vec3 liquid_blob_get_vel(const BlobSim *bs, int bidx) {
+  const LiquidStore *ls = &bs->liquids;
+  return HMM_V3(ls->vel_x[bidx], ls->vel_y[bidx], ls->vel_z[bidx]);
+}
+
+// Blobs are not in an octree until their position has been set
+static bool blob_pos_is_set(const HMM_Vec3 *pos) {
+  return !HMM_EqV3(*pos, HMM_V3(INFINITY, INFINITY, INFINITY));
+}
+
+static void liquid_store_set_vel(LiquidStore *ls, int bidx,
+                                 const HMM_Vec3 *vel) {
+  ls->vel_x[bidx] = vel->X;
+  ls->vel_y[bidx] = vel->Y;
+  ls->vel_z[bidx] = vel->Z;
+}
+
+static void liquid_blob_wake(BlobSim *bs, int bidx) {
+  bs->liquids.rest_ticks[bidx] = 0;
+  blob_sim_set_liquids_awake(bs);
+}
+
+static bool liquid_store_is_asleep(const LiquidStore *ls, int bidx) {
+  return ls->rest_ticks[bidx] >= LIQUID_SLEEP_TICKS;
+}
+
+void liquid_blob_set_vel(BlobSim *bs, int bidx, const HMM_Vec3 *vel) {
+  liquid_store_set_vel(&bs->liquids, bidx, vel);
+  liquid_blob_wake(bs, bidx);
 }
 
-LiquidBlob *projectile_create(BlobSim *bs) {
-  LiquidBlob *p = liquid_blob_create(bs);
+bool liquid_blob_is_asleep(const BlobSim *bs, int bidx) {
+  return liquid_store_is_asleep(&bs->liquids, bidx);
+}
+
+typedef struct WakeLiquidsData {
+  BlobSim *bs;
+  HMM_Vec3 pos;
+  float radius;
+} WakeLiquidsData;
+
+static bool blob_sim_wake_liquids_ot_leaf(BlobOtEnumData *enum_data) {
+  WakeLiquidsData *wake_data = enum_data->user_data;
+  BlobSim *bs = wake_data->bs;
+  for (int i = 0; i < enum_data->curr_leaf->leaf_blob_count; i++) {
+    int bidx = enum_data->curr_leaf->offsets[i];
+    if (!liquid_store_is_asleep(&bs->liquids, bidx)) {
+      continue;
+    }
 
-  if (p) {
-    p->type = LIQUID_PROJ;
-    p->proj.callback = NULL;
-    p->proj.userdata = 0;
+    HMM_Vec3 pos = liquid_blob_get_pos(bs, bidx);
+    float max_dist = wake_data->radius + bs->liquids.radius[bidx];
+    if (HMM_LenSqrV3(HMM_SubV3(pos, wake_data->pos)) <= max_dist * max_dist) {
+      liquid_blob_wake(bs, bidx);
+    }
   }
 
-  return p;
+  return true;
 }
 
-void solid_blob_set_radius_pos(BlobSim *bs, SolidBlob *b, float radius,
-                               const HMM_Vec3 *pos) {
+void blob_sim_wake_liquids(BlobSim *bs, const HMM_Vec3 *pos, float radius) {
+  if (!blob_pos_is_set(pos)) {
+    return;
+  }
+
+  WakeLiquidsData wake_data;
+  wake_data.bs = bs;
+  wake_data.pos = *pos;
+  wake_data.radius = radius;
+
+  BlobOtEnumData enum_data;
+  enum_data.bot = &bs->liquid_ot;
+  enum_data.shape_pos = *pos;
+  enum_data.shape_size = radius;
+  enum_data.callback = blob_sim_wake_liquids_ot_leaf;
+  enum_data.user_data = &wake_data;
+  blob_ot_enum_leaves_sphere(&enum_data);
+}
+
+LiquidBlobInfo *liquid_blob_get_info(BlobSim *bs, int bidx) {
+  return &bs->liquids.info[bidx];
+}
+
+// Updates the bricks of the solid field and wakes the liquids around a place
+// that a solid left or moved to. Bulk changes only mark the bricks, and
+// blob_simulate bakes them over the next ticks. During a solid batch the place
+// is only recorded, since solid_ot is out of date until the batch ends
+static void solid_sphere_changed(BlobSim *bs, const HMM_Vec3 *pos,
+                                 float radius, bool bulk) {
+  if (!blob_pos_is_set(pos)) {
+    return;
+  }
+
+  if (bs->solid_ot_rebuild) {
+    if (bs->batch_sphere_count >= bs->batch_sphere_capacity) {
+      bs->batch_sphere_capacity *= 2;
+      bs->batch_spheres = realloc_mem(
+          bs->batch_spheres,
+          bs->batch_sphere_capacity * sizeof(*bs->batch_spheres));
+    }
+    bs->batch_spheres[bs->batch_sphere_count++] =
+        HMM_V4(pos->X, pos->Y, pos->Z, radius);
+    return;
+  }
+
+  if (bulk) {
+    solid_field_mark_sphere(&bs->solid_field, pos, radius);
+  } else {
+    solid_field_update_sphere(&bs->solid_field, bs, pos, radius);
+  }
+  // Liquids resting on or near the solid might have to move now
+  blob_sim_wake_liquids(bs, pos, radius + BLOB_SMOOTH);
+}
+
+static void solid_blob_place(BlobSim *bs, SolidBlob *b, float radius,
+                             const HMM_Vec3 *pos, bool bulk) {
   int blob_idx = fixed_array_get_idx_from_ptr(&bs->solids, b);
 
-  if (!HMM_EqV3(b->pos, HMM_V3(INFINITY, INFINITY, INFINITY))) {
-    blob_ot_remove(&bs->solid_ot, &b->pos, b->radius, blob_idx);
+  HMM_Vec3 old_pos = b->pos;
+  float old_radius = b->radius;
+  if (blob_pos_is_set(&old_pos) && !bs->solid_ot_rebuild) {
+    blob_ot_remove(&bs->solid_ot, &old_pos, old_radius, blob_idx);
   }
   b->radius = radius;
   b->pos = *pos;
-  blob_ot_insert(&bs->solid_ot, pos, radius, blob_idx);
+  if (!bs->solid_ot_rebuild) {
+    blob_ot_insert(&bs->solid_ot, pos, radius, blob_idx);
+  }
+
+  // Bricks around the old place lose the solid and bricks around the new
+  // place gain it
+  solid_sphere_changed(bs, &old_pos, old_radius, bulk);
+  solid_sphere_changed(bs, pos, radius, bulk);
 }
 
-void liquid_blob_set_radius_pos(BlobSim *bs, LiquidBlob *b, float radius,
-                                const HMM_Vec3 *pos) {
-  int blob_idx = fixed_array_get_idx_from_ptr(&bs->liquids, b);
+void solid_blob_set_radius_pos(BlobSim *bs, SolidBlob *b, float radius,
+                               const HMM_Vec3 *pos) {
+  solid_blob_place(bs, b, radius, pos, false);
+}
 
-  if (!HMM_EqV3(b->pos, HMM_V3(INFINITY, INFINITY, INFINITY))) {
-    blob_ot_remove(&bs->liquid_ot, &b->pos, b->radius, blob_idx);
+void blob_sim_begin_solid_batch(BlobSim *bs) { bs->solid_ot_rebuild = true; }
+
+void blob_sim_end_solid_batch(BlobSim *bs) {
+  bs->solid_ot_rebuild = false;
+  blob_ot_build(&bs->solid_ot, bs->solids.count);
+
+  for (int i = 0; i < bs->batch_sphere_count; i++) {
+    const HMM_Vec4 *s = &bs->batch_spheres[i];
+    solid_sphere_changed(bs, &s->XYZ, s->W, true);
+  }
+  bs->batch_sphere_count = 0;
+}
+
+// Moves a liquid without waking it
+static void liquid_blob_move(BlobSim *bs, int bidx, float radius,
+                             const HMM_Vec3 *pos) {
+  LiquidStore *ls = &bs->liquids;
+
+  HMM_Vec3 old_pos = liquid_blob_get_pos(bs, bidx);
+  if (blob_pos_is_set(&old_pos) && !bs->liquid_ot_rebuild) {
+    blob_ot_remove(&bs->liquid_ot, &old_pos, ls->radius[bidx], bidx);
+  }
+  ls->radius[bidx] = radius;
+  ls->pos_x[bidx] = pos->X;
+  ls->pos_y[bidx] = pos->Y;
+  ls->pos_z[bidx] = pos->Z;
+  if (!bs->liquid_ot_rebuild) {
+    blob_ot_insert(&bs->liquid_ot, pos, radius, bidx);
   }
-  b->radius = radius;
-  b->pos = *pos;
-  blob_ot_insert(&bs->liquid_ot, pos, radius, blob_idx);
+}
+
+void liquid_blob_set_radius_pos(BlobSim *bs, int bidx, float radius,
+                                const HMM_Vec3 *pos) {
+  liquid_blob_wake(bs, bidx);
+  if (radius != bs->liquids.radius[bidx]) {
+    bs->liquid_neighbours_dirty = true;
+  }
+  liquid_blob_move(bs, bidx, radius, pos);
 }
 
 ColliderModel *collider_model_add(BlobSim *bs, Entity ent) {
@@ -152,25 +557,37 @@ ColliderModel *collider_model_add(BlobSim *bs, Entity ent) {
     return NULL;
   }
 
+  Handle h = handle_table_add(&bs->collider_model_handles,
+                              bs->collider_models.count - 1);
+  int_map_insert(&bs->collider_model_map, ent, h);
+
   cm->ent = ent;
 
   return cm;
 }
 
 void collider_model_remove(BlobSim *bs, Entity ent) {
-  for (int i = 0; i < bs->collider_models.count; i++) {
-    ColliderModel *cm = fixed_array_get(&bs->collider_models, i);
-    if (cm->ent == ent) {
-      blob_sim_queue_remove(bs, REMOVE_COLLIDER_MODEL, cm);
-      return;
-    }
+  uint64_t *h = int_map_get(&bs->collider_model_map, ent);
+  if (h) {
+    blob_sim_queue_remove(bs, REMOVE_COLLIDER_MODEL, *h);
   }
 }
 
-static const HMM_Vec3 *solid_ot_get_pos_from_idx(BlobOt *bot, int blob_idx) {
+Handle collider_model_get_handle(const BlobSim *bs, const ColliderModel *cm) {
+  return handle_table_get_handle(
+      &bs->collider_model_handles,
+      fixed_array_get_idx_from_ptr(&bs->collider_models, cm));
+}
+
+ColliderModel *collider_model_from_handle(BlobSim *bs, Handle h) {
+  int idx = handle_table_get_idx(&bs->collider_model_handles, h);
+  return idx != -1 ? fixed_array_get(&bs->collider_models, idx) : NULL;
+}
+
+static HMM_Vec3 solid_ot_get_pos_from_idx(BlobOt *bot, int blob_idx) {
   BlobSim *bs = bot->userdata;
   SolidBlob *b = fixed_array_get(&bs->solids, blob_idx);
-  return &b->pos;
+  return b->pos;
 }
 
 static float solid_ot_get_radius_from_idx(BlobOt *bot, int blob_idx) {
@@ -179,28 +596,140 @@ static float solid_ot_get_radius_from_idx(BlobOt *bot, int blob_idx) {
   return b->radius;
 }
 
-static const HMM_Vec3 *liquid_ot_get_pos_from_idx(BlobOt *bot, int blob_idx) {
+static HMM_Vec3 liquid_ot_get_pos_from_idx(BlobOt *bot, int blob_idx) {
   BlobSim *bs = bot->userdata;
-  LiquidBlob *b = fixed_array_get(&bs->liquids, blob_idx);
-  return &b->pos;
+  return liquid_blob_get_pos(bs, blob_idx);
 }
 
 static float liquid_ot_get_radius_from_idx(BlobOt *bot, int blob_idx) {
   BlobSim *bs = bot->userdata;
-  LiquidBlob *b = fixed_array_get(&bs->liquids, blob_idx);
-  return b->radius;
+  return bs->liquids.radius[blob_idx];
+}
+
+static HMM_Vec3 projectile_ot_get_pos_from_idx(BlobOt *bot, int blob_idx) {
+  BlobSim *bs = bot->userdata;
+  Projectile *p = fixed_array_get(&bs->projectiles, blob_idx);
+  return p->pos;
+}
+
+static float projectile_ot_get_radius_from_idx(BlobOt *bot, int blob_idx) {
+  BlobSim *bs = bot->userdata;
+  Projectile *p = fixed_array_get(&bs->projectiles, blob_idx);
+  return p->radius;
+}
+
+static void leaf_scratch_create(BlobSim *bs) {
+  bs->leaf_scratch =
+      alloc_mem(bs->workers.thread_count * sizeof(*bs->leaf_scratch));
+  for (int i = 0; i < bs->workers.thread_count; i++) {
+    LiquidLeafScratch *s = &bs->leaf_scratch[i];
+    s->capacity = LEAF_SCRATCH_START_CAPACITY;
+    s->x = alloc_mem(s->capacity * sizeof(float));
+    s->y = alloc_mem(s->capacity * sizeof(float));
+    s->z = alloc_mem(s->capacity * sizeof(float));
+    s->radius = alloc_mem(s->capacity * sizeof(float));
+    s->disturbing = alloc_mem(s->capacity * sizeof(int));
+    s->neighbour_capacity = LEAF_SCRATCH_START_CAPACITY;
+    s->neighbour_x = alloc_mem(s->neighbour_capacity * sizeof(float));
+    s->neighbour_y = alloc_mem(s->neighbour_capacity * sizeof(float));
+    s->neighbour_z = alloc_mem(s->neighbour_capacity * sizeof(float));
+    s->neighbour_radius = alloc_mem(s->neighbour_capacity * sizeof(float));
+    s->pair_count = 0;
+    visited_set_create(&s->solids_checked, BLOB_SIM_START_CAPACITY);
+  }
+}
+
+static void leaf_scratch_destroy(BlobSim *bs) {
+  for (int i = 0; i < bs->workers.thread_count; i++) {
+    LiquidLeafScratch *s = &bs->leaf_scratch[i];
+    free_mem(s->x);
+    free_mem(s->y);
+    free_mem(s->z);
+    free_mem(s->radius);
+    free_mem(s->disturbing);
+    free_mem(s->neighbour_x);
+    free_mem(s->neighbour_y);
+    free_mem(s->neighbour_z);
+    free_mem(s->neighbour_radius);
+    visited_set_destroy(&s->solids_checked);
+  }
+  free_mem(bs->leaf_scratch);
+  bs->leaf_scratch = NULL;
+}
+
+static void leaf_scratch_reserve(LiquidLeafScratch *s, int count) {
+  if (count <= s->capacity) {
+    return;
+  }
+
+  while (s->capacity < count) {
+    s->capacity *= 2;
+  }
+  s->x = realloc_mem(s->x, s->capacity * sizeof(float));
+  s->y = realloc_mem(s->y, s->capacity * sizeof(float));
+  s->z = realloc_mem(s->z, s->capacity * sizeof(float));
+  s->radius = realloc_mem(s->radius, s->capacity * sizeof(float));
+  s->disturbing = realloc_mem(s->disturbing, s->capacity * sizeof(int));
+}
+
+static void leaf_scratch_reserve_neighbours(LiquidLeafScratch *s, int count) {
+  if (count <= s->neighbour_capacity) {
+    return;
+  }
+
+  while (s->neighbour_capacity < count) {
+    s->neighbour_capacity *= 2;
+  }
+  int capacity = s->neighbour_capacity;
+  s->neighbour_x = realloc_mem(s->neighbour_x, capacity * sizeof(float));
+  s->neighbour_y = realloc_mem(s->neighbour_y, capacity * sizeof(float));
+  s->neighbour_z = realloc_mem(s->neighbour_z, capacity * sizeof(float));
+  s->neighbour_radius =
+      realloc_mem(s->neighbour_radius, capacity * sizeof(float));
+}
+
+// Makes the per tick liquid arrays big enough for every liquid. They are
+// only used during a tick, so they can move
+static void blob_sim_reserve_liquid_scratch(BlobSim *bs) {
+  int count = bs->liquids.count;
+  if (count <= bs->liquid_scratch_capacity) {
+    return;
+  }
+
+  while (bs->liquid_scratch_capacity < count) {
+    bs->liquid_scratch_capacity *= 2;
+  }
+  int capacity = bs->liquid_scratch_capacity;
+  bs->liquid_next_pos = realloc_mem(bs->liquid_next_pos,
+                                    capacity * sizeof(*bs->liquid_next_pos));
+  bs->liquid_owner =
+      realloc_mem(bs->liquid_owner, capacity * sizeof(*bs->liquid_owner));
+  visited_set_reserve(&bs->liquid_collected, capacity);
+  bs->liquid_sim_order = realloc_mem(bs->liquid_sim_order,
+                                     capacity * sizeof(*bs->liquid_sim_order));
+  bs->liquid_far_order = realloc_mem(bs->liquid_far_order,
+                                     capacity * sizeof(*bs->liquid_far_order));
 }
 
 void blob_sim_create(BlobSim *bs) {
   fixed_array_create(&bs->solids, sizeof(SolidBlob), BLOB_SIM_MAX_SOLIDS);
-  fixed_array_create(&bs->liquids, sizeof(LiquidBlob), BLOB_SIM_MAX_LIQUIDS);
+  liquid_store_create(&bs->liquids, BLOB_SIM_MAX_LIQUIDS);
   fixed_array_create(&bs->collider_models, sizeof(ColliderModel),
                      BLOB_SIM_MAX_COLLIDER_MODELS);
+  fixed_array_create(&bs->projectiles, sizeof(Projectile),
+                     BLOB_SIM_MAX_PROJECTILES);
+
+  handle_table_create(&bs->solid_handles, BLOB_SIM_MAX_SOLIDS);
+  handle_table_create(&bs->liquid_handles, BLOB_SIM_MAX_LIQUIDS);
+  handle_table_create(&bs->collider_model_handles,
+                      BLOB_SIM_MAX_COLLIDER_MODELS);
+  handle_table_create(&bs->projectile_handles, BLOB_SIM_MAX_PROJECTILES);
+  int_map_create(&bs->collider_model_map);
 
   for (int i = 0; i < REMOVE_MAX; i++) {
-    fixed_array_create(&bs->del_queues[i], sizeof(BlobRemoval),
-                       BLOB_SIM_MAX_DELETIONS);
+    timer_wheel_create(&bs->removal_wheels[i]);
   }
+  bs->removal_time = 0.0;
 
   bs->active_pos = HMM_V3(0, 0, 0);
 
@@ -213,6 +742,8 @@ void blob_sim_create(BlobSim *bs) {
   blob_ot_create(&bs->solid_ot);
   // This octree also gets sent to the GPU
   bs->solid_ot.max_dist_to_leaf = BLOB_SDF_MAX_DIST;
+  solid_field_create(&bs->solid_field, SOLID_FIELD_CELL_SIZE,
+                     SOLID_FIELD_BAND);
 
   bs->liquid_ot.max_subdiv = 8;
   bs->liquid_ot.root_pos = HMM_V3(0, 0, 0);
@@ -223,58 +754,301 @@ void blob_sim_create(BlobSim *bs) {
   blob_ot_create(&bs->liquid_ot);
   bs->liquid_ot.max_dist_to_leaf = BLOB_SDF_MAX_DIST;
 
-  bs->liquid_temp_ot = bs->liquid_ot;
-  blob_ot_create(&bs->liquid_temp_ot);
-  bs->liquid_temp_ot.max_dist_to_leaf = BLOB_SDF_MAX_DIST;
+  bs->projectile_ot.max_subdiv = 8;
+  bs->projectile_ot.root_pos = HMM_V3(0, 0, 0);
+  bs->projectile_ot.root_size = BLOB_LEVEL_SIZE;
+  bs->projectile_ot.userdata = bs;
+  bs->projectile_ot.get_pos_from_idx = projectile_ot_get_pos_from_idx;
+  bs->projectile_ot.get_radius_from_idx = projectile_ot_get_radius_from_idx;
+  blob_ot_create(&bs->projectile_ot);
+  bs->projectile_ot.max_dist_to_leaf = BLOB_SDF_MAX_DIST;
+
+  bs->liquid_broadphase = LIQUID_BROADPHASE_OCTREE;
+  // Same size as the smallest liquid octree leaves
+  blob_grid_create(&bs->liquid_grid,
+                   bs->liquid_ot.root_size / (1 << bs->liquid_ot.max_subdiv));
+  bs->liquid_grid.max_dist_to_leaf = BLOB_SDF_MAX_DIST;
+  bs->solid_ot_rebuild = false;
+  bs->liquid_ot_rebuild = false;
+  for (int i = 0; i < LIQUID_LOD_COUNT; i++) {
+    bs->liquids_awake[i] = false;
+  }
+  bs->sleep_active_pos = bs->active_pos;
+  bs->lod_tick = 0;
+
+  worker_pool_create(&bs->workers, 0);
+
+  bs->liquid_scratch_capacity = BLOB_SIM_START_CAPACITY;
+  bs->liquid_next_pos =
+      alloc_mem(bs->liquid_scratch_capacity * sizeof(*bs->liquid_next_pos));
+  bs->liquid_owner =
+      alloc_mem(bs->liquid_scratch_capacity * sizeof(*bs->liquid_owner));
+  visited_set_create(&bs->liquid_collected, bs->liquid_scratch_capacity);
+  visited_set_create(&bs->solids_checked, BLOB_SIM_START_CAPACITY);
+  bs->liquid_sim_order =
+      alloc_mem(bs->liquid_scratch_capacity * sizeof(*bs->liquid_sim_order));
+  bs->liquid_sim_count = 0;
+  bs->liquid_far_order =
+      alloc_mem(bs->liquid_scratch_capacity * sizeof(*bs->liquid_far_order));
+  bs->liquid_far_count = 0;
+
+  bs->batch_sphere_count = 0;
+  bs->batch_sphere_capacity = 64;
+  bs->batch_spheres =
+      alloc_mem(bs->batch_sphere_capacity * sizeof(*bs->batch_spheres));
+
+  bs->collider_sphere_count = 0;
+  bs->collider_sphere_capacity = 64;
+  bs->collider_spheres = alloc_mem(bs->collider_sphere_capacity *
+                                   sizeof(*bs->collider_spheres));
+  bs->collider_sphere_owners = alloc_mem(bs->collider_sphere_capacity *
+                                         sizeof(*bs->collider_sphere_owners));
+  sphere_bvh_create(&bs->collider_bvh);
+
+  neighbour_list_create(&bs->liquid_neighbours, LIQUID_ATTRACTION_REACH,
+                        LIQUID_NEIGHBOUR_SKIN);
+  bs->liquid_neighbours_dirty = true;
+  bs->liquid_pair_count = 0;
+
+  bs->projectile_step_capacity = 256;
+  bs->projectile_steps = alloc_mem(bs->projectile_step_capacity *
+                                   sizeof(*bs->projectile_steps));
+
+  bs->sim_leaf_capacity = 256;
+  bs->sim_leaf_count = 0;
+  bs->sim_leaves = alloc_mem(bs->sim_leaf_capacity * sizeof(*bs->sim_leaves));
+
+  leaf_scratch_create(bs);
+
+  blob_kernel_init();
 }
 
 void blob_sim_destroy(BlobSim *bs) {
   fixed_array_destroy(&bs->solids);
-  fixed_array_destroy(&bs->liquids);
+  liquid_store_destroy(&bs->liquids);
   fixed_array_destroy(&bs->collider_models);
+  fixed_array_destroy(&bs->projectiles);
+
+  handle_table_destroy(&bs->solid_handles);
+  handle_table_destroy(&bs->liquid_handles);
+  handle_table_destroy(&bs->collider_model_handles);
+  handle_table_destroy(&bs->projectile_handles);
+  int_map_destroy(&bs->collider_model_map);
 
   for (int i = 0; i < REMOVE_MAX; i++) {
-    fixed_array_destroy(&bs->del_queues[i]);
+    timer_wheel_destroy(&bs->removal_wheels[i]);
   }
 
   blob_ot_destroy(&bs->solid_ot);
+  solid_field_destroy(&bs->solid_field);
   blob_ot_destroy(&bs->liquid_ot);
-  blob_ot_destroy(&bs->liquid_temp_ot);
+  blob_ot_destroy(&bs->projectile_ot);
+  blob_grid_destroy(&bs->liquid_grid);
+
+  // The scratch space of each thread is freed before the pool forgets how
+  // many threads there were
+  leaf_scratch_destroy(bs);
+  worker_pool_destroy(&bs->workers);
+
+  free_mem(bs->liquid_next_pos);
+  free_mem(bs->liquid_owner);
+  visited_set_destroy(&bs->liquid_collected);
+  visited_set_destroy(&bs->solids_checked);
+  free_mem(bs->liquid_sim_order);
+  free_mem(bs->liquid_far_order);
+  free_mem(bs->batch_spheres);
+  free_mem(bs->collider_spheres);
+  free_mem(bs->collider_sphere_owners);
+  sphere_bvh_destroy(&bs->collider_bvh);
+  free_mem(bs->projectile_steps);
+  neighbour_list_destroy(&bs->liquid_neighbours);
+  free_mem(bs->sim_leaves);
 }
 
-BlobRemoval *blob_sim_queue_remove(BlobSim *bs, RemovalType type, void *b) {
-  BlobRemoval *del = fixed_array_append(&bs->del_queues[type], NULL);
-  if (!del) {
-    fprintf(stderr, "Too many blobs being deleted\n");
-    return NULL;
+void blob_sim_set_thread_count(BlobSim *bs, int thread_count) {
+  leaf_scratch_destroy(bs);
+  worker_pool_destroy(&bs->workers);
+  worker_pool_create(&bs->workers, thread_count);
+  leaf_scratch_create(bs);
+}
+
+void blob_sim_set_liquid_broadphase(BlobSim *bs, LiquidBroadphase broadphase) {
+  bs->liquid_broadphase = broadphase;
+}
+
+void blob_sim_queue_remove(BlobSim *bs, RemovalType type, Handle h) {
+  timer_wheel_schedule(&bs->removal_wheels[type], h, 0);
+}
+
+void blob_sim_delayed_remove(BlobSim *bs, RemovalType type, Handle h,
+                             double t) {
+  if (t <= 0.0) {
+    blob_sim_queue_remove(bs, type, h);
+    return;
   }
 
-  del->timer = 0.0;
+  uint64_t expires =
+      (uint64_t)ceil((bs->removal_time + t) / BLOB_SIM_REMOVAL_TICK);
+  timer_wheel_schedule(&bs->removal_wheels[type], h, expires);
+}
 
-  switch (type) {
-  case REMOVE_SOLID:
-    del->bidx = fixed_array_get_idx_from_ptr(&bs->solids, b);
-    break;
-  case REMOVE_LIQUID:
-    del->bidx = fixed_array_get_idx_from_ptr(&bs->liquids, b);
-    break;
-  case REMOVE_COLLIDER_MODEL:
-    del->bidx = fixed_array_get_idx_from_ptr(&bs->collider_models, b);
-    break;
-  case REMOVE_MAX:
-    break;
+bool blob_sim_cancel_remove(BlobSim *bs, RemovalType type, Handle h) {
+  return timer_wheel_cancel(&bs->removal_wheels[type], h);
+}
+
+#define BLOB_SIM_SNAPSHOT_MAGIC 0x504e5342 // BSNP
+// Has to be changed whenever anything that is written changes layout
+#define BLOB_SIM_SNAPSHOT_VERSION 3
+
+typedef struct BlobSimSnapshot {
+  HMM_Vec3 active_pos;
+  HMM_Vec3 sleep_active_pos;
+  double removal_time;
+  int lod_tick;
+  bool liquids_awake[LIQUID_LOD_COUNT];
+  bool solid_ot_rebuild;
+  bool liquid_ot_rebuild;
+  bool liquid_neighbours_dirty;
+} BlobSimSnapshot;
+
+// Removal wheels that are written. Collider models are not, so neither are
+// their removals
+static const RemovalType blob_sim_snapshot_removals[] = {
+    REMOVE_SOLID, REMOVE_LIQUID, REMOVE_PROJECTILE};
+
+bool blob_sim_save_snapshot(const BlobSim *bs, const char *path) {
+  SnapshotWriter w;
+  if (!snapshot_writer_open(&w, path, BLOB_SIM_SNAPSHOT_MAGIC,
+                            BLOB_SIM_SNAPSHOT_VERSION)) {
+    return false;
+  }
+
+  BlobSimSnapshot snap;
+  // Padding is written too, so it should not be garbage
+  memset(&snap, 0, sizeof(snap));
+  snap.active_pos = bs->active_pos;
+  snap.sleep_active_pos = bs->sleep_active_pos;
+  snap.removal_time = bs->removal_time;
+  snap.lod_tick = bs->lod_tick;
+  memcpy(snap.liquids_awake, bs->liquids_awake, sizeof(snap.liquids_awake));
+  snap.solid_ot_rebuild = bs->solid_ot_rebuild;
+  snap.liquid_ot_rebuild = bs->liquid_ot_rebuild;
+  snap.liquid_neighbours_dirty = bs->liquid_neighbours_dirty;
+  snapshot_write(&w, &snap, sizeof(snap));
+
+  fixed_array_snapshot_write(&bs->solids, &w);
+  handle_table_snapshot_write(&bs->solid_handles, &w, bs->solids.count);
+  liquid_store_snapshot_write(&bs->liquids, &w);
+  handle_table_snapshot_write(&bs->liquid_handles, &w, bs->liquids.count);
+  fixed_array_snapshot_write(&bs->projectiles, &w);
+  handle_table_snapshot_write(&bs->projectile_handles, &w,
+                              bs->projectiles.count);
+  for (int i = 0; i < (int)ARR_SIZE(blob_sim_snapshot_removals); i++) {
+    timer_wheel_snapshot_write(
+        &bs->removal_wheels[blob_sim_snapshot_removals[i]], &w);
+  }
+
+  blob_ot_snapshot_write(&bs->solid_ot, &w);
+  blob_ot_snapshot_write(&bs->liquid_ot, &w);
+  blob_ot_snapshot_write(&bs->projectile_ot, &w);
+  solid_field_snapshot_write(&bs->solid_field, &w);
+  neighbour_list_snapshot_write(&bs->liquid_neighbours, &w);
+
+  if (!snapshot_writer_close(&w)) {
+    fprintf(stderr, "Failed to write %s\n", path);
+    return false;
   }
+  return true;
+}
 
-  return del;
+static bool vec3_has_nan(const HMM_Vec3 *v) {
+  return isnan(v->X) || isnan(v->Y) || isnan(v->Z);
 }
 
-BlobRemoval *blob_sim_delayed_remove(BlobSim *bs, RemovalType type, void *b,
-                                     double t) {
-  BlobRemoval *del = blob_sim_queue_remove(bs, type, b);
-  if (del) {
-    del->timer = t;
+// NaN positions, velocities and radii would spread to every query that touches
+// the blob, so snapshots with them are treated as broken
+static bool blob_sim_has_nan(const BlobSim *bs) {
+  const LiquidStore *ls = &bs->liquids;
+  const float *liquid_arrays[] = {ls->pos_x, ls->pos_y, ls->pos_z, ls->vel_x,
+                                  ls->vel_y, ls->vel_z, ls->radius};
+  for (int a = 0; a < (int)ARR_SIZE(liquid_arrays); a++) {
+    for (int i = 0; i < ls->count; i++) {
+      if (isnan(liquid_arrays[a][i])) {
+        return true;
+      }
+    }
+  }
+  for (int i = 0; i < bs->solids.count; i++) {
+    const SolidBlob *b = fixed_array_get_const(&bs->solids, i);
+    if (vec3_has_nan(&b->pos) || isnan(b->radius)) {
+      return true;
+    }
   }
-  return del;
+  for (int i = 0; i < bs->projectiles.count; i++) {
+    const Projectile *p = fixed_array_get_const(&bs->projectiles, i);
+    if (vec3_has_nan(&p->pos) || vec3_has_nan(&p->vel) || isnan(p->radius) ||
+        isnan(p->lifetime)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool blob_sim_load_snapshot(BlobSim *bs, const char *path) {
+  SnapshotReader r;
+  if (!snapshot_reader_open(&r, path, BLOB_SIM_SNAPSHOT_MAGIC,
+                            BLOB_SIM_SNAPSHOT_VERSION)) {
+    return false;
+  }
+
+  BlobSimSnapshot snap;
+  bool ok = snapshot_read_into(&r, &snap, sizeof(snap)) &&
+            snap.removal_time >= 0.0 && snap.lod_tick >= 0 &&
+            bools_are_valid(snap.liquids_awake, LIQUID_LOD_COUNT) &&
+            bools_are_valid(&snap.solid_ot_rebuild, 1) &&
+            bools_are_valid(&snap.liquid_ot_rebuild, 1) &&
+            bools_are_valid(&snap.liquid_neighbours_dirty, 1) &&
+            fixed_array_snapshot_read(&bs->solids, &r) &&
+            handle_table_snapshot_read(&bs->solid_handles, &r,
+                                       bs->solids.count) &&
+            liquid_store_snapshot_read(&bs->liquids, &r) &&
+            handle_table_snapshot_read(&bs->liquid_handles, &r,
+                                       bs->liquids.count) &&
+            fixed_array_snapshot_read(&bs->projectiles, &r) &&
+            handle_table_snapshot_read(&bs->projectile_handles, &r,
+                                       bs->projectiles.count) &&
+            !blob_sim_has_nan(bs);
+  for (int i = 0; ok && i < (int)ARR_SIZE(blob_sim_snapshot_removals); i++) {
+    ok = timer_wheel_snapshot_read(
+        &bs->removal_wheels[blob_sim_snapshot_removals[i]], &r);
+  }
+  ok = ok && blob_ot_snapshot_read(&bs->solid_ot, &r, bs->solids.count) &&
+       blob_ot_snapshot_read(&bs->liquid_ot, &r, bs->liquids.count) &&
+       blob_ot_snapshot_read(&bs->projectile_ot, &r, bs->projectiles.count) &&
+       solid_field_snapshot_read(&bs->solid_field, &r) &&
+       neighbour_list_snapshot_read(&bs->liquid_neighbours, &r);
+  snapshot_reader_close(&r);
+  if (!ok) {
+    fprintf(stderr, "%s is broken\n", path);
+    return false;
+  }
+
+  bs->active_pos = snap.active_pos;
+  bs->sleep_active_pos = snap.sleep_active_pos;
+  bs->removal_time = snap.removal_time;
+  bs->lod_tick = snap.lod_tick;
+  memcpy(bs->liquids_awake, snap.liquids_awake, sizeof(bs->liquids_awake));
+  bs->solid_ot_rebuild = snap.solid_ot_rebuild;
+  bs->liquid_ot_rebuild = snap.liquid_ot_rebuild;
+  bs->liquid_neighbours_dirty = snap.liquid_neighbours_dirty;
+  bs->liquid_pair_count = 0;
+
+  // Callbacks point into the program that saved the snapshot
+  for (int i = 0; i < bs->projectiles.count; i++) {
+    Projectile *p = fixed_array_get(&bs->projectiles, i);
+    p->callback = NULL;
+  }
+  return true;
 }
 
 static float clampf(float x, float a, float b) {
@@ -293,240 +1067,1104 @@ static float dist_sphere(const HMM_Vec3 *c, float r, const HMM_Vec3 *p) {
   return HMM_LenV3(d) - r;
 }
 
-void blob_sim_raycast(RaycastResult *r, const BlobSim *bs, HMM_Vec3 ro,
-                      HMM_Vec3 rd) {
+// Sets t_near and t_far to where the ray enters and leaves the cube. Returns
+// false if the ray misses it
+static bool ray_cube_range(const HMM_Vec3 *ro, const HMM_Vec3 *rd_inv,
+                           const HMM_Vec3 *pos, float size, float *t_near,
+                           float *t_far) {
+  *t_near = -INFINITY;
+  *t_far = INFINITY;
+  for (int a = 0; a < 3; a++) {
+    float t1 = (pos->Elements[a] - size * 0.5f - ro->Elements[a]) *
+               rd_inv->Elements[a];
+    float t2 = (pos->Elements[a] + size * 0.5f - ro->Elements[a]) *
+               rd_inv->Elements[a];
+    *t_near = fmaxf(*t_near, fminf(t1, t2));
+    *t_far = fminf(*t_far, fmaxf(t1, t2));
+  }
+  return *t_near <= *t_far;
+}
+
+// One step of a ray through the blobs of one octree
+typedef struct RaycastStep {
+  // Smoothed distance to the blobs in the leaf the ray is in
+  float dist;
+  // How far the ray can move before the octree has to be checked again
+  float step;
+  // Closest blob in the leaf
+  int blob_idx;
+} RaycastStep;
+
+// A ray that is being traced
+typedef struct RayState {
+  HMM_Vec3 ro;
+  HMM_Vec3 rd_n;
+  HMM_Vec3 rd_inv;
+  float ray_dist;
+  float traveled;
+  bool done;
+} RayState;
+
+static void ray_state_init(RayState *ray, RaycastResult *r,
+                           const HMM_Vec3 *ro, const HMM_Vec3 *rd) {
   r->has_hit = false;
+  r->hit_liquid = false;
+
+  ray->ro = *ro;
+  ray->ray_dist = HMM_LenV3(*rd);
+  ray->traveled = 0.0f;
+  ray->done = ray->ray_dist == 0.0f;
+  if (ray->done) {
+    return;
+  }
+  ray->rd_n = HMM_NormV3(*rd);
+  ray->rd_inv =
+      HMM_V3(1.0f / ray->rd_n.X, 1.0f / ray->rd_n.Y, 1.0f / ray->rd_n.Z);
+}
+
+static HMM_Vec3 ray_state_get_pos(const RayState *ray) {
+  if (ray->done) {
+    return ray->ro;
+  }
+  return HMM_AddV3(ray->ro, HMM_MulV3F(ray->rd_n, ray->traveled));
+}
+
+// Stops the ray if it hit something at p, otherwise moves it along
+static void ray_state_advance(RayState *ray, RaycastResult *r,
+                              const HMM_Vec3 *p, const RaycastStep *solid,
+                              const RaycastStep *liquid) {
+  const RaycastStep *closest = liquid->dist < solid->dist ? liquid : solid;
+  if (closest->dist <= BLOB_RAY_INTERSECT) {
+    r->has_hit = true;
+    r->hit = *p;
+    r->traveled = ray->traveled;
+    r->blob_idx = closest->blob_idx;
+    r->hit_liquid = closest == liquid;
+    ray->done = true;
+    return;
+  }
+
+  ray->traveled += HMM_MIN(solid->step, liquid->step);
+  if (ray->traveled >= ray->ray_dist) {
+    ray->done = true;
+  }
+}
+
+static void raycast_step_reset(RaycastStep *s) {
+  s->dist = 100000.0f;
+  s->step = INFINITY;
+  s->blob_idx = -1;
+}
+
+static void raycast_get_blob(const BlobSim *bs, bool liquid, int bidx,
+                             HMM_Vec3 *pos, float *radius) {
+  if (liquid) {
+    *pos = HMM_V3(bs->liquids.pos_x[bidx], bs->liquids.pos_y[bidx],
+                  bs->liquids.pos_z[bidx]);
+    *radius = bs->liquids.radius[bidx];
+  } else {
+    const SolidBlob *b = fixed_array_get_const(&bs->solids, bidx);
+    *pos = b->pos;
+    *radius = b->radius;
+  }
+}
 
-  float ray_dist = HMM_LenV3(rd);
-  if (ray_dist == 0.0f) {
+// leaf_idx is the leaf containing p, or -1 if p is outside of the octree
+static void raycast_leaf_step(RaycastStep *s, const BlobSim *bs,
+                              const BlobOt *bot, bool liquid, int leaf_idx,
+                              const HMM_Vec3 *leaf_pos, float leaf_size,
+                              const HMM_Vec3 *p, const HMM_Vec3 *rd_inv) {
+  raycast_step_reset(s);
+
+  float t_near, t_far;
+  if (leaf_idx == -1) {
+    // Skip to where the ray enters the octree, if it ever does
+    if (ray_cube_range(p, rd_inv, &bot->root_pos, bot->root_size, &t_near,
+                       &t_far) &&
+        t_near > 0.0f) {
+      s->step = t_near + BLOB_RAY_INTERSECT;
+    }
     return;
   }
-  HMM_Vec3 rd_n = HMM_NormV3(rd);
 
-  float traveled = 0.0f;
+  const BlobOtNode *leaf = bot->root + leaf_idx;
+  if (leaf->leaf_blob_count == 0) {
+    // No blob is close enough to matter anywhere in this leaf, so skip to the
+    // next one
+    ray_cube_range(p, rd_inv, leaf_pos, leaf_size, &t_near, &t_far);
+    s->step = HMM_MAX(t_far, 0.0f) + BLOB_RAY_INTERSECT;
+    return;
+  }
+
+  float closest_dist = 100000.0f;
+  for (int i = 0; i < leaf->leaf_blob_count; i++) {
+    int bidx = leaf->offsets[i];
+    HMM_Vec3 bpos;
+    float bradius;
+    raycast_get_blob(bs, liquid, bidx, &bpos, &bradius);
+
+    float d = dist_sphere(&bpos, bradius, p);
+    s->dist = sminf(s->dist, d, BLOB_SMOOTH);
+    if (d < closest_dist) {
+      closest_dist = d;
+      s->blob_idx = bidx;
+    }
+  }
+
+  // Blobs that are not in the leaf are at least max_dist_to_leaf + BLOB_SMOOTH
+  // away, so they can't make the distance smaller than max_dist_to_leaf
+  s->step = HMM_MIN(s->dist, bot->max_dist_to_leaf);
+}
 
-  float closest_sphere = 1000000.0f;
+static void raycast_ot_step(RaycastStep *s, const BlobSim *bs,
+                            const BlobOt *bot, bool liquid, const HMM_Vec3 *p,
+                            const HMM_Vec3 *rd_inv) {
+  HMM_Vec3 leaf_pos;
+  float leaf_size;
+  int leaf_idx = blob_ot_find_leaf(bot, p, &leaf_pos, &leaf_size);
+  raycast_leaf_step(s, bs, bot, liquid, leaf_idx, &leaf_pos, leaf_size, p,
+                    rd_inv);
+}
+
+void blob_sim_raycast(RaycastResult *r, const BlobSim *bs, HMM_Vec3 ro,
+                      HMM_Vec3 rd, RaycastFlags flags) {
+  RayState ray;
+  ray_state_init(&ray, r, &ro, &rd);
+
+  for (int i = 0; i < BLOB_RAY_MAX_STEPS && !ray.done; i++) {
+    HMM_Vec3 p = ray_state_get_pos(&ray);
+
+    RaycastStep solid, liquid;
+    raycast_step_reset(&solid);
+    raycast_step_reset(&liquid);
+    if (flags & RAYCAST_SOLIDS) {
+      raycast_ot_step(&solid, bs, &bs->solid_ot, false, &p, &ray.rd_inv);
+    }
+    if (flags & RAYCAST_LIQUIDS) {
+      raycast_ot_step(&liquid, bs, &bs->liquid_ot, true, &p, &ray.rd_inv);
+    }
+
+    ray_state_advance(&ray, r, &p, &solid, &liquid);
+  }
+}
+
+// Steps every ray of a packet that is not done through one octree. When they
+// are all in the same leaf, its blobs are checked against every ray at once
+static void raycast_ot_step_packet(RaycastStep *steps, const BlobSim *bs,
+                                   const BlobOt *bot, bool liquid,
+                                   const RayState *rays, const HMM_Vec3 *p,
+                                   int ray_count, LiquidLeafScratch *scratch) {
+  int leaf_idx[RAYCAST_PACKET_SIZE];
+  HMM_Vec3 leaf_pos[RAYCAST_PACKET_SIZE];
+  float leaf_size[RAYCAST_PACKET_SIZE];
+
+  int shared_leaf = -1;
+  bool coherent = true;
+  bool first = true;
+  for (int l = 0; l < ray_count; l++) {
+    if (rays[l].done)
+      continue;
+
+    leaf_idx[l] = blob_ot_find_leaf(bot, &p[l], &leaf_pos[l], &leaf_size[l]);
+    if (first) {
+      shared_leaf = leaf_idx[l];
+      first = false;
+    } else if (leaf_idx[l] != shared_leaf) {
+      coherent = false;
+    }
+  }
+
+  if (!coherent || shared_leaf == -1 ||
+      (bot->root + shared_leaf)->leaf_blob_count == 0) {
+    for (int l = 0; l < ray_count; l++) {
+      if (!rays[l].done) {
+        raycast_leaf_step(&steps[l], bs, bot, liquid, leaf_idx[l],
+                          &leaf_pos[l], leaf_size[l], &p[l], &rays[l].rd_inv);
+      }
+    }
+    return;
+  }
+
+  const BlobOtNode *leaf = bot->root + shared_leaf;
+  leaf_scratch_reserve(scratch, leaf->leaf_blob_count);
+  for (int i = 0; i < leaf->leaf_blob_count; i++) {
+    HMM_Vec3 bpos;
+    raycast_get_blob(bs, liquid, leaf->offsets[i], &bpos, &scratch->radius[i]);
+    scratch->x[i] = bpos.X;
+    scratch->y[i] = bpos.Y;
+    scratch->z[i] = bpos.Z;
+  }
+
+  // Lanes without a ray repeat the first one
+  float px[4], py[4], pz[4];
+  for (int l = 0; l < 4; l++) {
+    const HMM_Vec3 *lp = l < ray_count ? &p[l] : &p[0];
+    px[l] = lp->X;
+    py[l] = lp->Y;
+    pz[l] = lp->Z;
+  }
+
+  BlobKernelBlobs blobs = {scratch->x, scratch->y, scratch->z,
+                           scratch->radius, leaf->leaf_blob_count};
+  float dist[4];
+  int closest[4];
+  blob_kernel_smin_dist_x4(px, py, pz, &blobs, BLOB_SMOOTH, dist, closest);
+
+  for (int l = 0; l < ray_count; l++) {
+    if (rays[l].done)
+      continue;
+
+    steps[l].dist = dist[l];
+    steps[l].blob_idx = leaf->offsets[closest[l]];
+    steps[l].step = HMM_MIN(dist[l], bot->max_dist_to_leaf);
+  }
+}
+
+static void raycast_packet(RaycastResult *results, const BlobSim *bs,
+                           const HMM_Vec3 *ro, const HMM_Vec3 *rd,
+                           int ray_count, RaycastFlags flags,
+                           LiquidLeafScratch *scratch) {
+  RayState rays[RAYCAST_PACKET_SIZE];
+  for (int l = 0; l < ray_count; l++) {
+    ray_state_init(&rays[l], &results[l], &ro[l], &rd[l]);
+  }
 
   for (int i = 0; i < BLOB_RAY_MAX_STEPS; i++) {
-    HMM_Vec3 p = HMM_AddV3(ro, HMM_MulV3F(rd_n, traveled));
-
-    float dist = 100000.0f;
-    for (int j = 0; j < bs->solids.count; j++) {
-      const SolidBlob *b = fixed_array_get_const(&bs->solids, j);
-      float d = dist_sphere(&b->pos, b->radius, &p);
-      dist = sminf(dist, dist_sphere(&b->pos, b->radius, &p), BLOB_SMOOTH);
-      if (d < closest_sphere) {
-        closest_sphere = d;
-        r->blob_idx = j;
+    bool any_left = false;
+    HMM_Vec3 p[RAYCAST_PACKET_SIZE];
+    RaycastStep solid[RAYCAST_PACKET_SIZE];
+    RaycastStep liquid[RAYCAST_PACKET_SIZE];
+    for (int l = 0; l < ray_count; l++) {
+      any_left |= !rays[l].done;
+      p[l] = ray_state_get_pos(&rays[l]);
+      raycast_step_reset(&solid[l]);
+      raycast_step_reset(&liquid[l]);
+    }
+    if (!any_left)
+      break;
+
+    if (flags & RAYCAST_SOLIDS) {
+      raycast_ot_step_packet(solid, bs, &bs->solid_ot, false, rays, p,
+                             ray_count, scratch);
+    }
+    if (flags & RAYCAST_LIQUIDS) {
+      raycast_ot_step_packet(liquid, bs, &bs->liquid_ot, true, rays, p,
+                             ray_count, scratch);
+    }
+
+    for (int l = 0; l < ray_count; l++) {
+      if (!rays[l].done) {
+        ray_state_advance(&rays[l], &results[l], &p[l], &solid[l],
+                          &liquid[l]);
       }
     }
+  }
+}
+
+typedef struct RaycastBatchData {
+  RaycastResult *results;
+  const BlobSim *bs;
+  const HMM_Vec3 *ro;
+  const HMM_Vec3 *rd;
+  int count;
+  RaycastFlags flags;
+  LiquidLeafScratch *scratch;
+} RaycastBatchData;
+
+static void raycast_batch_job(void *user_data, int idx, int worker_idx) {
+  RaycastBatchData *data = user_data;
+  int start = idx * RAYCAST_BATCH_JOB_RAYS;
+  int end = HMM_MIN(start + RAYCAST_BATCH_JOB_RAYS, data->count);
+
+  for (int i = start; i < end; i += RAYCAST_PACKET_SIZE) {
+    raycast_packet(data->results + i, data->bs, data->ro + i, data->rd + i,
+                   HMM_MIN(RAYCAST_PACKET_SIZE, end - i), data->flags,
+                   &data->scratch[worker_idx]);
+  }
+}
+
+void blob_sim_raycast_batch(RaycastResult *results, BlobSim *bs,
+                            const HMM_Vec3 *ro, const HMM_Vec3 *rd, int count,
+                            RaycastFlags flags) {
+  RaycastBatchData data;
+  data.results = results;
+  data.bs = bs;
+  data.ro = ro;
+  data.rd = rd;
+  data.count = count;
+  data.flags = flags;
+  data.scratch = bs->leaf_scratch;
+
+  int job_count = (count + RAYCAST_BATCH_JOB_RAYS - 1) / RAYCAST_BATCH_JOB_RAYS;
+  worker_pool_run(&bs->workers, raycast_batch_job, &data, job_count);
+}
+
+// Removes a solid by moving the last solid into its place. Only the octree
+// entries of the moved solid need to be updated
+static void solid_blob_remove_now(BlobSim *bs, Handle h, bool bulk) {
+  int bidx = handle_table_get_idx(&bs->solid_handles, h);
+  if (bidx == -1)
+    return;
+  int last_idx = bs->solids.count - 1;
+
+  SolidBlob *b = fixed_array_get(&bs->solids, bidx);
+  HMM_Vec3 removed_pos = b->pos;
+  float removed_radius = b->radius;
+  if (blob_pos_is_set(&b->pos) && !bs->solid_ot_rebuild) {
+    blob_ot_remove(&bs->solid_ot, &b->pos, b->radius, bidx);
+  }
+
+  SolidBlob *last = fixed_array_get(&bs->solids, last_idx);
+  if (bidx != last_idx && blob_pos_is_set(&last->pos) &&
+      !bs->solid_ot_rebuild) {
+    blob_ot_replace(&bs->solid_ot, &last->pos, last->radius, last_idx, bidx);
+  }
+
+  fixed_array_remove_swap(&bs->solids, bidx);
+  handle_table_remove_swap(&bs->solid_handles, bidx, last_idx);
+
+  // Bricks only store distances, so the moved solid doesn't change them
+  solid_sphere_changed(bs, &removed_pos, removed_radius, bulk);
+}
+
+// Removes a blob by moving the last blob into its place. Only the octree
+// entries of the moved blob need to be updated
+static void blob_sim_remove_now(BlobSim *bs, RemovalType type, Handle h) {
+  switch (type) {
+  case REMOVE_SOLID:
+    solid_blob_remove_now(bs, h, false);
+    break;
+  case REMOVE_LIQUID: {
+    int bidx = handle_table_get_idx(&bs->liquid_handles, h);
+    if (bidx == -1)
+      return;
+    int last_idx = bs->liquids.count - 1;
+
+    HMM_Vec3 pos = liquid_blob_get_pos(bs, bidx);
+    if (blob_pos_is_set(&pos) && !bs->liquid_ot_rebuild) {
+      blob_ot_remove(&bs->liquid_ot, &pos, bs->liquids.radius[bidx], bidx);
+    }
+
+    HMM_Vec3 last_pos = liquid_blob_get_pos(bs, last_idx);
+    if (bidx != last_idx && blob_pos_is_set(&last_pos) &&
+        !bs->liquid_ot_rebuild) {
+      blob_ot_replace(&bs->liquid_ot, &last_pos, bs->liquids.radius[last_idx],
+                      last_idx, bidx);
+    }
+
+    liquid_store_remove_swap(&bs->liquids, bidx);
+    handle_table_remove_swap(&bs->liquid_handles, bidx, last_idx);
+    bs->liquid_neighbours_dirty = true;
+    break;
+  }
+  case REMOVE_COLLIDER_MODEL: {
+    int idx = handle_table_get_idx(&bs->collider_model_handles, h);
+    if (idx == -1)
+      return;
+    int last_idx = bs->collider_models.count - 1;
+
+    // The entity might have gotten another collider model since this one was
+    // queued for removal
+    ColliderModel *cm = fixed_array_get(&bs->collider_models, idx);
+    uint64_t *mapped = int_map_get(&bs->collider_model_map, cm->ent);
+    if (mapped && *mapped == h) {
+      int_map_remove(&bs->collider_model_map, cm->ent);
+    }
+
+    fixed_array_remove_swap(&bs->collider_models, idx);
+    handle_table_remove_swap(&bs->collider_model_handles, idx, last_idx);
+    break;
+  }
+  case REMOVE_PROJECTILE: {
+    int idx = handle_table_get_idx(&bs->projectile_handles, h);
+    if (idx == -1)
+      return;
+    int last_idx = bs->projectiles.count - 1;
 
-    traveled += dist;
+    fixed_array_remove_swap(&bs->projectiles, idx);
+    handle_table_remove_swap(&bs->projectile_handles, idx, last_idx);
+    break;
+  }
+  case REMOVE_MAX:
+    break;
+  }
+}
 
-    if (dist <= BLOB_RAY_INTERSECT) {
-      r->has_hit = true;
-      r->hit = p;
-      r->traveled = traveled;
-    } else if (traveled >= ray_dist) {
+int solid_blobs_create(BlobSim *bs, const SolidBlob *src, int count,
+                       Handle *handles) {
+  int created = 0;
+  for (; created < count; created++) {
+    SolidBlob *b = solid_blob_create(bs);
+    if (!b) {
       break;
     }
+    b->mat_idx = src[created].mat_idx;
+    solid_blob_place(bs, b, src[created].radius, &src[created].pos, true);
+    handles[created] = solid_blob_get_handle(bs, b);
+  }
+  return created;
+}
+
+void solid_blobs_remove(BlobSim *bs, const Handle *handles, int count) {
+  for (int i = 0; i < count; i++) {
+    // The editor might have queued some of them for removal already
+    blob_sim_cancel_remove(bs, REMOVE_SOLID, handles[i]);
+    solid_blob_remove_now(bs, handles[i], true);
   }
 }
 
+static HMM_Vec3 blob_get_correction_from_solids_with(BlobSim *bs,
+                                                     VisitedSet *checked,
+                                                     const HMM_Vec3 *pos,
+                                                     float radius);
+static HMM_Vec3 blob_get_correction_from_solids_exact_with(
+    BlobSim *bs, VisitedSet *checked, const HMM_Vec3 *pos, float radius);
+
 typedef struct SimulationLiquidData {
   BlobSim *bs;
-  double delta;
-  // Keep track of which liquids have been simulated
-  bool simulated[BLOB_SIM_MAX_LIQUIDS];
+  // Which LOD tiers are simulated this tick, and the delta they use
+  bool lod_steps[LIQUID_LOD_COUNT];
+  float lod_delta[LIQUID_LOD_COUNT];
 } SimulationLiquidData;
 
-static bool blob_simulate_liquid_ot_leaf(BlobOtEnumData *enum_data) {
+static LiquidLod liquid_get_lod(const BlobSim *bs, const HMM_Vec3 *pos) {
+  HMM_Vec3 d = HMM_SubV3(*pos, bs->active_pos);
+  float dist = fmaxf(fabsf(d.X), fmaxf(fabsf(d.Y), fabsf(d.Z)));
+  if (dist <= BLOB_ACTIVE_SIZE * 0.5f) {
+    return LIQUID_LOD_NEAR;
+  }
+  if (dist <= BLOB_LOD_MID_SIZE * 0.5f) {
+    return LIQUID_LOD_MID;
+  }
+  return LIQUID_LOD_FAR;
+}
+
+// Assigns every liquid to the first leaf it is found in. Leaves that don't own
+// any liquids are skipped
+static bool blob_sim_collect_liquid_ot_leaf(BlobOtEnumData *enum_data) {
   BlobOtNode *leaf = enum_data->curr_leaf;
-  SimulationLiquidData *sim_data = enum_data->user_data;
+  BlobSim *bs = enum_data->user_data;
+
+  int leaf_idx = bs->sim_leaf_count;
+  bool owns_liquids = false;
+
+  for (int i = 0; i < leaf->leaf_blob_count; i++) {
+    int bidx = leaf->offsets[i];
+    if (!visited_set_add(&bs->liquid_collected, bidx)) {
+      continue;
+    }
+    bs->liquid_owner[bidx] = leaf_idx;
+    bs->liquid_sim_order[bs->liquid_sim_count++] = bidx;
+    owns_liquids = true;
+  }
+
+  if (!owns_liquids) {
+    return true;
+  }
+
+  if (bs->sim_leaf_count >= bs->sim_leaf_capacity) {
+    bs->sim_leaf_capacity *= 2;
+    bs->sim_leaves = realloc_mem(
+        bs->sim_leaves, bs->sim_leaf_capacity * sizeof(*bs->sim_leaves));
+  }
+  bs->sim_leaves[bs->sim_leaf_count++] = leaf;
+
+  return true;
+}
+
+// Checks if a sleeping liquid is close enough to one of the disturbing liquids
+// in a leaf to be woken
+static bool liquid_leaf_is_disturbed(const LiquidLeafScratch *scratch,
+                                     int disturbing_count, const HMM_Vec3 *pos,
+                                     float radius) {
+  for (int i = 0; i < disturbing_count; i++) {
+    int o = scratch->disturbing[i];
+    HMM_Vec3 d = HMM_SubV3(HMM_V3(scratch->x[o], scratch->y[o], scratch->z[o]),
+                           *pos);
+    float max_dist = radius + scratch->radius[o] + BLOB_SMOOTH;
+    if (HMM_LenSqrV3(d) <= max_dist * max_dist) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Sum of the attractions of a liquid's neighbours
+static HMM_Vec3 liquid_blob_get_attraction(BlobSim *bs,
+                                           LiquidLeafScratch *scratch,
+                                           int bidx, const HMM_Vec3 *pos) {
+  const LiquidStore *ls = &bs->liquids;
+  const NeighbourList *nl = &bs->liquid_neighbours;
+  int start = nl->starts[bidx];
+  int count = nl->counts[bidx];
+
+  // Gather the neighbours so several can be compared at a time
+  leaf_scratch_reserve_neighbours(scratch, count);
+  for (int i = 0; i < count; i++) {
+    int o = nl->neighbours[start + i];
+    scratch->neighbour_x[i] = ls->pos_x[o];
+    scratch->neighbour_y[i] = ls->pos_y[o];
+    scratch->neighbour_z[i] = ls->pos_z[o];
+    scratch->neighbour_radius[i] = ls->radius[o];
+  }
+  scratch->pair_count += count;
+
+  BlobKernelBlobs others;
+  others.x = scratch->neighbour_x;
+  others.y = scratch->neighbour_y;
+  others.z = scratch->neighbour_z;
+  others.radius = scratch->neighbour_radius;
+  others.count = count;
+  return blob_kernel_attraction_sum(pos, ls->radius[bidx], &others);
+}
+
+// Computes the new velocity and position of a liquid. Far liquids are not
+// attracted to anything
+static void liquid_blob_step(BlobSim *bs, LiquidLeafScratch *scratch,
+                             bool attract, int bidx, float delta) {
+  LiquidStore *ls = &bs->liquids;
+  HMM_Vec3 pos = liquid_blob_get_pos(bs, bidx);
+  HMM_Vec3 vel = liquid_blob_get_vel(bs, bidx);
+  float radius = ls->radius[bidx];
+
+  if (attract) {
+    HMM_Vec3 attraction = liquid_blob_get_attraction(bs, scratch, bidx, &pos);
+    vel = HMM_AddV3(vel, HMM_MulV3F(attraction, delta * 5.0f));
+  }
+
+  // blob_get_support_with always returns 0 for now, so it is not summed
+  float anti_grav = 0.0f;
+
+  vel.Y -= LIQUID_GRAVITY * delta * (1.0f - fminf(anti_grav, 1.0f));
+  vel.Y = HMM_MAX(vel.Y, LIQUID_MIN_Y_VEL);
+
+  // Now position + velocity * delta will be the new position before dealing
+  // with solid blobs
+
+  HMM_Vec3 new_pos = HMM_AddV3(pos, HMM_MulV3F(vel, delta));
+  HMM_Vec3 correction = blob_get_correction_from_solids_with(
+      bs, &scratch->solids_checked, &new_pos, radius);
+  if (HMM_LenV3(correction) > 0.0f) {
+    HMM_Vec3 n = HMM_NormV3(correction);
+    HMM_Vec3 u = HMM_MulV3F(n, HMM_DotV3(vel, n));
+    HMM_Vec3 w = HMM_SubV3(vel, u);
+    const float f = 0.95f;
+    const float r = 0.01f;
+    vel = HMM_SubV3(HMM_MulV3F(w, f), HMM_MulV3F(u, r));
+  }
+  new_pos = HMM_AddV3(new_pos, correction);
+
+  vel = HMM_MulV3F(vel, 1.0f - LIQUID_DRAG * delta);
+  if (HMM_LenSqrV3(vel) < LIQUID_REST_SPEED * LIQUID_REST_SPEED) {
+    if (++ls->rest_ticks[bidx] >= LIQUID_SLEEP_TICKS) {
+      vel = HMM_V3(0.0f, 0.0f, 0.0f);
+    }
+  } else {
+    ls->rest_ticks[bidx] = 0;
+  }
+
+  liquid_store_set_vel(ls, bidx, &vel);
+  bs->liquid_next_pos[bidx] = new_pos;
+}
+
+// Computes the new velocity and position of every liquid owned by a leaf. This
+// runs on worker threads, so it only writes to the liquids owned by this leaf
+// and never modifies the octrees
+static void blob_simulate_liquid_leaf_job(void *user_data, int leaf_idx,
+                                          int worker_idx) {
+  SimulationLiquidData *sim_data = user_data;
   BlobSim *bs = sim_data->bs;
-  double delta = sim_data->delta;
+  LiquidStore *ls = &bs->liquids;
+  BlobOtNode *leaf = bs->sim_leaves[leaf_idx];
+
+  // Only the disturbing liquids in the leaf are needed to wake sleeping ones.
+  // Attractions come from the neighbour lists, which cross leaves
+  LiquidLeafScratch *scratch = &bs->leaf_scratch[worker_idx];
+  leaf_scratch_reserve(scratch, leaf->leaf_blob_count);
+  int disturbing_count = 0;
+  for (int i = 0; i < leaf->leaf_blob_count; i++) {
+    int bidx = leaf->offsets[i];
+    if (ls->disturbing[bidx]) {
+      scratch->x[i] = ls->pos_x[bidx];
+      scratch->y[i] = ls->pos_y[bidx];
+      scratch->z[i] = ls->pos_z[bidx];
+      scratch->radius[i] = ls->radius[bidx];
+      scratch->disturbing[disturbing_count++] = i;
+    }
+  }
 
   for (int i = 0; i < leaf->leaf_blob_count; i++) {
     int bidx = leaf->offsets[i];
-    if (sim_data->simulated[bidx]) {
+    if (bs->liquid_owner[bidx] != leaf_idx) {
       continue;
     }
-    sim_data->simulated[bidx] = true;
 
-    LiquidBlob *b = fixed_array_get(&bs->liquids, bidx);
-    HMM_Vec3 new_pos = b->pos;
+    HMM_Vec3 pos = liquid_blob_get_pos(bs, bidx);
+    bs->liquid_next_pos[bidx] = pos;
+
+    LiquidLod lod = liquid_get_lod(bs, &pos);
+    if (!sim_data->lod_steps[lod]) {
+      continue;
+    }
+
+    if (liquid_store_is_asleep(ls, bidx)) {
+      if (!liquid_leaf_is_disturbed(scratch, disturbing_count, &pos,
+                                    ls->radius[bidx])) {
+        continue;
+      }
+      ls->rest_ticks[bidx] = 0;
+    }
+
+    liquid_blob_step(bs, scratch, lod != LIQUID_LOD_FAR, bidx,
+                     sim_data->lod_delta[lod]);
+  }
+}
+
+// Far liquids that are not in a simulated leaf only fall and collide with
+// solids, so they are simulated in fixed size chunks instead of by leaf
+static void blob_simulate_far_liquids_job(void *user_data, int job_idx,
+                                          int worker_idx) {
+  SimulationLiquidData *sim_data = user_data;
+  BlobSim *bs = sim_data->bs;
+  LiquidLeafScratch *scratch = &bs->leaf_scratch[worker_idx];
+
+  int start = job_idx * LIQUID_FAR_JOB_SIZE;
+  int end = HMM_MIN(start + LIQUID_FAR_JOB_SIZE, bs->liquid_far_count);
+  for (int i = start; i < end; i++) {
+    int bidx = bs->liquid_far_order[i];
+    bs->liquid_next_pos[bidx] = liquid_blob_get_pos(bs, bidx);
+    if (!liquid_store_is_asleep(&bs->liquids, bidx)) {
+      liquid_blob_step(bs, scratch, false, bidx,
+                       sim_data->lod_delta[LIQUID_LOD_FAR]);
+    }
+  }
+}
+
+// Far liquids that were not collected with the simulated leaves. Liquids that
+// have left the level cube are not in liquid_ot, so they stop where they are
+static void blob_sim_collect_far_liquids(BlobSim *bs) {
+  bs->liquid_far_count = 0;
+  for (int bidx = 0; bidx < bs->liquids.count; bidx++) {
+    HMM_Vec3 pos = liquid_blob_get_pos(bs, bidx);
+    if (!blob_pos_is_set(&pos) ||
+        visited_set_contains(&bs->liquid_collected, bidx) ||
+        liquid_get_lod(bs, &pos) != LIQUID_LOD_FAR) {
+      continue;
+    }
+
+    HMM_Vec3 d = HMM_SubV3(pos, bs->liquid_ot.root_pos);
+    float level_half = bs->liquid_ot.root_size * 0.5f;
+    if (fabsf(d.X) > level_half || fabsf(d.Y) > level_half ||
+        fabsf(d.Z) > level_half) {
+      continue;
+    }
+    bs->liquid_far_order[bs->liquid_far_count++] = bidx;
+  }
+}
+
+// Transforms the blobs of every collider model into collider_spheres and
+// builds collider_bvh over them. Spheres are in the order of the collider
+// models, so the first sphere a projectile touches is also in the first
+// collider model it touches
+static void blob_sim_build_collider_bvh(BlobSim *bs) {
+  bs->collider_sphere_count = 0;
+  for (int c = 0; c < bs->collider_models.count; c++) {
+    ColliderModel *col_mdl = fixed_array_get(&bs->collider_models, c);
+    Model *mdl = entity_get_component_or_null(col_mdl->ent, COMPONENT_MODEL);
+    if (!mdl)
+      continue;
+    HMM_Mat4 *trans = entity_get_component(col_mdl->ent, COMPONENT_TRANSFORM);
+
+    int count = bs->collider_sphere_count + mdl->blob_count;
+    if (count > bs->collider_sphere_capacity) {
+      while (bs->collider_sphere_capacity < count) {
+        bs->collider_sphere_capacity *= 2;
+      }
+      bs->collider_spheres =
+          realloc_mem(bs->collider_spheres, bs->collider_sphere_capacity *
+                                                sizeof(*bs->collider_spheres));
+      bs->collider_sphere_owners = realloc_mem(
+          bs->collider_sphere_owners,
+          bs->collider_sphere_capacity * sizeof(*bs->collider_sphere_owners));
+    }
+
+    for (int bi = 0; bi < mdl->blob_count; bi++) {
+      ModelBlob *mb = &mdl->blobs[bi];
+
+      HMM_Vec4 mbpv4 = {0, 0, 0, 1};
+      mbpv4.XYZ = mb->pos;
+
+      HMM_Vec4 *sphere = &bs->collider_spheres[bs->collider_sphere_count];
+      sphere->XYZ = HMM_MulM4V4(*trans, mbpv4).XYZ;
+      sphere->W = mb->radius;
+      bs->collider_sphere_owners[bs->collider_sphere_count++] = c;
+    }
+  }
+
+  sphere_bvh_build(&bs->collider_bvh, bs->collider_spheres,
+                   bs->collider_sphere_count);
+}
+
+// Sphere traces a projectile through the solid field from pos along move.
+// Returns the fraction of move that it can go before touching a solid, and
+// sets hit if it touches one on the way
+static float projectile_sweep_solids(BlobSim *bs, VisitedSet *checked,
+                                     const HMM_Vec3 *pos, const HMM_Vec3 *move,
+                                     float radius, bool *hit) {
+  *hit = false;
+  float len = HMM_LenV3(*move);
+  // Each step is at least this long, so projectiles sliding along a solid
+  // still get somewhere
+  float min_step = radius * 0.5f;
+
+  HMM_Vec3 dir_move = len > 0.0f ? HMM_MulV3F(*move, 1.0f / len) : *move;
+  float t = 0.0f;
+  for (int i = 0; i < PROJECTILE_MAX_STEPS; i++) {
+    HMM_Vec3 p = HMM_AddV3(*pos, HMM_MulV3F(dir_move, t));
+    float dist;
+    HMM_Vec3 dir;
+    if (solid_field_is_pending(&bs->solid_field, &p)) {
+      // The brick could be missing solids that were just added, so the
+      // distance comes from the octree. The correction of a sphere that
+      // reaches as far as the field would is how far it overlaps the solids
+      float reach = radius + bs->solid_field.band;
+      dist = reach - HMM_LenV3(blob_get_correction_from_solids_exact_with(
+                         bs, checked, &p, reach));
+    } else if (!solid_field_sample(&bs->solid_field, &p, &dist, &dir)) {
+      dist = bs->solid_field.band;
+    }
+    if (dist < radius) {
+      *hit = true;
+      break;
+    }
+
+    if (t >= len) {
+      return 1.0f;
+    }
+    t = HMM_MIN(t + HMM_MAX(dist - radius, min_step), len);
+  }
+  return len > 0.0f ? t / len : 1.0f;
+}
+
+// Moves a projectile for a tick without changing anything in bs
+static void projectile_step(BlobSim *bs, VisitedSet *checked, int idx,
+                            float delta) {
+  const Projectile *p = fixed_array_get(&bs->projectiles, idx);
+  ProjectileStep *step = &bs->projectile_steps[idx];
+
+  HMM_Vec3 vel = p->vel;
+  vel.Y -= LIQUID_GRAVITY * delta;
+  vel.Y = HMM_MAX(vel.Y, LIQUID_MIN_Y_VEL);
+  HMM_Vec3 move = HMM_MulV3F(vel, delta);
+
+  float t = projectile_sweep_solids(bs, checked, &p->pos, &move, p->radius,
+                                    &step->hit_solid);
+
+  step->hit_collider = -1;
+  if (p->callback) {
+    float col_t;
+    int sphere =
+        sphere_bvh_sweep(&bs->collider_bvh, &p->pos, &move, p->radius, &col_t);
+    // A projectile that stopped short of the end without hitting a solid
+    // only checks the part of the way it went
+    if (sphere != -1 && col_t <= t) {
+      step->hit_collider = bs->collider_sphere_owners[sphere];
+      step->hit_solid = false;
+      t = col_t;
+    }
+  }
+
+  step->pos = HMM_AddV3(p->pos, HMM_MulV3F(move, t));
+  step->vel = vel;
+}
+
+typedef struct ProjectileStepData {
+  BlobSim *bs;
+  float delta;
+} ProjectileStepData;
+
+static void projectile_step_job(void *user_data, int job_idx,
+                                int worker_idx) {
+  ProjectileStepData *step_data = user_data;
+  BlobSim *bs = step_data->bs;
+  VisitedSet *checked = &bs->leaf_scratch[worker_idx].solids_checked;
+
+  int start = job_idx * PROJECTILE_JOB_SIZE;
+  int end = HMM_MIN(start + PROJECTILE_JOB_SIZE, bs->projectiles.count);
+  for (int i = start; i < end; i++) {
+    projectile_step(bs, checked, i, step_data->delta);
+  }
+}
+
+static void projectile_remove_now(BlobSim *bs, int idx) {
+  // A removal that was scheduled for later would otherwise wait in the wheel
+  // until it expires, long after the projectile is gone
+  blob_sim_cancel_remove(bs, REMOVE_PROJECTILE,
+                         handle_table_get_handle(&bs->projectile_handles, idx));
+
+  int last_idx = bs->projectiles.count - 1;
+  fixed_array_remove_swap(&bs->projectiles, idx);
+  handle_table_remove_swap(&bs->projectile_handles, idx, last_idx);
+}
 
-    float anti_grav = 0.0f;
+// Turns a projectile into a liquid that keeps its velocity and lifetime
+static void projectile_to_liquid(BlobSim *bs, const Projectile *p) {
+  int bidx = liquid_blob_create(bs);
+  if (bidx == -1) {
+    return;
+  }
+  bs->liquids.info[bidx].mat_idx = p->mat_idx;
+  liquid_blob_set_radius_pos(bs, bidx, p->radius, &p->pos);
+  liquid_blob_set_vel(bs, bidx, &p->vel);
+  if (isfinite(p->lifetime)) {
+    blob_sim_delayed_remove(bs, REMOVE_LIQUID,
+                            liquid_blob_get_handle(bs, bidx), p->lifetime);
+  }
+}
 
-    // This only works when each liquid blob has a smaller radius than
-    // SDF_MAX_DIST
-    for (int j = 0; j < leaf->leaf_blob_count; j++) {
-      if (j == i)
-        continue;
+// Moves every projectile. Projectiles that hit something turn into liquids
+// unless a callback uses them up
+static void blob_simulate_projectiles(BlobSim *bs, float delta) {
+  int count = bs->projectiles.count;
+  if (count == 0) {
+    return;
+  }
 
-      int o_bidx = leaf->offsets[j];
-      LiquidBlob *ob = fixed_array_get(&bs->liquids, o_bidx);
-
-      HMM_Vec3 attraction = blob_get_attraction_to(b, ob);
-      b->vel = HMM_AddV3(b->vel, HMM_MulV3F(attraction, (float)delta * 5.0f));
-      anti_grav += blob_get_support_with(b, ob);
-    }
-
-    b->vel.Y -= LIQUID_GRAVITY * delta * (1.0f - fminf(anti_grav, 1.0f));
-    b->vel.Y = HMM_MAX(b->vel.Y, LIQUID_MIN_Y_VEL);
-
-    // Now position + velocity * delta will be the new position before dealing
-    // with solid blobs
-
-    new_pos = HMM_AddV3(b->pos, HMM_MulV3F(b->vel, (float)delta));
-    HMM_Vec3 correction =
-        blob_get_correction_from_solids(bs, &new_pos, b->radius);
-    if (HMM_LenV3(correction) > 0.0f) {
-      HMM_Vec3 n = HMM_NormV3(correction);
-      HMM_Vec3 u = HMM_MulV3F(n, HMM_DotV3(b->vel, n));
-      HMM_Vec3 w = HMM_SubV3(b->vel, u);
-      const float f = 0.95f;
-      const float r = (b->type == LIQUID_PROJ) ? 0.1f : 0.01f;
-      b->vel = HMM_SubV3(HMM_MulV3F(w, f), HMM_MulV3F(u, r));
-    }
-    new_pos = HMM_AddV3(new_pos, correction);
-
-    if (b->type == LIQUID_BASE) {
-      b->vel = HMM_MulV3F(b->vel, 1.0f - LIQUID_DRAG * (float)delta);
-    } else if (b->type == LIQUID_PROJ) {
-      for (int c = 0; c < bs->collider_models.count; c++) {
-        ColliderModel *col_mdl = fixed_array_get(&bs->collider_models, c);
-        Model *mdl =
-            entity_get_component_or_null(col_mdl->ent, COMPONENT_MODEL);
-        if (!mdl)
-          continue;
+  if (count > bs->projectile_step_capacity) {
+    while (bs->projectile_step_capacity < count) {
+      bs->projectile_step_capacity *= 2;
+    }
+    bs->projectile_steps =
+        realloc_mem(bs->projectile_steps,
+                    bs->projectile_step_capacity *
+                        sizeof(*bs->projectile_steps));
+  }
 
-        for (int bi = 0; bi < mdl->blob_count; bi++) {
-          ModelBlob *mb = &mdl->blobs[bi];
-
-          HMM_Vec4 mbpv4 = {0, 0, 0, 1};
-          mbpv4.XYZ = mb->pos;
-
-          HMM_Mat4 *trans =
-              entity_get_component(col_mdl->ent, COMPONENT_TRANSFORM);
-          HMM_Vec3 mbpos = HMM_MulM4V4(*trans, mbpv4).XYZ;
-          if (HMM_LenV3(HMM_SubV3(mbpos, b->pos)) <= mb->radius + b->radius) {
-            if (b->proj.callback) {
-              b->proj.callback(b, col_mdl);
-            }
-            break;
-          }
+  blob_sim_build_collider_bvh(bs);
+
+  ProjectileStepData step_data;
+  step_data.bs = bs;
+  step_data.delta = delta;
+  worker_pool_run(&bs->workers, projectile_step_job, &step_data,
+                  (count + PROJECTILE_JOB_SIZE - 1) / PROJECTILE_JOB_SIZE);
+
+  // Going backwards, removing a projectile only moves one that was already
+  // applied into its place. Projectiles that callbacks create are appended
+  // after count and start moving next tick
+  float level_half = BLOB_LEVEL_SIZE * 0.5f;
+  for (int i = count - 1; i >= 0; i--) {
+    Projectile *p = fixed_array_get(&bs->projectiles, i);
+    const ProjectileStep *step = &bs->projectile_steps[i];
+    p->pos = step->pos;
+    p->vel = step->vel;
+    p->lifetime -= delta;
+
+    int idx = i;
+    bool hit = step->hit_solid;
+    if (step->hit_collider != -1) {
+      ColliderModel *col_mdl =
+          fixed_array_get(&bs->collider_models, step->hit_collider);
+      // An earlier callback this tick might have destroyed the entity
+      if (entity_get_component_or_null(col_mdl->ent, COMPONENT_MODEL)) {
+        Handle h = handle_table_get_handle(&bs->projectile_handles, i);
+        bool used_up = p->callback(p, col_mdl);
+        // A callback can remove a projectile and create one that gets
+        // swap-moved into slot i, so the projectile is found again by its
+        // handle
+        p = projectile_from_handle(bs, h);
+        if (!p) {
+          continue;
         }
+        idx = fixed_array_get_idx_from_ptr(&bs->projectiles, p);
+        if (used_up) {
+          projectile_remove_now(bs, idx);
+          continue;
+        }
+        hit = true;
       }
     }
 
-    liquid_blob_set_radius_pos(sim_data->bs, b, b->radius, &new_pos);
+    if (hit && p->lifetime > 0.0f) {
+      projectile_to_liquid(bs, p);
+    }
+    if (hit || p->lifetime <= 0.0f || fabsf(p->pos.X) > level_half ||
+        fabsf(p->pos.Y) > level_half || fabsf(p->pos.Z) > level_half) {
+      projectile_remove_now(bs, idx);
+    }
+  }
+}
+
+// Moves a liquid after it was simulated
+static void liquid_blob_apply_step(BlobSim *bs, int bidx) {
+  // Sleeping liquids only read this during the next tick
+  HMM_Vec3 vel = liquid_blob_get_vel(bs, bidx);
+  bs->liquids.disturbing[bidx] =
+      HMM_LenSqrV3(vel) > LIQUID_WAKE_SPEED * LIQUID_WAKE_SPEED;
+
+  const HMM_Vec3 *next_pos = &bs->liquid_next_pos[bidx];
+  if (!HMM_EqV3(*next_pos, liquid_blob_get_pos(bs, bidx))) {
+    liquid_blob_move(bs, bidx, bs->liquids.radius[bidx], next_pos);
   }
+}
 
-  return true;
+// Counts the liquids that are going to move, and marks the LOD tiers that
+// have awake liquids in them after they move
+static int liquid_sim_count_moving(BlobSim *bs, const int *order, int count) {
+  int moving_count = 0;
+  for (int i = 0; i < count; i++) {
+    int bidx = order[i];
+    const HMM_Vec3 *next_pos = &bs->liquid_next_pos[bidx];
+    moving_count += !HMM_EqV3(*next_pos, liquid_blob_get_pos(bs, bidx));
+    if (!liquid_store_is_asleep(&bs->liquids, bidx)) {
+      bs->liquids_awake[liquid_get_lod(bs, next_pos)] = true;
+    }
+  }
+  return moving_count;
 }
 
 void blob_simulate(BlobSim *bs, double delta) {
-  // Liquids
-  {
-    memcpy(bs->liquid_temp_ot.root, bs->liquid_ot.root,
-           bs->liquid_ot.size_int * sizeof(int));
-    bs->liquid_temp_ot.size_int = bs->liquid_ot.size_int;
-
-    SimulationLiquidData sim_data = {0};
-    sim_data.bs = bs;
-    sim_data.delta = delta;
-
-    BlobOtEnumData enum_data;
-    enum_data.bot = &bs->liquid_temp_ot;
-    enum_data.shape_pos = bs->active_pos;
-    enum_data.shape_size = BLOB_ACTIVE_SIZE;
-    enum_data.callback = blob_simulate_liquid_ot_leaf;
-    enum_data.user_data = &sim_data;
+  // Liquids outside of the simulated cubes are not simulated, so they might be
+  // awake even though no simulated liquid is
+  if (!HMM_EqV3(bs->active_pos, bs->sleep_active_pos)) {
+    bs->sleep_active_pos = bs->active_pos;
+    blob_sim_set_liquids_awake(bs);
+  }
 
-    blob_ot_enum_leaves_cube(&enum_data);
+  static const int lod_interval[LIQUID_LOD_COUNT] = {
+      1, LIQUID_LOD_MID_INTERVAL, LIQUID_LOD_FAR_INTERVAL};
+  static const int lod_phase[LIQUID_LOD_COUNT] = {0, LIQUID_LOD_MID_PHASE,
+                                                  LIQUID_LOD_FAR_PHASE};
+
+  // Tiers where every liquid is asleep don't need to be simulated
+  SimulationLiquidData sim_data;
+  sim_data.bs = bs;
+  bool any_lod_steps = false;
+  for (int i = 0; i < LIQUID_LOD_COUNT; i++) {
+    sim_data.lod_steps[i] = bs->liquids_awake[i] &&
+                            bs->lod_tick % lod_interval[i] == lod_phase[i];
+    sim_data.lod_delta[i] = (float)delta * lod_interval[i];
+    any_lod_steps |= sim_data.lod_steps[i];
   }
+  bs->lod_tick++;
 
-  // Deletion queues
-  FixedArray *const blob_arrays[] = {&bs->solids, &bs->liquids,
-                                     &bs->collider_models};
-  for (int bt = 0; bt < REMOVE_MAX; bt++) {
-    FixedArray *ba = blob_arrays[bt];
-    FixedArray *del_queue = &bs->del_queues[bt];
+  blob_simulate_projectiles(bs, (float)delta);
 
-    for (int di = 0; di < del_queue->count; di++) {
-      BlobRemoval *del = fixed_array_get(del_queue, di);
-      del->timer -= delta;
-      if (del->timer > 0.0) {
-        continue;
+  // Liquids
+  bs->liquid_pair_count = 0;
+  if (any_lod_steps) {
+    blob_sim_reserve_liquid_scratch(bs);
+    visited_set_clear(&bs->liquid_collected);
+    bs->liquid_sim_count = 0;
+    bs->liquid_far_count = 0;
+    bs->sim_leaf_count = 0;
+
+    // Almost every liquid moves, so it is cheaper to build liquid_ot again at
+    // the end than to move each liquid in it. This also keeps liquid_ot the
+    // same while the leaves in it are being simulated
+    bs->liquid_ot_rebuild = true;
+
+    if (sim_data.lod_steps[LIQUID_LOD_NEAR] ||
+        sim_data.lod_steps[LIQUID_LOD_MID]) {
+      BlobOtEnumData enum_data;
+      enum_data.shape_pos = bs->active_pos;
+      enum_data.shape_size = sim_data.lod_steps[LIQUID_LOD_MID]
+                                 ? BLOB_LOD_MID_SIZE
+                                 : BLOB_ACTIVE_SIZE;
+      enum_data.callback = blob_sim_collect_liquid_ot_leaf;
+      enum_data.user_data = bs;
+
+      if (bs->liquid_broadphase == LIQUID_BROADPHASE_GRID) {
+        const LiquidStore *ls = &bs->liquids;
+        blob_grid_build(&bs->liquid_grid, ls->pos_x, ls->pos_y, ls->pos_z,
+                        ls->radius, ls->count);
+
+        enum_data.bot = NULL;
+        blob_grid_enum_leaves_cube(&bs->liquid_grid, &enum_data);
+      } else {
+        enum_data.bot = &bs->liquid_ot;
+        blob_ot_enum_leaves_cube(&enum_data);
       }
-      int bidx = del->bidx;
-
-      if (bt == REMOVE_SOLID || bt == REMOVE_LIQUID) {
-        // Remove this blob from the octree and decrement any indices
-        // TODO: anything but this
-        BlobOt *bot = NULL;
-        if (bt == REMOVE_SOLID) {
-          SolidBlob *b = fixed_array_get(ba, bidx);
-          bot = &bs->solid_ot;
-          blob_ot_remove(bot, &b->pos, b->radius, bidx);
-        } else if (bt == REMOVE_LIQUID) {
-          LiquidBlob *b = fixed_array_get(ba, bidx);
-          bot = &bs->liquid_ot;
-          blob_ot_remove(bot, &b->pos, b->radius, bidx);
-        }
+    }
+    if (sim_data.lod_steps[LIQUID_LOD_FAR]) {
+      blob_sim_collect_far_liquids(bs);
+    }
 
-        BlobOtNode *node_stack[BLOB_OT_MAX_SUBDIVISIONS + 1];
-        node_stack[0] = bot->root;
-        int iter_stack[BLOB_OT_MAX_SUBDIVISIONS + 1];
-        iter_stack[0] = 0;
-        int depth = 0;
-
-        while (depth >= 0) {
-          BlobOtNode *node = node_stack[depth];
-          if (node->leaf_blob_count == -1) {
-            int *c = &iter_stack[depth];
-            if (*c < 8) {
-              node_stack[depth + 1] = node + node->offsets[*c];
-              iter_stack[depth + 1] = 0;
-              depth += 2;
-              (*c)++;
-            }
-          } else {
-            for (int lbi = 0; lbi < node->leaf_blob_count; lbi++) {
-              int other_idx = node->offsets[lbi];
-              if (other_idx > bidx) {
-                node->offsets[lbi]--;
-              }
-            }
-          }
-
-          depth--;
-        }
+    const LiquidStore *ls = &bs->liquids;
+    if (sim_data.lod_steps[LIQUID_LOD_NEAR] ||
+        sim_data.lod_steps[LIQUID_LOD_MID]) {
+      if (bs->liquid_neighbours_dirty) {
+        neighbour_list_build(&bs->liquid_neighbours, ls->pos_x, ls->pos_y,
+                             ls->pos_z, ls->radius, ls->count);
+        bs->liquid_neighbours_dirty = false;
+      } else {
+        neighbour_list_update(&bs->liquid_neighbours, ls->pos_x, ls->pos_y,
+                              ls->pos_z, ls->radius, ls->count);
       }
+    }
+    for (int i = 0; i < bs->workers.thread_count; i++) {
+      bs->leaf_scratch[i].pair_count = 0;
+    }
 
-      // Decrement blob indices in deletion queue after this one. Or remove it
-      // from the queue if it if it is the same as the current blob index
-      for (int dj = 0; dj < del_queue->count; dj++) {
-        if (dj == di)
-          continue;
-        BlobRemoval *other_del = fixed_array_get(del_queue, dj);
-        if (other_del->bidx > bidx) {
-          other_del->bidx--;
-        } else if (other_del->bidx == bidx) {
-          fixed_array_remove(del_queue, dj);
-          if (dj < di) {
-            di--;
-          }
-          dj--;
-        }
+    worker_pool_run(&bs->workers, blob_simulate_liquid_leaf_job, &sim_data,
+                    bs->sim_leaf_count);
+    worker_pool_run(&bs->workers, blob_simulate_far_liquids_job, &sim_data,
+                    (bs->liquid_far_count + LIQUID_FAR_JOB_SIZE - 1) /
+                        LIQUID_FAR_JOB_SIZE);
+
+    for (int i = 0; i < bs->workers.thread_count; i++) {
+      bs->liquid_pair_count += bs->leaf_scratch[i].pair_count;
+    }
+
+    // Every liquid in a simulated tier was just checked. Liquids that fall
+    // asleep this tick still move once more. Callbacks and removals below can
+    // wake liquids again
+    for (int i = 0; i < LIQUID_LOD_COUNT; i++) {
+      if (sim_data.lod_steps[i]) {
+        bs->liquids_awake[i] = false;
       }
+    }
+    int moving_count =
+        liquid_sim_count_moving(bs, bs->liquid_sim_order,
+                                bs->liquid_sim_count) +
+        liquid_sim_count_moving(bs, bs->liquid_far_order,
+                                bs->liquid_far_count);
+
+    // When only a few liquids move, it is cheaper to move them in liquid_ot
+    // than to build it again
+    bs->liquid_ot_rebuild =
+        moving_count > bs->liquids.count / LIQUID_OT_MOVE_MAX_FRACTION;
+
+    // Apply the results in a fixed order
+    for (int i = 0; i < bs->liquid_sim_count; i++) {
+      liquid_blob_apply_step(bs, bs->liquid_sim_order[i]);
+    }
+    for (int i = 0; i < bs->liquid_far_count; i++) {
+      liquid_blob_apply_step(bs, bs->liquid_far_order[i]);
+    }
+  }
+
+  // Removals that are due
+  bs->removal_time += delta;
+  uint64_t removal_tick =
+      (uint64_t)floor(bs->removal_time / BLOB_SIM_REMOVAL_TICK);
+  for (int bt = 0; bt < REMOVE_MAX; bt++) {
+    TimerWheel *wheel = &bs->removal_wheels[bt];
+    int expired = timer_wheel_advance(wheel, removal_tick);
 
-      fixed_array_remove(ba, bidx);
-      fixed_array_remove(del_queue, di);
-      di--;
+    // The blob might have been removed already some other way
+    for (int i = 0; i < expired; i++) {
+      blob_sim_remove_now(bs, bt, wheel->expired[i]);
     }
   }
+
+  if (bs->liquid_ot_rebuild) {
+    bs->liquid_ot_rebuild = false;
+    blob_ot_build(&bs->liquid_ot, bs->liquids.count);
+  }
+  blob_ot_build(&bs->projectile_ot, bs->projectiles.count);
+
+  // Bricks marked by bulk solid changes
+  solid_field_bake_marked(&bs->solid_field, bs, SOLID_FIELD_BAKES_PER_TICK);
 }
 
 void blob_mdl_create(Model *mdl, const ModelBlob *mdl_blob_src,
@@ -560,15 +2198,14 @@ typedef struct CorrectionData {
   HMM_Vec3 correction;
   float min_dist;
   // Keep track of which solids have been checked
-  bool checked[BLOB_SIM_MAX_SOLIDS];
+  VisitedSet *checked;
 } CorrectionData;
 
 static bool blob_get_correction_from_solids_ot_leaf(BlobOtEnumData *enum_data) {
   CorrectionData *correction_data = enum_data->user_data;
   for (int i = 0; i < enum_data->curr_leaf->leaf_blob_count; i++) {
     int bidx = enum_data->curr_leaf->offsets[i];
-    if (!correction_data->checked[bidx]) {
-      correction_data->checked[bidx] = true;
+    if (visited_set_add(correction_data->checked, bidx)) {
       SolidBlob *b = fixed_array_get(&correction_data->bs->solids, bidx);
       blob_check_blob_at(
           &correction_data->min_dist, &correction_data->correction, &b->pos,
@@ -579,10 +2216,15 @@ static bool blob_get_correction_from_solids_ot_leaf(BlobOtEnumData *enum_data) {
   return true;
 }
 
-HMM_Vec3 blob_get_correction_from_solids(BlobSim *bs, const HMM_Vec3 *pos,
-                                         float radius) {
-  CorrectionData correction_data = {0};
+// checked is cleared and then used to skip solids that are in several leaves
+static HMM_Vec3 blob_get_correction_from_solids_exact_with(
+    BlobSim *bs, VisitedSet *checked, const HMM_Vec3 *pos, float radius) {
+  visited_set_reserve(checked, bs->solids.count);
+  visited_set_clear(checked);
+
+  CorrectionData correction_data;
   correction_data.bs = bs;
+  correction_data.checked = checked;
   correction_data.correction = HMM_V3(0, 0, 0);
   correction_data.min_dist = 10000.0f;
 
@@ -607,43 +2249,171 @@ HMM_Vec3 blob_get_correction_from_solids(BlobSim *bs, const HMM_Vec3 *pos,
   }
 }
 
-int blob_ot_get_alloc_size() {
-  int current_nodes = 1;
-  int total_size = sizeof(BlobOtNode) + sizeof(int[8]);
-  for (int i = 0; i < BLOB_OT_MAX_SUBDIVISIONS; i++) {
-    current_nodes *= 8;
-    int is_leaf = i == BLOB_OT_MAX_SUBDIVISIONS - 1;
+// Looks up the solid distance field when it covers the radius and the brick
+// is baked. checked is only used by the exact query
+static HMM_Vec3 blob_get_correction_from_solids_with(BlobSim *bs,
+                                                     VisitedSet *checked,
+                                                     const HMM_Vec3 *pos,
+                                                     float radius) {
+  // Bricks are marked around every solid that changed, including ones that
+  // were streamed in, so a marked brick can't be trusted until it is baked
+  if (radius > bs->solid_field.band ||
+      solid_field_is_pending(&bs->solid_field, pos)) {
+    return blob_get_correction_from_solids_exact_with(bs, checked, pos,
+                                                      radius);
+  }
 
-    if (!is_leaf) {
-      total_size += current_nodes * (sizeof(BlobOtNode) + sizeof(int[8]));
-    } else {
-      total_size += current_nodes * (sizeof(BlobOtNode) +
-                                     sizeof(int[BLOB_OT_LEAF_MAX_BLOB_COUNT]));
-    }
+  float dist;
+  HMM_Vec3 dir;
+  if (!solid_field_sample(&bs->solid_field, pos, &dist, &dir) ||
+      dist >= radius) {
+    return (HMM_Vec3){0};
+  }
+  return HMM_MulV3F(dir, radius - dist);
+}
+
+HMM_Vec3 blob_get_correction_from_solids(BlobSim *bs, const HMM_Vec3 *pos,
+                                         float radius) {
+  return blob_get_correction_from_solids_with(bs, &bs->solids_checked, pos,
+                                              radius);
+}
+
+HMM_Vec3 blob_get_correction_from_solids_exact(BlobSim *bs,
+                                               const HMM_Vec3 *pos,
+                                               float radius) {
+  return blob_get_correction_from_solids_exact_with(bs, &bs->solids_checked,
+                                                    pos, radius);
+}
+
+static int blob_ot_get_class_capacity(int size_class) {
+  return BLOB_OT_LEAF_SUBDIV_BLOB_COUNT << size_class;
+}
+
+// Smallest size class that fits blob_count blobs
+static int blob_ot_get_size_class(int blob_count) {
+  int size_class = 0;
+  while (blob_ot_get_class_capacity(size_class) < blob_count) {
+    size_class++;
   }
 
-  return total_size;
+  if (size_class >= BLOB_OT_SIZE_CLASS_COUNT) {
+    fprintf(stderr, "Octree leaf is too big\n");
+    exit_fatal_error();
+  }
+  return size_class;
 }
 
 void blob_ot_create(BlobOt *bot) {
   _Static_assert(sizeof(BlobOtNode) == sizeof(int),
                  "BlobOtNode should be the same as int");
+  _Static_assert(BLOB_OT_LEAF_SUBDIV_BLOB_COUNT >= 8,
+                 "Leaves should be able to become nodes in place");
 
-  bot->size_int = 1 + BLOB_OT_LEAF_MAX_BLOB_COUNT;
-  bot->capacity_int = BLOB_OT_DEFAULT_CAPACITY_INT;
+  bot->capacity_int = BLOB_OT_START_CAPACITY_INT;
+  // Unused ints in blocks are written to snapshots, so they start as 0
   bot->root = alloc_mem(bot->capacity_int * sizeof(int));
-  bot->root->leaf_blob_count = 0;
+  memset(bot->root, 0, bot->capacity_int * sizeof(int));
   bot->max_dist_to_leaf = 0.0f;
+  bot->high_water_int = 0;
+  blob_ot_reset(bot);
+
+  bot->build_blobs = NULL;
+  bot->build_temp = NULL;
+  bot->build_blob_capacity = 0;
+  bot->build_lists = NULL;
+  bot->build_list_flags = NULL;
+  bot->build_lists_capacity = 0;
 }
 
 void blob_ot_destroy(BlobOt *bot) {
   free(bot->root);
   bot->root = NULL;
+  free_mem(bot->build_blobs);
+  free_mem(bot->build_temp);
+  free_mem(bot->build_lists);
+  free_mem(bot->build_list_flags);
+  bot->build_blobs = NULL;
+  bot->build_temp = NULL;
+  bot->build_lists = NULL;
+  bot->build_list_flags = NULL;
 }
 
 void blob_ot_reset(BlobOt *bot) {
-  bot->size_int = 1 + BLOB_OT_LEAF_MAX_BLOB_COUNT;
+  bot->size_int = 1 + blob_ot_get_class_capacity(0);
+  bot->high_water_int = HMM_MAX(bot->high_water_int, bot->size_int);
   bot->root->leaf_blob_count = 0;
+  for (int i = 0; i < BLOB_OT_SIZE_CLASS_COUNT; i++) {
+    bot->free_blocks[i] = -1;
+  }
+  bot->free_int = 0;
+}
+
+int blob_ot_get_used_bytes(const BlobOt *bot) {
+  return (bot->size_int - bot->free_int) * sizeof(int);
+}
+
+static void blob_ot_reserve(BlobOt *bot, int capacity_int) {
+  if (capacity_int <= bot->capacity_int) {
+    return;
+  }
+
+  int old_capacity_int = bot->capacity_int;
+  while (bot->capacity_int < capacity_int) {
+    bot->capacity_int *= 2;
+  }
+  bot->root = realloc_mem(bot->root, bot->capacity_int * sizeof(int));
+  memset(bot->root + old_capacity_int, 0,
+         (bot->capacity_int - old_capacity_int) * sizeof(int));
+}
+
+// Returns the index of a block from the free list or the end of the pool.
+// Pointers into the pool are invalid afterwards
+static int blob_ot_alloc_block(BlobOt *bot, int size_class) {
+  int size_int = 1 + blob_ot_get_class_capacity(size_class);
+
+  int idx = bot->free_blocks[size_class];
+  if (idx != -1) {
+    bot->free_blocks[size_class] = (bot->root + idx)->offsets[0];
+    bot->free_int -= size_int;
+    return idx;
+  }
+
+  blob_ot_reserve(bot, bot->size_int + size_int);
+  idx = bot->size_int;
+  bot->size_int += size_int;
+  bot->high_water_int = HMM_MAX(bot->high_water_int, bot->size_int);
+  return idx;
+}
+
+static void blob_ot_free_block(BlobOt *bot, int idx, int size_class) {
+  (bot->root + idx)->offsets[0] = bot->free_blocks[size_class];
+  bot->free_blocks[size_class] = idx;
+  bot->free_int += 1 + blob_ot_get_class_capacity(size_class);
+}
+
+// Moves a leaf at the deepest level from the block for old_count blobs to the
+// block for new_count blobs, if they are different. The blobs in the leaf
+// need to fit in the new block. The leaf is child c of the node at parent_idx.
+// Returns the index of the leaf
+static int blob_ot_resize_leaf(BlobOt *bot, int parent_idx, int c,
+                               int old_count, int new_count) {
+  int leaf_idx = (bot->root + parent_idx)->offsets[c];
+  int old_class = blob_ot_get_size_class(old_count);
+  int new_class = blob_ot_get_size_class(new_count);
+  if (old_class == new_class) {
+    return leaf_idx;
+  }
+
+  int new_idx = blob_ot_alloc_block(bot, new_class);
+  const BlobOtNode *leaf = bot->root + leaf_idx;
+  BlobOtNode *new_leaf = bot->root + new_idx;
+  new_leaf->leaf_blob_count = leaf->leaf_blob_count;
+  memcpy(new_leaf->offsets, leaf->offsets,
+         leaf->leaf_blob_count * sizeof(int));
+
+  blob_ot_free_block(bot, leaf_idx, old_class);
+  (bot->root + parent_idx)->offsets[c] = new_idx;
+  return new_idx;
 }
 
 // This is also in the compute shader, so be careful if it needs to be changed
@@ -683,87 +2453,65 @@ static int get_octant_children_containing_cube(const HMM_Vec3 *npos,
   return ret;
 }
 
+static int get_octant_containing_point(const HMM_Vec3 *npos,
+                                       const HMM_Vec3 *p) {
+  int oct = 0;
+  if (p->X >= npos->X)
+    oct |= 4;
+  if (p->Y >= npos->Y)
+    oct |= 2;
+  if (p->Z >= npos->Z)
+    oct |= 1;
+  return oct;
+}
+
 static bool blob_ot_insert_ot_leaf(BlobOtEnumData *enum_data) {
-  BlobOtNode *leaf = enum_data->curr_leaf;
+  BlobOt *bot = enum_data->bot;
+  int depth = enum_data->curr_leaf_depth;
+  int leaf_idx = enum_data->node_stack[depth];
+  int bidx = *(int *)enum_data->user_data;
 
-  if (leaf->leaf_blob_count >= BLOB_OT_LEAF_MAX_BLOB_COUNT) {
-    static bool printed_warning = false;
-    if (!printed_warning) {
-      printed_warning = true;
-      fprintf(stderr, "Leaf node is full!\n");
+  if (depth >= bot->max_subdiv) {
+    // Leaves at the deepest level grow instead of being split
+    int parent_idx = enum_data->node_stack[depth - 1];
+    int c = 0;
+    while ((bot->root + parent_idx)->offsets[c] != leaf_idx) {
+      c++;
     }
+
+    int count = (bot->root + leaf_idx)->leaf_blob_count;
+    leaf_idx = blob_ot_resize_leaf(bot, parent_idx, c, count, count + 1);
+    enum_data->node_stack[depth] = leaf_idx;
+
+    BlobOtNode *leaf = bot->root + leaf_idx;
+    enum_data->curr_leaf = leaf;
+    leaf->offsets[leaf->leaf_blob_count++] = bidx;
     return true;
   }
 
-  leaf->offsets[leaf->leaf_blob_count++] = *(int *)enum_data->user_data;
+  BlobOtNode *leaf = bot->root + leaf_idx;
+  leaf->offsets[leaf->leaf_blob_count++] = bidx;
 
-  if (enum_data->curr_leaf_depth < enum_data->bot->max_subdiv &&
-      leaf->leaf_blob_count == BLOB_OT_LEAF_SUBDIV_BLOB_COUNT) {
+  if (leaf->leaf_blob_count == BLOB_OT_LEAF_SUBDIV_BLOB_COUNT) {
     int reinsert[BLOB_OT_LEAF_SUBDIV_BLOB_COUNT];
     for (int i = 0; i < BLOB_OT_LEAF_SUBDIV_BLOB_COUNT; i++) {
       reinsert[i] = leaf->offsets[i];
     }
 
-    // If the new leaves are not the last subdivision, there should only be a
-    // max of BLOB_OT_LEAF_SUBDIV_BLOB_COUNT leaves (fingers crossed)
-    int max_blobs_per_child;
-    if (enum_data->curr_leaf_depth < enum_data->bot->max_subdiv - 1) {
-      max_blobs_per_child = BLOB_OT_LEAF_SUBDIV_BLOB_COUNT;
-    } else {
-      max_blobs_per_child = BLOB_OT_LEAF_MAX_BLOB_COUNT;
-    }
-
-    int old_node_size_int = 1 + BLOB_OT_LEAF_SUBDIV_BLOB_COUNT;
-    int new_node_size_int = 1 + 8;
-    int children_size_int = (1 + max_blobs_per_child) * 8;
-    int size_diff = new_node_size_int + children_size_int - old_node_size_int;
-
-    // Adjust offsets in each parent
-    for (int d = enum_data->curr_leaf_depth - 1; d >= 0; d--) {
-      BlobOtNode *parent = enum_data->node_stack[d];
-      for (int i = 0; i < 8; i++) {
-        int *offset = &parent->offsets[i];
-        if (parent + *offset > leaf) {
-          *offset += size_diff;
-        }
-      }
-    }
-
-    int new_size_int = enum_data->bot->size_int + size_diff;
-
-    if (new_size_int > enum_data->bot->capacity_int) {
-      fprintf(stderr, "Octree is too big\n");
-      exit_fatal_error();
-
-      printf("Reallocating\n");
-      int old_capacity = enum_data->bot->capacity_int;
-      int new_capacity = old_capacity * 2;
-
-      void *new_data = alloc_mem(new_capacity * sizeof(int));
-      memcpy(new_data, enum_data->bot->root,
-             enum_data->bot->size_int * sizeof(int));
-
-      free(enum_data->bot->root);
-      enum_data->bot->root = new_data;
-      enum_data->bot->capacity_int = new_capacity;
-    }
-
-    BlobOtNode *node = leaf; // TODO
-    void *src_start = node + old_node_size_int;
-    void *src_end = enum_data->bot->root + enum_data->bot->size_int;
-    int src_size = (int)((char *)src_end - (char *)src_start);
-    memmove(node + new_node_size_int + children_size_int, src_start, src_size);
-    enum_data->bot->size_int = new_size_int;
-    node->leaf_blob_count = -1;
-
     // Set up each child right now before inserting nodes into them since they
     // might get filled up as well
+    int child_idxs[8];
     for (int i = 0; i < 8; i++) {
-      node->offsets[i] = new_node_size_int + i * (1 + max_blobs_per_child);
-      BlobOtNode *child = node + node->offsets[i];
-      child->leaf_blob_count = 0;
+      child_idxs[i] = blob_ot_alloc_block(bot, 0);
+      (bot->root + child_idxs[i])->leaf_blob_count = 0;
     }
 
+    // The leaf becomes a node in the same block
+    int node_idx = leaf_idx;
+    BlobOtNode *node = bot->root + node_idx;
+    node->leaf_blob_count = -1;
+    memcpy(node->offsets, child_idxs, sizeof(child_idxs));
+
     // TODO: don't change this stuff, this is nasty
     HMM_Vec3 old_pos = enum_data->shape_pos;
     float old_size = enum_data->shape_size;
@@ -773,11 +2521,9 @@ static bool blob_ot_insert_ot_leaf(BlobOtEnumData *enum_data) {
     float old_leaf_size = enum_data->curr_leaf_size;
 
     for (int j = 0; j < BLOB_OT_LEAF_SUBDIV_BLOB_COUNT; j++) {
-      enum_data->shape_pos =
-          *enum_data->bot->get_pos_from_idx(enum_data->bot, reinsert[j]);
-      enum_data->shape_size =
-          enum_data->bot->get_radius_from_idx(enum_data->bot, reinsert[j]) +
-          BLOB_SMOOTH + enum_data->bot->max_dist_to_leaf;
+      enum_data->shape_pos = bot->get_pos_from_idx(bot, reinsert[j]);
+      enum_data->shape_size = bot->get_radius_from_idx(bot, reinsert[j]) +
+                              BLOB_SMOOTH + bot->max_dist_to_leaf;
 
       int cflags = get_octant_children_containing_cube(enum_data->curr_leaf_pos,
                                                        &enum_data->shape_pos,
@@ -787,16 +2533,16 @@ static bool blob_ot_insert_ot_leaf(BlobOtEnumData *enum_data) {
           continue;
         }
 
-        BlobOtNode *child = node + node->offsets[i];
+        // Inserting into a child can grow the pool, so look the child up again
+        int child_idx = (bot->root + node_idx)->offsets[i];
         HMM_Vec3 child_pos = HMM_AddV3(
             HMM_MulV3F(ot_octants[i], enum_data->curr_leaf_size * 0.5f),
             *enum_data->curr_leaf_pos);
         float child_size = enum_data->curr_leaf_size * 0.5f;
 
-        // TODO: enum_data->bot might be invalidated
         enum_data->curr_leaf_depth++;
-        enum_data->node_stack[enum_data->curr_leaf_depth] = node + node->offsets[i];
-        enum_data->curr_leaf = child;
+        enum_data->node_stack[enum_data->curr_leaf_depth] = child_idx;
+        enum_data->curr_leaf = bot->root + child_idx;
         enum_data->curr_leaf_pos = &child_pos;
         enum_data->curr_leaf_size = child_size;
         enum_data->user_data = &reinsert[j];
@@ -831,18 +2577,300 @@ void blob_ot_insert(BlobOt *bot, const HMM_Vec3 *bpos, float bradius,
   blob_ot_enum_leaves_sphere(&enum_data);
 }
 
-static bool blob_ot_remove_ot_leaf(BlobOtEnumData *enum_data) {
+typedef struct BlobOtBuildBlob {
+  uint32_t morton;
+  int idx;
+  HMM_Vec3 pos;
+  // Half size of the cube used to find which children the blob is in
+  float half;
+} BlobOtBuildBlob;
+
+typedef struct BlobOtBuildData {
+  BlobOt *bot;
+  const BlobOtBuildBlob *blobs;
+
+  // Blob lists of the nodes currently being built, stacked on top of each
+  // other. The octant flags of each entry are kept next to it
+  int *lists;
+  uint8_t *list_flags;
+  int lists_size;
+  int lists_capacity;
+} BlobOtBuildData;
+
+// Spreads the lower 10 bits of x out so there are two 0 bits between each bit
+static uint32_t morton_spread_bits(uint32_t x) {
+  x &= 0x3FF;
+  x = (x | (x << 16)) & 0x030000FF;
+  x = (x | (x << 8)) & 0x0300F00F;
+  x = (x | (x << 4)) & 0x030C30C3;
+  x = (x | (x << 2)) & 0x09249249;
+  return x;
+}
+
+static uint32_t blob_ot_get_morton(const BlobOt *bot, const HMM_Vec3 *pos) {
+  uint32_t code = 0;
+  for (int a = 0; a < 3; a++) {
+    float t = (pos->Elements[a] - bot->root_pos.Elements[a]) / bot->root_size +
+              0.5f;
+    uint32_t q = (uint32_t)HMM_Clamp(0.0f, t * 1024.0f, 1023.0f);
+    code |= morton_spread_bits(q) << (2 - a);
+  }
+  return code;
+}
+
+// Stable LSD radix sort, so blobs with the same code stay in index order
+static void blob_ot_sort_build_blobs(BlobOtBuildBlob *blobs,
+                                     BlobOtBuildBlob *temp, int count) {
+  for (int shift = 0; shift < 30; shift += 8) {
+    int counts[256] = {0};
+    for (int i = 0; i < count; i++) {
+      counts[(blobs[i].morton >> shift) & 0xFF]++;
+    }
+
+    int offset = 0;
+    for (int i = 0; i < 256; i++) {
+      int c = counts[i];
+      counts[i] = offset;
+      offset += c;
+    }
+
+    for (int i = 0; i < count; i++) {
+      temp[counts[(blobs[i].morton >> shift) & 0xFF]++] = blobs[i];
+    }
+
+    BlobOtBuildBlob *swap = blobs;
+    blobs = temp;
+    temp = swap;
+  }
+
+  // There is an even number of passes, so the result is back in blobs
+}
+
+static void blob_ot_build_reserve(BlobOtBuildData *bd, int lists_size) {
+  if (lists_size <= bd->lists_capacity) {
+    return;
+  }
+
+  while (bd->lists_capacity < lists_size) {
+    bd->lists_capacity *= 2;
+  }
+  bd->lists = realloc_mem(bd->lists, bd->lists_capacity * sizeof(int));
+  bd->list_flags =
+      realloc_mem(bd->list_flags, bd->lists_capacity * sizeof(uint8_t));
+}
+
+// Builds a node with the blobs in lists[list_start, list_start + count) and
+// everything under it. The root goes in the block at index 0. Returns the
+// index of the node
+static int blob_ot_build_node(BlobOtBuildData *bd, int list_start, int count,
+                              const HMM_Vec3 *npos, float nsize, int depth) {
+  BlobOt *bot = bd->bot;
+
+  bool is_deepest = depth >= bot->max_subdiv;
+  if (is_deepest || count < BLOB_OT_LEAF_SUBDIV_BLOB_COUNT) {
+    int leaf_idx = 0;
+    if (depth > 0) {
+      leaf_idx = blob_ot_alloc_block(bot, blob_ot_get_size_class(count));
+    }
+
+    BlobOtNode *leaf = bot->root + leaf_idx;
+    leaf->leaf_blob_count = count;
+    for (int i = 0; i < count; i++) {
+      leaf->offsets[i] = bd->blobs[bd->lists[list_start + i]].idx;
+    }
+    return leaf_idx;
+  }
+
+  int node_idx = depth > 0 ? blob_ot_alloc_block(bot, 0) : 0;
+  (bot->root + node_idx)->leaf_blob_count = -1;
+
+  // Count how many blobs go into each child, then put the lists of the
+  // children right after this node's list
+  int child_counts[8] = {0};
+  for (int i = 0; i < count; i++) {
+    const BlobOtBuildBlob *b = &bd->blobs[bd->lists[list_start + i]];
+    int cflags = get_octant_children_containing_cube(npos, &b->pos, b->half);
+    bd->list_flags[list_start + i] = (uint8_t)cflags;
+    for (int c = 0; c < 8; c++) {
+      child_counts[c] += (cflags >> c) & 1;
+    }
+  }
+
+  int children_start = bd->lists_size;
+  int child_starts[8];
+  int total = 0;
+  for (int c = 0; c < 8; c++) {
+    child_starts[c] = children_start + total;
+    total += child_counts[c];
+  }
+  blob_ot_build_reserve(bd, children_start + total);
+
+  int fill[8];
+  memcpy(fill, child_starts, sizeof(fill));
+  for (int i = 0; i < count; i++) {
+    int cflags = bd->list_flags[list_start + i];
+    for (int c = 0; c < 8; c++) {
+      if (cflags & (1 << c)) {
+        bd->lists[fill[c]++] = bd->lists[list_start + i];
+      }
+    }
+  }
+  bd->lists_size = children_start + total;
+
+  for (int c = 0; c < 8; c++) {
+    HMM_Vec3 child_pos =
+        HMM_AddV3(HMM_MulV3F(ot_octants[c], nsize * 0.5f), *npos);
+    int child_idx = blob_ot_build_node(bd, child_starts[c], child_counts[c],
+                                       &child_pos, nsize * 0.5f, depth + 1);
+    (bot->root + node_idx)->offsets[c] = child_idx;
+  }
+
+  bd->lists_size = children_start;
+  return node_idx;
+}
+
+void blob_ot_build(BlobOt *bot, int blob_count) {
+  if (blob_count > bot->build_blob_capacity) {
+    bot->build_blob_capacity =
+        HMM_MAX(blob_count, bot->build_blob_capacity * 2);
+    free_mem(bot->build_blobs);
+    free_mem(bot->build_temp);
+    bot->build_blobs =
+        alloc_mem(bot->build_blob_capacity * sizeof(*bot->build_blobs));
+    bot->build_temp =
+        alloc_mem(bot->build_blob_capacity * sizeof(*bot->build_temp));
+  }
+
+  BlobOtBuildBlob *blobs = bot->build_blobs;
+  int count = 0;
+  for (int i = 0; i < blob_count; i++) {
+    HMM_Vec3 pos = bot->get_pos_from_idx(bot, i);
+    if (!blob_pos_is_set(&pos))
+      continue;
+
+    BlobOtBuildBlob *b = &blobs[count++];
+    b->idx = i;
+    b->pos = pos;
+    b->half = bot->get_radius_from_idx(bot, i) + BLOB_SMOOTH +
+              bot->max_dist_to_leaf;
+    b->morton = blob_ot_get_morton(bot, &pos);
+  }
+
+  // Sorting keeps blobs that end up in the same leaves close together
+  blob_ot_sort_build_blobs(blobs, bot->build_temp, count);
+
+  if (bot->build_lists_capacity == 0) {
+    bot->build_lists_capacity = 64;
+    bot->build_lists = alloc_mem(bot->build_lists_capacity * sizeof(int));
+    bot->build_list_flags =
+        alloc_mem(bot->build_lists_capacity * sizeof(uint8_t));
+  }
+
+  BlobOtBuildData bd;
+  bd.bot = bot;
+  bd.blobs = blobs;
+  bd.lists = bot->build_lists;
+  bd.list_flags = bot->build_list_flags;
+  bd.lists_capacity = bot->build_lists_capacity;
+  blob_ot_build_reserve(&bd, count * 2 + 64);
+  for (int i = 0; i < count; i++) {
+    bd.lists[i] = i;
+  }
+  bd.lists_size = count;
+
+  blob_ot_reset(bot);
+  blob_ot_build_node(&bd, 0, count, &bot->root_pos, bot->root_size, 0);
+
+  // The lists may have grown while building
+  bot->build_lists = bd.lists;
+  bot->build_list_flags = bd.list_flags;
+  bot->build_lists_capacity = bd.lists_capacity;
+}
+
+// Returns true if the node is an empty leaf afterwards. The node is child c
+// of the node at parent_idx, or the root if parent_idx is -1
+static bool blob_ot_remove_from_node(BlobOt *bot, int parent_idx, int c,
+                                     const HMM_Vec3 *npos, float nsize,
+                                     int depth, const HMM_Vec3 *bpos,
+                                     float bhalf, int bidx) {
+  int node_idx = parent_idx == -1 ? 0 : (bot->root + parent_idx)->offsets[c];
+  BlobOtNode *node = bot->root + node_idx;
+
+  if (node->leaf_blob_count != -1) {
+    for (int i = 0; i < node->leaf_blob_count; i++) {
+      int oidx = node->offsets[i];
+      if (oidx == bidx) {
+        void *dst = node->offsets + i;
+        void *src = node->offsets + i + 1;
+        int src_size_bytes = (node->leaf_blob_count - i - 1) * sizeof(int);
+        memmove(dst, src, src_size_bytes);
+        node->leaf_blob_count--;
+
+        if (depth >= bot->max_subdiv) {
+          int count = node->leaf_blob_count;
+          node_idx = blob_ot_resize_leaf(bot, parent_idx, c, count + 1, count);
+          node = bot->root + node_idx;
+        }
+        break;
+      }
+    }
+
+    return node->leaf_blob_count == 0;
+  }
+
+  int cflags = get_octant_children_containing_cube(npos, bpos, bhalf);
+  bool removed_empty = false;
+  for (int i = 0; i < 8; i++) {
+    if ((cflags & (1 << i)) == 0) {
+      continue;
+    }
+
+    HMM_Vec3 child_pos =
+        HMM_AddV3(HMM_MulV3F(ot_octants[i], nsize * 0.5f), *npos);
+    removed_empty |=
+        blob_ot_remove_from_node(bot, node_idx, i, &child_pos, nsize * 0.5f,
+                                 depth + 1, bpos, bhalf, bidx);
+  }
+
+  if (!removed_empty) {
+    return false;
+  }
+
+  // Turn the node back into a leaf once all of its children are empty. The
+  // pool might have moved while removing from the children
+  node = bot->root + node_idx;
+  for (int i = 0; i < 8; i++) {
+    if ((bot->root + node->offsets[i])->leaf_blob_count != 0) {
+      return false;
+    }
+  }
+
+  for (int i = 0; i < 8; i++) {
+    blob_ot_free_block(bot, node->offsets[i], 0);
+  }
+  node->leaf_blob_count = 0;
+  return true;
+}
+
+void blob_ot_remove(BlobOt *bot, const HMM_Vec3 *bpos, float bradius,
+                    int bidx) {
+  float bhalf = bradius + BLOB_SMOOTH + bot->max_dist_to_leaf;
+  blob_ot_remove_from_node(bot, -1, 0, &bot->root_pos, bot->root_size, 0,
+                           bpos, bhalf, bidx);
+}
+
+typedef struct BlobOtReplaceData {
+  int old_bidx;
+  int new_bidx;
+} BlobOtReplaceData;
+
+static bool blob_ot_replace_ot_leaf(BlobOtEnumData *enum_data) {
   BlobOtNode *leaf = enum_data->curr_leaf;
-  int bidx = *(int *)enum_data->user_data;
+  BlobOtReplaceData *replace_data = enum_data->user_data;
 
   for (int i = 0; i < leaf->leaf_blob_count; i++) {
-    int oidx = leaf->offsets[i];
-    if (oidx == bidx) {
-      void *dst = leaf->offsets + i;
-      void *src = leaf->offsets + i + 1;
-      int src_size_bytes = (leaf->leaf_blob_count - i - 1) * sizeof(int);
-      memmove(dst, src, src_size_bytes);
-      leaf->leaf_blob_count--;
+    if (leaf->offsets[i] == replace_data->old_bidx) {
+      leaf->offsets[i] = replace_data->new_bidx;
       break;
     }
   }
@@ -850,21 +2878,26 @@ static bool blob_ot_remove_ot_leaf(BlobOtEnumData *enum_data) {
   return true;
 }
 
-void blob_ot_remove(BlobOt *bot, const HMM_Vec3 *bpos, float bradius,
-                    int bidx) {
+void blob_ot_replace(BlobOt *bot, const HMM_Vec3 *bpos, float bradius,
+                     int old_bidx, int new_bidx) {
+  BlobOtReplaceData replace_data;
+  replace_data.old_bidx = old_bidx;
+  replace_data.new_bidx = new_bidx;
+
   BlobOtEnumData enum_data;
   enum_data.bot = bot;
   enum_data.shape_pos = *bpos;
   enum_data.shape_size = bradius + BLOB_SMOOTH + bot->max_dist_to_leaf;
-  enum_data.callback = blob_ot_remove_ot_leaf;
-  enum_data.user_data = &bidx;
+  enum_data.callback = blob_ot_replace_ot_leaf;
+  enum_data.user_data = &replace_data;
 
   blob_ot_enum_leaves_sphere(&enum_data);
 }
 
 void blob_ot_enum_leaves_sphere(BlobOtEnumData *enum_data) {
-  BlobOtNode *node_stack[BLOB_OT_MAX_SUBDIVISIONS + 1];
-  node_stack[0] = enum_data->bot->root;
+  // Indices instead of pointers, since the callback can grow the pool
+  int node_stack[BLOB_OT_MAX_SUBDIVISIONS + 1];
+  node_stack[0] = 0;
   HMM_Vec3 pos_stack[BLOB_OT_MAX_SUBDIVISIONS + 1];
   pos_stack[0] = enum_data->bot->root_pos;
   float size_stack[BLOB_OT_MAX_SUBDIVISIONS + 1];
@@ -878,7 +2911,7 @@ void blob_ot_enum_leaves_sphere(BlobOtEnumData *enum_data) {
 
   while (node_depth >= 0) {
     // Current node in the stack
-    BlobOtNode *node = node_stack[node_depth];
+    BlobOtNode *node = enum_data->bot->root + node_stack[node_depth];
     const HMM_Vec3 *npos = &pos_stack[node_depth];
     float nsize = size_stack[node_depth];
 
@@ -898,7 +2931,7 @@ void blob_ot_enum_leaves_sphere(BlobOtEnumData *enum_data) {
             HMM_AddV3(HMM_MulV3F(ot_octants[*i], nsize * 0.5f), *npos);
         size_stack[node_depth + 1] = nsize * 0.5f;
 
-        node_stack[node_depth + 1] = node + node->offsets[*i];
+        node_stack[node_depth + 1] = node->offsets[*i];
         iter_stack[node_depth + 1] = 0;
         node_depth += 2; // Because there is a decrement at the end of the
                          // outer loop
@@ -922,8 +2955,9 @@ void blob_ot_enum_leaves_sphere(BlobOtEnumData *enum_data) {
 }
 
 void blob_ot_enum_leaves_cube(BlobOtEnumData *enum_data) {
-  BlobOtNode *node_stack[BLOB_OT_MAX_SUBDIVISIONS + 1];
-  node_stack[0] = enum_data->bot->root;
+  // Indices instead of pointers, since the callback can grow the pool
+  int node_stack[BLOB_OT_MAX_SUBDIVISIONS + 1];
+  node_stack[0] = 0;
   HMM_Vec3 pos_stack[BLOB_OT_MAX_SUBDIVISIONS + 1];
   pos_stack[0] = enum_data->bot->root_pos;
   float size_stack[BLOB_OT_MAX_SUBDIVISIONS + 1];
@@ -937,7 +2971,7 @@ void blob_ot_enum_leaves_cube(BlobOtEnumData *enum_data) {
 
   while (node_depth >= 0) {
     // Current node in the stack
-    BlobOtNode *node = node_stack[node_depth];
+    BlobOtNode *node = enum_data->bot->root + node_stack[node_depth];
     const HMM_Vec3 *npos = &pos_stack[node_depth];
     float nsize = size_stack[node_depth];
 
@@ -957,7 +2991,7 @@ void blob_ot_enum_leaves_cube(BlobOtEnumData *enum_data) {
             HMM_AddV3(HMM_MulV3F(ot_octants[*i], nsize * 0.5f), *npos);
         size_stack[node_depth + 1] = nsize * 0.5f;
 
-        node_stack[node_depth + 1] = node + node->offsets[*i];
+        node_stack[node_depth + 1] = node->offsets[*i];
         iter_stack[node_depth + 1] = 0;
         node_depth += 2; // Because there is a decrement at the end of the
                          // outer loop
@@ -978,4 +3012,200 @@ void blob_ot_enum_leaves_cube(BlobOtEnumData *enum_data) {
 
     node_depth--;
   }
-}
\ No newline at end of file
+}
+
+static int blob_ot_serialize_node(const BlobOt *bot, int node_idx, int *dst,
+                                  int dst_idx) {
+  const BlobOtNode *node = bot->root + node_idx;
+  dst[dst_idx] = node->leaf_blob_count;
+
+  if (node->leaf_blob_count != -1) {
+    memcpy(dst + dst_idx + 1, node->offsets,
+           node->leaf_blob_count * sizeof(int));
+    return dst_idx + 1 + node->leaf_blob_count;
+  }
+
+  int next_idx = dst_idx + 1 + 8;
+  for (int i = 0; i < 8; i++) {
+    dst[dst_idx + 1 + i] = next_idx - dst_idx;
+    next_idx = blob_ot_serialize_node(bot, node->offsets[i], dst, next_idx);
+  }
+  return next_idx;
+}
+
+int blob_ot_find_leaf(const BlobOt *bot, const HMM_Vec3 *p,
+                      HMM_Vec3 *leaf_pos, float *leaf_size) {
+  HMM_Vec3 npos = bot->root_pos;
+  float nsize = bot->root_size;
+
+  float half = nsize * 0.5f;
+  for (int a = 0; a < 3; a++) {
+    float d = p->Elements[a] - npos.Elements[a];
+    if (d < -half || d > half) {
+      return -1;
+    }
+  }
+
+  // Same walk as compute_sdf.comp
+  int node_idx = 0;
+  while ((bot->root + node_idx)->leaf_blob_count == -1) {
+    const BlobOtNode *node = bot->root + node_idx;
+    int oct = get_octant_containing_point(&npos, p);
+    npos = HMM_AddV3(HMM_MulV3F(ot_octants[oct], nsize * 0.5f), npos);
+    nsize *= 0.5f;
+    node_idx = node->offsets[oct];
+  }
+
+  *leaf_pos = npos;
+  *leaf_size = nsize;
+  return node_idx;
+}
+
+int blob_ot_serialize(const BlobOt *bot, int *dst) {
+  return blob_ot_serialize_node(bot, 0, dst, 0);
+}
+
+typedef struct BlobOtSnapshot {
+  float max_dist_to_leaf;
+  int max_subdiv;
+  HMM_Vec3 root_pos;
+  float root_size;
+  int size_int;
+  int high_water_int;
+  int free_blocks[BLOB_OT_SIZE_CLASS_COUNT];
+  int free_int;
+} BlobOtSnapshot;
+
+void blob_ot_snapshot_write(const BlobOt *bot, SnapshotWriter *w) {
+  BlobOtSnapshot snap;
+  // Padding is written too, so it should not be garbage
+  memset(&snap, 0, sizeof(snap));
+  snap.max_dist_to_leaf = bot->max_dist_to_leaf;
+  snap.max_subdiv = bot->max_subdiv;
+  snap.root_pos = bot->root_pos;
+  snap.root_size = bot->root_size;
+  snap.size_int = bot->size_int;
+  snap.high_water_int = bot->high_water_int;
+  memcpy(snap.free_blocks, bot->free_blocks, sizeof(snap.free_blocks));
+  snap.free_int = bot->free_int;
+  snapshot_write(w, &snap, sizeof(snap));
+  // Children are stored as indices into the pool, so it can be copied as is
+  snapshot_write(w, bot->root, bot->size_int * sizeof(int));
+}
+
+// Marks the ints of a block as used. Returns false if the block is outside of
+// the pool or overlaps another one
+static bool blob_ot_mark_block(const BlobOt *bot, uint8_t *used, int idx,
+                               int size_class) {
+  int size_int = 1 + blob_ot_get_class_capacity(size_class);
+  if (idx < 0 || idx > bot->size_int - size_int) {
+    return false;
+  }
+
+  for (int i = idx; i < idx + size_int; i++) {
+    if (used[i]) {
+      return false;
+    }
+    used[i] = 1;
+  }
+  return true;
+}
+
+// Checks a node and everything under it the way blob_ot_build makes them
+static bool blob_ot_is_valid_node(const BlobOt *bot, uint8_t *used, int idx,
+                                  int depth, int blob_count) {
+  if (idx < 0 || idx >= bot->size_int) {
+    return false;
+  }
+
+  int count = (bot->root + idx)->leaf_blob_count;
+  int size_class = 0;
+  if (depth >= bot->max_subdiv) {
+    if (count < 0 ||
+        count > blob_ot_get_class_capacity(BLOB_OT_SIZE_CLASS_COUNT - 1)) {
+      return false;
+    }
+    size_class = blob_ot_get_size_class(count);
+  } else if (count < -1 || count >= BLOB_OT_LEAF_SUBDIV_BLOB_COUNT) {
+    // Leaves above the deepest level are split before they fill up
+    return false;
+  }
+  if (!blob_ot_mark_block(bot, used, idx, size_class)) {
+    return false;
+  }
+
+  const BlobOtNode *node = bot->root + idx;
+  if (count == -1) {
+    for (int i = 0; i < 8; i++) {
+      if (!blob_ot_is_valid_node(bot, used, node->offsets[i], depth + 1,
+                                 blob_count)) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  for (int i = 0; i < count; i++) {
+    if (node->offsets[i] < 0 || node->offsets[i] >= blob_count) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Checks that every int of the pool is either in a block under the root or in
+// a free block, but not both
+static bool blob_ot_is_valid(const BlobOt *bot, int blob_count) {
+  uint8_t *used = alloc_mem(bot->size_int);
+  memset(used, 0, bot->size_int);
+  bool ok = blob_ot_is_valid_node(bot, used, 0, 0, blob_count);
+
+  int free_int = 0;
+  for (int c = 0; ok && c < BLOB_OT_SIZE_CLASS_COUNT; c++) {
+    int idx = bot->free_blocks[c];
+    while (ok && idx != -1) {
+      ok = blob_ot_mark_block(bot, used, idx, c);
+      if (ok) {
+        free_int += 1 + blob_ot_get_class_capacity(c);
+        idx = (bot->root + idx)->offsets[0];
+      }
+    }
+  }
+  for (int i = 0; ok && i < bot->size_int; i++) {
+    ok = used[i];
+  }
+  free_mem(used);
+  return ok && free_int == bot->free_int;
+}
+
+bool blob_ot_snapshot_read(BlobOt *bot, SnapshotReader *r, int blob_count) {
+  BlobOtSnapshot snap;
+  if (!snapshot_read_into(r, &snap, sizeof(snap)) ||
+      snap.size_int < 1 + blob_ot_get_class_capacity(0) ||
+      snap.max_subdiv < 1 || snap.max_subdiv > BLOB_OT_MAX_SUBDIVISIONS ||
+      !(snap.root_size > 0.0f) || !(snap.max_dist_to_leaf >= 0.0f)) {
+    return false;
+  }
+
+  // The size is checked against the snapshot before anything is allocated
+  const void *pool = snapshot_read(r, (size_t)snap.size_int * sizeof(int));
+  if (!pool) {
+    return false;
+  }
+
+  blob_ot_reserve(bot, snap.size_int);
+  memcpy(bot->root, pool, snap.size_int * sizeof(int));
+  bot->max_dist_to_leaf = snap.max_dist_to_leaf;
+  bot->max_subdiv = snap.max_subdiv;
+  bot->root_pos = snap.root_pos;
+  bot->root_size = snap.root_size;
+  bot->size_int = snap.size_int;
+  memcpy(bot->free_blocks, snap.free_blocks, sizeof(bot->free_blocks));
+  bot->free_int = snap.free_int;
+  if (!blob_ot_is_valid(bot, blob_count)) {
+    blob_ot_reset(bot);
+    return false;
+  }
+  bot->high_water_int = HMM_MAX(bot->high_water_int, snap.high_water_int);
+  return true;
+}
@@ -6,11 +6,17 @@
 #include "HandmadeMath.h"
 
 #include "blob_defines.h"
+#include "blob_grid.h"
 #include "ecs.h"
 #include "fixed_array.h"
+#include "handle_table.h"
 #include "int_map.h"
-
-typedef enum LiquidType { LIQUID_BASE, LIQUID_PROJ } LiquidType;
+#include "neighbour_list.h"
+#include "solid_field.h"
+#include "sphere_bvh.h"
+#include "timer_wheel.h"
+#include "visited_set.h"
+#include "worker_pool.h"
 
 typedef struct SolidBlob {
   float radius;
@@ -18,23 +24,65 @@ typedef struct SolidBlob {
   int mat_idx;
 } SolidBlob;
 
-typedef struct LiquidBlob LiquidBlob;
 typedef struct ColliderModel ColliderModel;
-typedef void (*ProjectileCallback)(LiquidBlob *, ColliderModel *);
+typedef struct Projectile Projectile;
+// Called when a projectile hits a collider model. Returns true if the
+// projectile was used up. Otherwise, it turns into a liquid like when it hits a
+// solid
+typedef bool (*ProjectileCallback)(Projectile *, ColliderModel *);
+
+// Liquid data that the simulation rarely needs
+typedef struct LiquidBlobInfo {
+  int mat_idx;
+} LiquidBlobInfo;
 
-typedef struct LiquidBlob {
-  LiquidType type;
-  float radius;
+// Moves on its own without touching other blobs until it hits a solid or a
+// collider model, and then turns into a liquid
+typedef struct Projectile {
   HMM_Vec3 pos;
   HMM_Vec3 vel;
+  float radius;
   int mat_idx;
-  union {
-    struct {
-      ProjectileCallback callback;
-      uint64_t userdata;
-    } proj;
-  };
-} LiquidBlob;
+  // Seconds until the projectile is removed. A liquid that it turns into is
+  // removed when the rest of this runs out
+  float lifetime;
+  // Projectiles without a callback go through collider models
+  ProjectileCallback callback;
+  uint64_t userdata;
+} Projectile;
+
+// Where a projectile got to in a tick and what it hit on the way
+typedef struct ProjectileStep {
+  HMM_Vec3 pos;
+  HMM_Vec3 vel;
+  bool hit_solid;
+  // Index of the collider model that was hit, or -1
+  int hit_collider;
+} ProjectileStep;
+
+// Liquids are stored as a structure of arrays so that the simulation only
+// loads the data it needs for each neighbour. Removing a liquid moves the last
+// liquid into its place. The arrays are reserved for capacity liquids and
+// committed in chunks as the store grows, so they never move
+typedef struct LiquidStore {
+  int count;
+  int capacity;
+  // How many liquids the arrays have memory for
+  int committed;
+
+  float *pos_x, *pos_y, *pos_z;
+  float *vel_x, *vel_y, *vel_z;
+  float *radius;
+
+  LiquidBlobInfo *info;
+  // Ticks in a row that the liquid has been almost still. Liquids that have
+  // been still for long enough are asleep and are not simulated until
+  // something wakes them
+  int *rest_ticks;
+  // Set at the end of each tick for liquids that are fast enough to wake the
+  // sleeping liquids near them
+  bool *disturbing;
+} LiquidStore;
 
 typedef struct ColliderModel {
   Entity ent;
@@ -44,47 +92,85 @@ typedef enum RemovalType {
   REMOVE_SOLID,
   REMOVE_LIQUID,
   REMOVE_COLLIDER_MODEL,
+  REMOVE_PROJECTILE,
   REMOVE_MAX
 } RemovalType;
 
-typedef struct BlobRemoval {
-  int bidx;
-  double timer;
-} BlobRemoval;
-
-#define BLOB_SIM_MAX_SOLIDS 4096
-#define BLOB_SIM_MAX_LIQUIDS 4096
+// What the liquid simulation uses to find nearby liquids
+typedef enum LiquidBroadphase {
+  // Uses liquid_ot as it was at the start of the tick
+  LIQUID_BROADPHASE_OCTREE,
+  // Builds liquid_grid at the start of the tick
+  LIQUID_BROADPHASE_GRID,
+} LiquidBroadphase;
+
+// Memory for blobs is only committed as they are created, so these only limit
+// how much address space is reserved
+#define BLOB_SIM_MAX_SOLIDS (1 << 20)
+#define BLOB_SIM_MAX_LIQUIDS (1 << 20)
 #define BLOB_SIM_MAX_COLLIDER_MODELS 128
+#define BLOB_SIM_MAX_PROJECTILES 16384
 
-#define BLOB_SIM_MAX_DELETIONS 1024
+// Length of a tick of the removal timer wheels in seconds
+#define BLOB_SIM_REMOVAL_TICK 0.001
 
 typedef struct BlobOtNode {
   // Blob count if this node is a leaf. Otherwise, it is -1
   int leaf_blob_count;
-  // Indices of blobs if this is a leaf. Otherwise, it is the 8 offsets from this
-  // node to its children
+  // Indices of blobs if this is a leaf. Otherwise, it is the indices of the 8
+  // children in the octree's pool
   int offsets[];
 } BlobOtNode;
 
+// Octree nodes are stored in blocks of 1 + (8 << size class) ints. Nodes and
+// leaves above the deepest level always use size class 0, and leaves at the
+// deepest level use the smallest size class that fits their blobs
+#define BLOB_OT_SIZE_CLASS_COUNT 24
+
 typedef struct BlobOt BlobOt;
+typedef struct BlobOtBuildBlob BlobOtBuildBlob;
 
-// Octree
+// Octree. Nodes are blocks in a pool of ints and refer to their children by
+// index, so splitting a leaf doesn't move any other nodes. A leaf's block is
+// big enough for it to become a node in place, and leaves at the deepest level
+// move to another block when they need more or less room. Use
+// blob_ot_serialize to get the layout that the compute shader reads
 typedef struct BlobOt {
+  // Start of the pool, which is also where the root node is
   BlobOtNode *root;
   // At what distance should a blob be added to a leaf? This is useful for
   // calculating a signed distance field. Default is 0
   float max_dist_to_leaf;
 
+  // Should be at least 1, since the root can't move to a bigger block
   int max_subdiv;
   HMM_Vec3 root_pos;
   float root_size;
 
-  // Current capacity in ints (sizeof(BlobOtNode) == sizeof(int))
+  // Current capacity in ints (sizeof(BlobOtNode) == sizeof(int)). The pool
+  // starts small and grows when it runs out, which moves root
   int capacity_int;
+  // How much of the pool has been used, including blocks that are free again
   int size_int;
+  // Largest size_int since the octree was created
+  int high_water_int;
+  // Index of the first free block of each size class, or -1. A free block
+  // stores the index of the next one in offsets[0]
+  int free_blocks[BLOB_OT_SIZE_CLASS_COUNT];
+  // Ints in free blocks
+  int free_int;
+
+  // Scratch memory of blob_ot_build, which is kept between builds since some
+  // octrees are built every tick. It only grows
+  BlobOtBuildBlob *build_blobs;
+  BlobOtBuildBlob *build_temp;
+  int build_blob_capacity;
+  int *build_lists;
+  uint8_t *build_list_flags;
+  int build_lists_capacity;
 
   void *userdata;
-  const HMM_Vec3 *(*get_pos_from_idx)(BlobOt *, int);
+  HMM_Vec3 (*get_pos_from_idx)(BlobOt *, int);
   float (*get_radius_from_idx)(BlobOt *, int);
 } BlobOt;
 
@@ -100,32 +186,159 @@ typedef struct BlobOtEnumData {
   float shape_size;
   BlobOtEnumLeafFunc callback;
   void *user_data;
-  // This is modified by the enum function
+  // This is modified by the enum function. curr_leaf is only valid until the
+  // octree's pool grows
   BlobOtNode *curr_leaf;
   int curr_leaf_depth;
   const HMM_Vec3 *curr_leaf_pos;
   float curr_leaf_size;
-  BlobOtNode **node_stack;
+  // Pool indices of the nodes from the root to curr_leaf
+  int *node_stack;
 } BlobOtEnumData;
 
+// Liquids further from active_pos are simulated less often with a larger
+// delta. Near liquids are inside of the active cube, mid liquids are inside of
+// the mid LOD cube, and far liquids only fall and collide with solids
+typedef enum LiquidLod {
+  LIQUID_LOD_NEAR,
+  LIQUID_LOD_MID,
+  LIQUID_LOD_FAR,
+  LIQUID_LOD_COUNT,
+} LiquidLod;
+
+// Memory that a worker thread reuses for every leaf it simulates, and for
+// batched raycasts
+typedef struct LiquidLeafScratch {
+  // A copy of the blobs in the leaf, laid out for blob_kernel
+  int capacity;
+  float *x;
+  float *y;
+  float *z;
+  float *radius;
+  // Indices into the copy of the disturbing liquids in the leaf
+  int *disturbing;
+
+  // A copy of the neighbours of the liquid being simulated, laid out for
+  // blob_kernel
+  int neighbour_capacity;
+  float *neighbour_x;
+  float *neighbour_y;
+  float *neighbour_z;
+  float *neighbour_radius;
+  // Attractions evaluated by this thread during the current tick
+  int pair_count;
+
+  // Solids that have already been checked by a collision query
+  VisitedSet solids_checked;
+} LiquidLeafScratch;
+
 typedef struct BlobSim {
+  // Removing an element moves the last element into its place, so use handles
+  // to refer to elements for longer than a tick
   FixedArray solids;
-  FixedArray liquids;
+  LiquidStore liquids;
 
   FixedArray collider_models;
+  // Entities of the collider models to their handles
+  IntMap collider_model_map;
+
+  // Projectiles are not in liquid_ot and are never simulated with liquids
+  FixedArray projectiles;
 
-  FixedArray del_queues[REMOVE_MAX];
+  HandleTable solid_handles;
+  HandleTable liquid_handles;
+  HandleTable collider_model_handles;
+  HandleTable projectile_handles;
+
+  // Pending removals of each type, keyed by handle
+  TimerWheel removal_wheels[REMOVE_MAX];
+  // Seconds simulated so far, which the removal wheels are advanced to
+  double removal_time;
 
   HMM_Vec3 active_pos;
   
   // Used for collision detection and rendering
   BlobOt solid_ot;
+  // Distance field of the solids for collision queries. Bricks around a solid
+  // are baked again when it changes
+  SolidField solid_field;
 
-  // Used for simulation and rendering
+  // Used for simulation and rendering. It is not edited during a tick, so the
+  // simulation can traverse it while liquids move
   BlobOt liquid_ot;
-
-  // Used to avoid modifying the same octree while traversing it
-  BlobOt liquid_temp_ot;
+  // Only used for rendering. It is built again at the end of every tick
+  BlobOt projectile_ot;
+
+  LiquidBroadphase liquid_broadphase;
+  BlobGrid liquid_grid;
+  // Set while an octree is going to be rebuilt with blob_ot_build, so it does
+  // not need to be edited. liquid_ot is rebuilt at the end of every tick
+  bool solid_ot_rebuild;
+  bool liquid_ot_rebuild;
+  // Places that solids left or moved to during a solid batch, with the radius
+  // in W. Their bricks are marked and their liquids woken when it ends
+  HMM_Vec4 *batch_spheres;
+  int batch_sphere_count;
+  int batch_sphere_capacity;
+
+  // False when every liquid in a LOD tier is asleep, so ticks can skip
+  // simulating that tier. Anything that wakes a liquid sets them again
+  bool liquids_awake[LIQUID_LOD_COUNT];
+  // active_pos when liquids_awake was last updated
+  HMM_Vec3 sleep_active_pos;
+  // Counts ticks to decide which LOD tiers are simulated
+  int lod_tick;
+
+  // Liquids that each liquid can attract. Liquids that moved too far get new
+  // lists, and every list is built again after liquids were added, removed or
+  // resized
+  NeighbourList liquid_neighbours;
+  bool liquid_neighbours_dirty;
+  // Pairs of liquids whose attraction was evaluated during the last tick. 0
+  // if it did not simulate any liquids
+  int liquid_pair_count;
+
+  // Liquid leaves are simulated across these threads
+  WorkerPool workers;
+
+  // Per tick liquid simulation state. Positions are read from the liquids
+  // array and new positions are written here, so the result of a tick does not
+  // depend on how leaves are split between threads. The arrays grow with the
+  // liquid count at the start of a tick
+  int liquid_scratch_capacity;
+  HMM_Vec3 *liquid_next_pos;
+  // Which simulated leaf a liquid belongs to this tick. Only valid for
+  // liquids in liquid_collected
+  int *liquid_owner;
+  VisitedSet liquid_collected;
+  // Liquids in the order they were assigned to leaves
+  int *liquid_sim_order;
+  int liquid_sim_count;
+  // Far liquids that are not in any simulated leaf
+  int *liquid_far_order;
+  int liquid_far_count;
+  // Leaves inside of the active cube, or the mid LOD cube on ticks that
+  // simulate it
+  BlobOtNode **sim_leaves;
+  int sim_leaf_count;
+  int sim_leaf_capacity;
+  // Projectiles are moved on the worker threads and the results are applied
+  // in order afterwards, since callbacks can create and remove blobs
+  ProjectileStep *projectile_steps;
+  int projectile_step_capacity;
+  // World space blobs of every collider model, with the radius in W. They are
+  // transformed at the start of each tick that moves projectiles, so
+  // projectiles only have to query collider_bvh
+  HMM_Vec4 *collider_spheres;
+  // Index of the collider model that each sphere belongs to
+  int *collider_sphere_owners;
+  int collider_sphere_count;
+  int collider_sphere_capacity;
+  SphereBvh collider_bvh;
+  // One for each worker thread
+  LiquidLeafScratch *leaf_scratch;
+  // Used by collision queries from outside of the simulation
+  VisitedSet solids_checked;
 } BlobSim;
 
 // A blob that belongs to a model
@@ -145,40 +358,97 @@ typedef struct RaycastResult {
   HMM_Vec3 hit;
   HMM_Vec3 norm;
   float traveled;
+  // Index of the closest blob at the hit, a liquid if hit_liquid is set
   int blob_idx;
+  bool hit_liquid;
 } RaycastResult;
 
+// What blob_sim_raycast can hit
+typedef enum RaycastFlags {
+  RAYCAST_SOLIDS = 1,
+  RAYCAST_LIQUIDS = 2,
+} RaycastFlags;
+
 // Size of level cube. Contains inactive blobs
 static const float BLOB_LEVEL_SIZE = 640.0f;
 // Size of active simulation cube
 static const float BLOB_ACTIVE_SIZE = 32.0f;
+// Size of the cube around active_pos where liquids are simulated at reduced
+// rate. Liquids outside of it are far
+static const float BLOB_LOD_MID_SIZE = 64.0f;
 
-// How much force is needed to attract b to other
-HMM_Vec3 blob_get_attraction_to(LiquidBlob *b, LiquidBlob *other);
+// How much force is needed to attract a blob to other
+HMM_Vec3 blob_get_attraction_to(const HMM_Vec3 *pos, float radius,
+                                const HMM_Vec3 *other_pos, float other_radius);
 
-// How much anti gravitational force is applied to b from other
-float blob_get_support_with(LiquidBlob *b, LiquidBlob *other);
+// How much anti gravitational force is applied to a blob from other
+float blob_get_support_with(const HMM_Vec3 *pos, float radius,
+                            const HMM_Vec3 *other_pos, float other_radius);
 
 // Creates a solid blob if possible and adds it to the simulation. The
 // returned pointer may not always be valid.
 SolidBlob *solid_blob_create(BlobSim *bs);
 
-// Creates a liquid blob if possible and adds it to the simulation. The
-// returned pointer may not always be valid.
-LiquidBlob *liquid_blob_create(BlobSim *bs);
+// Creates a liquid blob if possible and adds it to the simulation. Returns
+// the index of the liquid or -1. The index may not always be valid.
+int liquid_blob_create(BlobSim *bs);
+
+// Creates a projectile if possible and adds it to the simulation. The
+// returned pointer may not always be valid. It has no callback and never runs
+// out by default
+Projectile *projectile_create(BlobSim *bs);
+
+Handle solid_blob_get_handle(const BlobSim *bs, const SolidBlob *b);
+Handle liquid_blob_get_handle(const BlobSim *bs, int bidx);
 
-// Creates a projectile if possible and adds it to the simulation. The returned
-// pointer may not always be valid.
-LiquidBlob *projectile_create(BlobSim *bs);
+Handle projectile_get_handle(const BlobSim *bs, const Projectile *p);
+
+// Returns NULL if the blob has been removed
+SolidBlob *solid_blob_from_handle(BlobSim *bs, Handle h);
+// Returns NULL if the projectile has been removed or has turned into a liquid
+Projectile *projectile_from_handle(BlobSim *bs, Handle h);
+// Returns -1 if the blob has been removed
+int liquid_blob_get_idx(const BlobSim *bs, Handle h);
+
+HMM_Vec3 liquid_blob_get_pos(const BlobSim *bs, int bidx);
+float liquid_blob_get_radius(const BlobSim *bs, int bidx);
+HMM_Vec3 liquid_blob_get_vel(const BlobSim *bs, int bidx);
+// Also wakes the liquid
+void liquid_blob_set_vel(BlobSim *bs, int bidx, const HMM_Vec3 *vel);
+bool liquid_blob_is_asleep(const BlobSim *bs, int bidx);
+LiquidBlobInfo *liquid_blob_get_info(BlobSim *bs, int bidx);
 
 // Updates a solid's radius and position, and updates the octree
 void solid_blob_set_radius_pos(BlobSim *bs, SolidBlob *b, float radius,
                                const HMM_Vec3 *pos);
 
-// Updates a solid's radius and position, and updates the octree
-void liquid_blob_set_radius_pos(BlobSim *bs, LiquidBlob *b, float radius,
+// Between these, solid_ot is not updated when solids are added, moved or
+// removed. It is rebuilt from scratch at the end instead, which is faster when
+// changing many solids at once. Only the bricks of the solid field and the
+// liquids around the solids that changed are marked and woken
+void blob_sim_begin_solid_batch(BlobSim *bs);
+void blob_sim_end_solid_batch(BlobSim *bs);
+
+// Creates solids with the radius, position and material of each of src, and
+// writes their handles. Returns how many were created. The solid field is
+// updated over the next ticks, and collision queries near the new solids use
+// the exact octree query until then
+int solid_blobs_create(BlobSim *bs, const SolidBlob *src, int count,
+                       Handle *handles);
+// Removes solids right away instead of on the next tick. Handles of solids
+// that were already removed are skipped. Like solid_blobs_create, the solid
+// field is updated over the next ticks
+void solid_blobs_remove(BlobSim *bs, const Handle *handles, int count);
+
+// Updates a liquid's radius and position, and updates the octree. Also wakes
+// the liquid
+void liquid_blob_set_radius_pos(BlobSim *bs, int bidx, float radius,
                                 const HMM_Vec3 *pos);
 
+// Wakes every sleeping liquid that overlaps the sphere. Editing solids does
+// this automatically
+void blob_sim_wake_liquids(BlobSim *bs, const HMM_Vec3 *pos, float radius);
+
 // Creates a collider model if possible and adds it to the simulation. The
 // returned pointer may not always be valid.
 ColliderModel *collider_model_add(BlobSim *bs, Entity ent);
@@ -186,18 +456,55 @@ ColliderModel *collider_model_add(BlobSim *bs, Entity ent);
 // Removes the collider model corresponding to the entity
 void collider_model_remove(BlobSim *bs, Entity ent);
 
+Handle collider_model_get_handle(const BlobSim *bs, const ColliderModel *cm);
+
+// Returns NULL if the collider model has been removed
+ColliderModel *collider_model_from_handle(BlobSim *bs, Handle h);
+
 void blob_sim_create(BlobSim *bs);
 void blob_sim_destroy(BlobSim *bs);
 
+// Sets how many threads are used to simulate liquids. 0 uses every logical
+// CPU and 1 simulates everything on the calling thread
+void blob_sim_set_thread_count(BlobSim *bs, int thread_count);
+
+void blob_sim_set_liquid_broadphase(BlobSim *bs, LiquidBroadphase broadphase);
+
 // Queues a blob to be removed at the end of a simulation tick. It is fine to
 // call this multiple times for the same blob
-BlobRemoval *blob_sim_queue_remove(BlobSim *bs, RemovalType type, void *b);
-BlobRemoval *blob_sim_delayed_remove(BlobSim *bs, RemovalType type, void *b,
-                                      double t);
-
-// rd should not be normalized
+void blob_sim_queue_remove(BlobSim *bs, RemovalType type, Handle h);
+// Removes a blob at the end of the first tick that is at least t seconds from
+// now. If the blob already has a pending removal, the earlier one is kept
+void blob_sim_delayed_remove(BlobSim *bs, RemovalType type, Handle h,
+                             double t);
+// Returns false if the blob had no pending removal
+bool blob_sim_cancel_remove(BlobSim *bs, RemovalType type, Handle h);
+
+// Writes the blobs, their handles, octrees, baked solid field, neighbour lists
+// and pending removals to a file. Collider models are not written, since they
+// belong to entities. Should only be called between ticks. Saving the same sim
+// gives the same file, except for the callback pointers of projectiles
+bool blob_sim_save_snapshot(const BlobSim *bs, const char *path);
+// Replaces everything that blob_sim_save_snapshot writes with the contents of
+// a snapshot, which is copied as it is without building or baking anything.
+// Every index in it is checked first, so broken files fail to load instead of
+// being used. Projectiles lose their callbacks. If this fails, the sim may be
+// partly loaded and should be destroyed or loaded again
+bool blob_sim_load_snapshot(BlobSim *bs, const char *path);
+
+// rd should not be normalized. Only the octree leaves along the ray are
+// checked, so this should not be called while blob_simulate is running
 void blob_sim_raycast(RaycastResult *r, const BlobSim *bs, HMM_Vec3 ro,
-                      HMM_Vec3 rd);
+                      HMM_Vec3 rd, RaycastFlags flags);
+
+// Same as calling blob_sim_raycast for every ray, with ro[i] and rd[i] giving
+// results[i]. Rays are traced in packets of 4 that check a leaf's blobs
+// together when they are in the same leaf, so rays that are next to each other
+// in the arrays should start close together and point the same way. Packets
+// are split between the worker threads
+void blob_sim_raycast_batch(RaycastResult *results, BlobSim *bs,
+                            const HMM_Vec3 *ro, const HMM_Vec3 *rd, int count,
+                            RaycastFlags flags);
 
 void blob_simulate(BlobSim *bs, double delta);
 
@@ -205,24 +512,56 @@ void blob_mdl_create(Model *mdl, const ModelBlob *mdl_blob_src,
                      int mdl_blob_count);
 void blob_mdl_destroy(Model *mdl);
 
-// Returns correction vector to separate a blob at pos from solids
+// Returns correction vector to separate a blob at pos from solids. Should not
+// be called while blob_simulate is running
 HMM_Vec3 blob_get_correction_from_solids(BlobSim *bs, const HMM_Vec3 *pos,
                                          float radius);
+// Same as blob_get_correction_from_solids, but always goes through every
+// nearby solid instead of using the distance field
+HMM_Vec3 blob_get_correction_from_solids_exact(BlobSim *bs,
+                                               const HMM_Vec3 *pos,
+                                               float radius);
 
-// Returns how many bytes are needed to fit the worst case octree
-int blob_ot_get_alloc_size();
-
-// Allocates an octree with the max possible size
 void blob_ot_create(BlobOt *bot);
 
 void blob_ot_destroy(BlobOt *bot);
 
 void blob_ot_reset(BlobOt *bot);
 
+// Bytes of the pool that are used by nodes, not counting free blocks
+int blob_ot_get_used_bytes(const BlobOt *bot);
+
 void blob_ot_insert(BlobOt *bot, const HMM_Vec3 *bpos, float bradius, int bidx);
 
+// Replaces the contents of the octree with blobs [0, blob_count), read through
+// get_pos_from_idx and get_radius_from_idx. Blobs without a position yet are
+// skipped. This is much faster than inserting the blobs one at a time
+void blob_ot_build(BlobOt *bot, int blob_count);
+
+// Nodes whose children all become empty are turned back into leaves
 void blob_ot_remove(BlobOt *bot, const HMM_Vec3 *bpos, float bradius, int bidx);
 
+// Changes the index of a blob that is already in the octree
+void blob_ot_replace(BlobOt *bot, const HMM_Vec3 *bpos, float bradius,
+                     int old_bidx, int new_bidx);
+
 void blob_ot_enum_leaves_sphere(BlobOtEnumData *enum_data);
 
 void blob_ot_enum_leaves_cube(BlobOtEnumData *enum_data);
+
+// Returns the pool index of the leaf containing p and sets its center and
+// size, or returns -1 if p is outside of the octree
+int blob_ot_find_leaf(const BlobOt *bot, const HMM_Vec3 *p,
+                      HMM_Vec3 *leaf_pos, float *leaf_size);
+
+// Writes the octree to dst in the layout that compute_sdf.comp reads: nodes
+// in depth first order, with each child stored as an offset from its parent.
+// dst needs room for bot->size_int ints. Returns how many ints were written
+int blob_ot_serialize(const BlobOt *bot, int *dst);
+
+// Writes the pool as it is to a snapshot
+void blob_ot_snapshot_write(const BlobOt *bot, SnapshotWriter *w);
+// Replaces the pool with the one in a snapshot. The callbacks and userdata are
+// kept. Leaves can only hold blobs below blob_count. Returns false if the
+// snapshot is broken
+bool blob_ot_snapshot_read(BlobOt *bot, SnapshotReader *r, int blob_count);
@@ -0,0 +1,301 @@
+#include <math.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "blob.h"
+#include "blob_grid.h"
+#include "core.h"
+
+#define BLOB_GRID_START_CAPACITY 1024
+
+// Cell coordinates are packed into 21 bits each
+#define CELL_COORD_BITS 21
+#define CELL_COORD_BIAS (1 << (CELL_COORD_BITS - 1))
+#define CELL_COORD_MASK ((1 << CELL_COORD_BITS) - 1)
+
+typedef struct CellRange {
+  int min[3];
+  int max[3];
+} CellRange;
+
+static int cell_coord_from_pos(const BlobGrid *grid, float p) {
+  float c = floorf(p / grid->cell_size);
+  c = HMM_Clamp(-CELL_COORD_BIAS, c, CELL_COORD_BIAS - 1);
+  return (int)c;
+}
+
+static void cell_range_from_cube(const BlobGrid *grid, CellRange *range,
+                                 const HMM_Vec3 *pos, float half) {
+  for (int a = 0; a < 3; a++) {
+    range->min[a] = cell_coord_from_pos(grid, pos->Elements[a] - half);
+    range->max[a] = cell_coord_from_pos(grid, pos->Elements[a] + half);
+  }
+}
+
+static uint64_t cell_key(int x, int y, int z) {
+  return ((uint64_t)((x + CELL_COORD_BIAS) & CELL_COORD_MASK)
+          << (CELL_COORD_BITS * 2)) |
+         ((uint64_t)((y + CELL_COORD_BIAS) & CELL_COORD_MASK)
+          << CELL_COORD_BITS) |
+         (uint64_t)((z + CELL_COORD_BIAS) & CELL_COORD_MASK);
+}
+
+static void cell_coords_from_key(uint64_t key, int *c) {
+  c[0] = (int)((key >> (CELL_COORD_BITS * 2)) & CELL_COORD_MASK) -
+         CELL_COORD_BIAS;
+  c[1] = (int)((key >> CELL_COORD_BITS) & CELL_COORD_MASK) - CELL_COORD_BIAS;
+  c[2] = (int)(key & CELL_COORD_MASK) - CELL_COORD_BIAS;
+}
+
+static int table_slot_from_key(const BlobGrid *grid, uint64_t key) {
+  // Fibonacci hashing, table_capacity is a power of two
+  return (int)((key * 0x9E3779B97F4A7C15ull) >> 32) &
+         (grid->table_capacity - 1);
+}
+
+// Returns the cell index or -1
+static int blob_grid_find_cell(const BlobGrid *grid, uint64_t key) {
+  int slot = table_slot_from_key(grid, key);
+  for (;;) {
+    int cell = grid->table[slot];
+    if (cell == -1 || grid->cell_keys[cell] == key) {
+      return cell;
+    }
+    slot = (slot + 1) & (grid->table_capacity - 1);
+  }
+}
+
+// Creates the cell if it doesn't exist yet
+static int blob_grid_get_cell(BlobGrid *grid, uint64_t key) {
+  int slot = table_slot_from_key(grid, key);
+  for (;;) {
+    int cell = grid->table[slot];
+    if (cell == -1) {
+      break;
+    }
+    if (grid->cell_keys[cell] == key) {
+      return cell;
+    }
+    slot = (slot + 1) & (grid->table_capacity - 1);
+  }
+
+  if (grid->cell_count >= grid->cell_capacity) {
+    grid->cell_capacity *= 2;
+    grid->cell_keys = realloc_mem(grid->cell_keys,
+                                  grid->cell_capacity * sizeof(uint64_t));
+    grid->cell_offsets =
+        realloc_mem(grid->cell_offsets, grid->cell_capacity * sizeof(int));
+    grid->cell_blob_counts =
+        realloc_mem(grid->cell_blob_counts, grid->cell_capacity * sizeof(int));
+  }
+
+  int cell = grid->cell_count++;
+  grid->cell_keys[cell] = key;
+  grid->cell_blob_counts[cell] = 0;
+  grid->table[slot] = cell;
+  return cell;
+}
+
+void blob_grid_create(BlobGrid *grid, float cell_size) {
+  grid->cell_size = cell_size;
+  grid->max_dist_to_leaf = 0.0f;
+
+  grid->capacity_int = BLOB_GRID_START_CAPACITY;
+  grid->root = alloc_mem(grid->capacity_int * sizeof(int));
+  grid->size_int = 0;
+
+  grid->cell_count = 0;
+  grid->cell_capacity = BLOB_GRID_START_CAPACITY;
+  grid->cell_keys = alloc_mem(grid->cell_capacity * sizeof(uint64_t));
+  grid->cell_offsets = alloc_mem(grid->cell_capacity * sizeof(int));
+  grid->cell_blob_counts = alloc_mem(grid->cell_capacity * sizeof(int));
+
+  grid->table_capacity = BLOB_GRID_START_CAPACITY * 2;
+  grid->table = alloc_mem(grid->table_capacity * sizeof(int));
+  memset(grid->table, 0xFF, grid->table_capacity * sizeof(int));
+
+  grid->pair_capacity = BLOB_GRID_START_CAPACITY;
+  grid->pair_cells = alloc_mem(grid->pair_capacity * sizeof(int));
+}
+
+void blob_grid_destroy(BlobGrid *grid) {
+  free_mem(grid->root);
+  free_mem(grid->cell_keys);
+  free_mem(grid->cell_offsets);
+  free_mem(grid->cell_blob_counts);
+  free_mem(grid->table);
+  free_mem(grid->pair_cells);
+  grid->root = NULL;
+}
+
+static void blob_grid_blob_range(const BlobGrid *grid, CellRange *range,
+                                 float x, float y, float z, float radius) {
+  HMM_Vec3 pos = HMM_V3(x, y, z);
+  float half = radius + BLOB_SMOOTH + grid->max_dist_to_leaf;
+  cell_range_from_cube(grid, range, &pos, half);
+}
+
+void blob_grid_build(BlobGrid *grid, const float *x, const float *y,
+                     const float *z, const float *radius, int count) {
+  // Count the pairs first so that nothing has to grow while adding them
+  int pair_count = 0;
+  for (int i = 0; i < count; i++) {
+    if (isinf(x[i]))
+      continue;
+
+    CellRange r;
+    blob_grid_blob_range(grid, &r, x[i], y[i], z[i], radius[i]);
+    pair_count += (r.max[0] - r.min[0] + 1) * (r.max[1] - r.min[1] + 1) *
+                  (r.max[2] - r.min[2] + 1);
+  }
+
+  if (pair_count > grid->pair_capacity) {
+    while (grid->pair_capacity < pair_count) {
+      grid->pair_capacity *= 2;
+    }
+    grid->pair_cells =
+        realloc_mem(grid->pair_cells, grid->pair_capacity * sizeof(int));
+  }
+
+  // There can't be more cells than pairs. Keep the table at most half full
+  if (pair_count * 2 > grid->table_capacity) {
+    while (grid->table_capacity < pair_count * 2) {
+      grid->table_capacity *= 2;
+    }
+    free_mem(grid->table);
+    grid->table = alloc_mem(grid->table_capacity * sizeof(int));
+  }
+  memset(grid->table, 0xFF, grid->table_capacity * sizeof(int));
+  grid->cell_count = 0;
+
+  // Find the cell of every pair and count the blobs in each cell
+  int p = 0;
+  for (int i = 0; i < count; i++) {
+    if (isinf(x[i]))
+      continue;
+
+    CellRange r;
+    blob_grid_blob_range(grid, &r, x[i], y[i], z[i], radius[i]);
+    for (int cx = r.min[0]; cx <= r.max[0]; cx++) {
+      for (int cy = r.min[1]; cy <= r.max[1]; cy++) {
+        for (int cz = r.min[2]; cz <= r.max[2]; cz++) {
+          int cell = blob_grid_get_cell(grid, cell_key(cx, cy, cz));
+          grid->cell_blob_counts[cell]++;
+          grid->pair_cells[p++] = cell;
+        }
+      }
+    }
+  }
+
+  int size_int = grid->cell_count + pair_count;
+  if (size_int > grid->capacity_int) {
+    while (grid->capacity_int < size_int) {
+      grid->capacity_int *= 2;
+    }
+    free_mem(grid->root);
+    grid->root = alloc_mem(grid->capacity_int * sizeof(int));
+  }
+  grid->size_int = size_int;
+
+  // Lay out the cells in the order they were created. The blob counts are
+  // filled in again while adding the blobs
+  int offset = 0;
+  for (int c = 0; c < grid->cell_count; c++) {
+    grid->cell_offsets[c] = offset;
+    offset += 1 + grid->cell_blob_counts[c];
+    grid->root[grid->cell_offsets[c]] = 0;
+  }
+
+  p = 0;
+  for (int i = 0; i < count; i++) {
+    if (isinf(x[i]))
+      continue;
+
+    CellRange r;
+    blob_grid_blob_range(grid, &r, x[i], y[i], z[i], radius[i]);
+    int cells_in_range = (r.max[0] - r.min[0] + 1) *
+                         (r.max[1] - r.min[1] + 1) * (r.max[2] - r.min[2] + 1);
+    for (int j = 0; j < cells_in_range; j++) {
+      BlobOtNode *leaf =
+          (BlobOtNode *)&grid->root[grid->cell_offsets[grid->pair_cells[p++]]];
+      leaf->offsets[leaf->leaf_blob_count++] = i;
+    }
+  }
+}
+
+// Returns false if the callback wants to stop
+static bool blob_grid_visit_cell(const BlobGrid *grid,
+                                 BlobOtEnumData *enum_data, int cell) {
+  int c[3];
+  cell_coords_from_key(grid->cell_keys[cell], c);
+  HMM_Vec3 cpos;
+  for (int a = 0; a < 3; a++) {
+    cpos.Elements[a] = ((float)c[a] + 0.5f) * grid->cell_size;
+  }
+
+  enum_data->curr_leaf = (BlobOtNode *)&grid->root[grid->cell_offsets[cell]];
+  enum_data->curr_leaf_depth = 0;
+  enum_data->curr_leaf_pos = &cpos;
+  enum_data->curr_leaf_size = grid->cell_size;
+  enum_data->node_stack = NULL;
+  return enum_data->callback(enum_data);
+}
+
+static void blob_grid_enum_range(const BlobGrid *grid,
+                                 BlobOtEnumData *enum_data,
+                                 const CellRange *r) {
+  int64_t range_cells = (int64_t)(r->max[0] - r->min[0] + 1) *
+                        (r->max[1] - r->min[1] + 1) *
+                        (r->max[2] - r->min[2] + 1);
+
+  // Big ranges are cheaper to check against every existing cell
+  if (range_cells > grid->cell_count) {
+    for (int cell = 0; cell < grid->cell_count; cell++) {
+      int c[3];
+      cell_coords_from_key(grid->cell_keys[cell], c);
+      bool inside = true;
+      for (int a = 0; a < 3; a++) {
+        inside &= c[a] >= r->min[a] && c[a] <= r->max[a];
+      }
+      if (inside && !blob_grid_visit_cell(grid, enum_data, cell)) {
+        return;
+      }
+    }
+    return;
+  }
+
+  for (int cx = r->min[0]; cx <= r->max[0]; cx++) {
+    for (int cy = r->min[1]; cy <= r->max[1]; cy++) {
+      for (int cz = r->min[2]; cz <= r->max[2]; cz++) {
+        int cell = blob_grid_find_cell(grid, cell_key(cx, cy, cz));
+        if (cell != -1 && !blob_grid_visit_cell(grid, enum_data, cell)) {
+          return;
+        }
+      }
+    }
+  }
+}
+
+void blob_grid_enum_leaves_sphere(const BlobGrid *grid,
+                                  BlobOtEnumData *enum_data) {
+  // Like the octree, this checks the cube around the sphere
+  CellRange r;
+  cell_range_from_cube(grid, &r, &enum_data->shape_pos,
+                       enum_data->shape_size);
+  blob_grid_enum_range(grid, enum_data, &r);
+}
+
+void blob_grid_enum_leaves_cube(const BlobGrid *grid,
+                                BlobOtEnumData *enum_data) {
+  CellRange r;
+  cell_range_from_cube(grid, &r, &enum_data->shape_pos,
+                       enum_data->shape_size * 0.5f);
+  blob_grid_enum_range(grid, enum_data, &r);
+}
+
+int blob_grid_get_size_bytes(const BlobGrid *grid) {
+  return grid->capacity_int * sizeof(int) +
+         grid->cell_capacity * (sizeof(uint64_t) + sizeof(int) * 2) +
+         grid->table_capacity * sizeof(int) +
+         grid->pair_capacity * sizeof(int);
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "HandmadeMath.h"
+
+typedef struct BlobOtEnumData BlobOtEnumData;
+
+// Uniform grid of blobs that is rebuilt from scratch every time instead of
+// being edited. Cells are stored the same way as octree leaves, so octree leaf
+// callbacks also work with the grid
+typedef struct BlobGrid {
+  float cell_size;
+  // Like BlobOt, blobs are added to every cell this close to them
+  float max_dist_to_leaf;
+
+  // Every cell with blobs in it, as a leaf blob count followed by blob indices
+  int *root;
+  int size_int;
+  int capacity_int;
+
+  int cell_count;
+  int cell_capacity;
+  uint64_t *cell_keys;
+  // Where each cell starts in root
+  int *cell_offsets;
+  int *cell_blob_counts;
+
+  // Open addressed map from cell keys to cell indices, -1 if empty
+  int *table;
+  int table_capacity;
+
+  // The cell of every blob and cell pair, in blob order
+  int *pair_cells;
+  int pair_capacity;
+} BlobGrid;
+
+void blob_grid_create(BlobGrid *grid, float cell_size);
+void blob_grid_destroy(BlobGrid *grid);
+
+// Replaces everything in the grid. Blobs with an infinite x position are
+// skipped
+void blob_grid_build(BlobGrid *grid, const float *x, const float *y,
+                     const float *z, const float *radius, int count);
+
+// Same as blob_ot_enum_leaves_sphere and blob_ot_enum_leaves_cube, except
+// enum_data->bot is not used and curr_leaf_depth and node_stack are not set
+void blob_grid_enum_leaves_sphere(const BlobGrid *grid,
+                                  BlobOtEnumData *enum_data);
+void blob_grid_enum_leaves_cube(const BlobGrid *grid,
+                                BlobOtEnumData *enum_data);
+
+int blob_grid_get_size_bytes(const BlobGrid *grid);
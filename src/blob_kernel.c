@@ -0,0 +1,398 @@
+#include <math.h>
+#include <stdbool.h>
+
+#include "blob.h"
+#include "blob_kernel.h"
+
+#if defined(_M_X64) || defined(__x86_64__)
+#define BLOB_KERNEL_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+// MSVC allows AVX2 intrinsics in any function
+#define TARGET_AVX2
+#else
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#endif
+
+typedef HMM_Vec3 (*AttractionSumFunc)(const HMM_Vec3 *pos, float radius,
+                                      const BlobKernelBlobs *others,
+                                      int start);
+typedef void (*SminDistX4Func)(const float *px, const float *py,
+                               const float *pz, const BlobKernelBlobs *blobs,
+                               float smooth, float *dist, int *closest);
+
+// Used for the whole array at the scalar level and for the leftover blobs
+// at the other levels
+static HMM_Vec3 attraction_sum_scalar(const HMM_Vec3 *pos, float radius,
+                                      const BlobKernelBlobs *others,
+                                      int start) {
+  HMM_Vec3 sum = {0};
+  for (int i = start; i < others->count; i++) {
+    HMM_Vec3 o_pos = HMM_V3(others->x[i], others->y[i], others->z[i]);
+    HMM_Vec3 attraction =
+        blob_get_attraction_to(pos, radius, &o_pos, others->radius[i]);
+    sum = HMM_AddV3(sum, attraction);
+  }
+  return sum;
+}
+
+static void smin_dist_x4_scalar(const float *px, const float *py,
+                                const float *pz, const BlobKernelBlobs *blobs,
+                                float smooth, float *dist, int *closest) {
+  for (int l = 0; l < 4; l++) {
+    float value = 100000.0f;
+    float closest_d = 100000.0f;
+    closest[l] = -1;
+    for (int i = 0; i < blobs->count; i++) {
+      float dx = px[l] - blobs->x[i];
+      float dy = py[l] - blobs->y[i];
+      float dz = pz[l] - blobs->z[i];
+      float d = sqrtf(dx * dx + dy * dy + dz * dz) - blobs->radius[i];
+
+      float h = 0.5f + 0.5f * (d - value) / smooth;
+      h = h < 0.0f ? 0.0f : h > 1.0f ? 1.0f : h;
+      value = d * (1.0f - h) + value * h - smooth * h * (1.0f - h);
+
+      if (d < closest_d) {
+        closest_d = d;
+        closest[l] = i;
+      }
+    }
+    dist[l] = value;
+  }
+}
+
+#ifdef BLOB_KERNEL_X86
+
+// Cephes logf polynomial, x * (x - 1)^2 * P(x - 1)
+static const float log_coeffs[9] = {
+    7.0376836292E-2f,  -1.1514610310E-1f, 1.1676998740E-1f,
+    -1.2420140846E-1f, 1.4249322787E-1f,  -1.6668057665E-1f,
+    2.0000714765E-1f,  -2.4999993993E-1f, 3.3333331174E-1f};
+
+#define LOG_SQRTHF 0.707106781186547524f
+#define LOG_Q1 -2.12194440e-4f
+#define LOG_Q2 0.693359375f
+
+// Only valid for positive, normal x
+static __m128 log_sse(__m128 x) {
+  const __m128 one = _mm_set1_ps(1.0f);
+
+  // Split x into a mantissa in [0.5, 1) and an exponent
+  __m128i exp_i = _mm_srli_epi32(_mm_castps_si128(x), 23);
+  exp_i = _mm_sub_epi32(exp_i, _mm_set1_epi32(0x7e));
+  __m128 e = _mm_cvtepi32_ps(exp_i);
+  x = _mm_and_ps(x, _mm_castsi128_ps(_mm_set1_epi32(~0x7f800000)));
+  x = _mm_or_ps(x, _mm_set1_ps(0.5f));
+
+  // Keep the mantissa in [sqrt(0.5), sqrt(2)) to stay accurate
+  __m128 below = _mm_cmplt_ps(x, _mm_set1_ps(LOG_SQRTHF));
+  e = _mm_sub_ps(e, _mm_and_ps(one, below));
+  x = _mm_add_ps(_mm_sub_ps(x, one), _mm_and_ps(x, below));
+
+  __m128 z = _mm_mul_ps(x, x);
+  __m128 y = _mm_set1_ps(log_coeffs[0]);
+  for (int i = 1; i < 9; i++) {
+    y = _mm_add_ps(_mm_mul_ps(y, x), _mm_set1_ps(log_coeffs[i]));
+  }
+  y = _mm_mul_ps(_mm_mul_ps(y, x), z);
+
+  y = _mm_add_ps(y, _mm_mul_ps(e, _mm_set1_ps(LOG_Q1)));
+  y = _mm_sub_ps(y, _mm_mul_ps(z, _mm_set1_ps(0.5f)));
+  x = _mm_add_ps(x, y);
+  return _mm_add_ps(x, _mm_mul_ps(e, _mm_set1_ps(LOG_Q2)));
+}
+
+static HMM_Vec3 attraction_sum_sse(const HMM_Vec3 *pos, float radius,
+                                   const BlobKernelBlobs *others, int start) {
+  const __m128 zero = _mm_setzero_ps();
+  const __m128 one = _mm_set1_ps(1.0f);
+  const __m128 abs_mask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+
+  __m128 px = _mm_set1_ps(pos->X);
+  __m128 py = _mm_set1_ps(pos->Y);
+  __m128 pz = _mm_set1_ps(pos->Z);
+  __m128 r = _mm_set1_ps(radius);
+
+  __m128 sum_x = zero;
+  __m128 sum_y = zero;
+  __m128 sum_z = zero;
+
+  int i = start;
+  for (; i + 4 <= others->count; i += 4) {
+    __m128 o_radius = _mm_loadu_ps(others->radius + i);
+    __m128 dx = _mm_sub_ps(px, _mm_loadu_ps(others->x + i));
+    __m128 dy = _mm_sub_ps(py, _mm_loadu_ps(others->y + i));
+    __m128 dz = _mm_sub_ps(pz, _mm_loadu_ps(others->z + i));
+
+    __m128 len_sq = _mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy));
+    __m128 len = _mm_sqrt_ps(_mm_add_ps(len_sq, _mm_mul_ps(dz, dz)));
+
+    __m128 desired_dist =
+        _mm_mul_ps(_mm_add_ps(r, o_radius), _mm_set1_ps(0.4f));
+    __m128 x = _mm_and_ps(_mm_sub_ps(desired_dist, len), abs_mask);
+
+    __m128 k = _mm_max_ps(one, _mm_div_ps(o_radius, _mm_set1_ps(0.5f)));
+    k = _mm_mul_ps(_mm_set1_ps(-50.0f), k);
+    __m128 arg = _mm_mul_ps(_mm_mul_ps(k, x), _mm_sub_ps(x, desired_dist));
+    arg = _mm_add_ps(arg, one);
+
+    // log(arg) is only positive when arg > 1
+    __m128 valid = _mm_and_ps(
+        _mm_cmpneq_ps(len, zero),
+        _mm_cmple_ps(x, _mm_mul_ps(desired_dist, _mm_set1_ps(2.0f))));
+    valid = _mm_and_ps(valid, _mm_cmpgt_ps(arg, one));
+    if (_mm_movemask_ps(valid) == 0)
+      continue;
+
+    __m128 power = log_sse(_mm_max_ps(arg, one));
+    __m128 inv_len = _mm_div_ps(one, len);
+
+    __m128 ax = _mm_mul_ps(_mm_mul_ps(dx, inv_len), power);
+    __m128 ay = _mm_mul_ps(_mm_mul_ps(dy, inv_len), power);
+    __m128 az = _mm_mul_ps(_mm_mul_ps(dz, inv_len), power);
+    // Blobs only fall with gravity
+    ay = _mm_max_ps(ay, zero);
+
+    sum_x = _mm_add_ps(sum_x, _mm_and_ps(ax, valid));
+    sum_y = _mm_add_ps(sum_y, _mm_and_ps(ay, valid));
+    sum_z = _mm_add_ps(sum_z, _mm_and_ps(az, valid));
+  }
+
+  float lanes[3][4];
+  _mm_storeu_ps(lanes[0], sum_x);
+  _mm_storeu_ps(lanes[1], sum_y);
+  _mm_storeu_ps(lanes[2], sum_z);
+
+  HMM_Vec3 sum = attraction_sum_scalar(pos, radius, others, i);
+  for (int c = 0; c < 3; c++) {
+    float *l = lanes[c];
+    sum.Elements[c] += (l[0] + l[1]) + (l[2] + l[3]);
+  }
+  return sum;
+}
+
+// The points go in the lanes, so every blob is only loaded once
+static void smin_dist_x4_sse(const float *px, const float *py,
+                             const float *pz, const BlobKernelBlobs *blobs,
+                             float smooth, float *dist, int *closest) {
+  const __m128 zero = _mm_setzero_ps();
+  const __m128 one = _mm_set1_ps(1.0f);
+  const __m128 half = _mm_set1_ps(0.5f);
+  const __m128 k = _mm_set1_ps(smooth);
+
+  __m128 x = _mm_loadu_ps(px);
+  __m128 y = _mm_loadu_ps(py);
+  __m128 z = _mm_loadu_ps(pz);
+
+  __m128 value = _mm_set1_ps(100000.0f);
+  __m128 closest_d = value;
+  __m128i closest_i = _mm_set1_epi32(-1);
+
+  for (int i = 0; i < blobs->count; i++) {
+    __m128 dx = _mm_sub_ps(x, _mm_set1_ps(blobs->x[i]));
+    __m128 dy = _mm_sub_ps(y, _mm_set1_ps(blobs->y[i]));
+    __m128 dz = _mm_sub_ps(z, _mm_set1_ps(blobs->z[i]));
+    __m128 len_sq = _mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy));
+    __m128 d = _mm_sub_ps(_mm_sqrt_ps(_mm_add_ps(len_sq, _mm_mul_ps(dz, dz))),
+                          _mm_set1_ps(blobs->radius[i]));
+
+    __m128 h =
+        _mm_add_ps(half, _mm_div_ps(_mm_mul_ps(half, _mm_sub_ps(d, value)), k));
+    h = _mm_min_ps(_mm_max_ps(h, zero), one);
+    __m128 inv_h = _mm_sub_ps(one, h);
+    value = _mm_sub_ps(
+        _mm_add_ps(_mm_mul_ps(d, inv_h), _mm_mul_ps(value, h)),
+        _mm_mul_ps(_mm_mul_ps(k, h), inv_h));
+
+    __m128 closer = _mm_cmplt_ps(d, closest_d);
+    closest_d =
+        _mm_or_ps(_mm_and_ps(closer, d), _mm_andnot_ps(closer, closest_d));
+    __m128i closer_i = _mm_castps_si128(closer);
+    closest_i =
+        _mm_or_si128(_mm_and_si128(closer_i, _mm_set1_epi32(i)),
+                     _mm_andnot_si128(closer_i, closest_i));
+  }
+
+  _mm_storeu_ps(dist, value);
+  _mm_storeu_si128((__m128i *)closest, closest_i);
+}
+
+TARGET_AVX2 static __m256 log_avx2(__m256 x) {
+  const __m256 one = _mm256_set1_ps(1.0f);
+
+  __m256i exp_i = _mm256_srli_epi32(_mm256_castps_si256(x), 23);
+  exp_i = _mm256_sub_epi32(exp_i, _mm256_set1_epi32(0x7e));
+  __m256 e = _mm256_cvtepi32_ps(exp_i);
+  x = _mm256_and_ps(x, _mm256_castsi256_ps(_mm256_set1_epi32(~0x7f800000)));
+  x = _mm256_or_ps(x, _mm256_set1_ps(0.5f));
+
+  __m256 below = _mm256_cmp_ps(x, _mm256_set1_ps(LOG_SQRTHF), _CMP_LT_OQ);
+  e = _mm256_sub_ps(e, _mm256_and_ps(one, below));
+  x = _mm256_add_ps(_mm256_sub_ps(x, one), _mm256_and_ps(x, below));
+
+  __m256 z = _mm256_mul_ps(x, x);
+  __m256 y = _mm256_set1_ps(log_coeffs[0]);
+  for (int i = 1; i < 9; i++) {
+    y = _mm256_add_ps(_mm256_mul_ps(y, x), _mm256_set1_ps(log_coeffs[i]));
+  }
+  y = _mm256_mul_ps(_mm256_mul_ps(y, x), z);
+
+  y = _mm256_add_ps(y, _mm256_mul_ps(e, _mm256_set1_ps(LOG_Q1)));
+  y = _mm256_sub_ps(y, _mm256_mul_ps(z, _mm256_set1_ps(0.5f)));
+  x = _mm256_add_ps(x, y);
+  return _mm256_add_ps(x, _mm256_mul_ps(e, _mm256_set1_ps(LOG_Q2)));
+}
+
+TARGET_AVX2 static HMM_Vec3 attraction_sum_avx2(const HMM_Vec3 *pos,
+                                                float radius,
+                                                const BlobKernelBlobs *others,
+                                                int start) {
+  const __m256 zero = _mm256_setzero_ps();
+  const __m256 one = _mm256_set1_ps(1.0f);
+  const __m256 abs_mask = _mm256_castsi256_ps(_mm256_set1_epi32(0x7fffffff));
+
+  __m256 px = _mm256_set1_ps(pos->X);
+  __m256 py = _mm256_set1_ps(pos->Y);
+  __m256 pz = _mm256_set1_ps(pos->Z);
+  __m256 r = _mm256_set1_ps(radius);
+
+  __m256 sum_x = zero;
+  __m256 sum_y = zero;
+  __m256 sum_z = zero;
+
+  int i = start;
+  for (; i + 8 <= others->count; i += 8) {
+    __m256 o_radius = _mm256_loadu_ps(others->radius + i);
+    __m256 dx = _mm256_sub_ps(px, _mm256_loadu_ps(others->x + i));
+    __m256 dy = _mm256_sub_ps(py, _mm256_loadu_ps(others->y + i));
+    __m256 dz = _mm256_sub_ps(pz, _mm256_loadu_ps(others->z + i));
+
+    __m256 len_sq = _mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy));
+    __m256 len = _mm256_sqrt_ps(_mm256_add_ps(len_sq, _mm256_mul_ps(dz, dz)));
+
+    __m256 desired_dist =
+        _mm256_mul_ps(_mm256_add_ps(r, o_radius), _mm256_set1_ps(0.4f));
+    __m256 x = _mm256_and_ps(_mm256_sub_ps(desired_dist, len), abs_mask);
+
+    __m256 k =
+        _mm256_max_ps(one, _mm256_div_ps(o_radius, _mm256_set1_ps(0.5f)));
+    k = _mm256_mul_ps(_mm256_set1_ps(-50.0f), k);
+    __m256 arg =
+        _mm256_mul_ps(_mm256_mul_ps(k, x), _mm256_sub_ps(x, desired_dist));
+    arg = _mm256_add_ps(arg, one);
+
+    __m256 valid = _mm256_and_ps(
+        _mm256_cmp_ps(len, zero, _CMP_NEQ_UQ),
+        _mm256_cmp_ps(x, _mm256_mul_ps(desired_dist, _mm256_set1_ps(2.0f)),
+                      _CMP_LE_OQ));
+    valid = _mm256_and_ps(valid, _mm256_cmp_ps(arg, one, _CMP_GT_OQ));
+    if (_mm256_movemask_ps(valid) == 0)
+      continue;
+
+    __m256 power = log_avx2(_mm256_max_ps(arg, one));
+    __m256 inv_len = _mm256_div_ps(one, len);
+
+    __m256 ax = _mm256_mul_ps(_mm256_mul_ps(dx, inv_len), power);
+    __m256 ay = _mm256_mul_ps(_mm256_mul_ps(dy, inv_len), power);
+    __m256 az = _mm256_mul_ps(_mm256_mul_ps(dz, inv_len), power);
+    ay = _mm256_max_ps(ay, zero);
+
+    sum_x = _mm256_add_ps(sum_x, _mm256_and_ps(ax, valid));
+    sum_y = _mm256_add_ps(sum_y, _mm256_and_ps(ay, valid));
+    sum_z = _mm256_add_ps(sum_z, _mm256_and_ps(az, valid));
+  }
+
+  float lanes[3][8];
+  _mm256_storeu_ps(lanes[0], sum_x);
+  _mm256_storeu_ps(lanes[1], sum_y);
+  _mm256_storeu_ps(lanes[2], sum_z);
+
+  // Fewer than 8 left, which the SSE version can still mostly handle
+  HMM_Vec3 sum = attraction_sum_sse(pos, radius, others, i);
+  for (int c = 0; c < 3; c++) {
+    float *l = lanes[c];
+    sum.Elements[c] +=
+        ((l[0] + l[1]) + (l[2] + l[3])) + ((l[4] + l[5]) + (l[6] + l[7]));
+  }
+  return sum;
+}
+
+#endif // BLOB_KERNEL_X86
+
+static BlobKernelLevel kernel_level = BLOB_KERNEL_SCALAR;
+static AttractionSumFunc attraction_sum_func = attraction_sum_scalar;
+static SminDistX4Func smin_dist_x4_func = smin_dist_x4_scalar;
+
+void blob_kernel_init() {
+  blob_kernel_set_level(blob_kernel_get_supported_level());
+}
+
+BlobKernelLevel blob_kernel_get_supported_level() {
+#ifndef BLOB_KERNEL_X86
+  return BLOB_KERNEL_SCALAR;
+#elif defined(_MSC_VER)
+  int info[4];
+  __cpuid(info, 0);
+  int max_leaf = info[0];
+
+  // The OS also has to save the AVX registers
+  __cpuid(info, 1);
+  bool avx = (info[2] & (1 << 27)) && (info[2] & (1 << 28)) &&
+             (_xgetbv(0) & 6) == 6;
+
+  bool avx2 = false;
+  if (avx && max_leaf >= 7) {
+    __cpuidex(info, 7, 0);
+    avx2 = (info[1] & (1 << 5)) != 0;
+  }
+
+  // SSE2 is always there on x64
+  return avx2 ? BLOB_KERNEL_AVX2 : BLOB_KERNEL_SSE;
+#else
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("avx2") ? BLOB_KERNEL_AVX2 : BLOB_KERNEL_SSE;
+#endif
+}
+
+BlobKernelLevel blob_kernel_get_level() { return kernel_level; }
+
+void blob_kernel_set_level(BlobKernelLevel level) {
+  BlobKernelLevel supported = blob_kernel_get_supported_level();
+  if (level > supported) {
+    level = supported;
+  }
+
+  kernel_level = level;
+  switch (level) {
+#ifdef BLOB_KERNEL_X86
+  case BLOB_KERNEL_AVX2:
+    attraction_sum_func = attraction_sum_avx2;
+    // Only 4 points are checked at once, which fits in SSE
+    smin_dist_x4_func = smin_dist_x4_sse;
+    break;
+  case BLOB_KERNEL_SSE:
+    attraction_sum_func = attraction_sum_sse;
+    smin_dist_x4_func = smin_dist_x4_sse;
+    break;
+#endif
+  default:
+    kernel_level = BLOB_KERNEL_SCALAR;
+    attraction_sum_func = attraction_sum_scalar;
+    smin_dist_x4_func = smin_dist_x4_scalar;
+    break;
+  }
+}
+
+HMM_Vec3 blob_kernel_attraction_sum(const HMM_Vec3 *pos, float radius,
+                                    const BlobKernelBlobs *others) {
+  return attraction_sum_func(pos, radius, others, 0);
+}
+
+void blob_kernel_smin_dist_x4(const float *px, const float *py,
+                              const float *pz, const BlobKernelBlobs *blobs,
+                              float smooth, float *dist, int *closest) {
+  smin_dist_x4_func(px, py, pz, blobs, smooth, dist, closest);
+}
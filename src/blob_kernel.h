@@ -0,0 +1,47 @@
+#pragma once
+
+#include "HandmadeMath.h"
+
+// Vectorized versions of the per pair liquid functions in blob.h. The SSE and
+// AVX2 versions use a polynomial logf and sum the pairs in a different order,
+// so their sums differ from the scalar version by less than 1e-5 of the summed
+// length of the attractions (about 1e-6 in practice). goop_bench -m kernel
+// checks this
+
+typedef enum BlobKernelLevel {
+  BLOB_KERNEL_SCALAR,
+  BLOB_KERNEL_SSE,
+  BLOB_KERNEL_AVX2,
+  BLOB_KERNEL_LEVEL_MAX
+} BlobKernelLevel;
+
+// Blobs stored as separate arrays so that several can be loaded at once
+typedef struct BlobKernelBlobs {
+  const float *x;
+  const float *y;
+  const float *z;
+  const float *radius;
+  int count;
+} BlobKernelBlobs;
+
+// Picks the best level supported by the CPU
+void blob_kernel_init();
+
+BlobKernelLevel blob_kernel_get_supported_level();
+BlobKernelLevel blob_kernel_get_level();
+// Levels that the CPU does not support are lowered to the supported level
+void blob_kernel_set_level(BlobKernelLevel level);
+
+// Sum of blob_get_attraction_to for the blob against every blob in others.
+// Blobs at the exact same position contribute nothing, so others can contain
+// the blob itself
+HMM_Vec3 blob_kernel_attraction_sum(const HMM_Vec3 *pos, float radius,
+                                    const BlobKernelBlobs *others);
+
+// Smoothed distance from each of 4 points to the blobs, folded with the same
+// smooth minimum as blob_sim_raycast. closest gets the index in blobs of the
+// closest sphere to each point, or -1 if there are no blobs. Every level gives
+// the same result, since the points are what is vectorized
+void blob_kernel_smin_dist_x4(const float *px, const float *py,
+                              const float *pz, const BlobKernelBlobs *blobs,
+                              float smooth, float *dist, int *closest);
@@ -16,6 +16,9 @@
 #include "shader.h"
 #include "shader_sources.h"
 
+// Blob buffers start with room for this many blobs
+#define BLOB_RENDER_START_CAPACITY 4096
+
 // Request dedicated GPU
 __declspec(dllexport) unsigned long NvOptimusEnablement = 1;
 __declspec(dllexport) int AmdPowerXpressRequestHighPerformance = 1;
@@ -52,32 +55,33 @@ void blob_renderer_create(BlobRenderer *br) {
                BLOB_MODEL_SDF_RES, BLOB_MODEL_SDF_RES, 0, GL_RGBA,
                GL_UNSIGNED_BYTE, NULL);
 
-  br->solids_ssbo_size_bytes = sizeof(HMM_Vec4) * BLOB_SIM_MAX_SOLIDS;
+  br->solids_ssbo_size_bytes = sizeof(HMM_Vec4) * BLOB_RENDER_START_CAPACITY;
   glGenBuffers(1, &br->solids_ssbo);
   glBindBuffer(GL_SHADER_STORAGE_BUFFER, br->solids_ssbo);
   glBufferData(GL_SHADER_STORAGE_BUFFER, br->solids_ssbo_size_bytes, NULL,
                GL_DYNAMIC_DRAW);
 
-  br->liquids_ssbo_size_bytes = sizeof(HMM_Vec4) * BLOB_SIM_MAX_LIQUIDS;
+  br->liquids_ssbo_size_bytes = sizeof(HMM_Vec4) * BLOB_RENDER_START_CAPACITY;
   glGenBuffers(1, &br->liquids_ssbo);
   glBindBuffer(GL_SHADER_STORAGE_BUFFER, br->liquids_ssbo);
   glBufferData(GL_SHADER_STORAGE_BUFFER, br->liquids_ssbo_size_bytes, NULL,
                GL_DYNAMIC_DRAW);
 
-  br->solid_ot_ssbo_size_bytes = 2400000 * sizeof(int);
+  // Octree buffers get their storage when they are first uploaded
+  br->solid_ot_ssbo_size_bytes = 0;
   glGenBuffers(1, &br->solid_ot_ssbo);
-  glBindBuffer(GL_SHADER_STORAGE_BUFFER, br->solid_ot_ssbo);
-  glBufferData(GL_SHADER_STORAGE_BUFFER, br->solid_ot_ssbo_size_bytes, NULL,
-               GL_DYNAMIC_DRAW);
 
-  br->liquid_ot_ssbo_size_bytes = 2400000 * sizeof(int);
+  br->liquid_ot_ssbo_size_bytes = 0;
   glGenBuffers(1, &br->liquid_ot_ssbo);
-  glBindBuffer(GL_SHADER_STORAGE_BUFFER, br->liquid_ot_ssbo);
-  glBufferData(GL_SHADER_STORAGE_BUFFER, br->liquid_ot_ssbo_size_bytes, NULL,
-               GL_DYNAMIC_DRAW);
 
-  br->solids_v4 = alloc_mem(BLOB_SIM_MAX_SOLIDS * sizeof(*br->solids_v4));
-  br->liquids_v4 = alloc_mem(BLOB_SIM_MAX_LIQUIDS * sizeof(*br->liquids_v4));
+  br->solids_v4_capacity = BLOB_RENDER_START_CAPACITY;
+  br->solids_v4 = alloc_mem(br->solids_v4_capacity * sizeof(*br->solids_v4));
+  br->liquids_v4_capacity = BLOB_RENDER_START_CAPACITY;
+  br->liquids_v4 =
+      alloc_mem(br->liquids_v4_capacity * sizeof(*br->liquids_v4));
+
+  br->ot_upload = NULL;
+  br->ot_upload_capacity_int = 0;
 
   {
     Resource img;
@@ -130,7 +134,25 @@ void blob_renderer_create(BlobRenderer *br) {
 }
 
 void blob_renderer_destroy(BlobRenderer *br) {
-  // TODO
+  free_mem(br->solids_v4);
+  br->solids_v4 = NULL;
+  free_mem(br->liquids_v4);
+  br->liquids_v4 = NULL;
+  free_mem(br->ot_upload);
+  br->ot_upload = NULL;
+  br->ot_upload_capacity_int = 0;
+
+  unsigned int textures[] = {
+      br->sdf_sim_solid_tex, br->sdf_sim_liquid_tex,     br->sdf_mdl_tex,
+      br->water_tex,         br->water_norm_tex,         br->screen_color_tex,
+      br->screen_depth_stencil_tex};
+  glDeleteTextures(ARR_SIZE(textures), textures);
+  unsigned int buffers[] = {br->solids_ssbo, br->liquids_ssbo,
+                            br->solid_ot_ssbo, br->liquid_ot_ssbo};
+  glDeleteBuffers(ARR_SIZE(buffers), buffers);
+  glDeleteFramebuffers(1, &br->screen_fbo);
+  glDeleteProgram(br->raymarch_program);
+  glDeleteProgram(br->compute_program);
 }
 
 void blob_renderer_update_framebuffer(BlobRenderer *br) {
@@ -208,8 +230,69 @@ void blob_render_start(BlobRenderer *br) {
   glUniform2f(7, (float)global.win_width, (float)global.win_height);
 }
 
+// Serializes bot and uploads it to ssbo, which is bound to binding 1. If
+// second is not NULL, it is serialized right after bot and the offset where it
+// starts is returned. Otherwise, -1 is returned. The buffer grows to the
+// capacity of the octrees' pools when it is too small
+static int blob_render_upload_ot(BlobRenderer *br, unsigned int ssbo,
+                                 int *ssbo_size_bytes, const BlobOt *bot,
+                                 const BlobOt *second) {
+  int size_int = bot->size_int + (second ? second->size_int : 0);
+  int capacity_int = bot->capacity_int + (second ? second->capacity_int : 0);
+  if (size_int > br->ot_upload_capacity_int) {
+    br->ot_upload_capacity_int = capacity_int;
+    free_mem(br->ot_upload);
+    br->ot_upload = alloc_mem(br->ot_upload_capacity_int * sizeof(int));
+  }
+
+  size_int = blob_ot_serialize(bot, br->ot_upload);
+  int second_offset = -1;
+  if (second) {
+    second_offset = size_int;
+    size_int += blob_ot_serialize(second, br->ot_upload + second_offset);
+  }
+
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, ssbo);
+  if (size_int * (int)sizeof(int) > *ssbo_size_bytes) {
+    *ssbo_size_bytes = capacity_int * sizeof(int);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, *ssbo_size_bytes, NULL,
+                 GL_DYNAMIC_DRAW);
+  }
+  glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, size_int * sizeof(int),
+                  br->ot_upload);
+  return second_offset;
+}
+
+// Grows a staging array so that it can hold count blobs
+static void blob_render_reserve_v4(HMM_Vec4 **v4, int *capacity, int count) {
+  if (count <= *capacity) {
+    return;
+  }
+
+  while (*capacity < count) {
+    *capacity *= 2;
+  }
+  *v4 = realloc_mem(*v4, *capacity * sizeof(**v4));
+}
+
+// Uploads count blobs to ssbo, which is bound to binding 0. The buffer grows
+// to the capacity of the staging array when it is too small
+static void blob_render_upload_blobs(unsigned int ssbo, int *ssbo_size_bytes,
+                                     const HMM_Vec4 *v4, int count,
+                                     int capacity) {
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, ssbo);
+  if (count * (int)sizeof(*v4) > *ssbo_size_bytes) {
+    *ssbo_size_bytes = capacity * sizeof(*v4);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, *ssbo_size_bytes, NULL,
+                 GL_DYNAMIC_DRAW);
+  }
+  glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, count * sizeof(*v4), v4);
+}
+
 void blob_render_sim(BlobRenderer *br, const BlobSim *bs) {
   // Solids
+  blob_render_reserve_v4(&br->solids_v4, &br->solids_v4_capacity,
+                         bs->solids.count);
   for (int i = 0; i < bs->solids.count; i++) {
     const SolidBlob *b = fixed_array_get_const(&bs->solids, i);
 
@@ -219,23 +302,32 @@ void blob_render_sim(BlobRenderer *br, const BlobSim *bs) {
                 b->mat_idx);
   }
 
-  // Liquids
-  for (int i = 0; i < bs->liquids.count; i++) {
-    const LiquidBlob *b = fixed_array_get_const(&bs->liquids, i);
-
-    br->liquids_v4[i].XYZ = b->pos;
+  // Liquids, and then projectiles, which are drawn together with them
+  const LiquidStore *ls = &bs->liquids;
+  int liquid_blob_count = ls->count + bs->projectiles.count;
+  blob_render_reserve_v4(&br->liquids_v4, &br->liquids_v4_capacity,
+                         liquid_blob_count);
+  for (int i = 0; i < ls->count; i++) {
+    br->liquids_v4[i].XYZ = HMM_V3(ls->pos_x[i], ls->pos_y[i], ls->pos_z[i]);
     br->liquids_v4[i].W =
-        (float)((int)(b->radius * BLOB_RADIUS_MULT) * BLOB_MAT_COUNT +
-                b->mat_idx);
+        (float)((int)(ls->radius[i] * BLOB_RADIUS_MULT) * BLOB_MAT_COUNT +
+                ls->info[i].mat_idx);
+  }
+  for (int i = 0; i < bs->projectiles.count; i++) {
+    const Projectile *p = fixed_array_get_const(&bs->projectiles, i);
+
+    br->liquids_v4[ls->count + i].XYZ = p->pos;
+    br->liquids_v4[ls->count + i].W =
+        (float)((int)(p->radius * BLOB_RADIUS_MULT) * BLOB_MAT_COUNT +
+                p->mat_idx);
   }
 
   // Solids
-  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, br->solids_ssbo);
-  glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, br->solids_ssbo_size_bytes,
-                  br->solids_v4);
-  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, br->solid_ot_ssbo);
-  glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0,
-                  bs->solid_ot.size_int * sizeof(int), bs->solid_ot.root);
+  blob_render_upload_blobs(br->solids_ssbo, &br->solids_ssbo_size_bytes,
+                           br->solids_v4, bs->solids.count,
+                           br->solids_v4_capacity);
+  blob_render_upload_ot(br, br->solid_ot_ssbo, &br->solid_ot_ssbo_size_bytes,
+                        &bs->solid_ot, NULL);
   glBindImageTexture(0, br->sdf_sim_solid_tex, 0, GL_TRUE, 0, GL_WRITE_ONLY,
                      GL_RGBA8);
   glUseProgram(br->compute_program);
@@ -246,17 +338,18 @@ void blob_render_sim(BlobRenderer *br, const BlobSim *bs) {
   glUniform1f(4, BLOB_SDF_MAX_DIST);
   glUniform1f(5, BLOB_SMOOTH);
   glUniform1f(6, bs->solid_ot.root_size);
+  glUniform1i(7, -1);
   glDispatchCompute(BLOB_SIM_SDF_RES / BLOB_SDF_LOCAL_GROUP_COUNT_X,
                     BLOB_SIM_SDF_RES / BLOB_SDF_LOCAL_GROUP_COUNT_Y,
                     BLOB_SIM_SDF_RES / BLOB_SDF_LOCAL_GROUP_COUNT_Z);
 
   // Liquids
-  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, br->liquids_ssbo);
-  glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, br->liquids_ssbo_size_bytes,
-                  br->liquids_v4);
-  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, br->liquid_ot_ssbo);
-  glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0,
-                  bs->liquid_ot.size_int * sizeof(int), bs->liquid_ot.root);
+  blob_render_upload_blobs(br->liquids_ssbo, &br->liquids_ssbo_size_bytes,
+                           br->liquids_v4, liquid_blob_count,
+                           br->liquids_v4_capacity);
+  int projectile_ot_offset = blob_render_upload_ot(
+      br, br->liquid_ot_ssbo, &br->liquid_ot_ssbo_size_bytes, &bs->liquid_ot,
+      &bs->projectile_ot);
   glBindImageTexture(0, br->sdf_sim_liquid_tex, 0, GL_TRUE, 0, GL_WRITE_ONLY,
                      GL_RGBA8);
   glUseProgram(br->compute_program);
@@ -267,6 +360,8 @@ void blob_render_sim(BlobRenderer *br, const BlobSim *bs) {
   glUniform1f(4, BLOB_SDF_MAX_DIST);
   glUniform1f(5, BLOB_SMOOTH);
   glUniform1f(6, bs->liquid_ot.root_size);
+  glUniform1i(7, projectile_ot_offset);
+  glUniform1i(8, ls->count);
   glDispatchCompute(BLOB_SIM_SDF_RES / BLOB_SDF_LOCAL_GROUP_COUNT_X,
                     BLOB_SIM_SDF_RES / BLOB_SDF_LOCAL_GROUP_COUNT_Y,
                     BLOB_SIM_SDF_RES / BLOB_SDF_LOCAL_GROUP_COUNT_Z);
@@ -16,8 +16,15 @@ typedef struct BlobRenderer {
 
   HMM_Mat4 cam_trans, view_mat, proj_mat;
 
+  // Blobs are staged here before being uploaded. These and the blob buffers
+  // grow with the number of blobs
   HMM_Vec4 *solids_v4;
   HMM_Vec4 *liquids_v4;
+  int solids_v4_capacity, liquids_v4_capacity;
+
+  // Octrees are serialized here before being uploaded
+  int *ot_upload;
+  int ot_upload_capacity_int;
 } BlobRenderer;
 
 typedef struct BlobSim BlobSim;
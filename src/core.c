@@ -1,19 +1,39 @@
+#ifndef _WIN32
+// For MAP_ANONYMOUS
+#define _DEFAULT_SOURCE
+#endif
+
 #include <stdio.h>
 #include <stdlib.h>
 
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <Windows.h>
+#else
+#include <sys/mman.h>
+#include <time.h>
+#endif
+
+#ifndef GOOP_HEADLESS
 #include <GLFW/glfw3.h>
+#endif
 
 #include "core.h"
 
 Global global;
 
 void exit_fatal_error() {
+#ifdef GOOP_HEADLESS
+  // Nobody is there to press enter
+  fprintf(stderr, "FATAL ERROR\n");
+#else
   fprintf(stderr, "FATAL ERROR. Press enter to exit\n");
 
   // If GLFW isn't terminated, the window will be frozen
   glfwTerminate();
 
   (void)getchar();
+#endif
   exit(-1);
 }
 
@@ -28,6 +48,70 @@ void *alloc_mem(size_t n) {
   return mem;
 }
 
+void *realloc_mem(void *mem, size_t n) {
+  void *new_mem = realloc(mem, n);
+  if (!new_mem) {
+    fprintf(stderr, "Failed to reallocate %zu bytes of memory\n", n);
+    exit_fatal_error();
+    return NULL;
+  }
+
+  return new_mem;
+}
+
 void free_mem(void *mem) { free(mem); }
 
-float rand_float() { return ((float)rand() / (float)(RAND_MAX)); }
\ No newline at end of file
+void *reserve_mem(size_t n) {
+#ifdef _WIN32
+  void *mem = VirtualAlloc(NULL, n, MEM_RESERVE, PAGE_NOACCESS);
+#else
+  void *mem = mmap(NULL, n, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (mem == MAP_FAILED) {
+    mem = NULL;
+  }
+#endif
+  if (!mem) {
+    fprintf(stderr, "Failed to reserve %zu bytes of memory\n", n);
+    exit_fatal_error();
+  }
+
+  return mem;
+}
+
+void commit_mem(void *mem, size_t n) {
+#ifdef _WIN32
+  bool ok = VirtualAlloc(mem, n, MEM_COMMIT, PAGE_READWRITE) != NULL;
+#else
+  bool ok = mprotect(mem, n, PROT_READ | PROT_WRITE) == 0;
+#endif
+  if (!ok) {
+    fprintf(stderr, "Failed to commit %zu bytes of memory\n", n);
+    exit_fatal_error();
+  }
+}
+
+void release_mem(void *mem, size_t n) {
+  if (!mem) {
+    return;
+  }
+#ifdef _WIN32
+  VirtualFree(mem, 0, MEM_RELEASE);
+#else
+  munmap(mem, n);
+#endif
+}
+
+float rand_float() { return ((float)rand() / (float)(RAND_MAX)); }
+
+double get_time() {
+#ifdef _WIN32
+  LARGE_INTEGER freq, counter;
+  QueryPerformanceFrequency(&freq);
+  QueryPerformanceCounter(&counter);
+  return (double)counter.QuadPart / (double)freq.QuadPart;
+#else
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+#endif
+}
\ No newline at end of file
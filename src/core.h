@@ -30,6 +30,29 @@ void exit_fatal_error();
 // Allocates n bytes. Exits on failure
 void *alloc_mem(size_t n);
 
+// Resizes mem to n bytes. Exits on failure
+void *realloc_mem(void *mem, size_t n);
+
 void free_mem(void *mem);
 
+// Reserves n bytes of address space without using any memory. Exits on
+// failure. Memory has to be committed before it is used, and it stays at the
+// same address for as long as it is reserved
+void *reserve_mem(size_t n);
+
+// Commits n bytes of reserved memory starting at mem, which has to be aligned
+// to MEM_COMMIT_ALIGN. The memory is zeroed. Exits on failure
+void commit_mem(void *mem, size_t n);
+
+// Frees memory from reserve_mem. n is the size that was reserved
+void release_mem(void *mem, size_t n);
+
+// Committed memory is allocated in blocks of this many bytes. This is at least
+// the page size on every platform
+#define MEM_COMMIT_ALIGN 65536
+
 float rand_float();
+
+// Seconds since some point in the past. Only useful for measuring how long
+// something takes, and works without GLFW
+double get_time();
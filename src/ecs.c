@@ -30,6 +30,10 @@ Entity entity_create() {
 
 void entity_destroy(Entity e) {
   for (int i = 0; i < COMPONENT_MAX; i++) {
+    // Programs like goop_bench don't register every component
+    if (!registered_components[i].components.data) {
+      continue;
+    }
     if (entity_get_component_or_null(e, i)) {
       entity_remove_component(e, i);
     }
@@ -91,7 +95,7 @@ EntityComponent *component_begin(ComponentType type) {
 
 EntityComponent *component_next(ComponentType type, EntityComponent *ec) {
   RegisteredComponent *rc = &registered_components[type];
-  return (char *)ec + rc->components.element_size;
+  return (EntityComponent *)((char *)ec + rc->components.element_size);
 }
 
 EntityComponent *component_end(ComponentType type) {
@@ -7,8 +7,10 @@
 #include "editor.h"
 #include "goop.h"
 #include "level.h"
+#include "level_stream.h"
 
 #define CAM_SPEED 4.0f
+#define REGION_SIZE 32.0f
 
 enum EditorState { STATE_NONE, STATE_MOVE, STATE_RESIZE, STATE_MATERIAL };
 
@@ -46,6 +48,10 @@ static void editor_save(Editor *editor) {
   fprintf(f, "]\n");
 
   fclose(f);
+
+  // The same solids split into regions, so the level can also be streamed
+  level_regions_write("assets/_editor_out.blrg", solids->data, solids->count,
+                      REGION_SIZE);
 }
 
 static void editor_open(Editor *editor) {
@@ -79,7 +85,7 @@ static void editor_open(Editor *editor) {
 static void editor_move_update(Editor *editor) {
   GoopEngine *goop = editor->goop;
 
-  SolidBlob *b = fixed_array_get(&goop->bs.solids, editor->selected);
+  SolidBlob *b = solid_blob_from_handle(&goop->bs, editor->selected);
 
   HMM_Vec3 rel = {0};
   rel = HMM_AddV3(rel, HMM_MulV4F(goop->br.cam_trans.Columns[0],
@@ -107,7 +113,7 @@ void editor_input(Entity ent, InputEvent *event) {
     if (event->key.key == GLFW_KEY_ESCAPE) {
       if (editor->state == STATE_MOVE) {
         // Reset position of selection
-        SolidBlob *b = fixed_array_get(&goop->bs.solids, editor->selected);
+        SolidBlob *b = solid_blob_from_handle(&goop->bs, editor->selected);
         solid_blob_set_radius_pos(&goop->bs, b, b->radius,
                                   &editor->move.start_pos);
       }
@@ -118,8 +124,8 @@ void editor_input(Entity ent, InputEvent *event) {
 
     if (editor->state == STATE_MATERIAL) {
       if (event->key.key >= GLFW_KEY_0 && event->key.key <= GLFW_KEY_9) {
-        if (editor->selected != -1) {
-          SolidBlob *b = fixed_array_get(&goop->bs.solids, editor->selected);
+        if (editor->selected != HANDLE_NULL) {
+          SolidBlob *b = solid_blob_from_handle(&goop->bs, editor->selected);
           b->mat_idx = event->key.key - GLFW_KEY_0;
         }
       }
@@ -174,20 +180,20 @@ void editor_input(Entity ent, InputEvent *event) {
         if (b) {
           solid_blob_set_radius_pos(&goop->bs, b, 0.5, &pos);
           b->mat_idx = 1;
-          editor->selected = fixed_array_get_idx_from_ptr(&goop->bs.solids, b);
+          editor->selected = solid_blob_get_handle(&goop->bs, b);
           editor->state = STATE_NONE;
         }
         break;
       }
       case GLFW_KEY_D: {
-        if (editor->selected == -1)
+        if (editor->selected == HANDLE_NULL)
           break;
-        SolidBlob *o = fixed_array_get(&goop->bs.solids, editor->selected);
+        SolidBlob *o = solid_blob_from_handle(&goop->bs, editor->selected);
         SolidBlob *b = solid_blob_create(&goop->bs);
         if (b) {
           solid_blob_set_radius_pos(&goop->bs, b, o->radius, &o->pos);
           b->mat_idx = o->mat_idx;
-          editor->selected = fixed_array_get_idx_from_ptr(&goop->bs.solids, b);
+          editor->selected = solid_blob_get_handle(&goop->bs, b);
           editor->state = STATE_MOVE;
         }
         break;
@@ -199,10 +205,10 @@ void editor_input(Entity ent, InputEvent *event) {
       return;
     }
 
-    if (editor->selected == -1)
+    if (editor->selected == HANDLE_NULL)
       return;
 
-    SolidBlob *b = fixed_array_get(&goop->bs.solids, editor->selected);
+    SolidBlob *b = solid_blob_from_handle(&goop->bs, editor->selected);
 
     switch (event->key.key) {
     case GLFW_KEY_G:
@@ -219,8 +225,8 @@ void editor_input(Entity ent, InputEvent *event) {
       editor->state = STATE_MATERIAL;
       break;
     case GLFW_KEY_X:
-      blob_sim_queue_remove(&editor->goop->bs, REMOVE_SOLID, b);
-      editor->selected = -1;
+      blob_sim_queue_remove(&editor->goop->bs, REMOVE_SOLID, editor->selected);
+      editor->selected = HANDLE_NULL;
       break;
     default:
       break;
@@ -262,20 +268,21 @@ void editor_input(Entity ent, InputEvent *event) {
 
       RaycastResult result;
       blob_sim_raycast(&result, &goop->bs, start.XYZ,
-                       HMM_SubV3(end.XYZ, start.XYZ));
+                       HMM_SubV3(end.XYZ, start.XYZ), RAYCAST_SOLIDS);
 
       if (result.has_hit) {
-        editor->selected = result.blob_idx;
+        editor->selected = solid_blob_get_handle(
+            &goop->bs, fixed_array_get(&goop->bs.solids, result.blob_idx));
       } else {
-        editor->selected = -1;
+        editor->selected = HANDLE_NULL;
       }
     }
   } else if (event->type == INPUT_MOUSE_MOTION) {
-    if (editor->selected == -1) {
+    if (editor->selected == HANDLE_NULL) {
       return;
     }
 
-    SolidBlob *b = fixed_array_get(&goop->bs.solids, editor->selected);
+    SolidBlob *b = solid_blob_from_handle(&goop->bs, editor->selected);
 
     if (editor->state == STATE_MOVE) {
       editor->move.relx += event->mouse_motion.relx;
@@ -296,7 +303,7 @@ void editor_init(GoopEngine* goop) {
   Editor *editor = entity_add_component(editor_ent, COMPONENT_EDITOR);
   editor->goop = goop;
   editor->state = STATE_NONE;
-  editor->selected = -1;
+  editor->selected = HANDLE_NULL;
   editor->selected_text_box_ent = entity_create();
   TextBox *text_box =
       entity_add_component(editor->selected_text_box_ent, COMPONENT_TEXT_BOX);
@@ -354,9 +361,14 @@ void editor_process(Entity ent) {
   cam_trans->Columns[3].XYZ = cam_pos;
   goop->bs.active_pos = cam_pos;
 
+  // The selected blob might have been removed
+  if (!solid_blob_from_handle(&goop->bs, editor->selected)) {
+    editor->selected = HANDLE_NULL;
+  }
+
   TextBox *text_box =
       entity_get_component(editor->selected_text_box_ent, COMPONENT_TEXT_BOX);
-  if (editor->selected != -1) {
+  if (editor->selected != HANDLE_NULL) {
     const char *action = "";
     switch (editor->state) {
     case STATE_NONE:
@@ -373,12 +385,12 @@ void editor_process(Entity ent) {
       break;
     }
 
-    SolidBlob *b = fixed_array_get(&goop->bs.solids, editor->selected);
+    SolidBlob *b = solid_blob_from_handle(&goop->bs, editor->selected);
     snprintf(editor->selected_text, sizeof(editor->selected_text),
              "Selected: %d\nPos: (%.2f, %.2f, %.2f)\nRadius: %.2f\nMaterial: "
              "%d\n\n%s",
-             editor->selected, b->pos.X, b->pos.Y, b->pos.Z, b->radius,
-             b->mat_idx, action);
+             fixed_array_get_idx_from_ptr(&goop->bs.solids, b), b->pos.X,
+             b->pos.Y, b->pos.Z, b->radius, b->mat_idx, action);
 
     text_box->text = editor->selected_text;
   } else {
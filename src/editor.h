@@ -3,6 +3,7 @@
 #include "HandmadeMath.h"
 
 #include "core.h"
+#include "handle_table.h"
 
 typedef struct GoopEngine GoopEngine;
 
@@ -23,7 +24,7 @@ typedef struct Editor {
       MoveAxis axis;
     } move;
   };
-  int selected;
+  Handle selected;
   char selected_text[128];
   Entity selected_text_box_ent;
 } Editor;
@@ -57,13 +57,13 @@ void floater_process(Entity ent) {
   if (floater->shoot_timer <= 0.0) {
     floater->shoot_timer = SHOOT_CD;
 
-    LiquidBlob *p = projectile_create(global.blob_sim);
+    Projectile *p = projectile_create(global.blob_sim);
     if (p) {
       p->mat_idx = 0;
       p->vel = HMM_MulV3F(trans->Columns[2].XYZ, -20.0f);
-      liquid_blob_set_radius_pos(global.blob_sim, p, 0.2f,
-                                 &trans->Columns[3].XYZ);
-      blob_sim_delayed_remove(global.blob_sim, REMOVE_LIQUID, p, 1.0);
+      p->pos = trans->Columns[3].XYZ;
+      p->radius = 0.2f;
+      p->lifetime = 1.0f;
     }
   }
 }
\ No newline at end of file
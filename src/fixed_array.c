@@ -3,28 +3,37 @@
 
 #include "core.h"
 #include "fixed_array.h"
+#include "snapshot.h"
+
+static size_t fixed_array_reserved_bytes(const FixedArray *a) {
+  size_t bytes = (size_t)a->element_size * a->capacity;
+  return (bytes + MEM_COMMIT_ALIGN - 1) / MEM_COMMIT_ALIGN * MEM_COMMIT_ALIGN;
+}
 
 void fixed_array_create(FixedArray* a, int element_size, int capacity) {
   a->element_size = element_size;
   a->capacity = capacity;
   a->count = 0;
 
-  a->data = alloc_mem(element_size * capacity);
+  a->data = reserve_mem(fixed_array_reserved_bytes(a));
+  a->committed_bytes = 0;
 }
 
 void fixed_array_destroy(FixedArray *a) {
+  release_mem(a->data, fixed_array_reserved_bytes(a));
   a->capacity = 0;
   a->count = 0;
+  a->committed_bytes = 0;
 
   a->data = NULL;
 }
 
 void *fixed_array_get(FixedArray *a, int idx) {
-  return (char *)a->data + idx * a->element_size;
+  return (char *)a->data + (size_t)idx * a->element_size;
 }
 
 const void *fixed_array_get_const(const FixedArray *a, int idx) {
-  return (const char *)a->data + idx * a->element_size;
+  return (const char *)a->data + (size_t)idx * a->element_size;
 }
 
 int fixed_array_get_idx_from_ptr(const FixedArray *a, const void *element) {
@@ -36,6 +45,12 @@ void *fixed_array_append(FixedArray *a, void *element) {
     return NULL;
   }
 
+  size_t needed = (size_t)(a->count + 1) * a->element_size;
+  while (needed > a->committed_bytes) {
+    commit_mem((char *)a->data + a->committed_bytes, MEM_COMMIT_ALIGN);
+    a->committed_bytes += MEM_COMMIT_ALIGN;
+  }
+
   if (element != NULL) {
     memcpy(fixed_array_get(a, a->count), element, a->element_size);
   }
@@ -48,3 +63,36 @@ void fixed_array_remove(FixedArray* a, int idx) {
   memmove(fixed_array_get(a, idx), fixed_array_get(a, idx + 1), cpy_size);
   a->count--;
 }
+
+void fixed_array_remove_swap(FixedArray *a, int idx) {
+  int last_idx = a->count - 1;
+  if (idx != last_idx) {
+    memcpy(fixed_array_get(a, idx), fixed_array_get(a, last_idx),
+           a->element_size);
+  }
+  a->count--;
+}
+
+void fixed_array_snapshot_write(const FixedArray *a, SnapshotWriter *w) {
+  snapshot_write(w, &a->count, sizeof(a->count));
+  snapshot_write(w, a->data, (size_t)a->count * a->element_size);
+}
+
+bool fixed_array_snapshot_read(FixedArray *a, SnapshotReader *r) {
+  int count;
+  if (!snapshot_read_into(r, &count, sizeof(count)) || count < 0 ||
+      count > a->capacity) {
+    return false;
+  }
+
+  size_t needed = (size_t)count * a->element_size;
+  while (needed > a->committed_bytes) {
+    commit_mem((char *)a->data + a->committed_bytes, MEM_COMMIT_ALIGN);
+    a->committed_bytes += MEM_COMMIT_ALIGN;
+  }
+  if (!snapshot_read_into(r, a->data, needed)) {
+    return false;
+  }
+  a->count = count;
+  return true;
+}
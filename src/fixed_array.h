@@ -1,10 +1,21 @@
 #pragma once
 
+#include <stdbool.h>
+#include <stddef.h>
+
+typedef struct SnapshotWriter SnapshotWriter;
+typedef struct SnapshotReader SnapshotReader;
+
+// Array with a maximum capacity. Address space for every element is reserved
+// up front, but memory is only committed as the array grows, so elements never
+// move and a large capacity costs nothing until it is used
 typedef struct FixedArray {
   int element_size;
   int capacity;
   int count;
   void *data;
+  // Bytes of data that are backed by memory
+  size_t committed_bytes;
 } FixedArray;
 
 void fixed_array_create(FixedArray *a, int element_size, int capacity);
@@ -23,3 +34,13 @@ void *fixed_array_append(FixedArray *a, void *element);
 
 // Removes specified index and resizes the array
 void fixed_array_remove(FixedArray *a, int idx);
+
+// Removes specified index by moving the last element into its place. This
+// doesn't keep the order of the elements
+void fixed_array_remove_swap(FixedArray *a, int idx);
+
+// Writes the elements of the array to a snapshot
+void fixed_array_snapshot_write(const FixedArray *a, SnapshotWriter *w);
+// Replaces the elements with the ones in a snapshot. Returns false if they
+// don't fit or the snapshot is broken
+bool fixed_array_snapshot_read(FixedArray *a, SnapshotReader *r);
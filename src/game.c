@@ -5,9 +5,18 @@
 #include "resource.h"
 #include "resource_load.h"
 
+// Levels that are too big to load at once are streamed from a region file
+#define LEVEL_REGIONS_PATH "assets/level.blrg"
+#define LEVEL_REGION_LOAD_RADIUS 1
+#define LEVEL_REGION_MAX_IN_USE 64
+
 void game_init(GoopEngine *goop) {
+  goop->level_streaming =
+      level_stream_open(&goop->level_stream, LEVEL_REGIONS_PATH,
+                        LEVEL_REGION_LOAD_RADIUS, LEVEL_REGION_MAX_IN_USE);
+
   // Load test level
-  {
+  if (!goop->level_streaming) {
     Resource blvl_rsrc;
     resource_load(&blvl_rsrc, IDS_TEST, "BLVL");
     level_load(&goop->bs, blvl_rsrc.data, blvl_rsrc.data_size);
@@ -177,6 +177,7 @@ void goop_create(GoopEngine *goop) {
 
   blob_sim_create(&goop->bs);
   global.blob_sim = &goop->bs;
+  goop->level_streaming = false;
 
   // Create primitive buffers before creating renderers
   primitives_create_buffers();
@@ -192,6 +193,9 @@ void goop_create(GoopEngine *goop) {
 void goop_destroy(GoopEngine *goop) {
   skybox_destroy(&goop->skybox);
 
+  if (goop->level_streaming) {
+    level_stream_close(&goop->level_stream);
+  }
   blob_sim_destroy(&goop->bs);
   blob_renderer_destroy(&goop->br);
 
@@ -236,6 +240,9 @@ void goop_main_loop(GoopEngine *goop) {
 
     // Simulate blobs
 
+    if (goop->level_streaming)
+      level_stream_update(&goop->level_stream, &goop->bs);
+
     if (blob_sim_running)
       blob_simulate(&goop->bs, delta);
 
@@ -281,8 +288,12 @@ void goop_main_loop(GoopEngine *goop) {
     blob_render_sim(&goop->br, &goop->bs);
 
     int mem_bytes = 0;
-    mem_bytes += goop->bs.solid_ot.size_int * 4;
-    mem_bytes += goop->bs.liquid_ot.size_int * 4;
+    mem_bytes += blob_ot_get_used_bytes(&goop->bs.solid_ot);
+    mem_bytes += blob_ot_get_used_bytes(&goop->bs.liquid_ot);
+    mem_bytes += solid_field_get_size_bytes(&goop->bs.solid_field);
+    if (goop->bs.liquid_broadphase == LIQUID_BROADPHASE_GRID) {
+      mem_bytes += goop->bs.liquid_grid.size_int * 4;
+    }
     double mem_mb = mem_bytes / 1000000.0;
 
     char perf_text[256];
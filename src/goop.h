@@ -5,6 +5,7 @@
 #include "blob.h"
 #include "blob_render.h"
 #include "core.h"
+#include "level_stream.h"
 #include "skybox.h"
 #include "text.h"
 
@@ -13,6 +14,9 @@ typedef struct GLFWwindow GLFWwindow;
 typedef struct GoopEngine {
   GLFWwindow *window;
   BlobSim bs;
+  // Only used when the level is streamed from a region file
+  LevelStream level_stream;
+  bool level_streaming;
   BlobRenderer br;
   Skybox skybox;
   TextRenderer txtr;
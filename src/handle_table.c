@@ -0,0 +1,183 @@
+#include <stdbool.h>
+#include <string.h>
+
+#include "core.h"
+#include "handle_table.h"
+#include "snapshot.h"
+
+#define HANDLE_TABLE_START_CAPACITY 256
+
+// Adds more free slots. Returns false if the table is at max_capacity
+static bool handle_table_grow(HandleTable *ht) {
+  if (ht->capacity >= ht->max_capacity) {
+    return false;
+  }
+
+  int old_capacity = ht->capacity;
+  ht->capacity = old_capacity ? old_capacity * 2 : HANDLE_TABLE_START_CAPACITY;
+  if (ht->capacity > ht->max_capacity) {
+    ht->capacity = ht->max_capacity;
+  }
+  ht->slots = realloc_mem(ht->slots, ht->capacity * sizeof(*ht->slots));
+  ht->idx_to_slot =
+      realloc_mem(ht->idx_to_slot, ht->capacity * sizeof(*ht->idx_to_slot));
+
+  // The table only grows when there are no free slots, so the new slots
+  // become the whole free list
+  for (int i = old_capacity; i < ht->capacity; i++) {
+    ht->slots[i].idx = i + 1 < ht->capacity ? i + 1 : -1;
+    // Generation 0 is never used so that HANDLE_NULL is never valid
+    ht->slots[i].gen = 1;
+  }
+  ht->free_slot = old_capacity;
+  return true;
+}
+
+void handle_table_create(HandleTable *ht, int max_capacity) {
+  ht->capacity = 0;
+  ht->max_capacity = max_capacity;
+  ht->slots = NULL;
+  ht->idx_to_slot = NULL;
+  ht->free_slot = -1;
+}
+
+void handle_table_destroy(HandleTable *ht) {
+  free_mem(ht->slots);
+  free_mem(ht->idx_to_slot);
+  ht->slots = NULL;
+  ht->idx_to_slot = NULL;
+  ht->capacity = 0;
+  ht->max_capacity = 0;
+  ht->free_slot = -1;
+}
+
+Handle handle_table_add(HandleTable *ht, int idx) {
+  if (ht->free_slot == -1 && !handle_table_grow(ht)) {
+    return HANDLE_NULL;
+  }
+
+  int slot = ht->free_slot;
+  HandleSlot *s = &ht->slots[slot];
+  ht->free_slot = s->idx;
+  s->idx = idx;
+  ht->idx_to_slot[idx] = slot;
+
+  return ((Handle)s->gen << 32) | (uint32_t)slot;
+}
+
+int handle_table_get_idx(const HandleTable *ht, Handle h) {
+  uint32_t slot = (uint32_t)h;
+  uint32_t gen = (uint32_t)(h >> 32);
+  if (slot >= (uint32_t)ht->capacity) {
+    return -1;
+  }
+
+  const HandleSlot *s = &ht->slots[slot];
+  if (s->gen != gen) {
+    return -1;
+  }
+  return s->idx;
+}
+
+Handle handle_table_get_handle(const HandleTable *ht, int idx) {
+  int slot = ht->idx_to_slot[idx];
+  return ((Handle)ht->slots[slot].gen << 32) | (uint32_t)slot;
+}
+
+void handle_table_remove_swap(HandleTable *ht, int idx, int last_idx) {
+  int slot = ht->idx_to_slot[idx];
+  HandleSlot *s = &ht->slots[slot];
+
+  if (idx != last_idx) {
+    int moved_slot = ht->idx_to_slot[last_idx];
+    ht->slots[moved_slot].idx = idx;
+    ht->idx_to_slot[idx] = moved_slot;
+  }
+
+  s->gen++;
+  if (s->gen == 0) {
+    s->gen = 1;
+  }
+  s->idx = ht->free_slot;
+  ht->free_slot = slot;
+}
+
+void handle_table_snapshot_write(const HandleTable *ht, SnapshotWriter *w,
+                                 int count) {
+  int header[2] = {ht->capacity, ht->free_slot};
+  snapshot_write(w, header, sizeof(header));
+  snapshot_write(w, ht->slots, ht->capacity * sizeof(*ht->slots));
+  // Entries past count were never set, and would make saves of the same sim
+  // differ
+  snapshot_write(w, ht->idx_to_slot, count * sizeof(*ht->idx_to_slot));
+}
+
+// Checks that every slot is either free or used by exactly one element
+static bool handle_table_is_valid(const HandleTable *ht, int count) {
+  if (count > ht->capacity || ht->free_slot < -1 ||
+      ht->free_slot >= ht->capacity) {
+    return false;
+  }
+
+  if (ht->capacity == 0) {
+    return true;
+  }
+
+  bool *seen = alloc_mem(ht->capacity * sizeof(*seen));
+  memset(seen, 0, ht->capacity * sizeof(*seen));
+  bool ok = true;
+  for (int i = 0; ok && i < count; i++) {
+    int slot = ht->idx_to_slot[i];
+    ok = slot >= 0 && slot < ht->capacity && !seen[slot] &&
+         ht->slots[slot].idx == i;
+    if (ok) {
+      seen[slot] = true;
+    }
+  }
+  int free_count = 0;
+  int slot = ht->free_slot;
+  while (ok && slot != -1) {
+    ok = slot >= 0 && slot < ht->capacity && !seen[slot];
+    if (ok) {
+      seen[slot] = true;
+      free_count++;
+      slot = ht->slots[slot].idx;
+    }
+  }
+  free_mem(seen);
+  return ok && count + free_count == ht->capacity;
+}
+
+bool handle_table_snapshot_read(HandleTable *ht, SnapshotReader *r,
+                                int count) {
+  int header[2];
+  if (!snapshot_read_into(r, header, sizeof(header)) || header[0] < 0 ||
+      header[0] > ht->max_capacity || count > header[0]) {
+    return false;
+  }
+
+  // A table that never had a handle has no slots
+  if (header[0] == 0) {
+    free_mem(ht->slots);
+    free_mem(ht->idx_to_slot);
+    ht->slots = NULL;
+    ht->idx_to_slot = NULL;
+  } else {
+    ht->slots = realloc_mem(ht->slots, header[0] * sizeof(*ht->slots));
+    ht->idx_to_slot =
+        realloc_mem(ht->idx_to_slot, header[0] * sizeof(*ht->idx_to_slot));
+  }
+  ht->capacity = header[0];
+  ht->free_slot = header[1];
+  if (snapshot_read_into(r, ht->slots, ht->capacity * sizeof(*ht->slots)) &&
+      snapshot_read_into(r, ht->idx_to_slot,
+                         count * sizeof(*ht->idx_to_slot)) &&
+      handle_table_is_valid(ht, count)) {
+    return true;
+  }
+
+  // Nothing should be looked up through a broken table
+  ht->capacity = 0;
+  ht->free_slot = -1;
+  return false;
+}
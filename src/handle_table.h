@@ -0,0 +1,60 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef struct SnapshotWriter SnapshotWriter;
+typedef struct SnapshotReader SnapshotReader;
+
+// Refers to an element of an array that can be reordered. The low 32 bits are
+// the slot and the high 32 bits are the generation of the slot
+typedef uint64_t Handle;
+
+// Never refers to anything
+#define HANDLE_NULL 0
+
+typedef struct HandleSlot {
+  // Index of the element if the slot is used. Otherwise, the next free slot
+  int idx;
+  // Incremented every time the slot is freed so old handles stop working
+  uint32_t gen;
+} HandleSlot;
+
+// Keeps handles pointing to the right elements of a dense array that removes
+// elements by moving the last element into their place
+typedef struct HandleTable {
+  // Slots are allocated as they are needed, up to max_capacity
+  int capacity;
+  int max_capacity;
+  HandleSlot *slots;
+  // Which slot each element of the dense array belongs to
+  int *idx_to_slot;
+  // -1 if there are no free slots
+  int free_slot;
+} HandleTable;
+
+void handle_table_create(HandleTable *ht, int max_capacity);
+void handle_table_destroy(HandleTable *ht);
+
+// Call this after appending an element at idx. Returns the new handle or
+// HANDLE_NULL if there are no free slots
+Handle handle_table_add(HandleTable *ht, int idx);
+
+// Returns the index of the element or -1 if it has been removed
+int handle_table_get_idx(const HandleTable *ht, Handle h);
+
+// Returns the handle of the element at idx
+Handle handle_table_get_handle(const HandleTable *ht, int idx);
+
+// Call this after the element at idx was removed and the element at last_idx
+// was moved into its place. idx and last_idx can be the same
+void handle_table_remove_swap(HandleTable *ht, int idx, int last_idx);
+
+// Writes every slot to a snapshot, so handles stay the same after it is read.
+// count is how many elements the dense array has
+void handle_table_snapshot_write(const HandleTable *ht, SnapshotWriter *w,
+                                 int count);
+// Replaces every slot with the ones in a snapshot. count is how many elements
+// the dense array has after it was read. Returns false if they don't fit or
+// the snapshot is broken
+bool handle_table_snapshot_read(HandleTable *ht, SnapshotReader *r, int count);
@@ -1,8 +1,10 @@
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 
 #include "core.h"
 #include "int_map.h"
+#include "snapshot.h"
 
 #define INT_MAP_START_CAPACITY 32
 
@@ -10,6 +12,8 @@ static void int_map_alloc_data(IntMap *map) {
   map->data = alloc_mem(map->capacity * sizeof(*map->data));
   for (int i = 0; i < map->capacity; i++) {
     map->data[i].key = -1;
+    // Empty slots are written to snapshots too
+    map->data[i].value = 0;
   }
 }
 
@@ -17,7 +21,7 @@ static void int_map_alloc_data(IntMap *map) {
 static IntMapKV *int_map_find_kv(IntMap *map, uint64_t key) {
   IntMapKV *kv = map->data + (key % map->capacity);
   for (int i = 0; i < map->capacity; i++) {
-    if (kv->key == -1 || kv->key == key) {
+    if (kv->key == (uint64_t)-1 || kv->key == key) {
       break;
     }
 
@@ -61,7 +65,7 @@ static void int_map_maybe_realloc(IntMap *map) {
   // Insert all old key/values
   for (int i = 0; i < map->capacity; i++) {
     IntMapKV *kv = &map->data[i];
-    if (kv->key != -1) {
+    if (kv->key != (uint64_t)-1) {
       int_map_insert_no_realloc(&new_map, kv->key, kv->value);
     }
   }
@@ -117,7 +121,7 @@ void int_map_remove(IntMap *map, uint64_t key) {
       kv = map->data;
     }
 
-    if (kv->key == -1) {
+    if (kv->key == (uint64_t)-1) {
       break;
     }
 
@@ -131,3 +135,72 @@ void int_map_remove(IntMap *map, uint64_t key) {
 
   int_map_maybe_realloc(map);
 }
+
+uint64_t int_map_coord_key(int x, int y, int z) {
+  const uint64_t mask = (1 << INT_MAP_COORD_BITS) - 1;
+  uint64_t kx = (uint64_t)(x + INT_MAP_COORD_BIAS) & mask;
+  uint64_t ky = (uint64_t)(y + INT_MAP_COORD_BIAS) & mask;
+  uint64_t kz = (uint64_t)(z + INT_MAP_COORD_BIAS) & mask;
+  uint64_t key =
+      (kx << (INT_MAP_COORD_BITS * 2)) | (ky << INT_MAP_COORD_BITS) | kz;
+
+  // This can be undone, so different coordinates keep different keys
+  key ^= key >> 33;
+  key *= 0xFF51AFD7ED558CCDull;
+  key ^= key >> 33;
+  return key;
+}
+
+void int_map_snapshot_write(const IntMap *map, SnapshotWriter *w) {
+  int header[2] = {map->count, map->capacity};
+  snapshot_write(w, header, sizeof(header));
+  snapshot_write(w, map->data, map->capacity * sizeof(*map->data));
+}
+
+// Checks that count is right, there is always an empty key to stop probing at
+// and every key can be found from where it hashes to
+static bool int_map_is_valid(IntMap *map) {
+  if (map->count >= map->capacity) {
+    return false;
+  }
+
+  int count = 0;
+  for (int i = 0; i < map->capacity; i++) {
+    IntMapKV *kv = &map->data[i];
+    if (kv->key == (uint64_t)-1) {
+      continue;
+    }
+    if (int_map_find_kv(map, kv->key) != kv) {
+      return false;
+    }
+    count++;
+  }
+  return count == map->count;
+}
+
+bool int_map_snapshot_read(IntMap *map, SnapshotReader *r) {
+  int header[2];
+  if (!snapshot_read_into(r, header, sizeof(header)) || header[1] <= 0 ||
+      header[0] > header[1]) {
+    return false;
+  }
+
+  // The size is checked against the snapshot before anything is allocated
+  const void *data = snapshot_read(r, (size_t)header[1] * sizeof(*map->data));
+  if (!data) {
+    return false;
+  }
+
+  free_mem(map->data);
+  map->count = header[0];
+  map->capacity = header[1];
+  map->data = alloc_mem(map->capacity * sizeof(*map->data));
+  memcpy(map->data, data, map->capacity * sizeof(*map->data));
+  if (!int_map_is_valid(map)) {
+    // Leave an empty map behind
+    int_map_destroy(map);
+    int_map_create(map);
+    return false;
+  }
+  return true;
+}
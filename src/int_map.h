@@ -1,7 +1,16 @@
 #pragma once
 
+#include <stdbool.h>
 #include <stdint.h>
 
+typedef struct SnapshotWriter SnapshotWriter;
+typedef struct SnapshotReader SnapshotReader;
+
+// Coordinates packed into a key by int_map_coord_key must be in
+// [-INT_MAP_COORD_BIAS, INT_MAP_COORD_BIAS)
+#define INT_MAP_COORD_BITS 21
+#define INT_MAP_COORD_BIAS (1 << (INT_MAP_COORD_BITS - 1))
+
 typedef struct IntMapKV {
   uint64_t key;
   uint64_t value;
@@ -19,4 +28,14 @@ void int_map_destroy(IntMap *map);
 
 void int_map_insert(IntMap *map, uint64_t key, uint64_t value);
 uint64_t *int_map_get(IntMap *map, uint64_t key);
-void int_map_remove(IntMap *map, uint64_t key);
\ No newline at end of file
+void int_map_remove(IntMap *map, uint64_t key);
+
+// Packs three coordinates into a key. The coordinates are mixed into the low
+// bits, which IntMap uses as the hash, so nearby coordinates spread out
+uint64_t int_map_coord_key(int x, int y, int z);
+
+// Writes the table as it is to a snapshot, so reading it needs no rehashing
+void int_map_snapshot_write(const IntMap *map, SnapshotWriter *w);
+// Replaces the map with the one in a snapshot. Returns false if the snapshot
+// is broken
+bool int_map_snapshot_read(IntMap *map, SnapshotReader *r);
@@ -56,6 +56,8 @@ void level_load(BlobSim *bs, const char *data, int data_size) {
   if (!mat_idx_arr)
     level_load_fail("No mat_idx array");
 
+  // Build solid_ot once after every solid has been added
+  blob_sim_begin_solid_batch(bs);
   for (int i = 0;; i++) {
     toml_datum_t radius = toml_double_at(radius_arr, i);
     toml_array_t *pos_xyz = toml_array_at(pos_arr, i);
@@ -68,6 +70,9 @@ void level_load(BlobSim *bs, const char *data, int data_size) {
     solid_blob_set_radius_pos(bs, b, (float)radius.u.d, &pos);
     b->mat_idx = (int)mat_idx.u.i;
   }
+  blob_sim_end_solid_batch(bs);
+  // The level starts with every brick baked instead of a few per tick
+  solid_field_bake_marked(&bs->solid_field, bs, bs->solid_field.pending_count);
 
   toml_array_t *enemies_arr = toml_array_in(blvl, "enemies");
 
@@ -87,7 +92,7 @@ void level_load(BlobSim *bs, const char *data, int data_size) {
 
       HMM_Vec3 pos = parse_vec3(pos_xyz);
 
-      printf("%s at (%f, %f, %f)\n", type.u.s, pos.X, pos.Y, pos.Z);
+      fprintf(stderr, "%s at (%f, %f, %f)\n", type.u.s, pos.X, pos.Y, pos.Z);
 
       if (strcmp("floater", type.u.s) == 0) {
         Entity enemy = floater_create();
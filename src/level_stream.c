@@ -0,0 +1,487 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "blob.h"
+#include "core.h"
+#include "level_stream.h"
+#include "thread.h"
+
+// Region files start with a header, followed by the table of regions and then
+// the solids of every region, one region after another
+#define LEVEL_REGIONS_MAGIC 0x47524C42 // "BLRG"
+#define LEVEL_REGIONS_VERSION 1
+
+// Adding a region can rebuild solid_ot, so only this many are added per update
+#define LEVEL_STREAM_ADDS_PER_UPDATE 1
+
+typedef struct LevelRegionsHeader {
+  uint32_t magic;
+  uint32_t version;
+  float region_size;
+  int32_t region_count;
+} LevelRegionsHeader;
+
+typedef struct LevelRegionsEntry {
+  int32_t x, y, z;
+  int32_t solid_count;
+  uint64_t offset;
+} LevelRegionsEntry;
+
+typedef struct LevelRegionsSolid {
+  float radius;
+  float pos[3];
+  int32_t mat_idx;
+} LevelRegionsSolid;
+
+struct LevelStreamShared {
+  Mutex mutex;
+  Cond cond;
+  bool quit;
+
+  // Only used by the loader thread
+  FILE *file;
+  LevelRegion *regions;
+
+  // Ring buffers of region indices. A region is in at most one of them at a
+  // time, so neither holds more than capacity indices
+  int capacity;
+  int *requests;
+  int request_start;
+  int request_count;
+  int *done;
+  int done_start;
+  int done_count;
+
+  Thread thread;
+};
+
+static void ring_push(int *ring, int capacity, int start, int *count,
+                      int value) {
+  ring[(start + *count) % capacity] = value;
+  (*count)++;
+}
+
+static int ring_pop(const int *ring, int capacity, int *start, int *count) {
+  int value = ring[*start];
+  *start = (*start + 1) % capacity;
+  (*count)--;
+  return value;
+}
+
+static int region_coord_from_pos(float region_size, float p) {
+  return (int)floorf(p / region_size);
+}
+
+typedef struct RegionSortItem {
+  int c[3];
+  int solid_idx;
+} RegionSortItem;
+
+static int region_sort_item_cmp(const void *a, const void *b) {
+  const RegionSortItem *ia = a;
+  const RegionSortItem *ib = b;
+  for (int i = 0; i < 3; i++) {
+    if (ia->c[i] != ib->c[i]) {
+      return ia->c[i] < ib->c[i] ? -1 : 1;
+    }
+  }
+  return ia->solid_idx - ib->solid_idx;
+}
+
+bool level_regions_write(const char *path, const SolidBlob *solids, int count,
+                         float region_size) {
+  FILE *f = fopen(path, "wb");
+  if (!f) {
+    fprintf(stderr, "Failed to open %s\n", path);
+    return false;
+  }
+
+  // Sorting by region puts the solids of each region next to each other
+  RegionSortItem *items = alloc_mem((count + 1) * sizeof(*items));
+  for (int i = 0; i < count; i++) {
+    for (int a = 0; a < 3; a++) {
+      items[i].c[a] =
+          region_coord_from_pos(region_size, solids[i].pos.Elements[a]);
+    }
+    items[i].solid_idx = i;
+  }
+  qsort(items, count, sizeof(*items), region_sort_item_cmp);
+
+  LevelRegionsEntry *entries = alloc_mem((count + 1) * sizeof(*entries));
+  int region_count = 0;
+  for (int i = 0; i < count; i++) {
+    if (i > 0 && memcmp(items[i - 1].c, items[i].c, sizeof(items[i].c)) == 0) {
+      entries[region_count - 1].solid_count++;
+      continue;
+    }
+
+    LevelRegionsEntry *e = &entries[region_count++];
+    e->x = items[i].c[0];
+    e->y = items[i].c[1];
+    e->z = items[i].c[2];
+    e->solid_count = 1;
+  }
+
+  uint64_t offset = sizeof(LevelRegionsHeader) +
+                    (uint64_t)region_count * sizeof(LevelRegionsEntry);
+  for (int i = 0; i < region_count; i++) {
+    entries[i].offset = offset;
+    offset += (uint64_t)entries[i].solid_count * sizeof(LevelRegionsSolid);
+  }
+
+  LevelRegionsHeader header;
+  header.magic = LEVEL_REGIONS_MAGIC;
+  header.version = LEVEL_REGIONS_VERSION;
+  header.region_size = region_size;
+  header.region_count = region_count;
+  fwrite(&header, sizeof(header), 1, f);
+  fwrite(entries, sizeof(*entries), region_count, f);
+
+  for (int i = 0; i < count; i++) {
+    const SolidBlob *b = &solids[items[i].solid_idx];
+    LevelRegionsSolid s;
+    s.radius = b->radius;
+    s.pos[0] = b->pos.X;
+    s.pos[1] = b->pos.Y;
+    s.pos[2] = b->pos.Z;
+    s.mat_idx = b->mat_idx;
+    fwrite(&s, sizeof(s), 1, f);
+  }
+
+  free_mem(entries);
+  free_mem(items);
+
+  bool ok = !ferror(f);
+  fclose(f);
+  if (!ok) {
+    fprintf(stderr, "Failed to write %s\n", path);
+  }
+  return ok;
+}
+
+static bool file_seek(FILE *f, uint64_t offset) {
+#ifdef _WIN32
+  return _fseeki64(f, (__int64)offset, SEEK_SET) == 0;
+#else
+  return fseek(f, (long)offset, SEEK_SET) == 0;
+#endif
+}
+
+// Returns the solids of the region, or NULL if they could not be read
+static SolidBlob *level_stream_read_region(FILE *f,
+                                           const LevelRegion *region) {
+  int count = region->solid_count;
+  LevelRegionsSolid *src = alloc_mem((count + 1) * sizeof(*src));
+  if (!file_seek(f, region->offset) ||
+      fread(src, sizeof(*src), count, f) != (size_t)count) {
+    fprintf(stderr, "Failed to read region (%d, %d, %d)\n", region->x,
+            region->y, region->z);
+    free_mem(src);
+    return NULL;
+  }
+
+  SolidBlob *solids = alloc_mem((count + 1) * sizeof(*solids));
+  for (int i = 0; i < count; i++) {
+    solids[i].radius = src[i].radius;
+    solids[i].pos = HMM_V3(src[i].pos[0], src[i].pos[1], src[i].pos[2]);
+    solids[i].mat_idx = src[i].mat_idx;
+  }
+  free_mem(src);
+  return solids;
+}
+
+static void level_stream_loader_main(void *args) {
+  LevelStreamShared *shared = args;
+
+  mutex_lock(&shared->mutex);
+  for (;;) {
+    while (shared->request_count == 0 && !shared->quit) {
+      cond_wait(&shared->cond, &shared->mutex);
+    }
+    if (shared->quit) {
+      break;
+    }
+    int region_idx = ring_pop(shared->requests, shared->capacity,
+                              &shared->request_start, &shared->request_count);
+    mutex_unlock(&shared->mutex);
+
+    // The main thread doesn't touch a region while it is loading
+    LevelRegion *region = &shared->regions[region_idx];
+    region->loaded = level_stream_read_region(shared->file, region);
+
+    mutex_lock(&shared->mutex);
+    ring_push(shared->done, shared->capacity, shared->done_start,
+              &shared->done_count, region_idx);
+  }
+  mutex_unlock(&shared->mutex);
+}
+
+bool level_stream_open(LevelStream *stream, const char *path, int load_radius,
+                       int max_in_use) {
+  FILE *f = fopen(path, "rb");
+  if (!f) {
+    return false;
+  }
+
+  LevelRegionsHeader header;
+  if (fread(&header, sizeof(header), 1, f) != 1 ||
+      header.magic != LEVEL_REGIONS_MAGIC ||
+      header.version != LEVEL_REGIONS_VERSION || header.region_count < 0) {
+    fprintf(stderr, "%s is not a supported region file\n", path);
+    fclose(f);
+    return false;
+  }
+
+  int region_count = header.region_count;
+  LevelRegionsEntry *entries = alloc_mem((region_count + 1) * sizeof(*entries));
+  if (fread(entries, sizeof(*entries), region_count, f) !=
+      (size_t)region_count) {
+    fprintf(stderr, "Failed to read the regions of %s\n", path);
+    free_mem(entries);
+    fclose(f);
+    return false;
+  }
+
+  stream->region_size = header.region_size;
+  stream->region_count = region_count;
+  stream->regions = alloc_mem((region_count + 1) * sizeof(*stream->regions));
+  int_map_create(&stream->region_map);
+  for (int i = 0; i < region_count; i++) {
+    LevelRegion *region = &stream->regions[i];
+    region->x = entries[i].x;
+    region->y = entries[i].y;
+    region->z = entries[i].z;
+    region->solid_count = entries[i].solid_count;
+    region->offset = entries[i].offset;
+    region->state = REGION_UNLOADED;
+    region->last_wanted = 0;
+    region->loaded = NULL;
+    region->handles = NULL;
+    region->handle_count = 0;
+    int_map_insert(&stream->region_map,
+                   int_map_coord_key(region->x, region->y, region->z), i);
+  }
+  free_mem(entries);
+
+  // Every region within load_radius has to fit at once
+  int side = load_radius * 2 + 1;
+  stream->load_radius = load_radius;
+  stream->max_in_use = HMM_MAX(max_in_use, side * side * side);
+  stream->in_use = alloc_mem(stream->max_in_use * sizeof(*stream->in_use));
+  stream->in_use_count = 0;
+  stream->update_count = 0;
+
+  LevelStreamShared *shared = alloc_mem(sizeof(*shared));
+  stream->shared = shared;
+  mutex_init(&shared->mutex);
+  cond_init(&shared->cond);
+  shared->quit = false;
+  shared->file = f;
+  shared->regions = stream->regions;
+  shared->capacity = region_count + 1;
+  shared->requests = alloc_mem(shared->capacity * sizeof(int));
+  shared->request_start = 0;
+  shared->request_count = 0;
+  shared->done = alloc_mem(shared->capacity * sizeof(int));
+  shared->done_start = 0;
+  shared->done_count = 0;
+
+  if (!thread_create(&shared->thread, level_stream_loader_main, shared)) {
+    fprintf(stderr, "Failed to create level stream thread\n");
+    exit_fatal_error();
+  }
+
+  return true;
+}
+
+void level_stream_close(LevelStream *stream) {
+  LevelStreamShared *shared = stream->shared;
+
+  mutex_lock(&shared->mutex);
+  shared->quit = true;
+  cond_broadcast(&shared->cond);
+  mutex_unlock(&shared->mutex);
+  thread_join(&shared->thread);
+
+  for (int i = 0; i < stream->region_count; i++) {
+    free_mem(stream->regions[i].loaded);
+    free_mem(stream->regions[i].handles);
+  }
+
+  fclose(shared->file);
+  free_mem(shared->requests);
+  free_mem(shared->done);
+  cond_destroy(&shared->cond);
+  mutex_destroy(&shared->mutex);
+  free_mem(shared);
+  stream->shared = NULL;
+
+  int_map_destroy(&stream->region_map);
+  free_mem(stream->regions);
+  free_mem(stream->in_use);
+  stream->regions = NULL;
+  stream->region_count = 0;
+}
+
+static LevelRegion *level_stream_get_region(LevelStream *stream, int x, int y,
+                                            int z) {
+  uint64_t *idx =
+      int_map_get(&stream->region_map, int_map_coord_key(x, y, z));
+  return idx ? &stream->regions[*idx] : NULL;
+}
+
+static void level_stream_add_region(LevelStream *stream, BlobSim *bs,
+                                    LevelRegion *region) {
+  (void)stream;
+  int count = region->loaded ? region->solid_count : 0;
+  region->handles = alloc_mem((count + 1) * sizeof(*region->handles));
+  region->handle_count =
+      solid_blobs_create(bs, region->loaded, count, region->handles);
+
+  free_mem(region->loaded);
+  region->loaded = NULL;
+  region->state = REGION_RESIDENT;
+}
+
+// Removes the region from the simulation if it is resident, and frees it
+static void level_stream_drop_region(LevelStream *stream, BlobSim *bs,
+                                     int in_use_idx) {
+  LevelRegion *region = &stream->regions[stream->in_use[in_use_idx]];
+  if (region->state == REGION_RESIDENT) {
+    solid_blobs_remove(bs, region->handles, region->handle_count);
+  }
+
+  free_mem(region->handles);
+  region->handles = NULL;
+  region->handle_count = 0;
+  free_mem(region->loaded);
+  region->loaded = NULL;
+  region->state = REGION_UNLOADED;
+
+  stream->in_use[in_use_idx] = stream->in_use[--stream->in_use_count];
+}
+
+// Drops the resident region that was wanted the longest time ago. Returns
+// false if every resident region is still wanted
+static bool level_stream_drop_least_recent(LevelStream *stream, BlobSim *bs) {
+  int oldest = -1;
+  for (int i = 0; i < stream->in_use_count; i++) {
+    const LevelRegion *region = &stream->regions[stream->in_use[i]];
+    if (region->state != REGION_RESIDENT ||
+        region->last_wanted == stream->update_count) {
+      continue;
+    }
+    if (oldest == -1 ||
+        region->last_wanted <
+            stream->regions[stream->in_use[oldest]].last_wanted) {
+      oldest = i;
+    }
+  }
+
+  if (oldest == -1) {
+    return false;
+  }
+  level_stream_drop_region(stream, bs, oldest);
+  return true;
+}
+
+static void level_stream_request(LevelStream *stream, int region_idx) {
+  LevelStreamShared *shared = stream->shared;
+  stream->regions[region_idx].state = REGION_LOADING;
+  stream->in_use[stream->in_use_count++] = region_idx;
+
+  mutex_lock(&shared->mutex);
+  ring_push(shared->requests, shared->capacity, shared->request_start,
+            &shared->request_count, region_idx);
+  cond_signal(&shared->cond);
+  mutex_unlock(&shared->mutex);
+}
+
+void level_stream_update(LevelStream *stream, BlobSim *bs) {
+  LevelStreamShared *shared = stream->shared;
+  stream->update_count++;
+
+  mutex_lock(&shared->mutex);
+  while (shared->done_count > 0) {
+    int region_idx = ring_pop(shared->done, shared->capacity,
+                              &shared->done_start, &shared->done_count);
+    stream->regions[region_idx].state = REGION_LOADED;
+  }
+  mutex_unlock(&shared->mutex);
+
+  int center[3];
+  for (int a = 0; a < 3; a++) {
+    center[a] =
+        region_coord_from_pos(stream->region_size, bs->active_pos.Elements[a]);
+  }
+
+  // Mark every region around active_pos first, so none of them is dropped to
+  // make room for another
+  int r = stream->load_radius;
+  for (int x = center[0] - r; x <= center[0] + r; x++) {
+    for (int y = center[1] - r; y <= center[1] + r; y++) {
+      for (int z = center[2] - r; z <= center[2] + r; z++) {
+        LevelRegion *region = level_stream_get_region(stream, x, y, z);
+        if (region) {
+          region->last_wanted = stream->update_count;
+        }
+      }
+    }
+  }
+
+  // Regions that were left behind while loading are not needed anymore
+  for (int i = 0; i < stream->in_use_count; i++) {
+    const LevelRegion *region = &stream->regions[stream->in_use[i]];
+    if (region->state == REGION_LOADED &&
+        region->last_wanted != stream->update_count) {
+      level_stream_drop_region(stream, bs, i);
+      i--;
+    }
+  }
+
+  for (int added = 0; added < LEVEL_STREAM_ADDS_PER_UPDATE; added++) {
+    LevelRegion *region = NULL;
+    for (int i = 0; i < stream->in_use_count && !region; i++) {
+      if (stream->regions[stream->in_use[i]].state == REGION_LOADED) {
+        region = &stream->regions[stream->in_use[i]];
+      }
+    }
+    if (!region) {
+      break;
+    }
+
+    // Make room in the simulation for the solids of the region
+    while (bs->solids.capacity - bs->solids.count < region->solid_count &&
+           level_stream_drop_least_recent(stream, bs)) {
+    }
+    level_stream_add_region(stream, bs, region);
+  }
+
+  // Request the closest regions first
+  for (int d = 0; d <= r; d++) {
+    for (int x = center[0] - d; x <= center[0] + d; x++) {
+      for (int y = center[1] - d; y <= center[1] + d; y++) {
+        for (int z = center[2] - d; z <= center[2] + d; z++) {
+          int dist = HMM_MAX(abs(x - center[0]),
+                             HMM_MAX(abs(y - center[1]), abs(z - center[2])));
+          if (dist != d) {
+            continue;
+          }
+
+          LevelRegion *region = level_stream_get_region(stream, x, y, z);
+          if (!region || region->state != REGION_UNLOADED) {
+            continue;
+          }
+          if (stream->in_use_count >= stream->max_in_use &&
+              !level_stream_drop_least_recent(stream, bs)) {
+            continue;
+          }
+
+          level_stream_request(stream, (int)(region - stream->regions));
+        }
+      }
+    }
+  }
+}
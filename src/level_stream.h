@@ -0,0 +1,77 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "handle_table.h"
+#include "int_map.h"
+
+typedef struct BlobSim BlobSim;
+typedef struct SolidBlob SolidBlob;
+
+typedef enum LevelRegionState {
+  REGION_UNLOADED,
+  // Waiting for or being read by the loader thread
+  REGION_LOADING,
+  // Read from disk, but not added to the simulation yet
+  REGION_LOADED,
+  REGION_RESIDENT,
+} LevelRegionState;
+
+// A cube of the level that is loaded and unloaded as a whole
+typedef struct LevelRegion {
+  int x, y, z;
+  int solid_count;
+  // Where the solids of the region start in the file
+  uint64_t offset;
+
+  LevelRegionState state;
+  // The last update that the region was near active_pos
+  int last_wanted;
+  // Written by the loader thread. Only valid while the region is loaded
+  SolidBlob *loaded;
+  // Handles of the solids while the region is resident
+  Handle *handles;
+  int handle_count;
+} LevelRegion;
+
+typedef struct LevelStreamShared LevelStreamShared;
+
+// Keeps the solids of the regions around active_pos in the simulation. Regions
+// are read from a region file on a background thread, and regions that have
+// not been near active_pos for the longest are removed first
+typedef struct LevelStream {
+  float region_size;
+  int region_count;
+  LevelRegion *regions;
+  // Region coordinates to region indices
+  IntMap region_map;
+
+  // Regions up to this many regions away from active_pos are loaded
+  int load_radius;
+  // Indices of the regions that are loading, loaded or resident. This is what
+  // bounds memory
+  int *in_use;
+  int in_use_count;
+  int max_in_use;
+  int update_count;
+
+  LevelStreamShared *shared;
+} LevelStream;
+
+// Splits the solids into regions and writes them to a region file
+bool level_regions_write(const char *path, const SolidBlob *solids, int count,
+                         float region_size);
+
+// Opens a region file and starts the loader thread. At most max_in_use
+// regions are kept in memory, but never fewer than the regions within
+// load_radius
+bool level_stream_open(LevelStream *stream, const char *path, int load_radius,
+                       int max_in_use);
+// Stops the loader thread. Resident solids stay in the simulation
+void level_stream_close(LevelStream *stream);
+
+// Requests the regions around active_pos, adds at most one region that has
+// finished loading and removes regions that are over the limit. Call this once
+// per tick
+void level_stream_update(LevelStream *stream, BlobSim *bs);
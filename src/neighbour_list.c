@@ -0,0 +1,571 @@
+#include <math.h>
+#include <string.h>
+
+#include "HandmadeMath.h"
+#include "core.h"
+#include "neighbour_list.h"
+#include "snapshot.h"
+
+#define NEIGHBOUR_LIST_START_CAPACITY 1024
+// Neighbours per blob that the neighbour array starts with room for
+#define NEIGHBOUR_LIST_START_NEIGHBOURS 16
+// Blobs in a cell are checked this many at a time
+#define NEIGHBOUR_LIST_BATCH 64
+// Every list is built again when more than 1 / this of the blobs have moved
+// too far, since that is faster than updating them one by one
+#define NEIGHBOUR_LIST_MAX_MOVED_FRACTION 4
+// Extra room that every list gets for blobs that move near it, on top of a
+// quarter of its size
+#define NEIGHBOUR_LIST_SLACK 4
+
+void neighbour_list_create(NeighbourList *nl, float reach_scale, float skin) {
+  nl->reach_scale = reach_scale;
+  nl->skin = skin;
+  nl->cell_size = 0.0f;
+  nl->builds = 0;
+  nl->updates = 0;
+
+  nl->count = 0;
+  nl->capacity = NEIGHBOUR_LIST_START_CAPACITY;
+  nl->starts = alloc_mem(nl->capacity * sizeof(*nl->starts));
+  nl->counts = alloc_mem(nl->capacity * sizeof(*nl->counts));
+  nl->list_capacities =
+      alloc_mem(nl->capacity * sizeof(*nl->list_capacities));
+  nl->marks = alloc_mem(nl->capacity * sizeof(*nl->marks));
+  nl->found = alloc_mem(nl->capacity * sizeof(*nl->found));
+  nl->x = alloc_mem(nl->capacity * sizeof(*nl->x));
+  nl->y = alloc_mem(nl->capacity * sizeof(*nl->y));
+  nl->z = alloc_mem(nl->capacity * sizeof(*nl->z));
+  nl->radius = alloc_mem(nl->capacity * sizeof(*nl->radius));
+  nl->moved = alloc_mem(nl->capacity * sizeof(*nl->moved));
+  nl->blob_cells = alloc_mem(nl->capacity * sizeof(*nl->blob_cells));
+  nl->sorted = alloc_mem(nl->capacity * sizeof(*nl->sorted));
+  nl->sorted_x = alloc_mem(nl->capacity * sizeof(*nl->sorted_x));
+  nl->sorted_y = alloc_mem(nl->capacity * sizeof(*nl->sorted_y));
+  nl->sorted_z = alloc_mem(nl->capacity * sizeof(*nl->sorted_z));
+  nl->sorted_radius = alloc_mem(nl->capacity * sizeof(*nl->sorted_radius));
+
+  nl->neighbour_count = 0;
+  nl->used_neighbour_count = 0;
+  nl->neighbour_capacity =
+      NEIGHBOUR_LIST_START_CAPACITY * NEIGHBOUR_LIST_START_NEIGHBOURS;
+  // The slack after each list is written to snapshots, so it starts as 0
+  nl->neighbours =
+      alloc_mem(nl->neighbour_capacity * sizeof(*nl->neighbours));
+  memset(nl->neighbours, 0, nl->neighbour_capacity * sizeof(*nl->neighbours));
+
+  int_map_create(&nl->cell_map);
+  nl->cell_count = 0;
+  nl->cell_capacity = NEIGHBOUR_LIST_START_CAPACITY;
+  nl->cell_starts =
+      alloc_mem((nl->cell_capacity + 1) * sizeof(*nl->cell_starts));
+}
+
+void neighbour_list_destroy(NeighbourList *nl) {
+  free_mem(nl->starts);
+  free_mem(nl->counts);
+  free_mem(nl->list_capacities);
+  free_mem(nl->marks);
+  free_mem(nl->found);
+  free_mem(nl->x);
+  free_mem(nl->y);
+  free_mem(nl->z);
+  free_mem(nl->radius);
+  free_mem(nl->moved);
+  free_mem(nl->blob_cells);
+  free_mem(nl->sorted);
+  free_mem(nl->sorted_x);
+  free_mem(nl->sorted_y);
+  free_mem(nl->sorted_z);
+  free_mem(nl->sorted_radius);
+  free_mem(nl->neighbours);
+  free_mem(nl->cell_starts);
+  int_map_destroy(&nl->cell_map);
+  nl->count = 0;
+  nl->neighbour_count = 0;
+}
+
+static void neighbour_list_reserve(NeighbourList *nl, int count) {
+  if (count <= nl->capacity) {
+    return;
+  }
+
+  while (nl->capacity < count) {
+    nl->capacity *= 2;
+  }
+  nl->starts = realloc_mem(nl->starts, nl->capacity * sizeof(*nl->starts));
+  nl->counts = realloc_mem(nl->counts, nl->capacity * sizeof(*nl->counts));
+  nl->list_capacities = realloc_mem(
+      nl->list_capacities, nl->capacity * sizeof(*nl->list_capacities));
+  nl->marks = realloc_mem(nl->marks, nl->capacity * sizeof(*nl->marks));
+  nl->found = realloc_mem(nl->found, nl->capacity * sizeof(*nl->found));
+  nl->x = realloc_mem(nl->x, nl->capacity * sizeof(*nl->x));
+  nl->y = realloc_mem(nl->y, nl->capacity * sizeof(*nl->y));
+  nl->z = realloc_mem(nl->z, nl->capacity * sizeof(*nl->z));
+  nl->radius = realloc_mem(nl->radius, nl->capacity * sizeof(*nl->radius));
+  nl->moved = realloc_mem(nl->moved, nl->capacity * sizeof(*nl->moved));
+  nl->blob_cells =
+      realloc_mem(nl->blob_cells, nl->capacity * sizeof(*nl->blob_cells));
+  nl->sorted = realloc_mem(nl->sorted, nl->capacity * sizeof(*nl->sorted));
+  nl->sorted_x =
+      realloc_mem(nl->sorted_x, nl->capacity * sizeof(*nl->sorted_x));
+  nl->sorted_y =
+      realloc_mem(nl->sorted_y, nl->capacity * sizeof(*nl->sorted_y));
+  nl->sorted_z =
+      realloc_mem(nl->sorted_z, nl->capacity * sizeof(*nl->sorted_z));
+  nl->sorted_radius =
+      realloc_mem(nl->sorted_radius, nl->capacity * sizeof(*nl->sorted_radius));
+}
+
+// Makes sure that extra more neighbours fit
+static void neighbour_list_reserve_neighbours(NeighbourList *nl, int extra) {
+  int needed = nl->neighbour_count + extra;
+  if (needed <= nl->neighbour_capacity) {
+    return;
+  }
+
+  int old_capacity = nl->neighbour_capacity;
+  while (nl->neighbour_capacity < needed) {
+    nl->neighbour_capacity *= 2;
+  }
+  nl->neighbours = realloc_mem(
+      nl->neighbours, nl->neighbour_capacity * sizeof(*nl->neighbours));
+  memset(nl->neighbours + old_capacity, 0,
+         (nl->neighbour_capacity - old_capacity) * sizeof(*nl->neighbours));
+}
+
+static int neighbour_list_cell_coord(const NeighbourList *nl, float p) {
+  float c = floorf(p / nl->cell_size);
+  c = HMM_Clamp(-INT_MAP_COORD_BIAS, c, INT_MAP_COORD_BIAS - 1);
+  return (int)c;
+}
+
+// Sorts the blobs into cells by their listed positions with a counting sort,
+// so blobs in a cell stay in index order
+static void neighbour_list_bin(NeighbourList *nl) {
+  int_map_destroy(&nl->cell_map);
+  int_map_create(&nl->cell_map);
+  nl->cell_count = 0;
+
+  for (int i = 0; i < nl->count; i++) {
+    if (isinf(nl->x[i])) {
+      nl->blob_cells[i] = -1;
+      continue;
+    }
+
+    uint64_t key = int_map_coord_key(neighbour_list_cell_coord(nl, nl->x[i]),
+                                     neighbour_list_cell_coord(nl, nl->y[i]),
+                                     neighbour_list_cell_coord(nl, nl->z[i]));
+    uint64_t *cell = int_map_get(&nl->cell_map, key);
+    if (cell) {
+      nl->blob_cells[i] = (int)*cell;
+      continue;
+    }
+
+    if (nl->cell_count >= nl->cell_capacity) {
+      nl->cell_capacity *= 2;
+      nl->cell_starts =
+          realloc_mem(nl->cell_starts,
+                      (nl->cell_capacity + 1) * sizeof(*nl->cell_starts));
+    }
+    nl->blob_cells[i] = nl->cell_count;
+    int_map_insert(&nl->cell_map, key, nl->cell_count++);
+  }
+
+  // Count the blobs in each cell, turn the counts into the end of each cell,
+  // and then fill the cells from the back
+  memset(nl->cell_starts, 0, (nl->cell_count + 1) * sizeof(int));
+  for (int i = 0; i < nl->count; i++) {
+    if (nl->blob_cells[i] != -1) {
+      nl->cell_starts[nl->blob_cells[i]]++;
+    }
+  }
+  int end = 0;
+  for (int c = 0; c < nl->cell_count; c++) {
+    end += nl->cell_starts[c];
+    nl->cell_starts[c] = end;
+  }
+  nl->cell_starts[nl->cell_count] = end;
+  for (int i = nl->count - 1; i >= 0; i--) {
+    if (nl->blob_cells[i] != -1) {
+      nl->sorted[--nl->cell_starts[nl->blob_cells[i]]] = i;
+    }
+  }
+
+  // Copy the blobs in cell order so the cells around a blob are read in
+  // order
+  for (int s = 0; s < end; s++) {
+    int i = nl->sorted[s];
+    nl->sorted_x[s] = nl->x[i];
+    nl->sorted_y[s] = nl->y[i];
+    nl->sorted_z[s] = nl->z[i];
+    nl->sorted_radius[s] = nl->radius[i];
+  }
+}
+
+typedef struct NeighbourCellRanges {
+  int count;
+  int starts[27];
+  int ends[27];
+} NeighbourCellRanges;
+
+// Finds the ranges of sorted blobs in the cells around a position
+static void neighbour_list_get_ranges(NeighbourList *nl,
+                                      NeighbourCellRanges *ranges, float x,
+                                      float y, float z) {
+  int cx = neighbour_list_cell_coord(nl, x);
+  int cy = neighbour_list_cell_coord(nl, y);
+  int cz = neighbour_list_cell_coord(nl, z);
+
+  ranges->count = 0;
+  for (int ox = -1; ox <= 1; ox++) {
+    for (int oy = -1; oy <= 1; oy++) {
+      for (int oz = -1; oz <= 1; oz++) {
+        uint64_t *cell = int_map_get(
+            &nl->cell_map, int_map_coord_key(cx + ox, cy + oy, cz + oz));
+        if (cell) {
+          ranges->starts[ranges->count] = nl->cell_starts[*cell];
+          ranges->ends[ranges->count++] = nl->cell_starts[*cell + 1];
+        }
+      }
+    }
+  }
+}
+
+// Writes the neighbours of blob i after the end of the neighbour array and
+// returns how many there are. Room for every blob has to be reserved first
+static int neighbour_list_find(NeighbourList *nl,
+                               const NeighbourCellRanges *ranges, int i) {
+  float px = nl->x[i];
+  float py = nl->y[i];
+  float pz = nl->z[i];
+  float reach_base = nl->reach_scale * nl->radius[i] + nl->skin;
+
+  int *out = nl->neighbours + nl->neighbour_count;
+  int found = 0;
+  for (int r = 0; r < ranges->count; r++) {
+    int start = ranges->starts[r];
+    int end = ranges->ends[r];
+    // Each cell is checked in two passes so that the distances can be
+    // computed several at a time
+    while (start < end) {
+      int n = HMM_MIN(end - start, NEIGHBOUR_LIST_BATCH);
+      bool near[NEIGHBOUR_LIST_BATCH];
+      for (int k = 0; k < n; k++) {
+        float dx = nl->sorted_x[start + k] - px;
+        float dy = nl->sorted_y[start + k] - py;
+        float dz = nl->sorted_z[start + k] - pz;
+        float reach =
+            reach_base + nl->reach_scale * nl->sorted_radius[start + k];
+        near[k] = dx * dx + dy * dy + dz * dz <= reach * reach;
+      }
+      for (int k = 0; k < n; k++) {
+        // Written either way, and only kept if it is a neighbour
+        out[found] = nl->sorted[start + k];
+        found += near[k] && out[found] != i;
+      }
+      start += n;
+    }
+  }
+  return found;
+}
+
+// Makes the neighbours after the end of the neighbour array the list of blob
+// i, with some room to grow
+static void neighbour_list_append(NeighbourList *nl, int i, int count) {
+  int capacity = count + count / 4 + NEIGHBOUR_LIST_SLACK;
+  nl->starts[i] = nl->neighbour_count;
+  nl->counts[i] = count;
+  nl->list_capacities[i] = capacity;
+  nl->neighbour_count += capacity;
+  nl->used_neighbour_count += capacity;
+}
+
+void neighbour_list_build(NeighbourList *nl, const float *x, const float *y,
+                          const float *z, const float *radius, int count) {
+  neighbour_list_reserve(nl, count);
+  nl->count = count;
+  memcpy(nl->x, x, count * sizeof(*x));
+  memcpy(nl->y, y, count * sizeof(*y));
+  memcpy(nl->z, z, count * sizeof(*z));
+  memcpy(nl->radius, radius, count * sizeof(*radius));
+
+  float max_radius = 0.0f;
+  for (int i = 0; i < count; i++) {
+    nl->counts[i] = 0;
+    if (!isinf(x[i])) {
+      max_radius = HMM_MAX(max_radius, radius[i]);
+    }
+  }
+  nl->cell_size = nl->reach_scale * max_radius * 2.0f + nl->skin;
+  neighbour_list_bin(nl);
+  nl->used_neighbour_count = 0;
+
+  // Every blob in a cell has the same cells around it, so they are only
+  // looked up once per cell
+  nl->neighbour_count = 0;
+  // Room for a blob next to every other blob, with its slack
+  int list_max = nl->cell_starts[nl->cell_count] * 2 + NEIGHBOUR_LIST_SLACK;
+  for (int c = 0; c < nl->cell_count; c++) {
+    int first = nl->cell_starts[c];
+    NeighbourCellRanges ranges;
+    neighbour_list_get_ranges(nl, &ranges, nl->sorted_x[first],
+                              nl->sorted_y[first], nl->sorted_z[first]);
+
+    for (int s = first; s < nl->cell_starts[c + 1]; s++) {
+      int i = nl->sorted[s];
+      neighbour_list_reserve_neighbours(nl, list_max);
+      neighbour_list_append(nl, i, neighbour_list_find(nl, &ranges, i));
+    }
+  }
+  nl->builds++;
+}
+
+// Adds o to the list of blob i. A full list is moved to the end of the
+// neighbour array with more room
+static void neighbour_list_add(NeighbourList *nl, int i, int o) {
+  int *list = nl->neighbours + nl->starts[i];
+  int count = nl->counts[i];
+  if (count == nl->list_capacities[i]) {
+    neighbour_list_reserve_neighbours(nl, count * 2 + NEIGHBOUR_LIST_SLACK);
+    memcpy(nl->neighbours + nl->neighbour_count, nl->neighbours + nl->starts[i],
+           count * sizeof(*nl->neighbours));
+    nl->used_neighbour_count -= nl->list_capacities[i];
+    neighbour_list_append(nl, i, count);
+    list = nl->neighbours + nl->starts[i];
+  }
+  list[count] = o;
+  nl->counts[i]++;
+}
+
+static void neighbour_list_remove(NeighbourList *nl, int i, int o) {
+  int *list = nl->neighbours + nl->starts[i];
+  for (int k = 0; k < nl->counts[i]; k++) {
+    if (list[k] == o) {
+      list[k] = list[--nl->counts[i]];
+      return;
+    }
+  }
+}
+
+void neighbour_list_update(NeighbourList *nl, const float *x, const float *y,
+                           const float *z, const float *radius, int count) {
+  if (count != nl->count) {
+    neighbour_list_build(nl, x, y, z, radius, count);
+    return;
+  }
+
+  // Two blobs are in each other's lists if the positions they were listed at
+  // are within reach. That stays true for pairs that are within reach now as
+  // long as neither has moved more than half of the skin since
+  float max_dist_sq = nl->skin * nl->skin * 0.25f;
+  int moved_count = 0;
+  for (int i = 0; i < count; i++) {
+    nl->moved[i] = false;
+    if (isinf(x[i]) || isinf(nl->x[i])) {
+      if (isinf(x[i]) != isinf(nl->x[i])) {
+        neighbour_list_build(nl, x, y, z, radius, count);
+        return;
+      }
+      continue;
+    }
+
+    float dx = x[i] - nl->x[i];
+    float dy = y[i] - nl->y[i];
+    float dz = z[i] - nl->z[i];
+    if (dx * dx + dy * dy + dz * dz > max_dist_sq) {
+      nl->moved[i] = true;
+      moved_count++;
+    }
+  }
+  if (moved_count == 0) {
+    return;
+  }
+
+  // Lists that were moved to the end leave their old room behind, so
+  // everything is built again once that is half of the array
+  if (moved_count > count / NEIGHBOUR_LIST_MAX_MOVED_FRACTION ||
+      nl->neighbour_count > nl->used_neighbour_count * 2) {
+    neighbour_list_build(nl, x, y, z, radius, count);
+    return;
+  }
+
+  for (int i = 0; i < count; i++) {
+    if (nl->moved[i]) {
+      nl->x[i] = x[i];
+      nl->y[i] = y[i];
+      nl->z[i] = z[i];
+    }
+  }
+  neighbour_list_bin(nl);
+
+  // The moved blobs get new lists at their new positions. They are added to
+  // the lists of the blobs that they are now near, and removed from the ones
+  // that they have left. Lists are symmetric, so a blob is in the lists of
+  // the blobs in its own list and nothing has to be searched for. Moved blobs
+  // find each other when their own lists are made
+  for (int i = 0; i < count; i++) {
+    nl->marks[i] = -1;
+  }
+  int sorted_count = nl->cell_starts[nl->cell_count];
+  for (int i = 0; i < count; i++) {
+    if (!nl->moved[i]) {
+      continue;
+    }
+
+    // Neighbours that were only in the old list are marked with i * 2, and
+    // the ones in both with i * 2 + 1
+    const int *old_list = nl->neighbours + nl->starts[i];
+    for (int k = 0; k < nl->counts[i]; k++) {
+      nl->marks[old_list[k]] = i * 2;
+    }
+
+    NeighbourCellRanges ranges;
+    neighbour_list_get_ranges(nl, &ranges, nl->x[i], nl->y[i], nl->z[i]);
+    neighbour_list_reserve_neighbours(nl, sorted_count);
+    int found = neighbour_list_find(nl, &ranges, i);
+    // Moving lists while adding to them writes over the end of the array
+    memcpy(nl->found, nl->neighbours + nl->neighbour_count,
+           found * sizeof(*nl->found));
+
+    for (int k = 0; k < found; k++) {
+      int o = nl->found[k];
+      if (nl->marks[o] == i * 2) {
+        nl->marks[o] = i * 2 + 1;
+      } else if (!nl->moved[o]) {
+        neighbour_list_add(nl, o, i);
+      }
+    }
+    old_list = nl->neighbours + nl->starts[i];
+    for (int k = 0; k < nl->counts[i]; k++) {
+      int o = old_list[k];
+      if (nl->marks[o] == i * 2 && !nl->moved[o]) {
+        neighbour_list_remove(nl, o, i);
+      }
+    }
+
+    if (found <= nl->list_capacities[i]) {
+      memcpy(nl->neighbours + nl->starts[i], nl->found,
+             found * sizeof(*nl->found));
+      nl->counts[i] = found;
+    } else {
+      neighbour_list_reserve_neighbours(nl, found * 2 + NEIGHBOUR_LIST_SLACK);
+      memcpy(nl->neighbours + nl->neighbour_count, nl->found,
+             found * sizeof(*nl->found));
+      nl->used_neighbour_count -= nl->list_capacities[i];
+      neighbour_list_append(nl, i, found);
+    }
+  }
+  nl->updates++;
+}
+
+int neighbour_list_get_size_bytes(const NeighbourList *nl) {
+  int per_blob = 7 * sizeof(int) + 8 * sizeof(float) + sizeof(bool);
+  return nl->capacity * per_blob + nl->neighbour_capacity * sizeof(int) +
+         nl->cell_capacity * sizeof(int) +
+         nl->cell_map.capacity * sizeof(IntMapKV);
+}
+
+typedef struct NeighbourListSnapshot {
+  float reach_scale;
+  float skin;
+  float cell_size;
+  int count;
+  int neighbour_count;
+  int used_neighbour_count;
+} NeighbourListSnapshot;
+
+void neighbour_list_snapshot_write(const NeighbourList *nl,
+                                   SnapshotWriter *w) {
+  NeighbourListSnapshot snap;
+  // Padding is written too, so it should not be garbage
+  memset(&snap, 0, sizeof(snap));
+  snap.reach_scale = nl->reach_scale;
+  snap.skin = nl->skin;
+  snap.cell_size = nl->cell_size;
+  snap.count = nl->count;
+  snap.neighbour_count = nl->neighbour_count;
+  snap.used_neighbour_count = nl->used_neighbour_count;
+  snapshot_write(w, &snap, sizeof(snap));
+
+  const void *arrays[] = {nl->starts, nl->counts, nl->list_capacities,
+                          nl->x,      nl->y,      nl->z,
+                          nl->radius};
+  for (int i = 0; i < (int)ARR_SIZE(arrays); i++) {
+    snapshot_write(w, arrays[i], nl->count * sizeof(int));
+  }
+  snapshot_write(w, nl->neighbours,
+                 nl->neighbour_count * sizeof(*nl->neighbours));
+}
+
+// Checks that every list is inside the neighbours and only holds blobs that
+// exist
+static bool neighbour_list_is_valid(const NeighbourList *nl) {
+  if (!(nl->reach_scale > 0.0f) || !(nl->skin >= 0.0f) ||
+      !(nl->cell_size >= 0.0f) || nl->used_neighbour_count < 0 ||
+      nl->used_neighbour_count > nl->neighbour_count) {
+    return false;
+  }
+
+  for (int i = 0; i < nl->count; i++) {
+    int start = nl->starts[i];
+    int list_capacity = nl->list_capacities[i];
+    if (nl->counts[i] < 0 || nl->counts[i] > list_capacity || start < 0 ||
+        start > nl->neighbour_count - list_capacity) {
+      return false;
+    }
+  }
+  for (int i = 0; i < nl->neighbour_count; i++) {
+    if (nl->neighbours[i] < 0 || nl->neighbours[i] >= nl->count) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool neighbour_list_snapshot_read(NeighbourList *nl, SnapshotReader *r) {
+  NeighbourListSnapshot snap;
+  if (!snapshot_read_into(r, &snap, sizeof(snap)) || snap.count < 0 ||
+      snap.neighbour_count < 0) {
+    return false;
+  }
+
+  // The sizes are checked against the snapshot before anything is allocated
+  const void *read[7];
+  for (int i = 0; i < (int)ARR_SIZE(read); i++) {
+    read[i] = snapshot_read(r, (size_t)snap.count * sizeof(int));
+  }
+  const void *read_neighbours =
+      snapshot_read(r, (size_t)snap.neighbour_count * sizeof(int));
+  if (!read_neighbours) {
+    return false;
+  }
+
+  neighbour_list_reserve(nl, snap.count);
+  nl->neighbour_count = 0;
+  neighbour_list_reserve_neighbours(nl, snap.neighbour_count);
+
+  nl->reach_scale = snap.reach_scale;
+  nl->skin = snap.skin;
+  nl->cell_size = snap.cell_size;
+  nl->count = snap.count;
+  nl->neighbour_count = snap.neighbour_count;
+  nl->used_neighbour_count = snap.used_neighbour_count;
+
+  void *arrays[] = {nl->starts, nl->counts, nl->list_capacities,
+                    nl->x,      nl->y,      nl->z,
+                    nl->radius};
+  for (int i = 0; i < (int)ARR_SIZE(arrays); i++) {
+    memcpy(arrays[i], read[i], nl->count * sizeof(int));
+  }
+  memcpy(nl->neighbours, read_neighbours,
+         nl->neighbour_count * sizeof(*nl->neighbours));
+  if (neighbour_list_is_valid(nl)) {
+    return true;
+  }
+
+  nl->count = 0;
+  nl->neighbour_count = 0;
+  nl->used_neighbour_count = 0;
+  return false;
+}
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <stdbool.h>
+
+#include "int_map.h"
+
+typedef struct SnapshotWriter SnapshotWriter;
+typedef struct SnapshotReader SnapshotReader;
+
+// Verlet neighbour lists. Every blob gets the blobs whose listed positions
+// are within reach_scale * (radius + other radius) + skin of its own, wherever
+// they are. The lists have every pair within reach_scale * (radius + other
+// radius) as long as no blob is more than half of the skin from its listed
+// position, and only blobs that moved further than that get new lists
+typedef struct NeighbourList {
+  float reach_scale;
+  float skin;
+  // Size of the grid cells, which are as large as the longest reach so that
+  // neighbours are always in the 27 cells around a blob
+  float cell_size;
+  // Times that every list was built and times that some were updated. These
+  // are not written to snapshots
+  int builds;
+  int updates;
+
+  // Blob i has counts[i] neighbours from neighbours[starts[i]], with room for
+  // list_capacities[i]. Lists that outgrow their room are moved to the end,
+  // so used_neighbour_count of the neighbours are still in use
+  int count;
+  int capacity;
+  int *starts;
+  int *counts;
+  int *list_capacities;
+  int *neighbours;
+  int neighbour_count;
+  int neighbour_capacity;
+  int used_neighbour_count;
+  // Positions that the blobs were listed at, and their radii
+  float *x;
+  float *y;
+  float *z;
+  float *radius;
+  // Scratch space for updating the lists of the blobs that moved
+  bool *moved;
+  int *marks;
+  int *found;
+
+  // Blobs sorted by the grid cell that their listed position is in
+  IntMap cell_map;
+  int *cell_starts;
+  int cell_count;
+  int cell_capacity;
+  int *blob_cells;
+  int *sorted;
+  // Copies of the blobs in sorted order
+  float *sorted_x;
+  float *sorted_y;
+  float *sorted_z;
+  float *sorted_radius;
+} NeighbourList;
+
+void neighbour_list_create(NeighbourList *nl, float reach_scale, float skin);
+void neighbour_list_destroy(NeighbourList *nl);
+
+// Replaces every list. Blobs with an infinite x position get no neighbours.
+// Needed whenever blobs are added, removed or resized
+void neighbour_list_build(NeighbourList *nl, const float *x, const float *y,
+                          const float *z, const float *radius, int count);
+
+// Gives new lists to the blobs that have moved too far since they were listed,
+// or builds every list again if that is faster
+void neighbour_list_update(NeighbourList *nl, const float *x, const float *y,
+                           const float *z, const float *radius, int count);
+
+int neighbour_list_get_size_bytes(const NeighbourList *nl);
+
+// Writes the lists and the positions they were made at to a snapshot. The
+// grid is not written, since it is made again before it is used
+void neighbour_list_snapshot_write(const NeighbourList *nl, SnapshotWriter *w);
+// Replaces the lists with the ones in a snapshot. Returns false if the
+// snapshot is broken
+bool neighbour_list_snapshot_read(NeighbourList *nl, SnapshotReader *r);
@@ -22,10 +22,10 @@ static void liquify_model(Entity e) {
     p.XYZ = mdl->blobs[i].pos;
     p = HMM_MulM4V4(*trans, p);
 
-    LiquidBlob *b = liquid_blob_create(global.blob_sim);
-    if (b) {
-      b->type = LIQUID_BASE;
-      b->mat_idx = mdl->blobs[i].mat_idx;
+    int b = liquid_blob_create(global.blob_sim);
+    if (b != -1) {
+      LiquidBlobInfo *info = liquid_blob_get_info(global.blob_sim, b);
+      info->mat_idx = mdl->blobs[i].mat_idx;
       liquid_blob_set_radius_pos(global.blob_sim, b,
                                  HMM_MAX(0.2f, mdl->blobs[i].radius), &p.XYZ);
       HMM_Vec3 force;
@@ -33,7 +33,7 @@ static void liquify_model(Entity e) {
         force.Elements[x] = (rand_float() - 0.5f) * 5.0f;
       }
       force.Y += 8.0f;
-      b->vel = force;
+      liquid_blob_set_vel(global.blob_sim, b, &force);
     }
   }
 }
@@ -95,41 +95,44 @@ Entity player_create() {
   return ent;
 }
 
-static void proj_callback(LiquidBlob *p, ColliderModel *col_mdl) {
+static bool proj_callback(Projectile *p, ColliderModel *col_mdl) {
   Entity ent = col_mdl->ent;
   Creature *creature = entity_get_component(ent, COMPONENT_CREATURE);
 
   if (!creature || creature->health <= 0 || !creature->is_enemy) {
-    return;
+    return false;
   }
 
   // Blood
+  HMM_Vec3 p_pos = p->pos;
   for (int i = 0; i < 4; i++) {
-    LiquidBlob *b = liquid_blob_create(global.blob_sim);
-    if (b) {
-      b->type = LIQUID_BASE;
-      b->mat_idx = 0;
-      liquid_blob_set_radius_pos(global.blob_sim, b, 0.2f, &p->pos);
+    int b = liquid_blob_create(global.blob_sim);
+    if (b != -1) {
+      LiquidBlobInfo *info = liquid_blob_get_info(global.blob_sim, b);
+      info->mat_idx = 0;
+      liquid_blob_set_radius_pos(global.blob_sim, b, 0.2f, &p_pos);
 
       HMM_Vec3 force;
       for (int x = 0; x < 3; x++) {
         force.Elements[x] = (rand_float() - 0.5f) * 10.0f;
       }
-      b->vel = force;
+      liquid_blob_set_vel(global.blob_sim, b, &force);
     }
   }
 
   creature->health -= 1;
-  blob_sim_queue_remove(global.blob_sim, REMOVE_LIQUID, p);
 
   if (creature->health <= 0) {
     Model *mdl = entity_get_component(ent, COMPONENT_MODEL);
     liquify_model(ent);
-    blob_sim_queue_remove(global.blob_sim, REMOVE_COLLIDER_MODEL, col_mdl);
+    blob_sim_queue_remove(global.blob_sim, REMOVE_COLLIDER_MODEL,
+                          collider_model_get_handle(global.blob_sim, col_mdl));
 
     blob_mdl_destroy(mdl);
     entity_destroy(ent);
   }
+
+  return true;
 }
 
 void player_process(Entity ent) {
@@ -233,7 +236,7 @@ void player_process(Entity ent) {
       HMM_Vec3 ro = HMM_MulM4V4(*trans, HMM_V4V(origin, 1.0f)).XYZ;
       HMM_Vec3 rd = HMM_MulV3F(trans->Columns[2].XYZ, -3.0f);
       RaycastResult result;
-      blob_sim_raycast(&result, global.blob_sim, ro, rd);
+      blob_sim_raycast(&result, global.blob_sim, ro, rd, RAYCAST_SOLIDS);
       
       HMM_Vec3 goal = origin;
       if (result.has_hit) {
@@ -259,7 +262,7 @@ void player_process(Entity ent) {
     HMM_Vec3 rd = HMM_MulV3F(cam_trans->Columns[2].XYZ, cam_dist);
 
     RaycastResult result;
-    blob_sim_raycast(&result, global.blob_sim, ro, rd);
+    blob_sim_raycast(&result, global.blob_sim, ro, rd, RAYCAST_SOLIDS);
 
     if (result.has_hit) {
       cam_dist = result.traveled * 0.7f;
@@ -295,13 +298,14 @@ void player_process(Entity ent) {
 
         const float radius = 0.2f;
 
-        LiquidBlob *p = projectile_create(global.blob_sim);
+        Projectile *p = projectile_create(global.blob_sim);
         if (p) {
           p->mat_idx = 6;
+          p->callback = proj_callback;
           p->vel = force;
-          p->proj.callback = proj_callback;
-          liquid_blob_set_radius_pos(global.blob_sim, p, radius, &pos);
-          blob_sim_delayed_remove(global.blob_sim, REMOVE_LIQUID, p, 2.0);
+          p->pos = pos;
+          p->radius = radius;
+          p->lifetime = 2.0f;
         }
       }
       if (glfwGetKey(window, GLFW_KEY_LEFT_SHIFT) == GLFW_PRESS) {
@@ -309,10 +313,10 @@ void player_process(Entity ent) {
 
         const float radius = 0.5f;
 
-        LiquidBlob *b = liquid_blob_create(global.blob_sim);
-        if (b) {
-          b->mat_idx = 2;
-          b->vel = force;
+        int b = liquid_blob_create(global.blob_sim);
+        if (b != -1) {
+          liquid_blob_get_info(global.blob_sim, b)->mat_idx = 2;
+          liquid_blob_set_vel(global.blob_sim, b, &force);
           liquid_blob_set_radius_pos(global.blob_sim, b, radius, &pos);
         }
       }
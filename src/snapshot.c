@@ -0,0 +1,174 @@
+#include <string.h>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "snapshot.h"
+
+#define SNAPSHOT_ALIGN 8
+
+typedef struct SnapshotHeader {
+  uint32_t magic;
+  uint32_t version;
+} SnapshotHeader;
+
+static size_t snapshot_align(size_t bytes) {
+  return (bytes + SNAPSHOT_ALIGN - 1) / SNAPSHOT_ALIGN * SNAPSHOT_ALIGN;
+}
+
+bool snapshot_writer_open(SnapshotWriter *w, const char *path, uint32_t magic,
+                          uint32_t version) {
+  w->file = fopen(path, "wb");
+  w->failed = false;
+  if (!w->file) {
+    fprintf(stderr, "Failed to open %s\n", path);
+    return false;
+  }
+
+  SnapshotHeader header;
+  header.magic = magic;
+  header.version = version;
+  w->failed = fwrite(&header, sizeof(header), 1, w->file) != 1;
+  return true;
+}
+
+bool snapshot_writer_close(SnapshotWriter *w) {
+  if (fclose(w->file) != 0) {
+    w->failed = true;
+  }
+  w->file = NULL;
+  return !w->failed;
+}
+
+void snapshot_write(SnapshotWriter *w, const void *data, size_t bytes) {
+  if (w->failed) {
+    return;
+  }
+
+  static const char padding[SNAPSHOT_ALIGN] = {0};
+  uint64_t size = bytes;
+  size_t pad = snapshot_align(bytes) - bytes;
+  if (fwrite(&size, sizeof(size), 1, w->file) != 1 ||
+      (bytes && fwrite(data, bytes, 1, w->file) != 1) ||
+      (pad && fwrite(padding, pad, 1, w->file) != 1)) {
+    w->failed = true;
+  }
+}
+
+bool snapshot_reader_open(SnapshotReader *r, const char *path, uint32_t magic,
+                          uint32_t version) {
+  r->data = NULL;
+  r->size = 0;
+  r->pos = snapshot_align(sizeof(SnapshotHeader));
+  r->failed = false;
+
+#ifdef _WIN32
+  r->mapping = NULL;
+  r->file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL,
+                        OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+  LARGE_INTEGER size;
+  if (r->file != INVALID_HANDLE_VALUE && GetFileSizeEx(r->file, &size) &&
+      size.QuadPart > 0) {
+    r->size = (size_t)size.QuadPart;
+    r->mapping = CreateFileMappingA(r->file, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (r->mapping) {
+      r->data = MapViewOfFile(r->mapping, FILE_MAP_READ, 0, 0, 0);
+    }
+  }
+#else
+  int fd = open(path, O_RDONLY);
+  struct stat st;
+  if (fd != -1 && fstat(fd, &st) == 0 && st.st_size > 0) {
+    r->size = (size_t)st.st_size;
+    void *data = mmap(NULL, r->size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data != MAP_FAILED) {
+      r->data = data;
+    }
+  }
+  if (fd != -1) {
+    // The mapping stays valid after the file is closed
+    close(fd);
+  }
+#endif
+
+  if (!r->data) {
+    fprintf(stderr, "Failed to map %s\n", path);
+    snapshot_reader_close(r);
+    return false;
+  }
+
+  SnapshotHeader header;
+  if (r->size < r->pos) {
+    header.magic = 0;
+  } else {
+    memcpy(&header, r->data, sizeof(header));
+  }
+  if (header.magic != magic || header.version != version) {
+    fprintf(stderr, "%s is not a snapshot of this version\n", path);
+    snapshot_reader_close(r);
+    return false;
+  }
+  return true;
+}
+
+void snapshot_reader_close(SnapshotReader *r) {
+#ifdef _WIN32
+  if (r->data) {
+    UnmapViewOfFile(r->data);
+  }
+  if (r->mapping) {
+    CloseHandle(r->mapping);
+  }
+  if (r->file != INVALID_HANDLE_VALUE) {
+    CloseHandle(r->file);
+  }
+  r->mapping = NULL;
+  r->file = INVALID_HANDLE_VALUE;
+#else
+  if (r->data) {
+    munmap((void *)r->data, r->size);
+  }
+#endif
+  r->data = NULL;
+  r->size = 0;
+}
+
+const void *snapshot_read(SnapshotReader *r, size_t bytes) {
+  if (r->failed) {
+    return NULL;
+  }
+
+  uint64_t size;
+  if (r->size - r->pos < sizeof(size)) {
+    r->failed = true;
+    return NULL;
+  }
+  memcpy(&size, r->data + r->pos, sizeof(size));
+  size_t start = r->pos + sizeof(size);
+  if (size != bytes || r->size - start < snapshot_align(bytes)) {
+    r->failed = true;
+    return NULL;
+  }
+
+  r->pos = start + snapshot_align(bytes);
+  return r->data + start;
+}
+
+bool snapshot_read_into(SnapshotReader *r, void *dst, size_t bytes) {
+  const void *src = snapshot_read(r, bytes);
+  if (!src) {
+    return false;
+  }
+  // Empty arrays may not be allocated
+  if (bytes) {
+    memcpy(dst, src, bytes);
+  }
+  return true;
+}
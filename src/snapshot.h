@@ -0,0 +1,52 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// Snapshot files start with a header and are followed by sections that are
+// read back in the order they were written. Each section is its size followed
+// by its bytes, padded so the next one starts at a multiple of 8 bytes.
+// Sections are raw memory, so a snapshot can only be loaded by a build with
+// the same struct layouts, which the version has to be changed for
+
+typedef struct SnapshotWriter {
+  FILE *file;
+  // Set when a write fails. Later writes are skipped
+  bool failed;
+} SnapshotWriter;
+
+typedef struct SnapshotReader {
+  // The whole file, mapped read only
+  const char *data;
+  size_t size;
+  // Where the next section starts
+  size_t pos;
+  // Set when a section doesn't match what was asked for. Later reads fail
+  bool failed;
+
+#ifdef _WIN32
+  void *file;
+  void *mapping;
+#endif
+} SnapshotReader;
+
+bool snapshot_writer_open(SnapshotWriter *w, const char *path, uint32_t magic,
+                          uint32_t version);
+// Returns false if anything failed to be written
+bool snapshot_writer_close(SnapshotWriter *w);
+
+void snapshot_write(SnapshotWriter *w, const void *data, size_t bytes);
+
+// Maps the file at path. Fails if the magic or version is different
+bool snapshot_reader_open(SnapshotReader *r, const char *path, uint32_t magic,
+                          uint32_t version);
+void snapshot_reader_close(SnapshotReader *r);
+
+// Returns the next section, which points into the mapped file. Returns NULL
+// and fails the reader if the section is not bytes long
+const void *snapshot_read(SnapshotReader *r, size_t bytes);
+
+// Reads the next section into dst
+bool snapshot_read_into(SnapshotReader *r, void *dst, size_t bytes);
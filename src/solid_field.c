@@ -0,0 +1,471 @@
+#include <math.h>
+#include <string.h>
+
+#include "blob.h"
+#include "core.h"
+#include "snapshot.h"
+#include "solid_field.h"
+
+#define SOLID_FIELD_START_CAPACITY 64
+
+#define SOLID_FIELD_SAMPLE_DIM (SOLID_FIELD_BRICK_CELLS + 1)
+
+static float solid_field_brick_size(const SolidField *sf) {
+  return sf->cell_size * SOLID_FIELD_BRICK_CELLS;
+}
+
+static int brick_coord_from_pos(const SolidField *sf, float p) {
+  float c = floorf(p / solid_field_brick_size(sf));
+  c = HMM_Clamp(-INT_MAP_COORD_BIAS, c, INT_MAP_COORD_BIAS - 1);
+  return (int)c;
+}
+
+void solid_field_create(SolidField *sf, float cell_size, float band) {
+  sf->cell_size = cell_size;
+  sf->band = band;
+
+  int_map_create(&sf->brick_map);
+  sf->brick_count = 0;
+  sf->brick_capacity = SOLID_FIELD_START_CAPACITY;
+  sf->bricks = alloc_mem(sf->brick_capacity * sizeof(*sf->bricks));
+  sf->free_bricks = alloc_mem(sf->brick_capacity * sizeof(int));
+  sf->free_brick_count = 0;
+
+  sf->pending_count = 0;
+  sf->pending_capacity = SOLID_FIELD_START_CAPACITY;
+  sf->pending = alloc_mem(sf->pending_capacity * 3 * sizeof(int));
+  int_map_create(&sf->pending_map);
+
+  sf->candidate_count = 0;
+  sf->candidate_capacity = SOLID_FIELD_START_CAPACITY;
+  sf->candidates = alloc_mem(sf->candidate_capacity * sizeof(int));
+  visited_set_create(&sf->candidates_found, SOLID_FIELD_START_CAPACITY);
+}
+
+void solid_field_destroy(SolidField *sf) {
+  int_map_destroy(&sf->brick_map);
+  free_mem(sf->bricks);
+  free_mem(sf->free_bricks);
+  free_mem(sf->pending);
+  int_map_destroy(&sf->pending_map);
+  free_mem(sf->candidates);
+  visited_set_destroy(&sf->candidates_found);
+  sf->bricks = NULL;
+}
+
+static int solid_field_alloc_brick(SolidField *sf) {
+  if (sf->free_brick_count > 0) {
+    return sf->free_bricks[--sf->free_brick_count];
+  }
+
+  if (sf->brick_count >= sf->brick_capacity) {
+    sf->brick_capacity *= 2;
+    sf->bricks =
+        realloc_mem(sf->bricks, sf->brick_capacity * sizeof(*sf->bricks));
+    sf->free_bricks =
+        realloc_mem(sf->free_bricks, sf->brick_capacity * sizeof(int));
+  }
+  return sf->brick_count++;
+}
+
+static bool solid_field_add_candidates_ot_leaf(BlobOtEnumData *enum_data) {
+  SolidField *sf = enum_data->user_data;
+  for (int i = 0; i < enum_data->curr_leaf->leaf_blob_count; i++) {
+    int bidx = enum_data->curr_leaf->offsets[i];
+    if (!visited_set_add(&sf->candidates_found, bidx)) {
+      continue;
+    }
+
+    if (sf->candidate_count >= sf->candidate_capacity) {
+      sf->candidate_capacity *= 2;
+      sf->candidates = realloc_mem(sf->candidates,
+                                   sf->candidate_capacity * sizeof(int));
+    }
+    sf->candidates[sf->candidate_count++] = bidx;
+  }
+
+  return true;
+}
+
+// Smooth minimum of the distance in a and the distance in b, the same as the
+// one used by blob_get_correction_from_solids. The gradient of the result is
+// blended with the same factor as the distance
+static HMM_Vec4 smin_with_gradient(HMM_Vec4 a, HMM_Vec4 b, float k) {
+  float h = HMM_Clamp(0.0f, 0.5f + 0.5f * (b.W - a.W) / k, 1.0f);
+  HMM_Vec4 r;
+  r.XYZ = HMM_LerpV3(b.XYZ, h, a.XYZ);
+  r.W = HMM_Lerp(b.W, h, a.W) - k * h * (1.0f - h);
+  return r;
+}
+
+// Returns true if the brick has to be kept. A point in the band can be up to
+// half a cell diagonal away from the closest sample, so samples a cell past
+// the band still count
+static bool solid_field_bake_brick(SolidField *sf, BlobSim *bs,
+                                   SolidFieldBrick *brick,
+                                   const HMM_Vec3 *origin) {
+  bool in_band = false;
+
+  for (int x = 0; x < SOLID_FIELD_SAMPLE_DIM; x++) {
+    for (int y = 0; y < SOLID_FIELD_SAMPLE_DIM; y++) {
+      for (int z = 0; z < SOLID_FIELD_SAMPLE_DIM; z++) {
+        HMM_Vec3 p = HMM_AddV3(
+            *origin, HMM_MulV3F(HMM_V3((float)x, (float)y, (float)z),
+                                sf->cell_size));
+
+        HMM_Vec4 sample = HMM_V4(0.0f, 0.0f, 0.0f, 10000.0f);
+        for (int i = 0; i < sf->candidate_count; i++) {
+          const SolidBlob *b =
+              fixed_array_get_const(&bs->solids, sf->candidates[i]);
+          HMM_Vec3 d = HMM_SubV3(p, b->pos);
+          float len = HMM_LenV3(d);
+
+          HMM_Vec4 s;
+          s.XYZ = len > 0.0f ? HMM_DivV3F(d, len) : HMM_V3(0.0f, 0.0f, 0.0f);
+          s.W = len - b->radius;
+          sample = smin_with_gradient(sample, s, BLOB_SMOOTH);
+        }
+
+        brick->samples[(x * SOLID_FIELD_SAMPLE_DIM + y) *
+                           SOLID_FIELD_SAMPLE_DIM +
+                       z] = sample;
+        in_band |= sample.W <= sf->band + sf->cell_size;
+      }
+    }
+  }
+
+  return in_band;
+}
+
+// Bakes the brick at brick coordinates c, or removes it if it is outside of
+// the band
+static void solid_field_update_brick(SolidField *sf, BlobSim *bs,
+                                     const int *c) {
+  float brick_size = solid_field_brick_size(sf);
+  HMM_Vec3 origin =
+      HMM_V3(c[0] * brick_size, c[1] * brick_size, c[2] * brick_size);
+
+  // Solids further than this from the brick can't change any sample in the
+  // band
+  float reach = sf->band + sf->cell_size + BLOB_SMOOTH;
+
+  visited_set_reserve(&sf->candidates_found, bs->solids.count);
+  visited_set_clear(&sf->candidates_found);
+  sf->candidate_count = 0;
+
+  BlobOtEnumData enum_data;
+  enum_data.bot = &bs->solid_ot;
+  float half = brick_size * 0.5f;
+  enum_data.shape_pos = HMM_AddV3(origin, HMM_V3(half, half, half));
+  enum_data.shape_size = brick_size + reach * 2.0f;
+  enum_data.callback = solid_field_add_candidates_ot_leaf;
+  enum_data.user_data = sf;
+  blob_ot_enum_leaves_cube(&enum_data);
+
+  // Leaves also have solids that are only near other parts of the leaf
+  int kept = 0;
+  for (int i = 0; i < sf->candidate_count; i++) {
+    const SolidBlob *b = fixed_array_get_const(&bs->solids, sf->candidates[i]);
+    float dist_sq = 0.0f;
+    for (int a = 0; a < 3; a++) {
+      float lo = origin.Elements[a];
+      float p = HMM_Clamp(lo, b->pos.Elements[a], lo + brick_size);
+      float d = b->pos.Elements[a] - p;
+      dist_sq += d * d;
+    }
+
+    float max_dist = b->radius + reach;
+    if (dist_sq <= max_dist * max_dist) {
+      sf->candidates[kept++] = sf->candidates[i];
+    }
+  }
+  sf->candidate_count = kept;
+
+  uint64_t key = int_map_coord_key(c[0], c[1], c[2]);
+  uint64_t *brick_idx = int_map_get(&sf->brick_map, key);
+
+  if (sf->candidate_count == 0) {
+    if (brick_idx) {
+      sf->free_bricks[sf->free_brick_count++] = (int)*brick_idx;
+      int_map_remove(&sf->brick_map, key);
+    }
+    return;
+  }
+
+  int idx = brick_idx ? (int)*brick_idx : solid_field_alloc_brick(sf);
+  if (solid_field_bake_brick(sf, bs, &sf->bricks[idx], &origin)) {
+    if (!brick_idx) {
+      int_map_insert(&sf->brick_map, key, idx);
+    }
+  } else {
+    if (brick_idx) {
+      int_map_remove(&sf->brick_map, key);
+    }
+    sf->free_bricks[sf->free_brick_count++] = idx;
+  }
+}
+
+// Finds the range of bricks that a solid at pos with radius could affect.
+// Returns false if the solid hasn't been placed yet
+static bool solid_field_get_sphere_bricks(const SolidField *sf,
+                                          const HMM_Vec3 *pos, float radius,
+                                          int *min, int *max) {
+  // Solids that haven't been placed yet have an infinite position
+  if (isinf(pos->X)) {
+    return false;
+  }
+
+  float reach = radius + sf->band + sf->cell_size + BLOB_SMOOTH;
+  for (int a = 0; a < 3; a++) {
+    min[a] = brick_coord_from_pos(sf, pos->Elements[a] - reach);
+    max[a] = brick_coord_from_pos(sf, pos->Elements[a] + reach);
+  }
+  return true;
+}
+
+void solid_field_update_sphere(SolidField *sf, BlobSim *bs,
+                               const HMM_Vec3 *pos, float radius) {
+  int min[3], max[3];
+  if (!solid_field_get_sphere_bricks(sf, pos, radius, min, max)) {
+    return;
+  }
+
+  int c[3];
+  for (c[0] = min[0]; c[0] <= max[0]; c[0]++) {
+    for (c[1] = min[1]; c[1] <= max[1]; c[1]++) {
+      for (c[2] = min[2]; c[2] <= max[2]; c[2]++) {
+        solid_field_update_brick(sf, bs, c);
+      }
+    }
+  }
+}
+
+void solid_field_mark_sphere(SolidField *sf, const HMM_Vec3 *pos,
+                             float radius) {
+  int min[3], max[3];
+  if (!solid_field_get_sphere_bricks(sf, pos, radius, min, max)) {
+    return;
+  }
+
+  int c[3];
+  for (c[0] = min[0]; c[0] <= max[0]; c[0]++) {
+    for (c[1] = min[1]; c[1] <= max[1]; c[1]++) {
+      for (c[2] = min[2]; c[2] <= max[2]; c[2]++) {
+        uint64_t key = int_map_coord_key(c[0], c[1], c[2]);
+        if (int_map_get(&sf->pending_map, key)) {
+          continue;
+        }
+        int_map_insert(&sf->pending_map, key, 1);
+
+        if (sf->pending_count >= sf->pending_capacity) {
+          sf->pending_capacity *= 2;
+          sf->pending = realloc_mem(sf->pending,
+                                    sf->pending_capacity * 3 * sizeof(int));
+        }
+        memcpy(&sf->pending[sf->pending_count++ * 3], c, sizeof(c));
+      }
+    }
+  }
+}
+
+int solid_field_bake_marked(SolidField *sf, BlobSim *bs, int max_bricks) {
+  for (int i = 0; i < max_bricks && sf->pending_count > 0; i++) {
+    const int *c = &sf->pending[--sf->pending_count * 3];
+    int_map_remove(&sf->pending_map, int_map_coord_key(c[0], c[1], c[2]));
+    solid_field_update_brick(sf, bs, c);
+  }
+  return sf->pending_count;
+}
+
+bool solid_field_is_pending(SolidField *sf, const HMM_Vec3 *pos) {
+  if (sf->pending_count == 0) {
+    return false;
+  }
+
+  int c[3];
+  for (int a = 0; a < 3; a++) {
+    c[a] = brick_coord_from_pos(sf, pos->Elements[a]);
+  }
+  return int_map_get(&sf->pending_map, int_map_coord_key(c[0], c[1], c[2])) !=
+         NULL;
+}
+
+bool solid_field_sample(SolidField *sf, const HMM_Vec3 *pos, float *dist,
+                        HMM_Vec3 *dir) {
+  int c[3];
+  for (int a = 0; a < 3; a++) {
+    c[a] = brick_coord_from_pos(sf, pos->Elements[a]);
+  }
+
+  uint64_t *brick_idx =
+      int_map_get(&sf->brick_map, int_map_coord_key(c[0], c[1], c[2]));
+  if (!brick_idx) {
+    return false;
+  }
+  const SolidFieldBrick *brick = &sf->bricks[*brick_idx];
+
+  // Which cell pos is in and how far along the cell it is
+  int cell[3];
+  float t[3];
+  float brick_size = solid_field_brick_size(sf);
+  for (int a = 0; a < 3; a++) {
+    float local = (pos->Elements[a] - c[a] * brick_size) / sf->cell_size;
+    local = HMM_Clamp(0.0f, local, (float)SOLID_FIELD_BRICK_CELLS);
+    cell[a] = HMM_MIN((int)local, SOLID_FIELD_BRICK_CELLS - 1);
+    t[a] = local - cell[a];
+  }
+
+  HMM_Vec4 sum = HMM_V4(0.0f, 0.0f, 0.0f, 0.0f);
+  for (int i = 0; i < 8; i++) {
+    int x = cell[0] + ((i >> 2) & 1);
+    int y = cell[1] + ((i >> 1) & 1);
+    int z = cell[2] + (i & 1);
+    float w = (((i >> 2) & 1) ? t[0] : 1.0f - t[0]) *
+              (((i >> 1) & 1) ? t[1] : 1.0f - t[1]) *
+              ((i & 1) ? t[2] : 1.0f - t[2]);
+
+    const HMM_Vec4 *s =
+        &brick->samples[(x * SOLID_FIELD_SAMPLE_DIM + y) *
+                            SOLID_FIELD_SAMPLE_DIM +
+                        z];
+    sum = HMM_AddV4(sum, HMM_MulV4F(*s, w));
+  }
+
+  *dist = sum.W;
+  *dir = HMM_LenV3(sum.XYZ) > 0.0f ? HMM_NormV3(sum.XYZ) : sum.XYZ;
+  return true;
+}
+
+int solid_field_get_size_bytes(const SolidField *sf) {
+  return sf->brick_capacity * (sizeof(SolidFieldBrick) + sizeof(int)) +
+         sf->brick_map.capacity * sizeof(IntMapKV) +
+         sf->candidate_capacity * sizeof(int);
+}
+
+typedef struct SolidFieldSnapshot {
+  float cell_size;
+  float band;
+  int brick_count;
+  int free_brick_count;
+  int pending_count;
+} SolidFieldSnapshot;
+
+void solid_field_snapshot_write(const SolidField *sf, SnapshotWriter *w) {
+  SolidFieldSnapshot snap;
+  // Padding is written too, so it should not be garbage
+  memset(&snap, 0, sizeof(snap));
+  snap.cell_size = sf->cell_size;
+  snap.band = sf->band;
+  snap.brick_count = sf->brick_count;
+  snap.free_brick_count = sf->free_brick_count;
+  snap.pending_count = sf->pending_count;
+  snapshot_write(w, &snap, sizeof(snap));
+  snapshot_write(w, sf->bricks, sf->brick_count * sizeof(*sf->bricks));
+  snapshot_write(w, sf->free_bricks, sf->free_brick_count * sizeof(int));
+  snapshot_write(w, sf->pending, sf->pending_count * 3 * sizeof(int));
+  int_map_snapshot_write(&sf->brick_map, w);
+  int_map_snapshot_write(&sf->pending_map, w);
+}
+
+// Checks that every brick is either in brick_map once or free, and that
+// every marked brick can be packed into a key and is in pending_map
+static bool solid_field_is_valid(SolidField *sf) {
+  if (!(sf->cell_size > 0.0f) || !(sf->band >= 0.0f) ||
+      sf->pending_map.count != sf->pending_count ||
+      sf->brick_map.count + sf->free_brick_count != sf->brick_count) {
+    return false;
+  }
+
+  bool *used = alloc_mem(sf->brick_count + 1);
+  memset(used, 0, sf->brick_count + 1);
+  bool ok = true;
+  for (int i = 0; ok && i < sf->free_brick_count; i++) {
+    int idx = sf->free_bricks[i];
+    ok = idx >= 0 && idx < sf->brick_count && !used[idx];
+    if (ok) {
+      used[idx] = true;
+    }
+  }
+  for (int i = 0; ok && i < sf->brick_map.capacity; i++) {
+    const IntMapKV *kv = &sf->brick_map.data[i];
+    if (kv->key == (uint64_t)-1) {
+      continue;
+    }
+    ok = kv->value < (uint64_t)sf->brick_count && !used[kv->value];
+    if (ok) {
+      used[kv->value] = true;
+    }
+  }
+  free_mem(used);
+
+  for (int i = 0; ok && i < sf->pending_count * 3; i++) {
+    ok = sf->pending[i] >= -INT_MAP_COORD_BIAS &&
+         sf->pending[i] < INT_MAP_COORD_BIAS;
+  }
+  for (int i = 0; ok && i < sf->pending_count; i++) {
+    const int *c = &sf->pending[i * 3];
+    ok = int_map_get(&sf->pending_map, int_map_coord_key(c[0], c[1], c[2])) !=
+         NULL;
+  }
+  return ok;
+}
+
+bool solid_field_snapshot_read(SolidField *sf, SnapshotReader *r) {
+  SolidFieldSnapshot snap;
+  if (!snapshot_read_into(r, &snap, sizeof(snap)) || snap.brick_count < 0 ||
+      snap.free_brick_count < 0 || snap.free_brick_count > snap.brick_count ||
+      snap.pending_count < 0) {
+    return false;
+  }
+
+  // The sizes are checked against the snapshot before anything is allocated
+  const void *bricks =
+      snapshot_read(r, (size_t)snap.brick_count * sizeof(*sf->bricks));
+  const void *free_bricks =
+      snapshot_read(r, (size_t)snap.free_brick_count * sizeof(int));
+  const void *pending =
+      snapshot_read(r, (size_t)snap.pending_count * 3 * sizeof(int));
+  if (!pending) {
+    return false;
+  }
+
+  if (sf->brick_capacity < snap.brick_count) {
+    while (sf->brick_capacity < snap.brick_count) {
+      sf->brick_capacity *= 2;
+    }
+    sf->bricks =
+        realloc_mem(sf->bricks, sf->brick_capacity * sizeof(*sf->bricks));
+    sf->free_bricks =
+        realloc_mem(sf->free_bricks, sf->brick_capacity * sizeof(int));
+  }
+  if (sf->pending_capacity < snap.pending_count) {
+    while (sf->pending_capacity < snap.pending_count) {
+      sf->pending_capacity *= 2;
+    }
+    sf->pending =
+        realloc_mem(sf->pending, sf->pending_capacity * 3 * sizeof(int));
+  }
+
+  sf->cell_size = snap.cell_size;
+  sf->band = snap.band;
+  sf->brick_count = snap.brick_count;
+  sf->free_brick_count = snap.free_brick_count;
+  sf->pending_count = snap.pending_count;
+  memcpy(sf->bricks, bricks, sf->brick_count * sizeof(*sf->bricks));
+  memcpy(sf->free_bricks, free_bricks, sf->free_brick_count * sizeof(int));
+  memcpy(sf->pending, pending, sf->pending_count * 3 * sizeof(int));
+  if (int_map_snapshot_read(&sf->brick_map, r) &&
+      int_map_snapshot_read(&sf->pending_map, r) && solid_field_is_valid(sf)) {
+    return true;
+  }
+
+  // Leave an empty field behind
+  int_map_destroy(&sf->brick_map);
+  int_map_create(&sf->brick_map);
+  int_map_destroy(&sf->pending_map);
+  int_map_create(&sf->pending_map);
+  sf->brick_count = 0;
+  sf->free_brick_count = 0;
+  sf->pending_count = 0;
+  return false;
+}
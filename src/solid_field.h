@@ -0,0 +1,88 @@
+#pragma once
+
+#include <stdbool.h>
+
+#include "HandmadeMath.h"
+
+#include "int_map.h"
+#include "visited_set.h"
+
+typedef struct BlobSim BlobSim;
+typedef struct SnapshotWriter SnapshotWriter;
+typedef struct SnapshotReader SnapshotReader;
+
+// Each brick stores SOLID_FIELD_BRICK_CELLS cells along each axis, with a
+// sample at every corner. Bricks don't share samples, so a lookup only ever
+// reads one brick
+#define SOLID_FIELD_BRICK_CELLS 8
+#define SOLID_FIELD_BRICK_SAMPLES                                              \
+  ((SOLID_FIELD_BRICK_CELLS + 1) * (SOLID_FIELD_BRICK_CELLS + 1) *             \
+   (SOLID_FIELD_BRICK_CELLS + 1))
+
+typedef struct SolidFieldBrick {
+  // XYZ is the direction away from the solids and W is the distance to the
+  // smoothed solids
+  HMM_Vec4 samples[SOLID_FIELD_BRICK_SAMPLES];
+} SolidFieldBrick;
+
+// Distance field of the smoothed union of every solid, baked into bricks so
+// that collision queries don't have to go through the solid octree. Only
+// bricks that are at most band away from the solids are stored
+typedef struct SolidField {
+  float cell_size;
+  float band;
+
+  // Brick keys to brick indices
+  IntMap brick_map;
+  SolidFieldBrick *bricks;
+  int brick_count;
+  int brick_capacity;
+  // Bricks that were removed and can be reused
+  int *free_bricks;
+  int free_brick_count;
+
+  // Coordinates of bricks that have to be baked again, three ints per brick.
+  // pending_map keeps a brick from being added twice
+  int *pending;
+  int pending_count;
+  int pending_capacity;
+  IntMap pending_map;
+
+  // Solids near the brick being baked
+  int *candidates;
+  int candidate_count;
+  int candidate_capacity;
+  VisitedSet candidates_found;
+} SolidField;
+
+void solid_field_create(SolidField *sf, float cell_size, float band);
+void solid_field_destroy(SolidField *sf);
+
+// Bakes the bricks that a solid at pos with radius could affect. Call this for
+// both the old and the new place of a solid that changed
+void solid_field_update_sphere(SolidField *sf, BlobSim *bs,
+                               const HMM_Vec3 *pos, float radius);
+
+// Like solid_field_update_sphere, but the bricks are only marked to be baked
+// later. A brick that several marked solids affect is only baked once
+void solid_field_mark_sphere(SolidField *sf, const HMM_Vec3 *pos,
+                             float radius);
+// Bakes up to max_bricks of the marked bricks. Returns how many are still
+// marked. Until then, marked bricks keep their old distances
+int solid_field_bake_marked(SolidField *sf, BlobSim *bs, int max_bricks);
+// Returns true if the brick at pos is marked, so a sample there could be
+// missing solids that were just added or have solids that were just removed
+bool solid_field_is_pending(SolidField *sf, const HMM_Vec3 *pos);
+
+// Trilinearly interpolates the distance and direction at pos. Returns false if
+// there is no brick at pos, which means the solids are further than band away
+bool solid_field_sample(SolidField *sf, const HMM_Vec3 *pos, float *dist,
+                        HMM_Vec3 *dir);
+
+int solid_field_get_size_bytes(const SolidField *sf);
+
+// Writes the baked bricks and the marked ones to a snapshot
+void solid_field_snapshot_write(const SolidField *sf, SnapshotWriter *w);
+// Replaces every brick with the ones in a snapshot, so nothing has to be
+// baked. Returns false if the snapshot is broken
+bool solid_field_snapshot_read(SolidField *sf, SnapshotReader *r);
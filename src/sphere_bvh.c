@@ -0,0 +1,217 @@
+#include <math.h>
+
+#include "core.h"
+#include "sphere_bvh.h"
+
+void sphere_bvh_create(SphereBvh *bvh) {
+  bvh->count = 0;
+  bvh->capacity = 64;
+  bvh->spheres = alloc_mem(bvh->capacity * sizeof(*bvh->spheres));
+  bvh->indices = alloc_mem(bvh->capacity * sizeof(*bvh->indices));
+
+  bvh->node_count = 0;
+  bvh->node_capacity = bvh->capacity * 2;
+  bvh->nodes = alloc_mem(bvh->node_capacity * sizeof(*bvh->nodes));
+}
+
+void sphere_bvh_destroy(SphereBvh *bvh) {
+  free_mem(bvh->spheres);
+  free_mem(bvh->indices);
+  free_mem(bvh->nodes);
+  bvh->spheres = NULL;
+  bvh->indices = NULL;
+  bvh->nodes = NULL;
+  bvh->count = 0;
+  bvh->node_count = 0;
+}
+
+static void sphere_bvh_swap(SphereBvh *bvh, int a, int b) {
+  HMM_Vec4 sphere = bvh->spheres[a];
+  bvh->spheres[a] = bvh->spheres[b];
+  bvh->spheres[b] = sphere;
+
+  int idx = bvh->indices[a];
+  bvh->indices[a] = bvh->indices[b];
+  bvh->indices[b] = idx;
+}
+
+// Fits the node around its spheres and splits it in half along the longest
+// axis of their centers until the leaves are small enough
+static void sphere_bvh_split(SphereBvh *bvh, int node_idx) {
+  SphereBvhNode *node = &bvh->nodes[node_idx];
+  int start = node->start;
+  int count = node->count;
+
+  HMM_Vec3 min = HMM_V3(INFINITY, INFINITY, INFINITY);
+  HMM_Vec3 max = HMM_V3(-INFINITY, -INFINITY, -INFINITY);
+  HMM_Vec3 center_min = min;
+  HMM_Vec3 center_max = max;
+  for (int i = start; i < start + count; i++) {
+    HMM_Vec4 s = bvh->spheres[i];
+    for (int x = 0; x < 3; x++) {
+      float c = s.Elements[x];
+      min.Elements[x] = HMM_MIN(min.Elements[x], c - s.W);
+      max.Elements[x] = HMM_MAX(max.Elements[x], c + s.W);
+      center_min.Elements[x] = HMM_MIN(center_min.Elements[x], c);
+      center_max.Elements[x] = HMM_MAX(center_max.Elements[x], c);
+    }
+  }
+  node->min = min;
+  node->max = max;
+
+  if (count <= SPHERE_BVH_LEAF_SIZE) {
+    return;
+  }
+
+  HMM_Vec3 extent = HMM_SubV3(center_max, center_min);
+  int axis = 0;
+  if (extent.Y > extent.Elements[axis])
+    axis = 1;
+  if (extent.Z > extent.Elements[axis])
+    axis = 2;
+  float mid = (center_min.Elements[axis] + center_max.Elements[axis]) * 0.5f;
+
+  int left_end = start;
+  for (int i = start; i < start + count; i++) {
+    if (bvh->spheres[i].Elements[axis] < mid) {
+      sphere_bvh_swap(bvh, i, left_end++);
+    }
+  }
+  // Every center is on one side, so any split is as good as another
+  int left_count = left_end - start;
+  if (left_count == 0 || left_count == count) {
+    left_count = count / 2;
+  }
+
+  int left = bvh->node_count;
+  bvh->node_count += 2;
+  bvh->nodes[left].start = start;
+  bvh->nodes[left].count = left_count;
+  bvh->nodes[left + 1].start = start + left_count;
+  bvh->nodes[left + 1].count = count - left_count;
+
+  node->start = left;
+  node->count = 0;
+  sphere_bvh_split(bvh, left);
+  sphere_bvh_split(bvh, left + 1);
+}
+
+void sphere_bvh_build(SphereBvh *bvh, const HMM_Vec4 *spheres, int count) {
+  if (count > bvh->capacity) {
+    while (bvh->capacity < count) {
+      bvh->capacity *= 2;
+    }
+    bvh->spheres =
+        realloc_mem(bvh->spheres, bvh->capacity * sizeof(*bvh->spheres));
+    bvh->indices =
+        realloc_mem(bvh->indices, bvh->capacity * sizeof(*bvh->indices));
+
+    // A tree with a sphere in every leaf has fewer nodes than this
+    bvh->node_capacity = bvh->capacity * 2;
+    bvh->nodes =
+        realloc_mem(bvh->nodes, bvh->node_capacity * sizeof(*bvh->nodes));
+  }
+
+  bvh->count = count;
+  for (int i = 0; i < count; i++) {
+    bvh->spheres[i] = spheres[i];
+    bvh->indices[i] = i;
+  }
+
+  bvh->node_count = 0;
+  if (count == 0) {
+    return;
+  }
+
+  bvh->node_count = 1;
+  bvh->nodes[0].start = 0;
+  bvh->nodes[0].count = count;
+  sphere_bvh_split(bvh, 0);
+}
+
+typedef struct SphereBvhSweep {
+  HMM_Vec3 from;
+  HMM_Vec3 move;
+  float radius;
+  // Box around the whole sweep
+  HMM_Vec3 min;
+  HMM_Vec3 max;
+
+  int first;
+  float t;
+} SphereBvhSweep;
+
+// Fraction of move at which a sphere moving from from touches a sphere that
+// is combined_radius away from its center, or INFINITY if it never does
+static float sphere_sweep_hit_t(const HMM_Vec3 *from, const HMM_Vec3 *move,
+                                const HMM_Vec3 *center,
+                                float combined_radius) {
+  HMM_Vec3 d = HMM_SubV3(*from, *center);
+  float c = HMM_DotV3(d, d) - combined_radius * combined_radius;
+  if (c <= 0.0f) {
+    return 0.0f;
+  }
+
+  float a = HMM_DotV3(*move, *move);
+  float b = HMM_DotV3(d, *move);
+  if (a == 0.0f || b >= 0.0f) {
+    return INFINITY;
+  }
+  float disc = b * b - a * c;
+  if (disc < 0.0f) {
+    return INFINITY;
+  }
+  float t = (-b - sqrtf(disc)) / a;
+  return t <= 1.0f ? t : INFINITY;
+}
+
+static void sphere_bvh_sweep_node(const SphereBvh *bvh, int node_idx,
+                                  SphereBvhSweep *sweep) {
+  const SphereBvhNode *node = &bvh->nodes[node_idx];
+  for (int x = 0; x < 3; x++) {
+    if (node->min.Elements[x] > sweep->max.Elements[x] ||
+        node->max.Elements[x] < sweep->min.Elements[x]) {
+      return;
+    }
+  }
+
+  if (node->count == 0) {
+    sphere_bvh_sweep_node(bvh, node->start, sweep);
+    sphere_bvh_sweep_node(bvh, node->start + 1, sweep);
+    return;
+  }
+
+  for (int i = node->start; i < node->start + node->count; i++) {
+    const HMM_Vec4 *s = &bvh->spheres[i];
+    float t = sphere_sweep_hit_t(&sweep->from, &sweep->move, &s->XYZ,
+                                 s->W + sweep->radius);
+    int idx = bvh->indices[i];
+    if (t < sweep->t || (t == sweep->t && idx < sweep->first)) {
+      sweep->t = t;
+      sweep->first = idx;
+    }
+  }
+}
+
+int sphere_bvh_sweep(const SphereBvh *bvh, const HMM_Vec3 *from,
+                     const HMM_Vec3 *move, float radius, float *t) {
+  SphereBvhSweep sweep;
+  sweep.from = *from;
+  sweep.move = *move;
+  sweep.radius = radius;
+  HMM_Vec3 to = HMM_AddV3(*from, *move);
+  for (int x = 0; x < 3; x++) {
+    sweep.min.Elements[x] =
+        HMM_MIN(from->Elements[x], to.Elements[x]) - radius;
+    sweep.max.Elements[x] =
+        HMM_MAX(from->Elements[x], to.Elements[x]) + radius;
+  }
+  sweep.first = -1;
+  sweep.t = INFINITY;
+
+  if (bvh->count > 0) {
+    sphere_bvh_sweep_node(bvh, 0, &sweep);
+  }
+  *t = sweep.t;
+  return sweep.first;
+}
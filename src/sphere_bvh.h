@@ -0,0 +1,44 @@
+#pragma once
+
+#include "HandmadeMath.h"
+
+// Spheres in a leaf of a SphereBvh, at most
+#define SPHERE_BVH_LEAF_SIZE 4
+
+typedef struct SphereBvhNode {
+  HMM_Vec3 min;
+  HMM_Vec3 max;
+  // If count is 0, the children are nodes start and start + 1. Otherwise,
+  // the node is a leaf with count spheres from start in the sorted spheres
+  int start;
+  int count;
+} SphereBvhNode;
+
+// Bounding volume hierarchy of spheres that is rebuilt from scratch every time
+// instead of being edited. Meant for a few thousand spheres at most
+typedef struct SphereBvh {
+  // Copy of the spheres with the radius in W, sorted so that each leaf's
+  // spheres are next to each other
+  HMM_Vec4 *spheres;
+  // Index that each sorted sphere had when it was passed to sphere_bvh_build
+  int *indices;
+  int count;
+  int capacity;
+
+  // Node 0 is the root if count is not 0
+  SphereBvhNode *nodes;
+  int node_count;
+  int node_capacity;
+} SphereBvh;
+
+void sphere_bvh_create(SphereBvh *bvh);
+void sphere_bvh_destroy(SphereBvh *bvh);
+
+// Replaces everything in the BVH
+void sphere_bvh_build(SphereBvh *bvh, const HMM_Vec4 *spheres, int count);
+
+// Moves a sphere from from to from + move and returns the index of the first
+// sphere that it touches on the way, or -1. t is set to the fraction of move
+// at which they touch. Ties go to the lowest index
+int sphere_bvh_sweep(const SphereBvh *bvh, const HMM_Vec3 *from,
+                     const HMM_Vec3 *move, float radius, float *t);
@@ -0,0 +1,77 @@
+#include "core.h"
+#include "thread.h"
+
+typedef struct ThreadStart {
+  ThreadFunc func;
+  void *args;
+} ThreadStart;
+
+#ifdef _WIN32
+void mutex_init(Mutex *m) { InitializeSRWLock(m); }
+void mutex_destroy(Mutex *m) {}
+void mutex_lock(Mutex *m) { AcquireSRWLockExclusive(m); }
+void mutex_unlock(Mutex *m) { ReleaseSRWLockExclusive(m); }
+void cond_init(Cond *c) { InitializeConditionVariable(c); }
+void cond_destroy(Cond *c) {}
+void cond_wait(Cond *c, Mutex *m) {
+  SleepConditionVariableSRW(c, m, INFINITE, 0);
+}
+void cond_signal(Cond *c) { WakeConditionVariable(c); }
+void cond_broadcast(Cond *c) { WakeAllConditionVariable(c); }
+
+static DWORD WINAPI thread_entry(LPVOID args) {
+  ThreadStart start = *(ThreadStart *)args;
+  free_mem(args);
+  start.func(start.args);
+  return 0;
+}
+
+bool thread_create(Thread *t, ThreadFunc func, void *args) {
+  ThreadStart *start = alloc_mem(sizeof(*start));
+  start->func = func;
+  start->args = args;
+
+  *t = CreateThread(NULL, 0, thread_entry, start, 0, NULL);
+  if (*t == NULL) {
+    free_mem(start);
+    return false;
+  }
+  return true;
+}
+
+void thread_join(Thread *t) {
+  WaitForSingleObject(*t, INFINITE);
+  CloseHandle(*t);
+}
+#else
+void mutex_init(Mutex *m) { pthread_mutex_init(m, NULL); }
+void mutex_destroy(Mutex *m) { pthread_mutex_destroy(m); }
+void mutex_lock(Mutex *m) { pthread_mutex_lock(m); }
+void mutex_unlock(Mutex *m) { pthread_mutex_unlock(m); }
+void cond_init(Cond *c) { pthread_cond_init(c, NULL); }
+void cond_destroy(Cond *c) { pthread_cond_destroy(c); }
+void cond_wait(Cond *c, Mutex *m) { pthread_cond_wait(c, m); }
+void cond_signal(Cond *c) { pthread_cond_signal(c); }
+void cond_broadcast(Cond *c) { pthread_cond_broadcast(c); }
+
+static void *thread_entry(void *args) {
+  ThreadStart start = *(ThreadStart *)args;
+  free_mem(args);
+  start.func(start.args);
+  return NULL;
+}
+
+bool thread_create(Thread *t, ThreadFunc func, void *args) {
+  ThreadStart *start = alloc_mem(sizeof(*start));
+  start->func = func;
+  start->args = args;
+
+  if (pthread_create(t, NULL, thread_entry, start) != 0) {
+    free_mem(start);
+    return false;
+  }
+  return true;
+}
+
+void thread_join(Thread *t) { pthread_join(*t, NULL); }
+#endif
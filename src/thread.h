@@ -0,0 +1,39 @@
+#pragma once
+
+#include <stdbool.h>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <Windows.h>
+#else
+#include <pthread.h>
+#endif
+
+#ifdef _WIN32
+typedef SRWLOCK Mutex;
+typedef CONDITION_VARIABLE Cond;
+typedef HANDLE Thread;
+#else
+typedef pthread_mutex_t Mutex;
+typedef pthread_cond_t Cond;
+typedef pthread_t Thread;
+#endif
+
+typedef void (*ThreadFunc)(void *args);
+
+void mutex_init(Mutex *m);
+void mutex_destroy(Mutex *m);
+void mutex_lock(Mutex *m);
+void mutex_unlock(Mutex *m);
+
+void cond_init(Cond *c);
+void cond_destroy(Cond *c);
+// Unlocks m while waiting and locks it again before returning
+void cond_wait(Cond *c, Mutex *m);
+void cond_signal(Cond *c);
+void cond_broadcast(Cond *c);
+
+// Starts a thread that calls func with args. Returns false on failure
+bool thread_create(Thread *t, ThreadFunc func, void *args);
+// Waits for the thread to return and frees it
+void thread_join(Thread *t);
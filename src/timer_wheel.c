@@ -0,0 +1,357 @@
+#include <string.h>
+
+#include "core.h"
+#include "snapshot.h"
+#include "timer_wheel.h"
+
+#define TIMER_WHEEL_START_CAPACITY 256
+#define TIMER_WHEEL_DUE_SLOT (TIMER_WHEEL_LEVELS * TIMER_WHEEL_SLOTS)
+
+void timer_wheel_create(TimerWheel *tw) {
+  tw->now = 0;
+
+  tw->entry_count = 0;
+  tw->entry_capacity = TIMER_WHEEL_START_CAPACITY;
+  tw->entries = alloc_mem(tw->entry_capacity * sizeof(*tw->entries));
+  tw->free_entry = -1;
+  tw->count = 0;
+
+  tw->slot_capacity = TIMER_WHEEL_START_CAPACITY;
+  tw->slot_entries =
+      alloc_mem(tw->slot_capacity * sizeof(*tw->slot_entries));
+  for (int i = 0; i < tw->slot_capacity; i++) {
+    tw->slot_entries[i] = -1;
+  }
+
+  for (int i = 0; i <= TIMER_WHEEL_DUE_SLOT; i++) {
+    tw->heads[i] = -1;
+  }
+
+  tw->expired_count = 0;
+  tw->expired_capacity = TIMER_WHEEL_START_CAPACITY;
+  tw->expired = alloc_mem(tw->expired_capacity * sizeof(*tw->expired));
+}
+
+void timer_wheel_destroy(TimerWheel *tw) {
+  free_mem(tw->entries);
+  free_mem(tw->expired);
+  free_mem(tw->slot_entries);
+  tw->entries = NULL;
+  tw->expired = NULL;
+  tw->slot_entries = NULL;
+  tw->count = 0;
+  tw->entry_count = 0;
+  tw->expired_count = 0;
+}
+
+// Finds the slot that a timer belongs in, given how far away it is
+static int timer_wheel_get_slot(const TimerWheel *tw, uint64_t expires) {
+  if (expires <= tw->now) {
+    return TIMER_WHEEL_DUE_SLOT;
+  }
+
+  // Timers that are too far away wait in the last slot that can be reached
+  uint64_t diff = expires - tw->now;
+  if (diff >= TIMER_WHEEL_RANGE) {
+    expires = tw->now + TIMER_WHEEL_RANGE - 1;
+    diff = TIMER_WHEEL_RANGE - 1;
+  }
+
+  int level = 0;
+  while (diff >> (TIMER_WHEEL_SLOT_BITS * (level + 1))) {
+    level++;
+  }
+  int slot = (expires >> (TIMER_WHEEL_SLOT_BITS * level)) &
+             (TIMER_WHEEL_SLOTS - 1);
+  return level * TIMER_WHEEL_SLOTS + slot;
+}
+
+static void timer_wheel_link(TimerWheel *tw, int idx) {
+  TimerWheelEntry *e = &tw->entries[idx];
+  e->slot = timer_wheel_get_slot(tw, e->expires);
+  e->prev = -1;
+  e->next = tw->heads[e->slot];
+  if (e->next != -1) {
+    tw->entries[e->next].prev = idx;
+  }
+  tw->heads[e->slot] = idx;
+}
+
+static void timer_wheel_unlink(TimerWheel *tw, int idx) {
+  TimerWheelEntry *e = &tw->entries[idx];
+  if (e->prev != -1) {
+    tw->entries[e->prev].next = e->next;
+  } else {
+    tw->heads[e->slot] = e->next;
+  }
+  if (e->next != -1) {
+    tw->entries[e->next].prev = e->prev;
+  }
+}
+
+static int timer_wheel_get_handle_slot(Handle h) {
+  return (int)(h & 0xffffffff);
+}
+
+// Returns the entry of h or -1
+static int timer_wheel_find(const TimerWheel *tw, Handle h) {
+  int hs = timer_wheel_get_handle_slot(h);
+  if (hs >= tw->slot_capacity) {
+    return -1;
+  }
+
+  int idx = tw->slot_entries[hs];
+  if (idx == -1 || tw->entries[idx].key != h) {
+    return -1;
+  }
+  return idx;
+}
+
+static void timer_wheel_free_entry(TimerWheel *tw, int idx) {
+  tw->slot_entries[timer_wheel_get_handle_slot(tw->entries[idx].key)] = -1;
+  tw->count--;
+  tw->entries[idx].slot = -1;
+  tw->entries[idx].next = tw->free_entry;
+  tw->free_entry = idx;
+}
+
+void timer_wheel_schedule(TimerWheel *tw, Handle h, uint64_t expires) {
+  int idx = timer_wheel_find(tw, h);
+  if (idx != -1) {
+    if (expires < tw->entries[idx].expires) {
+      timer_wheel_unlink(tw, idx);
+      tw->entries[idx].expires = expires;
+      timer_wheel_link(tw, idx);
+    }
+    return;
+  }
+
+  int hs = timer_wheel_get_handle_slot(h);
+  if (hs >= tw->slot_capacity) {
+    int old_capacity = tw->slot_capacity;
+    while (tw->slot_capacity <= hs) {
+      tw->slot_capacity *= 2;
+    }
+    tw->slot_entries = realloc_mem(
+        tw->slot_entries, tw->slot_capacity * sizeof(*tw->slot_entries));
+    for (int i = old_capacity; i < tw->slot_capacity; i++) {
+      tw->slot_entries[i] = -1;
+    }
+  }
+
+  // The slot belongs to only one of the two handles now, and timers of the
+  // other one wouldn't do anything. The one with the newer generation is kept
+  if (tw->slot_entries[hs] != -1) {
+    int stale = tw->slot_entries[hs];
+    if ((tw->entries[stale].key >> 32) > (h >> 32)) {
+      return;
+    }
+    timer_wheel_unlink(tw, stale);
+    timer_wheel_free_entry(tw, stale);
+  }
+
+  idx = tw->free_entry;
+  if (idx != -1) {
+    tw->free_entry = tw->entries[idx].next;
+  } else {
+    if (tw->entry_count >= tw->entry_capacity) {
+      tw->entry_capacity *= 2;
+      tw->entries = realloc_mem(tw->entries,
+                                tw->entry_capacity * sizeof(*tw->entries));
+    }
+    idx = tw->entry_count++;
+    // Clears the padding, since entries are written to snapshots as they are
+    memset(&tw->entries[idx], 0, sizeof(tw->entries[idx]));
+  }
+
+  tw->entries[idx].key = h;
+  tw->entries[idx].expires = expires;
+  timer_wheel_link(tw, idx);
+  tw->slot_entries[hs] = idx;
+  tw->count++;
+}
+
+bool timer_wheel_cancel(TimerWheel *tw, Handle h) {
+  int idx = timer_wheel_find(tw, h);
+  if (idx == -1) {
+    return false;
+  }
+
+  timer_wheel_unlink(tw, idx);
+  timer_wheel_free_entry(tw, idx);
+  return true;
+}
+
+// Expires every timer in a slot, or moves them to the slots they belong in
+// now if they have not expired yet
+static void timer_wheel_flush_slot(TimerWheel *tw, int slot) {
+  int idx = tw->heads[slot];
+  tw->heads[slot] = -1;
+  while (idx != -1) {
+    int next = tw->entries[idx].next;
+    if (tw->entries[idx].expires > tw->now) {
+      timer_wheel_link(tw, idx);
+      idx = next;
+      continue;
+    }
+
+    if (tw->expired_count >= tw->expired_capacity) {
+      tw->expired_capacity *= 2;
+      tw->expired = realloc_mem(tw->expired,
+                                tw->expired_capacity * sizeof(*tw->expired));
+    }
+    tw->expired[tw->expired_count++] = tw->entries[idx].key;
+    timer_wheel_free_entry(tw, idx);
+    idx = next;
+  }
+}
+
+int timer_wheel_advance(TimerWheel *tw, uint64_t now) {
+  tw->expired_count = 0;
+  timer_wheel_flush_slot(tw, TIMER_WHEEL_DUE_SLOT);
+
+  while (tw->now < now) {
+    tw->now++;
+
+    // Higher levels go first, since their timers can move into a slot of a
+    // lower level that is reached on this same tick
+    for (int level = TIMER_WHEEL_LEVELS - 1; level > 0; level--) {
+      uint64_t mask = ((uint64_t)1 << (TIMER_WHEEL_SLOT_BITS * level)) - 1;
+      if ((tw->now & mask) == 0) {
+        int slot = (tw->now >> (TIMER_WHEEL_SLOT_BITS * level)) &
+                   (TIMER_WHEEL_SLOTS - 1);
+        timer_wheel_flush_slot(tw, level * TIMER_WHEEL_SLOTS + slot);
+      }
+    }
+    timer_wheel_flush_slot(tw, tw->now & (TIMER_WHEEL_SLOTS - 1));
+  }
+
+  return tw->expired_count;
+}
+
+int timer_wheel_get_count(const TimerWheel *tw) { return tw->count; }
+
+typedef struct TimerWheelSnapshot {
+  uint64_t now;
+  int count;
+  int entry_count;
+  int free_entry;
+  int slot_capacity;
+} TimerWheelSnapshot;
+
+void timer_wheel_snapshot_write(const TimerWheel *tw, SnapshotWriter *w) {
+  TimerWheelSnapshot snap;
+  // Padding is written too, so it should not be garbage
+  memset(&snap, 0, sizeof(snap));
+  snap.now = tw->now;
+  snap.count = tw->count;
+  snap.entry_count = tw->entry_count;
+  snap.free_entry = tw->free_entry;
+  snap.slot_capacity = tw->slot_capacity;
+  snapshot_write(w, &snap, sizeof(snap));
+  snapshot_write(w, tw->entries, tw->entry_count * sizeof(*tw->entries));
+  snapshot_write(w, tw->slot_entries,
+                 tw->slot_capacity * sizeof(*tw->slot_entries));
+  snapshot_write(w, tw->heads, sizeof(tw->heads));
+}
+
+// Checks that every entry is either in the list of its slot or free, and
+// that slot_entries and the entries of the handles agree
+static bool timer_wheel_is_valid(const TimerWheel *tw) {
+  if (tw->count < 0 || tw->count > tw->entry_count || tw->free_entry < -1 ||
+      tw->free_entry >= tw->entry_count) {
+    return false;
+  }
+
+  // 0 for unseen entries, 1 for linked ones and 2 for free ones
+  char *seen = alloc_mem(tw->entry_count + 1);
+  memset(seen, 0, tw->entry_count + 1);
+  bool ok = true;
+  int linked_count = 0;
+  for (int slot = 0; ok && slot <= TIMER_WHEEL_DUE_SLOT; slot++) {
+    int prev = -1;
+    int idx = tw->heads[slot];
+    while (ok && idx != -1) {
+      ok = idx >= 0 && idx < tw->entry_count && !seen[idx];
+      if (!ok) {
+        break;
+      }
+      const TimerWheelEntry *e = &tw->entries[idx];
+      int hs = timer_wheel_get_handle_slot(e->key);
+      ok = e->slot == slot && e->prev == prev && hs >= 0 &&
+           hs < tw->slot_capacity && tw->slot_entries[hs] == idx;
+      seen[idx] = 1;
+      linked_count++;
+      prev = idx;
+      idx = e->next;
+    }
+  }
+  int free_count = 0;
+  int idx = tw->free_entry;
+  while (ok && idx != -1) {
+    ok = idx >= 0 && idx < tw->entry_count && !seen[idx] &&
+         tw->entries[idx].slot == -1;
+    if (ok) {
+      seen[idx] = 2;
+      free_count++;
+      idx = tw->entries[idx].next;
+    }
+  }
+  for (int hs = 0; ok && hs < tw->slot_capacity; hs++) {
+    int e = tw->slot_entries[hs];
+    ok = e == -1 || (e >= 0 && e < tw->entry_count && seen[e] == 1);
+  }
+  free_mem(seen);
+  return ok && linked_count == tw->count &&
+         linked_count + free_count == tw->entry_count;
+}
+
+bool timer_wheel_snapshot_read(TimerWheel *tw, SnapshotReader *r) {
+  TimerWheelSnapshot snap;
+  if (!snapshot_read_into(r, &snap, sizeof(snap)) || snap.entry_count < 0 ||
+      snap.slot_capacity <= 0) {
+    return false;
+  }
+
+  // The sizes are checked against the snapshot before anything is allocated
+  const void *entries =
+      snapshot_read(r, (size_t)snap.entry_count * sizeof(*tw->entries));
+  const void *slot_entries =
+      snapshot_read(r, (size_t)snap.slot_capacity * sizeof(*tw->slot_entries));
+  if (!entries || !snapshot_read_into(r, tw->heads, sizeof(tw->heads))) {
+    return false;
+  }
+
+  while (tw->entry_capacity < snap.entry_count) {
+    tw->entry_capacity *= 2;
+  }
+  tw->entries =
+      realloc_mem(tw->entries, tw->entry_capacity * sizeof(*tw->entries));
+  memcpy(tw->entries, entries, snap.entry_count * sizeof(*tw->entries));
+  tw->slot_capacity = snap.slot_capacity;
+  tw->slot_entries = realloc_mem(
+      tw->slot_entries, tw->slot_capacity * sizeof(*tw->slot_entries));
+  memcpy(tw->slot_entries, slot_entries,
+         tw->slot_capacity * sizeof(*tw->slot_entries));
+
+  tw->now = snap.now;
+  tw->count = snap.count;
+  tw->entry_count = snap.entry_count;
+  tw->free_entry = snap.free_entry;
+  tw->expired_count = 0;
+  if (timer_wheel_is_valid(tw)) {
+    return true;
+  }
+
+  // Leave an empty wheel behind
+  tw->count = 0;
+  tw->entry_count = 0;
+  tw->free_entry = -1;
+  for (int i = 0; i < tw->slot_capacity; i++) {
+    tw->slot_entries[i] = -1;
+  }
+  for (int i = 0; i <= TIMER_WHEEL_DUE_SLOT; i++) {
+    tw->heads[i] = -1;
+  }
+  return false;
+}
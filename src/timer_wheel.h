@@ -0,0 +1,82 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "handle_table.h"
+
+typedef struct SnapshotWriter SnapshotWriter;
+typedef struct SnapshotReader SnapshotReader;
+
+#define TIMER_WHEEL_SLOT_BITS 6
+#define TIMER_WHEEL_SLOTS (1 << TIMER_WHEEL_SLOT_BITS)
+#define TIMER_WHEEL_LEVELS 4
+// Timers further away than this many ticks wait in the last level and are
+// put back into it until they are close enough
+#define TIMER_WHEEL_RANGE \
+  ((uint64_t)1 << (TIMER_WHEEL_SLOT_BITS * TIMER_WHEEL_LEVELS))
+
+typedef struct TimerWheelEntry {
+  Handle key;
+  // Tick that the timer expires on
+  uint64_t expires;
+  // Neighbours in the slot's list. next is the next free entry if the entry
+  // is not used
+  int prev;
+  int next;
+  // -1 if the entry is not used
+  int slot;
+} TimerWheelEntry;
+
+// Hierarchical timer wheel. Level 0 has a slot for each of the next ticks,
+// and each level after it has a slot for each TIMER_WHEEL_SLOTS slots of the
+// level before. Timers move down a level when the wheel reaches their slot,
+// so scheduling, cancelling and expiring a timer take constant time. Each
+// timer belongs to a handle, and a handle has at most one timer
+typedef struct TimerWheel {
+  uint64_t now;
+  int count;
+
+  TimerWheelEntry *entries;
+  int entry_count;
+  int entry_capacity;
+  // -1 if there are no free entries
+  int free_entry;
+  // Entry of the timer of each handle slot or -1. The handle of the entry has
+  // to be checked, since the slot might have been reused
+  int *slot_entries;
+  int slot_capacity;
+
+  // First entry of each slot or -1. The slot after the last level holds
+  // timers that are already due
+  int heads[TIMER_WHEEL_LEVELS * TIMER_WHEEL_SLOTS + 1];
+
+  // Handles of the timers that expired during the last advance
+  Handle *expired;
+  int expired_count;
+  int expired_capacity;
+} TimerWheel;
+
+void timer_wheel_create(TimerWheel *tw);
+void timer_wheel_destroy(TimerWheel *tw);
+
+// Schedules h to expire on the tick expires. Timers that are due already
+// expire on the next advance. If h is already scheduled, the earlier of the
+// two ticks is kept
+void timer_wheel_schedule(TimerWheel *tw, Handle h, uint64_t expires);
+
+// Returns false if h was not scheduled
+bool timer_wheel_cancel(TimerWheel *tw, Handle h);
+
+// Moves the wheel forward to the tick now and puts the handles of every timer
+// that expired in expired. Returns how many expired
+int timer_wheel_advance(TimerWheel *tw, uint64_t now);
+
+// Number of scheduled timers
+int timer_wheel_get_count(const TimerWheel *tw);
+
+// Writes every timer to a snapshot as it is, slots and all
+void timer_wheel_snapshot_write(const TimerWheel *tw, SnapshotWriter *w);
+// Replaces every timer with the ones in a snapshot. Returns false if the
+// snapshot is broken
+bool timer_wheel_snapshot_read(TimerWheel *tw, SnapshotReader *r);
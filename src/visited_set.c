@@ -0,0 +1,52 @@
+#include <string.h>
+
+#include "core.h"
+#include "visited_set.h"
+
+void visited_set_create(VisitedSet *set, int capacity) {
+  set->capacity = capacity;
+  set->stamps = alloc_mem(capacity * sizeof(uint32_t));
+  memset(set->stamps, 0, capacity * sizeof(uint32_t));
+  // Stamps start at 0, so the first epoch has to be something else
+  set->epoch = 1;
+}
+
+void visited_set_destroy(VisitedSet *set) {
+  free_mem(set->stamps);
+  set->stamps = NULL;
+  set->capacity = 0;
+}
+
+void visited_set_reserve(VisitedSet *set, int capacity) {
+  if (capacity <= set->capacity) {
+    return;
+  }
+
+  int old_capacity = set->capacity;
+  while (set->capacity < capacity) {
+    set->capacity = set->capacity ? set->capacity * 2 : 64;
+  }
+  set->stamps = realloc_mem(set->stamps, set->capacity * sizeof(uint32_t));
+  memset(set->stamps + old_capacity, 0,
+         (set->capacity - old_capacity) * sizeof(uint32_t));
+}
+
+void visited_set_clear(VisitedSet *set) {
+  set->epoch++;
+  if (set->epoch == 0) {
+    memset(set->stamps, 0, set->capacity * sizeof(uint32_t));
+    set->epoch = 1;
+  }
+}
+
+bool visited_set_add(VisitedSet *set, int idx) {
+  if (set->stamps[idx] == set->epoch) {
+    return false;
+  }
+  set->stamps[idx] = set->epoch;
+  return true;
+}
+
+bool visited_set_contains(const VisitedSet *set, int idx) {
+  return set->stamps[idx] == set->epoch;
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Set of indices in [0, capacity) that is emptied by starting a new epoch
+// instead of clearing every element. An index is in the set if its stamp is
+// the current epoch
+typedef struct VisitedSet {
+  int capacity;
+  uint32_t *stamps;
+  uint32_t epoch;
+} VisitedSet;
+
+void visited_set_create(VisitedSet *set, int capacity);
+void visited_set_destroy(VisitedSet *set);
+
+// Grows the set so that it can hold indices up to capacity - 1
+void visited_set_reserve(VisitedSet *set, int capacity);
+
+// Removes every index from the set. The stamps are only cleared when the
+// epoch wraps around
+void visited_set_clear(VisitedSet *set);
+
+// Adds idx to the set. Returns false if it was already in the set
+bool visited_set_add(VisitedSet *set, int idx);
+
+bool visited_set_contains(const VisitedSet *set, int idx);
@@ -0,0 +1,201 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
+#include "core.h"
+#include "thread.h"
+#include "worker_pool.h"
+
+#ifdef _WIN32
+typedef volatile LONG AtomicInt;
+#else
+typedef int AtomicInt;
+#endif
+
+typedef struct WorkerPoolShared {
+  Mutex mutex;
+  Cond start_cond;
+  Cond done_cond;
+
+  // Incremented every time a new batch of jobs is started
+  int job_gen;
+  // Workers that have not finished the current batch yet
+  int working;
+  bool quit;
+
+  WorkerPoolFunc func;
+  void *user_data;
+  int count;
+  AtomicInt next_idx;
+
+  int thread_count;
+  Thread *threads;
+} WorkerPoolShared;
+
+typedef struct WorkerArgs {
+  WorkerPoolShared *shared;
+  int worker_idx;
+} WorkerArgs;
+
+#ifdef _WIN32
+// Returns the value before incrementing
+static int atomic_fetch_inc(AtomicInt *a) { return InterlockedIncrement(a) - 1; }
+static void atomic_set(AtomicInt *a, int v) { InterlockedExchange(a, v); }
+#else
+// Returns the value before incrementing
+static int atomic_fetch_inc(AtomicInt *a) {
+  return __atomic_fetch_add(a, 1, __ATOMIC_RELAXED);
+}
+static void atomic_set(AtomicInt *a, int v) {
+  __atomic_store_n(a, v, __ATOMIC_RELAXED);
+}
+#endif
+
+static void worker_pool_do_jobs(WorkerPoolShared *shared, int worker_idx) {
+  for (;;) {
+    int idx = atomic_fetch_inc(&shared->next_idx);
+    if (idx >= shared->count) {
+      break;
+    }
+    shared->func(shared->user_data, idx, worker_idx);
+  }
+}
+
+static void worker_main(void *user_data) {
+  WorkerArgs *args = user_data;
+  WorkerPoolShared *shared = args->shared;
+  int worker_idx = args->worker_idx;
+  free_mem(args);
+
+  int seen_gen = 0;
+
+  mutex_lock(&shared->mutex);
+  for (;;) {
+    while (shared->job_gen == seen_gen && !shared->quit) {
+      cond_wait(&shared->start_cond, &shared->mutex);
+    }
+    if (shared->quit) {
+      break;
+    }
+    seen_gen = shared->job_gen;
+    mutex_unlock(&shared->mutex);
+
+    worker_pool_do_jobs(shared, worker_idx);
+
+    mutex_lock(&shared->mutex);
+    if (--shared->working == 0) {
+      cond_signal(&shared->done_cond);
+    }
+  }
+  mutex_unlock(&shared->mutex);
+}
+
+int worker_pool_get_cpu_count() {
+#ifdef _WIN32
+  SYSTEM_INFO info;
+  GetSystemInfo(&info);
+  int count = (int)info.dwNumberOfProcessors;
+#else
+  int count = (int)sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+  return count > 0 ? count : 1;
+}
+
+void worker_pool_create(WorkerPool *wp, int thread_count) {
+  if (thread_count <= 0) {
+    thread_count = worker_pool_get_cpu_count();
+  }
+
+  wp->thread_count = thread_count;
+
+  WorkerPoolShared *shared = alloc_mem(sizeof(*shared));
+  wp->shared = shared;
+
+  mutex_init(&shared->mutex);
+  cond_init(&shared->start_cond);
+  cond_init(&shared->done_cond);
+  shared->job_gen = 0;
+  shared->working = 0;
+  shared->quit = false;
+  shared->func = NULL;
+  shared->user_data = NULL;
+  shared->count = 0;
+  atomic_set(&shared->next_idx, 0);
+
+  // The thread calling worker_pool_run is worker 0
+  shared->thread_count = thread_count - 1;
+  shared->threads = NULL;
+  if (shared->thread_count > 0) {
+    shared->threads = alloc_mem(shared->thread_count * sizeof(Thread));
+  }
+
+  for (int i = 0; i < shared->thread_count; i++) {
+    WorkerArgs *args = alloc_mem(sizeof(*args));
+    args->shared = shared;
+    args->worker_idx = i + 1;
+
+    if (!thread_create(&shared->threads[i], worker_main, args)) {
+      fprintf(stderr, "Failed to create worker thread\n");
+      exit_fatal_error();
+    }
+  }
+}
+
+void worker_pool_destroy(WorkerPool *wp) {
+  WorkerPoolShared *shared = wp->shared;
+  if (!shared) {
+    return;
+  }
+
+  mutex_lock(&shared->mutex);
+  shared->quit = true;
+  cond_broadcast(&shared->start_cond);
+  mutex_unlock(&shared->mutex);
+
+  for (int i = 0; i < shared->thread_count; i++) {
+    thread_join(&shared->threads[i]);
+  }
+
+  cond_destroy(&shared->start_cond);
+  cond_destroy(&shared->done_cond);
+  mutex_destroy(&shared->mutex);
+
+  free_mem(shared->threads);
+  free_mem(shared);
+  wp->shared = NULL;
+  wp->thread_count = 0;
+}
+
+void worker_pool_run(WorkerPool *wp, WorkerPoolFunc func, void *user_data,
+                     int count) {
+  WorkerPoolShared *shared = wp->shared;
+
+  // Not worth waking anyone up
+  if (shared->thread_count == 0 || count <= 1) {
+    for (int i = 0; i < count; i++) {
+      func(user_data, i, 0);
+    }
+    return;
+  }
+
+  mutex_lock(&shared->mutex);
+  shared->func = func;
+  shared->user_data = user_data;
+  shared->count = count;
+  atomic_set(&shared->next_idx, 0);
+  shared->working = shared->thread_count;
+  shared->job_gen++;
+  cond_broadcast(&shared->start_cond);
+  mutex_unlock(&shared->mutex);
+
+  worker_pool_do_jobs(shared, 0);
+
+  mutex_lock(&shared->mutex);
+  while (shared->working > 0) {
+    cond_wait(&shared->done_cond, &shared->mutex);
+  }
+  mutex_unlock(&shared->mutex);
+}
@@ -0,0 +1,25 @@
+#pragma once
+
+// Called once for every job index. worker_idx is in [0, thread_count) and can
+// be used to pick per-thread scratch memory
+typedef void (*WorkerPoolFunc)(void *user_data, int idx, int worker_idx);
+
+typedef struct WorkerPoolShared WorkerPoolShared;
+
+typedef struct WorkerPool {
+  // Includes the thread that calls worker_pool_run
+  int thread_count;
+  WorkerPoolShared *shared;
+} WorkerPool;
+
+// Starts thread_count - 1 worker threads. If thread_count is 0, the number of
+// logical CPUs is used
+void worker_pool_create(WorkerPool *wp, int thread_count);
+void worker_pool_destroy(WorkerPool *wp);
+
+// Calls func for every index in [0, count) using every thread in the pool,
+// including the calling one. Returns once all calls have finished
+void worker_pool_run(WorkerPool *wp, WorkerPoolFunc func, void *user_data,
+                     int count);
+
+int worker_pool_get_cpu_count();